@@ -0,0 +1,382 @@
+#!/bin/bash
+
+# Benchmarks for the pipeline system
+# usage: ./benchmark.sh [section ...]   (no section - run them all)
+# sections:
+#   long-chain   RSS, threads and startup time of 100 and 1000 stage chains
+#   ordering     throughput and end-to-end latency of a partitioned stage, ordered vs --relaxed-order
+#   output       write throughput of --output with 1 (serial) to 8 writer threads, and that the files match
+#   scaling      throughput on 1..N cores (taskset) per chain, queue layout and scheduling mode,
+#                a table and a CSV (SCALING_CSV, default output/bench-scaling.csv)
+#   backlog      RSS and CPU of a deep queue backlog, plain vs --compress-backlog, per input kind
+#                (BACKLOG_LINES lines, default 1000000), and the memory saved per CPU second spent
+#   journal      throughput of --journal per group commit size (lines per fdatasync) vs no journal,
+#                in JOURNAL_DIR (default a temporary directory - put it on the disk to measure)
+
+# Colors for output
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+NC='\033[0m' # No Color
+
+ANALYZER="output/analyzer"
+BENCH_DIR=$(mktemp -d /tmp/pipeline-bench-XXXXXX)
+trap 'rm -rf "$BENCH_DIR"' EXIT
+trap "" PIPE # a chain that fails to start closes its input early
+
+print_status()
+{
+    echo -e "${GREEN}[BENCH]${NC} $1"
+}
+print_warning()
+{
+    echo -e "${YELLOW}[WARNING]${NC} $1"
+}
+
+# chain of <n> stages: n-1 rotators and a logger at the end
+make_chain()
+{
+    local n=$1
+    local chain=""
+    for ((i = 1; i < n; i++)); do
+        chain="$chain rotator"
+    done
+    echo "$chain logger"
+}
+
+now_ms()
+{
+    echo $(( $(date +%s%N) / 1000000 ))
+}
+
+# measure_chain <label> <stages> <analyzer options...>
+# startup = launch until the first line came out of the last stage
+# RSS and thread count are read from /proc while the pipeline is up
+measure_chain()
+{
+    local label=$1
+    local stages=$2
+    shift 2
+    local fifo="$BENCH_DIR/input"
+    local out="$BENCH_DIR/out"
+    rm -f "$fifo" "$out"
+    mkfifo "$fifo"
+
+    local start=$(now_ms)
+    "$ANALYZER" "$@" 10 $(make_chain $stages) < "$fifo" > "$out" 2>/dev/null &
+    local pid=$!
+    exec 3>"$fifo"
+    echo "warmup" >&3
+
+    local status="ok"
+    until grep -q "\[logger\]" "$out" 2>/dev/null; do
+        if ! kill -0 $pid 2>/dev/null; then
+            status="failed"
+            break
+        fi
+        sleep 0.01
+    done
+    local ready=$(now_ms)
+
+    local rss_kb="-"
+    local threads="-"
+    if [[ "$status" == "ok" ]]; then
+        rss_kb=$(awk '/^VmRSS/ {print $2}' /proc/$pid/status)
+        threads=$(awk '/^Threads/ {print $2}' /proc/$pid/status)
+    fi
+
+    echo "<END>" >&3 2>/dev/null
+    exec 3>&-
+    wait $pid 2>/dev/null
+
+    local startup_ms="-"
+    local rss_mb="-"
+    if [[ "$status" == "ok" ]]; then
+        startup_ms=$((ready - start))
+        rss_mb=$(awk -v kb=$rss_kb 'BEGIN {printf "%.1f", kb / 1024}')
+    fi
+    printf "%-28s %7s %11s %8s %8s  %s\n" "$label" "$stages" "$startup_ms" "$rss_mb" "$threads" "$status"
+}
+
+bench_long_chain()
+{
+    print_status "Long chains - footprint per stage"
+    printf "%-28s %7s %11s %8s %8s  %s\n" "mode" "stages" "startup_ms" "rss_mb" "threads" "status"
+    for stages in 10 100 1000; do
+        # dlmopen namespaces are limited by glibc, the default mode cannot go far
+        measure_chain "default" $stages
+        measure_chain "lean" $stages --lean
+        measure_chain "lean + 2 workers" $stages --lean --workers 2
+    done
+}
+
+# drive_pipeline <lines> <lines per second, 0 - as fast as possible> <analyzer args...>
+# every input line carries its send time, the logger output is timestamped on arrival
+# prints: wall_ms lines_per_s p50_us p99_us max_us
+drive_pipeline()
+{
+    local lines=$1
+    local rate=$2
+    shift 2
+    perl -MTime::HiRes=time,sleep -MIPC::Open2 -e '
+        my ($lines, $rate, @command) = @ARGV;
+        my $pid = open2(my $from_analyzer, my $to_analyzer, @command);
+        my $start = time();
+        if (0 == fork()) {
+            close($from_analyzer);
+            select((select($to_analyzer), $| = 1)[0]) if $rate > 0;
+            for my $i (1 .. $lines) {
+                if ($rate > 0) {
+                    my $due = $start + $i / $rate;
+                    my $now = time();
+                    sleep($due - $now) if $due > $now;
+                }
+                printf $to_analyzer "k%d %.6f payload %d\n", $i % 64, time(), $i;
+            }
+            print $to_analyzer "<END>\n";
+            close($to_analyzer);
+            exit 0;
+        }
+        close($to_analyzer);
+        my @latencies;
+        while (my $line = <$from_analyzer>) {
+            push @latencies, time() - $1 if $line =~ /^\[logger\] k\d+ (\d+\.\d+) /;
+        }
+        my $wall = time() - $start;
+        waitpid($pid, 0);
+        wait();
+        @latencies = sort { $a <=> $b } @latencies;
+        my $count = scalar(@latencies) || 1;
+        printf "%d %d %d %d %d\n", $wall * 1000, scalar(@latencies) / $wall,
+            $latencies[int(($count - 1) * 0.5)] * 1e6, $latencies[int(($count - 1) * 0.99)] * 1e6, $latencies[-1] * 1e6;
+    ' "$lines" "$rate" "$ANALYZER" "$@"
+}
+
+bench_ordering()
+{
+    local lines=200000
+    local paced_rate=20000
+    print_status "Partitioned stage - input order (reorder buffer) vs --relaxed-order"
+    print_status "throughput: $lines lines as fast as possible, latency: paced at $paced_rate lines/s"
+    printf "%-26s %9s %12s %9s %9s %9s\n" "mode" "wall_ms" "lines_per_s" "p50_us" "p99_us" "max_us"
+    for partitions in 2 4 8; do
+        for mode in ordered relaxed; do
+            local mode_flag=""
+            [[ "$mode" == "relaxed" ]] && mode_flag="--relaxed-order"
+            read -r wall_ms lines_per_s _ _ _ <<< "$(drive_pipeline $lines 0 --partitions $partitions $mode_flag 100 counter logger)"
+            read -r _ _ p50_us p99_us max_us <<< "$(drive_pipeline $((paced_rate / 2)) $paced_rate --partitions $partitions $mode_flag 100 counter logger)"
+            printf "%-26s %9s %12s %9s %9s %9s\n" "$mode, $partitions partitions" "$wall_ms" "$lines_per_s" "$p50_us" "$p99_us" "$max_us"
+        done
+    done
+}
+
+bench_output()
+{
+    local lines=2000000
+    local input="$BENCH_DIR/output-input.txt"
+    perl -e 'my $payload = "x" x 100; print "line $_ $payload\n" for 1 .. $ARGV[0]; print "<END>\n"' $lines > "$input"
+    print_status "Output file - $lines lines through expander (~450MB written), serial vs parallel writers"
+    printf "%-10s %9s %9s %10s\n" "writers" "wall_ms" "MB_per_s" "identical"
+    for writers in 1 2 4 8; do
+        local start_ms=$(now_ms)
+        "$ANALYZER" --output "$BENCH_DIR/output-$writers.txt" --output-writers $writers 1000 expander < "$input" > /dev/null
+        local wall_ms=$(( $(now_ms) - start_ms ))
+        local bytes=$(stat -c %s "$BENCH_DIR/output-$writers.txt")
+        local identical="yes"
+        cmp -s "$BENCH_DIR/output-1.txt" "$BENCH_DIR/output-$writers.txt" || identical="NO"
+        printf "%-10s %9s %9s %10s\n" "$writers" "$wall_ms" "$(( bytes / 1000 / (wall_ms > 0 ? wall_ms : 1) ))" "$identical"
+    done
+    rm -f "$BENCH_DIR"/output-*.txt
+}
+
+# core counts for the scaling runs - powers of two and all of them
+scaling_core_counts()
+{
+    local max_cores=$(nproc)
+    local cores=1
+    while ((cores < max_cores)); do
+        echo $cores
+        cores=$((cores * 2))
+    done
+    echo $max_cores
+}
+
+bench_scaling()
+{
+    local lines=500000
+    local input="$BENCH_DIR/scaling-input.txt"
+    local csv=${SCALING_CSV:-output/bench-scaling.csv}
+    perl -e 'print "key", $_ % 64, " GET /api/items/$_ status=200 bytes=", $_ * 131 % 65536, "\n" for 1 .. $ARGV[0]; print "<END>\n"' $lines > "$input"
+    print_status "Core scaling - $lines lines on 1..$(nproc) cores (taskset), speedup against 1 core of the same row"
+    echo "chain,queue,scheduling,cores,wall_ms,lines_per_s,speedup" > "$csv"
+    printf "%-12s %-6s %-10s %6s %9s %12s %8s\n" "chain" "queue" "scheduling" "cores" "wall_ms" "lines_per_s" "speedup"
+
+    # stateless stages, the same ones fused, and a key partitioned stage that gets a shard per core
+    local chains="stateless fused stateful"
+    for chain in $chains; do
+        for queue in array ring; do
+            for scheduling in threads workers; do
+                local base_rate=0
+                for cores in $(scaling_core_counts); do
+                    local args=()
+                    [[ "$queue" == "ring" ]] && args+=(--ring-bytes 65536)
+                    [[ "$scheduling" == "workers" ]] && args+=(--workers $cores)
+                    case $chain in
+                        stateless) args+=(100 uppercaser rotator flipper logger) ;;
+                        fused) args+=(100 uppercaser+rotator+flipper logger) ;;
+                        stateful) args=(--partitions $cores "${args[@]}" 100 counter logger) ;;
+                    esac
+
+                    local start_ms=$(now_ms)
+                    taskset -c 0-$((cores - 1)) "$ANALYZER" "${args[@]}" < "$input" > /dev/null 2>&1
+                    local wall_ms=$(( $(now_ms) - start_ms ))
+                    ((wall_ms > 0)) || wall_ms=1
+                    local rate=$(( lines * 1000 / wall_ms ))
+                    ((base_rate > 0)) || base_rate=$rate
+                    local speedup=$(awk -v rate=$rate -v base=$base_rate 'BEGIN {printf "%.2f", rate / base}')
+                    printf "%-12s %-6s %-10s %6s %9s %12s %8s\n" "$chain" "$queue" "$scheduling" "$cores" "$wall_ms" "$rate" "$speedup"
+                    echo "$chain,$queue,$scheduling,$cores,$wall_ms,$rate,$speedup" >> "$csv"
+                done
+            done
+        done
+    done
+    # the knee - the fewest cores that reach the best rate of each row (within 10%)
+    print_status "Scaling limit per configuration"
+    awk -F, 'NR > 1 {
+        row = $1 " " $2 " " $3
+        if (!(row in best) || $6 > best[row]) { best[row] = $6 }
+        rates[row, $4] = $6; if (!(row in seen)) { order[++rows] = row; seen[row] = 1 }; cores[row] = cores[row] " " $4
+    }
+    END {
+        for (i = 1; i <= rows; i++) {
+            row = order[i]; n = split(cores[row], list, " ")
+            for (j = 1; j <= n; j++) { if (rates[row, list[j]] >= best[row] * 0.9) { knee = list[j]; break } }
+            printf "  %-30s best %8d lines/s, reached with %s cores\n", row, best[row], knee
+        }
+    }' "$csv"
+    print_status "CSV written to $csv"
+    rm -f "$input"
+}
+
+# measure_backlog <input> <lines> <analyzer options...>
+# the logger writes into a fifo nobody reads yet, so the whole input piles up in its queue;
+# RSS is read once the input is consumed, then the fifo is drained
+# prints: fill_ms rss_kb drain_ms
+measure_backlog()
+{
+    local input=$1
+    local lines=$2
+    shift 2
+    local fifo="$BENCH_DIR/backlog-out"
+    rm -f "$fifo"
+    mkfifo "$fifo"
+    exec 4<>"$fifo" # keeps the fifo open without reading it
+
+    local input_bytes=$(stat -c %s "$input")
+    local start_ms=$(now_ms)
+    "$ANALYZER" "$@" $((lines + 16)) logger < "$input" > "$fifo" 2>/dev/null 4<&- &
+    local pid=$!
+    while kill -0 $pid 2>/dev/null; do
+        local pos=$(awk '/^pos:/ {print $2}' /proc/$pid/fdinfo/0 2>/dev/null)
+        [[ "$pos" == "$input_bytes" ]] && break
+        sleep 0.01
+    done
+    sleep 0.2 # the last lines reach the queue
+    local fill_ms=$(( $(now_ms) - start_ms ))
+    local rss_kb=$(awk '/^VmRSS/ {print $2}' /proc/$pid/status 2>/dev/null)
+
+    # the reader is open before the read-write descriptor goes, so the logger never sees a closed fifo
+    local drain_start_ms=$(now_ms)
+    exec 5<"$fifo"
+    exec 4<&-
+    cat <&5 > /dev/null &
+    local reader=$!
+    exec 5<&-
+    wait $pid 2>/dev/null
+    wait $reader 2>/dev/null
+    local drain_ms=$(( $(now_ms) - drain_start_ms ))
+    rm -f "$fifo"
+    echo "$((fill_ms - 200)) ${rss_kb:-0} $drain_ms"
+}
+
+bench_backlog()
+{
+    local lines=${BACKLOG_LINES:-1000000}
+    local hot_items=1024
+    print_status "Deep backlog - $lines lines queued in front of a blocked logger, plain vs --compress-backlog $hot_items"
+    printf "%-8s %-11s %8s %8s %11s %9s\n" "input" "queue" "fill_ms" "rss_mb" "bytes/line" "drain_ms"
+    for kind in logs random; do
+        local input="$BENCH_DIR/backlog-$kind.txt"
+        if [[ "$kind" == "logs" ]]; then
+            perl -e 'print "2024-05-01T10:", sprintf("%02d:%02d", $_ / 60 % 60, $_ % 60), " level=info req=$_ user=u", $_ % 500,
+                     " GET /api/v1/items/", $_ % 1000, " status=200 bytes=", $_ * 131 % 65536, "\n" for 1 .. $ARGV[0]; print "<END>\n"' $lines > "$input"
+        else
+            perl -e 'srand(7); for (1 .. $ARGV[0]) { print join("", map { sprintf "%08x", int(rand(2**32)) } 1 .. 10), "\n" } print "<END>\n"' $lines > "$input"
+        fi
+
+        local plain_rss=0 plain_cpu=0
+        for queue in plain compressed; do
+            local args=()
+            [[ "$queue" == "compressed" ]] && args=(--compress-backlog $hot_items)
+            read -r fill_ms rss_kb drain_ms <<< "$(measure_backlog "$input" $lines "${args[@]}")"
+            printf "%-8s %-11s %8s %8s %11s %9s\n" "$kind" "$queue" "$fill_ms" "$(( rss_kb / 1024 ))" "$(( rss_kb * 1024 / lines ))" "$drain_ms"
+            # one core does the filling and the draining, so their wall time is the CPU time
+            if [[ "$queue" == "plain" ]]; then
+                plain_rss=$rss_kb
+                plain_cpu=$((fill_ms + drain_ms))
+            else
+                awk -v saved_kb=$((plain_rss - rss_kb)) -v extra_ms=$((fill_ms + drain_ms - plain_cpu)) -v lines=$lines 'BEGIN {
+                    printf "  %s: %d bytes/line saved for %.0f ns/line of CPU", "'"$kind"'", saved_kb * 1024 / lines, extra_ms * 1e6 / lines
+                    if (saved_kb <= 0) { print " - no memory saved, compression does not pay" }
+                    else if (extra_ms <= 0) { print " - no measurable CPU cost" }
+                    else { printf " - %.0f MB kept out of memory per CPU second\n", saved_kb / 1024 / (extra_ms / 1000) }
+                }'
+            fi
+        done
+        rm -f "$input"
+    done
+}
+
+bench_journal()
+{
+    local lines=200000
+    local input="$BENCH_DIR/journal-input.txt"
+    local journal_dir=${JOURNAL_DIR:-$BENCH_DIR/journal}
+    perl -e 'print "2024-05-01 level=info req=$_ GET /api/v1/items/", $_ % 1000, " status=200\n" for 1 .. $ARGV[0]; print "<END>\n"' $lines > "$input"
+    print_status "Input journal - $lines lines through uppercaser, one fdatasync per group commit, in $journal_dir"
+    printf "%-14s %9s %12s %9s %14s\n" "journal" "wall_ms" "lines_per_s" "commits" "sync_ms"
+    for batch in off 16 256 4096; do
+        local args=()
+        [[ "$batch" != "off" ]] && args=(--journal "$journal_dir" --journal-batch $batch)
+        local start_ms=$(now_ms)
+        "$ANALYZER" --stats "${args[@]}" 1000 uppercaser < "$input" > /dev/null 2> "$BENCH_DIR/journal-stats.txt"
+        local wall_ms=$(( $(now_ms) - start_ms ))
+        local commits="-" sync_ms="-"
+        if [[ "$batch" != "off" ]]; then
+            read -r commits sync_ms <<< "$(sed -n 's/^journal: .* in \([0-9]*\) group commits, \([0-9.]*\) ms.*/\1 \2/p' "$BENCH_DIR/journal-stats.txt")"
+        fi
+        printf "%-14s %9s %12s %9s %14s\n" "$batch" "$wall_ms" "$(( lines * 1000 / (wall_ms > 0 ? wall_ms : 1) ))" "$commits" "$sync_ms"
+    done
+    rm -f "$input" "$BENCH_DIR/journal-stats.txt"
+}
+
+if [[ ! -x "$ANALYZER" ]]; then
+    print_warning "$ANALYZER not found, building first"
+    ./build.sh > /dev/null || exit 1
+fi
+
+sections="$@"
+if [[ -z "$sections" ]]; then
+    sections="long-chain ordering output scaling backlog journal"
+fi
+
+for section in $sections; do
+    case $section in
+        long-chain) bench_long_chain ;;
+        ordering) bench_ordering ;;
+        output) bench_output ;;
+        scaling) bench_scaling ;;
+        backlog) bench_backlog ;;
+        journal) bench_journal ;;
+        *) print_warning "Unknown section: $section" ;;
+    esac
+done
@@ -38,7 +38,7 @@ rm -f output/*.so output/analyzer
 
 # now we can compile the main app
 print_status "Compiling main application..."
-gcc -o output/analyzer main.c -ldl -lpthread
+gcc -o output/analyzer main.c core/executor.c core/metrics.c core/watchdog.c core/trace.c core/output_sink.c core/plan.c core/calibration.c core/alloc_profile.c core/memory_trim.c core/journal.c -ldl -lpthread -lm
 #check the exit code of the last command
 # if [ $? -eq 0 ]; then
 #     print_status "Main application built successfully"
@@ -51,24 +51,72 @@ gcc -o output/analyzer main.c -ldl -lpthread
 print_status "Main application built successfully"
 
 
-# now we can compile all plugins - we use the code from the pdf instructions
-print_status "Start building plugins..."
-for plugin_name in logger uppercaser rotator flipper expander typewriter; do
+# optimization flags shared by all the plugin builds (baseline and per-ISA variants)
+PLUGIN_OPT_FLAGS="-O3"
 
-    print_status "Building plugin: $plugin_name"
-    gcc -fPIC -shared -o output/${plugin_name}.so \
+# on x86-64 we also build each plugin for the newer ISA levels, the analyzer picks
+# the best one the running CPU supports (output/<level>/<plugin>.so) and falls back to output/<plugin>.so
+ISA_LEVELS=""
+if [ "$(uname -m)" = "x86_64" ]; then
+    for level in x86-64-v2 x86-64-v3 x86-64-v4; do
+        if echo 'int main(void){return 0;}' | gcc -march=$level -x c - -o /dev/null 2>/dev/null; then
+            ISA_LEVELS="$ISA_LEVELS $level"
+        else
+            print_warning "Compiler does not support -march=$level, skipping this variant"
+        fi
+    done
+fi
+
+# build_plugin <plugin_name> <output_file> [extra gcc flags]
+build_plugin()
+{
+    local plugin_name=$1
+    local output_file=$2
+    shift 2
+    gcc -fPIC -shared $PLUGIN_OPT_FLAGS "$@" -o $output_file \
         plugins/${plugin_name}.c \
         plugins/plugin_common.c \
+        plugins/plugin_partition.c \
         plugins/sync/monitor.c \
         plugins/sync/consumer_producer.c \
-        -ldl -lpthread || {
+        plugins/sync/byte_ring.c \
+        plugins/sync/reorder_buffer.c \
+        plugins/sync/allocator.c \
+        plugins/sync/async_log.c \
+        plugins/sync/lock_profile.c \
+        plugins/sync/backlog.c \
+        plugins/sync/lz_codec.c \
+        -ldl -lpthread
+}
+
+# now we can compile all plugins - we use the code from the pdf instructions
+print_status "Start building plugins..."
+for level in $ISA_LEVELS; do
+    mkdir -p output/$level
+    rm -f output/$level/*.so
+done
+
+for plugin_name in logger uppercaser rotator flipper expander typewriter counter drain; do
+
+    print_status "Building plugin: $plugin_name"
+    build_plugin $plugin_name output/${plugin_name}.so || {
         print_error "Failed to build $plugin_name"
         exit 1
     }
+
+    for level in $ISA_LEVELS; do
+        build_plugin $plugin_name output/$level/${plugin_name}.so -march=$level || {
+            print_error "Failed to build $plugin_name for $level"
+            exit 1
+        }
+    done
     #print_status "Plugin $plugin_name built successfully"
 done
 
 print_status "All plugins built successfully"
 print_status "Built files:"
 print_status "  - Main executable: output/analyzer"
-print_status "  - Plugins: logger.so uppercaser.so rotator.so flipper.so expander.so typewriter.so"
+print_status "  - Plugins: logger.so uppercaser.so rotator.so flipper.so expander.so typewriter.so counter.so drain.so"
+if [ -n "$ISA_LEVELS" ]; then
+    print_status "  - ISA variants:$ISA_LEVELS"
+fi
@@ -0,0 +1,52 @@
+#include "alloc_profile.h"
+#include <stdlib.h>
+#include <string.h>
+
+static void* counting_allocate(void* context, size_t size);
+static void counting_deallocate(void* context, void* ptr, size_t size);
+
+void alloc_profile_init(alloc_profile_t* profile, pipeline_allocator_t* allocator)
+{
+    memset(profile, 0, sizeof(alloc_profile_t));
+    allocator->allocate = counting_allocate;
+    allocator->deallocate = counting_deallocate;
+    allocator->context = profile;
+}
+
+void alloc_profile_snapshot(const alloc_profile_t* profile, alloc_profile_t* snapshot)
+{
+    snapshot->allocations = __atomic_load_n(&profile->allocations, __ATOMIC_RELAXED);
+    snapshot->frees = __atomic_load_n(&profile->frees, __ATOMIC_RELAXED);
+    snapshot->bytes_allocated = __atomic_load_n(&profile->bytes_allocated, __ATOMIC_RELAXED);
+    snapshot->bytes_freed = __atomic_load_n(&profile->bytes_freed, __ATOMIC_RELAXED);
+    snapshot->bytes_in_flight = __atomic_load_n(&profile->bytes_in_flight, __ATOMIC_RELAXED);
+    snapshot->peak_bytes_in_flight = __atomic_load_n(&profile->peak_bytes_in_flight, __ATOMIC_RELAXED);
+}
+
+static void* counting_allocate(void* context, size_t size)
+{
+    void* ptr = malloc(size);
+    if (NULL == ptr) {
+        return NULL;
+    }
+
+    alloc_profile_t* profile = (alloc_profile_t*)context;
+    __atomic_add_fetch(&profile->allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&profile->bytes_allocated, size, __ATOMIC_RELAXED);
+    unsigned long long in_flight = __atomic_add_fetch(&profile->bytes_in_flight, size, __ATOMIC_RELAXED);
+    //raise the peak unless another thread already saw more
+    unsigned long long peak = __atomic_load_n(&profile->peak_bytes_in_flight, __ATOMIC_RELAXED);
+    while (in_flight > peak &&
+           !__atomic_compare_exchange_n(&profile->peak_bytes_in_flight, &peak, in_flight, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+    return ptr;
+}
+
+static void counting_deallocate(void* context, void* ptr, size_t size)
+{
+    alloc_profile_t* profile = (alloc_profile_t*)context;
+    __atomic_add_fetch(&profile->frees, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&profile->bytes_freed, size, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&profile->bytes_in_flight, size, __ATOMIC_RELAXED);
+    free(ptr);
+}
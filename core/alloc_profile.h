@@ -0,0 +1,40 @@
+#ifndef ALLOC_PROFILE_H
+#define ALLOC_PROFILE_H
+
+#include "../plugins/sync/allocator.h"
+
+/**
+ * Allocation profile of a stage - a counting allocator installed through the SDK
+ * allocator hook (plugin_set_allocator), so every queue ring, item copy and
+ * plugin_alloc output of the stage is seen, together with its size.
+ * Divided by the items of the stage it tells how much allocation churn each line
+ * costs, and the peak of the bytes in flight how much memory the stage held at once.
+ * Memory a plugin takes with plain malloc (e.g. its own state) is not seen.
+ * The counters are atomics, the stage may allocate on any thread (shards, executor workers).
+ */
+
+typedef struct
+{
+    unsigned long long allocations;
+    unsigned long long frees;
+    unsigned long long bytes_allocated;
+    unsigned long long bytes_freed;
+    unsigned long long bytes_in_flight;       /* Allocated and not freed yet */
+    unsigned long long peak_bytes_in_flight;
+} alloc_profile_t;
+
+/**
+ * Clear a profile and point an allocator at it (malloc/free that count into the profile)
+ * @param profile Profile to count into, must outlive every allocation made through the allocator
+ * @param allocator Filled with the counting allocator, ready for plugin_set_allocator
+ */
+void alloc_profile_init(alloc_profile_t* profile, pipeline_allocator_t* allocator);
+
+/**
+ * Consistent enough copy of the counters for a report (relaxed loads)
+ * @param profile Profile to read
+ * @param snapshot Filled with the counters
+ */
+void alloc_profile_snapshot(const alloc_profile_t* profile, alloc_profile_t* snapshot);
+
+#endif /* ALLOC_PROFILE_H */
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+#include "calibration.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// slots of the ring the handoff measurement passes its items through
+#define HANDOFF_RING_SLOTS 64
+
+// longer than any sample line, the in-place transforms keep the length
+#define SAMPLE_LINE_BYTES 128
+
+typedef struct
+{
+    int slots[HANDOFF_RING_SLOTS];
+    int head;
+    int count;
+    int items;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} handoff_ring_t;
+
+static void* handoff_consumer(void* arg);
+static int same_target(const calibration_target_t* target, const calibration_target_t* other);
+static void run_measure_child(const calibration_target_t* targets, const int* unique_indexes, int first_unique,
+                              int num_unique, calibration_start_func start_stage, void* context, int result_fd);
+static void measure_target(const calibration_target_t* target, int target_index, char sample[][SAMPLE_LINE_BYTES],
+                           calibration_start_func start_stage, void* context, calibration_result_t* result);
+static const char* discard_output(const char* line);
+static void group_under_cap(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, double cap,
+                            int max_partitions, calibration_plan_t* plan);
+static double monotonic_ns(void);
+
+double calibration_measure_handoff_ns(int items)
+{
+    if (items <= 0) {
+        return -1;
+    }
+
+    handoff_ring_t ring = {0};
+    ring.items = items;
+    pthread_mutex_init(&ring.mutex, NULL);
+    pthread_cond_init(&ring.not_empty, NULL);
+    pthread_cond_init(&ring.not_full, NULL);
+
+    double start_ns = monotonic_ns();
+    pthread_t consumer;
+    if (0 != pthread_create(&consumer, NULL, handoff_consumer, &ring)) {
+        pthread_cond_destroy(&ring.not_full);
+        pthread_cond_destroy(&ring.not_empty);
+        pthread_mutex_destroy(&ring.mutex);
+        return -1;
+    }
+
+    //the same protocol as a stage queue - signal the consumer on every put, wait while full
+    for (int i = 0; i < items; i++) {
+        pthread_mutex_lock(&ring.mutex);
+        while (HANDOFF_RING_SLOTS == ring.count) {
+            pthread_cond_wait(&ring.not_full, &ring.mutex);
+        }
+        ring.slots[(ring.head + ring.count) % HANDOFF_RING_SLOTS] = i;
+        ring.count++;
+        pthread_cond_signal(&ring.not_empty);
+        pthread_mutex_unlock(&ring.mutex);
+    }
+    pthread_join(consumer, NULL);
+    double elapsed_ns = monotonic_ns() - start_ns;
+
+    pthread_cond_destroy(&ring.not_full);
+    pthread_cond_destroy(&ring.not_empty);
+    pthread_mutex_destroy(&ring.mutex);
+    return elapsed_ns / items;
+}
+
+static void* handoff_consumer(void* arg)
+{
+    handoff_ring_t* ring = (handoff_ring_t*)arg;
+    for (int i = 0; i < ring->items; i++) {
+        pthread_mutex_lock(&ring->mutex);
+        while (0 == ring->count) {
+            pthread_cond_wait(&ring->not_empty, &ring->mutex);
+        }
+        ring->head = (ring->head + 1) % HANDOFF_RING_SLOTS;
+        ring->count--;
+        pthread_cond_signal(&ring->not_full);
+        pthread_mutex_unlock(&ring->mutex);
+    }
+    return NULL;
+}
+
+int calibration_measure_plugins(const calibration_target_t* targets, int num_targets,
+                                calibration_start_func start_stage, void* context, calibration_result_t* results)
+{
+    if (NULL == targets || num_targets <= 0 || NULL == start_stage || NULL == results) {
+        return -1;
+    }
+
+    //the same plugin with the same parameters is measured once (long chains repeat a few plugins)
+    int* unique_indexes = (int*)calloc(num_targets, sizeof(int));
+    int* same_as = (int*)calloc(num_targets, sizeof(int));
+    if (NULL == unique_indexes || NULL == same_as) {
+        free(unique_indexes);
+        free(same_as);
+        return -1;
+    }
+    int num_unique = 0;
+    for (int i = 0; i < num_targets; i++) {
+        same_as[i] = i;
+        for (int earlier = 0; earlier < i; earlier++) {
+            if (same_target(&targets[i], &targets[earlier])) {
+                same_as[i] = earlier;
+                break;
+            }
+        }
+        if (same_as[i] == i) {
+            unique_indexes[num_unique++] = i;
+        }
+    }
+
+    int next_unique = 0;
+    while (next_unique < num_unique) {
+        int result_pipe[2];
+        if (0 != pipe(result_pipe)) {
+            free(unique_indexes);
+            free(same_as);
+            return -1;
+        }
+        fflush(stdout);
+        fflush(stderr);
+        pid_t child = fork();
+        if (child < 0) {
+            close(result_pipe[0]);
+            close(result_pipe[1]);
+            free(unique_indexes);
+            free(same_as);
+            return -1;
+        }
+        if (0 == child) {
+            close(result_pipe[0]);
+            run_measure_child(targets, unique_indexes, next_unique, num_unique, start_stage, context, result_pipe[1]);
+            _exit(0);
+        }
+        close(result_pipe[1]);
+
+        //one result per plugin, in order - silence for too long means the plugin is that slow
+        while (next_unique < num_unique) {
+            int target_index = unique_indexes[next_unique];
+            calibration_result_t result;
+            size_t received = 0;
+            int timed_out = 0;
+            while (received < sizeof(result)) {
+                struct pollfd result_poll = { result_pipe[0], POLLIN, 0 };
+                int ready = poll(&result_poll, 1, CALIBRATION_PLUGIN_TIMEOUT_MS);
+                if (ready < 0 && EINTR == errno) {
+                    continue;
+                }
+                if (0 == ready) {
+                    timed_out = 1;
+                    break;
+                }
+                ssize_t got = (ready < 0) ? -1 : read(result_pipe[0], (char*)&result + received, sizeof(result) - received);
+                if (got <= 0) {
+                    break;
+                }
+                received += (size_t)got;
+            }
+
+            if (received == sizeof(result) && result.plugin_index == target_index) {
+                results[target_index] = result;
+                next_unique++;
+                continue;
+            }
+            //too slow - at least the timeout per line, or the child died in this plugin
+            memset(&results[target_index], 0, sizeof(calibration_result_t));
+            results[target_index].plugin_index = target_index;
+            results[target_index].measured = timed_out;
+            results[target_index].stage_ns = timed_out ? CALIBRATION_PLUGIN_TIMEOUT_MS * 1e6 : 0;
+            results[target_index].inplace_ns = -1;
+            next_unique++;
+            break;
+        }
+
+        close(result_pipe[0]);
+        kill(child, SIGKILL);
+        waitpid(child, NULL, 0);
+    }
+
+    for (int i = 0; i < num_targets; i++) {
+        if (same_as[i] != i) {
+            results[i] = results[same_as[i]];
+            results[i].plugin_index = i;
+        }
+    }
+    free(unique_indexes);
+    free(same_as);
+    return 0;
+}
+
+void calibration_format_cost(double cost_ns, char* text, size_t text_size)
+{
+    if (cost_ns < 1000) {
+        snprintf(text, text_size, "%.0f ns", cost_ns);
+    } else if (cost_ns < 1e6) {
+        snprintf(text, text_size, "%.1f us", cost_ns / 1e3);
+    } else {
+        snprintf(text, text_size, "%.1f ms", cost_ns / 1e6);
+    }
+}
+
+void calibration_predict(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, int cpus,
+                         calibration_plan_t* plan)
+{
+    double slowest_ns = 0;
+    double total_work_ns = 0;
+    plan->num_stages = 0;
+    plan->bottleneck = 0;
+
+    for (int head = 0; head < num_plugins; head++) {
+        if (head > 0 && plan->fused_into_previous[head]) {
+            continue;
+        }
+        plan->num_stages++;
+
+        double stage_ns;
+        double work_ns;
+        int shards = (plugins[head].partitioned && plan->partitions[head] > 1) ? plan->partitions[head] : 1;
+        if (shards > 1) {
+            //the dispatcher hands every line over once more, the shards split the transform
+            stage_ns = plugins[head].stage_ns / shards + handoff_ns;
+            work_ns = plugins[head].stage_ns + 2 * handoff_ns;
+        } else {
+            stage_ns = plugins[head].stage_ns + handoff_ns;
+            for (int fused = head + 1; fused < num_plugins && plan->fused_into_previous[fused]; fused++) {
+                stage_ns += plugins[fused].inplace_ns;
+            }
+            work_ns = stage_ns;
+        }
+
+        if (stage_ns > slowest_ns) {
+            slowest_ns = stage_ns;
+            plan->bottleneck = head;
+        }
+        total_work_ns += work_ns;
+    }
+
+    plan->bottleneck_ns = slowest_ns;
+    if (slowest_ns <= 0 || total_work_ns <= 0) {
+        plan->throughput = 0;
+        return;
+    }
+    double stage_bound = 1e9 / slowest_ns;
+    double cpu_bound = (cpus > 0 ? cpus : 1) * 1e9 / total_work_ns;
+    plan->throughput = (stage_bound < cpu_bound) ? stage_bound : cpu_bound;
+}
+
+const char* calibration_choose_plan(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, int cpus,
+                                    int max_partitions, calibration_plan_t* plan)
+{
+    if (NULL == plugins || num_plugins <= 0 || NULL == plan || NULL == plan->fused_into_previous ||
+        NULL == plan->partitions || handoff_ns < 0 || max_partitions < 1) {
+        return "Invalid calibration arguments";
+    }
+
+    //caps from the cheapest stage of its own up to the whole chain as one stage,
+    //every plugin alone is tried exactly since the best cap is often one of them
+    double lowest_cap = 0;
+    double highest_cap = handoff_ns;
+    for (int i = 0; i < num_plugins; i++) {
+        double alone_ns = plugins[i].stage_ns + handoff_ns;
+        if (0 == i || alone_ns < lowest_cap) {
+            lowest_cap = alone_ns;
+        }
+        highest_cap += (plugins[i].inplace_ns >= 0) ? plugins[i].inplace_ns : plugins[i].stage_ns;
+    }
+    if (lowest_cap <= 0) {
+        lowest_cap = 1;
+    }
+    if (highest_cap < lowest_cap) {
+        highest_cap = lowest_cap;
+    }
+    double step = pow(highest_cap / lowest_cap, 1.0 / CALIBRATION_CAP_STEPS);
+    int num_caps = num_plugins + CALIBRATION_CAP_STEPS + 1;
+
+    //first the best throughput, then the fewest stages that come close to it
+    double best_throughput = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        double chosen_cap = -1;
+        int chosen_stages = 0;
+        for (int c = 0; c < num_caps; c++) {
+            double cap = (c < num_plugins) ? plugins[c].stage_ns + handoff_ns
+                                           : lowest_cap * pow(step, c - num_plugins);
+            group_under_cap(plugins, num_plugins, handoff_ns, cap, max_partitions, plan);
+            calibration_predict(plugins, num_plugins, handoff_ns, cpus, plan);
+            if (0 == pass) {
+                if (plan->throughput > best_throughput) {
+                    best_throughput = plan->throughput;
+                }
+            } else if (plan->throughput >= best_throughput * (100 - CALIBRATION_TIE_PERCENT) / 100 &&
+                       (chosen_cap < 0 || plan->num_stages < chosen_stages)) {
+                chosen_cap = cap;
+                chosen_stages = plan->num_stages;
+            }
+        }
+        if (1 == pass) {
+            group_under_cap(plugins, num_plugins, handoff_ns, chosen_cap, max_partitions, plan);
+            calibration_predict(plugins, num_plugins, handoff_ns, cpus, plan);
+        }
+    }
+    return NULL;
+}
+
+// greedy grouping - keep fusing into the current stage while it stays under the cap
+static void group_under_cap(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, double cap,
+                            int max_partitions, calibration_plan_t* plan)
+{
+    double current_stage_ns = 0;
+    int current_head_fusable = 0;
+    for (int i = 0; i < num_plugins; i++) {
+        int fusable = plugins[i].inplace_ns >= 0 && !plugins[i].must_start_stage && !plugins[i].partitioned;
+        if (i > 0 && fusable && current_head_fusable && current_stage_ns + plugins[i].inplace_ns <= cap) {
+            plan->fused_into_previous[i] = 1;
+            plan->partitions[i] = 1;
+            current_stage_ns += plugins[i].inplace_ns;
+            continue;
+        }
+
+        plan->fused_into_previous[i] = 0;
+        plan->partitions[i] = 1;
+        current_stage_ns = plugins[i].stage_ns + handoff_ns;
+        current_head_fusable = !plugins[i].partitioned;
+        if (plugins[i].partitioned && current_stage_ns > cap) {
+            //enough shards for the transform share of every line to fit under the cap
+            int shards = (cap > handoff_ns) ? (int)ceil(plugins[i].stage_ns / (cap - handoff_ns)) : max_partitions;
+            plan->partitions[i] = (shards > max_partitions) ? max_partitions : shards;
+        }
+    }
+}
+
+static int same_target(const calibration_target_t* target, const calibration_target_t* other)
+{
+    if (0 != strcmp(target->name, other->name)) {
+        return 0;
+    }
+    if (NULL == target->params || NULL == other->params) {
+        return target->params == other->params;
+    }
+    return 0 == strcmp(target->params, other->params);
+}
+
+// the child reports one result per plugin from first_unique on, the parent kills it after a timeout
+static void run_measure_child(const calibration_target_t* targets, const int* unique_indexes, int first_unique,
+                              int num_unique, calibration_start_func start_stage, void* context, int result_fd)
+{
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+
+    //log like lines, a few keys for the stateful plugins and a spread of lengths
+    static char sample[CALIBRATION_SAMPLE_LINES][SAMPLE_LINE_BYTES];
+    for (int i = 0; i < CALIBRATION_SAMPLE_LINES; i++) {
+        snprintf(sample[i], SAMPLE_LINE_BYTES, "key%d GET /api/v%d/items/%d?user=%d status=%d bytes=%d",
+                 i % 16, i % 3 + 1, i * 7919 % 100000, i * 31 % 977, (0 == i % 11) ? 404 : 200, i * 131 % 65536);
+    }
+
+    for (int unique = first_unique; unique < num_unique; unique++) {
+        calibration_result_t result;
+        memset(&result, 0, sizeof(result));
+        result.plugin_index = unique_indexes[unique];
+        measure_target(&targets[result.plugin_index], result.plugin_index, sample, start_stage, context, &result);
+        if (sizeof(result) != (size_t)write(result_fd, &result, sizeof(result))) {
+            return;
+        }
+    }
+}
+
+static void measure_target(const calibration_target_t* target, int target_index, char sample[][SAMPLE_LINE_BYTES],
+                           calibration_start_func start_stage, void* context, calibration_result_t* result)
+{
+    const double budget_ns = CALIBRATION_PLUGIN_BUDGET_MS * 1e6;
+    char buffer[SAMPLE_LINE_BYTES];
+
+    //fused cost - the in-place transform alone
+    result->inplace_ns = -1;
+    if (NULL != target->transform_inplace) {
+        unsigned long long lines = 0;
+        double start_ns = monotonic_ns();
+        double elapsed_ns = 0;
+        do {
+            const char* line = sample[lines % CALIBRATION_SAMPLE_LINES];
+            size_t length = strlen(line);
+            memcpy(buffer, line, length + 1);
+            target->transform_inplace(buffer, (int)length);
+            lines++;
+            elapsed_ns = monotonic_ns() - start_ns;
+        } while (elapsed_ns < budget_ns);
+        result->inplace_ns = elapsed_ns / (double)lines;
+    }
+
+    //stage cost - put, step and forward on this thread in executor mode, the transform and the queue around it
+    int partitioned = 0;
+    if (NULL == target->place_work || NULL == target->step || NULL == target->attach ||
+        0 != start_stage(context, target_index, &partitioned)) {
+        return;
+    }
+    target->attach(discard_output);
+
+    //a queue full at a time, a running stage takes its items in bursts as well
+    int burst = (target->queue_size < CALIBRATION_BURST_LINES) ? target->queue_size : CALIBRATION_BURST_LINES;
+    unsigned long long lines = 0;
+    double start_ns = monotonic_ns();
+    double elapsed_ns = 0;
+    do {
+        for (int i = 0; i < burst; i++) {
+            if (NULL != target->place_work(sample[(lines + i) % CALIBRATION_SAMPLE_LINES])) {
+                return;
+            }
+        }
+        for (int done = 0; done < burst; ) {
+            int stepped = target->step(burst - done);
+            if (stepped <= 0) {
+                return;
+            }
+            done += stepped;
+        }
+        lines += burst;
+        elapsed_ns = monotonic_ns() - start_ns;
+    } while (elapsed_ns < budget_ns);
+
+    result->measured = 1;
+    result->stage_ns = elapsed_ns / (double)lines;
+    result->partitioned = partitioned;
+}
+
+static const char* discard_output(const char* line)
+{
+    (void)line;
+    return NULL;
+}
+
+static double monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
@@ -0,0 +1,136 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+/**
+ * Startup calibration cost model - the fusion boundaries and the shards of the
+ * stateful stages chosen from costs measured on this machine instead of by hand.
+ *
+ * Per line, a plugin running as a stage of its own costs stage_ns (its transform and
+ * the queue put/get around it), fused into the previous stage inplace_ns (the in-place
+ * transform alone). Every stage boundary adds handoff_ns - the wakeup of the next thread
+ * and the line moving to another core. A chain runs at the rate of its slowest stage,
+ * and no faster than the CPUs get through all of its work:
+ *     throughput = min(1 / slowest stage, cpus / total work)
+ * Fusing saves a handoff and a thread but adds the costs up. The model tries caps for
+ * the slowest stage, fuses greedily under each one and keeps the grouping with the best
+ * throughput (the fewest stages when two are within CALIBRATION_TIE_PERCENT). A key
+ * partitioned stage above the cap gets as many shards as it takes to get under it.
+ *
+ * The costs are measured in a child process (calibration_measure_plugins), so whatever
+ * a plugin prints, sleeps or keeps in its state stays there. A plugin that takes too
+ * long is killed with the child and the next child goes on after it.
+ */
+
+#include <stddef.h>
+
+// two plans closer than this are a tie, the one with fewer stages wins
+#define CALIBRATION_TIE_PERCENT 2
+
+// caps tried between the most expensive plugin and the whole chain as one stage
+#define CALIBRATION_CAP_STEPS 128
+
+// time spent measuring each plugin (in-place and as a stage), and when to give up on one
+#define CALIBRATION_PLUGIN_BUDGET_MS 30
+#define CALIBRATION_PLUGIN_TIMEOUT_MS 1000
+#define CALIBRATION_SAMPLE_LINES 256
+#define CALIBRATION_BURST_LINES 32
+#define CALIBRATION_HANDOFF_ITEMS 100000
+
+// what the host knows of a plugin before it is started
+typedef struct
+{
+    const char* name;                               /* Plugins with the same name and parameters are measured once */
+    const char* params;                             /* Stage parameters, NULL - none */
+    int queue_size;                                 /* Queue of the stage, the burst is no longer than that */
+    int (*transform_inplace)(char*, int);           /* NULL - cannot be fused */
+    const char* (*place_work)(const char*);
+    int (*step)(int);
+    void (*attach)(const char* (*)(const char*));
+} calibration_target_t;
+
+// start a plugin as an executor stage in the calibration child (init with its parameters),
+// 0 and *partitioned set - started, -1 - it cannot run on its own
+typedef int (*calibration_start_func)(void* context, int target_index, int* partitioned);
+
+// what the calibration child reports about one plugin
+typedef struct
+{
+    int plugin_index;
+    int measured;           /* 0 - the plugin could not run on its own (init failed, no executor mode) */
+    double stage_ns;        /* Per line as a stage of its own, CALIBRATION_PLUGIN_TIMEOUT_MS at least if it timed out */
+    double inplace_ns;      /* Per line of the in-place transform, -1 - none */
+    int partitioned;        /* Key partitioned (stateful) stage */
+} calibration_result_t;
+
+typedef struct
+{
+    double stage_ns;        /* Per line as a stage of its own */
+    double inplace_ns;      /* Per line fused into the previous stage, < 0 - cannot be fused */
+    int partitioned;        /* Key partitioned - may be split over shards, never fused with others */
+    int must_start_stage;   /* Keeps a stage of its own (first plugin, init parameters, not measured) */
+} calibration_plugin_t;
+
+typedef struct
+{
+    int* fused_into_previous;   /* Per plugin, 1 - runs inside the stage before it (caller allocated) */
+    int* partitions;            /* Per plugin, shards of a partitioned stage head, 1 otherwise (caller allocated) */
+    double throughput;          /* Predicted lines per second */
+    int bottleneck;             /* Head of the slowest stage */
+    double bottleneck_ns;       /* Per line cost of the slowest stage */
+    int num_stages;
+} calibration_plan_t;
+
+/**
+ * Cost of handing a line from one thread to another through a bounded queue,
+ * measured with two threads passing items through a mutex/condition ring
+ * @param items Number of items to pass
+ * @return Nanoseconds per item, -1 on failure
+ */
+double calibration_measure_handoff_ns(int items);
+
+/**
+ * Measure every plugin of the chain in child processes - the in-place transform alone,
+ * then put, step and a discarded output in executor mode on one thread
+ * @param targets Plugins of the chain
+ * @param num_targets Number of plugins
+ * @param start_stage Starts a plugin in the child
+ * @param context Handed to start_stage
+ * @param results One per plugin, filled
+ * @return 0 on success, -1 if no child could be started
+ */
+int calibration_measure_plugins(const calibration_target_t* targets, int num_targets,
+                                calibration_start_func start_stage, void* context, calibration_result_t* results);
+
+/**
+ * Format a per line cost for the report - "812 ns", "4.2 us", "100.3 ms"
+ * @param cost_ns Cost in nanoseconds
+ * @param text Output buffer
+ * @param text_size Size of the buffer
+ */
+void calibration_format_cost(double cost_ns, char* text, size_t text_size);
+
+/**
+ * Predicted throughput of a grouping (plan->fused_into_previous and plan->partitions set)
+ * @param plugins Measured plugins of the chain
+ * @param num_plugins Number of plugins
+ * @param handoff_ns Cost of a stage boundary
+ * @param cpus CPUs the stages share
+ * @param plan Grouping to evaluate, throughput/bottleneck/num_stages are filled
+ */
+void calibration_predict(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, int cpus,
+                         calibration_plan_t* plan);
+
+/**
+ * Choose the grouping and the shards with the best predicted throughput
+ * @param plugins Measured plugins of the chain
+ * @param num_plugins Number of plugins
+ * @param handoff_ns Cost of a stage boundary
+ * @param cpus CPUs the stages share
+ * @param max_partitions Most shards of a partitioned stage
+ * @param plan Filled with the chosen grouping (its arrays hold num_plugins entries)
+ * @return NULL on success, error message on failure
+ */
+const char* calibration_choose_plan(const calibration_plugin_t* plugins, int num_plugins, double handoff_ns, int cpus,
+                                    int max_partitions, calibration_plan_t* plan);
+
+#endif /* CALIBRATION_H */
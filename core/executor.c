@@ -0,0 +1,152 @@
+#define _GNU_SOURCE
+#include "executor.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// idle backoff - a worker that found nothing to do sleeps a little, doubling up to the max
+#define EXECUTOR_IDLE_SLEEP_MIN_NS 20000L
+#define EXECUTOR_IDLE_SLEEP_MAX_NS 1000000L
+
+static void* executor_worker_thread(void* arg);
+static int try_run_stage(executor_t* executor, executor_stage_t* stage);
+static void join_and_free_workers(executor_t* executor);
+
+
+const char* executor_start(executor_t* executor, executor_step_func* steps, int num_stages, int num_workers)
+{
+    if (NULL == executor || NULL == steps || num_stages <= 0 || num_workers <= 0) {
+        return "Invalid executor arguments";
+    }
+
+    memset(executor, 0, sizeof(executor_t));
+    executor->stages = (executor_stage_t*)calloc(num_stages, sizeof(executor_stage_t));
+    executor->workers = (pthread_t*)calloc(num_workers, sizeof(pthread_t));
+    if (NULL == executor->stages || NULL == executor->workers) {
+        free(executor->stages);
+        free(executor->workers);
+        memset(executor, 0, sizeof(executor_t));
+        return "Failed to allocate executor";
+    }
+
+    for (int i = 0; i < num_stages; i++) {
+        executor->stages[i].step = steps[i];
+    }
+    executor->num_stages = num_stages;
+    executor->num_workers = num_workers;
+
+    for (int i = 0; i < num_workers; i++) {
+        if (0 != pthread_create(&executor->workers[i], NULL, executor_worker_thread, executor)) {
+            break;
+        }
+        executor->workers_started++;
+
+        //stages have no thread of their own here, name the workers so top -H shows what they are
+        //(thread names are 15 chars, the id is clamped to the 6 digits left after "executor#")
+        char worker_name[16];
+        snprintf(worker_name, sizeof(worker_name), "executor#%d", (i + 1) % 1000000);
+        pthread_setname_np(executor->workers[i], worker_name);
+    }
+
+    //less workers than asked is still fine, zero is not
+    if (0 == executor->workers_started) {
+        free(executor->stages);
+        free(executor->workers);
+        memset(executor, 0, sizeof(executor_t));
+        return "Failed to create executor workers";
+    }
+
+    return NULL;
+}
+
+void executor_wait(executor_t* executor)
+{
+    if (NULL == executor || NULL == executor->workers) {
+        return;
+    }
+    //workers leave by themselves once every stage finished
+    join_and_free_workers(executor);
+}
+
+void executor_stop(executor_t* executor)
+{
+    if (NULL == executor || NULL == executor->workers) {
+        return;
+    }
+    __atomic_store_n(&executor->stop_requested, 1, __ATOMIC_RELEASE);
+    join_and_free_workers(executor);
+}
+
+
+/*** HELPER FUNCTIONS ***/
+
+static void join_and_free_workers(executor_t* executor)
+{
+    for (int i = 0; i < executor->workers_started; i++) {
+        pthread_join(executor->workers[i], NULL);
+    }
+    free(executor->workers);
+    free(executor->stages);
+    memset(executor, 0, sizeof(executor_t));
+}
+
+// claim the stage, step it once and release it
+// returns 1 if the stage made progress, 0 otherwise (busy in another worker, idle or blocked)
+static int try_run_stage(executor_t* executor, executor_stage_t* stage)
+{
+    if (__atomic_load_n(&stage->finished, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    int expected = 0;
+    if (!__atomic_compare_exchange_n(&stage->running, &expected, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0; //another worker has it
+    }
+
+    int progress = 0;
+    int step_result = stage->step(EXECUTOR_STEP_BATCH);
+    if (step_result < 0) {
+        __atomic_store_n(&stage->finished, 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&executor->finished_stages, 1, __ATOMIC_ACQ_REL);
+        progress = 1;
+    } else if (step_result > 0) {
+        progress = 1;
+    }
+
+    __atomic_store_n(&stage->running, 0, __ATOMIC_RELEASE);
+    return progress;
+}
+
+// every worker walks over all the stages, starting from a different offset so they
+// spread over the chain instead of fighting on the same stage
+static void* executor_worker_thread(void* arg)
+{
+    executor_t* executor = (executor_t*)arg;
+    int start_index = __atomic_fetch_add(&executor->next_worker_index, 1, __ATOMIC_RELAXED) % executor->num_stages;
+    long idle_sleep_ns = EXECUTOR_IDLE_SLEEP_MIN_NS;
+
+    while (!__atomic_load_n(&executor->stop_requested, __ATOMIC_ACQUIRE) &&
+           __atomic_load_n(&executor->finished_stages, __ATOMIC_ACQUIRE) < executor->num_stages)
+    {
+        int progress = 0;
+        for (int i = 0; i < executor->num_stages; i++) {
+            executor_stage_t* stage = &executor->stages[(start_index + i) % executor->num_stages];
+            progress |= try_run_stage(executor, stage);
+        }
+
+        if (progress) {
+            idle_sleep_ns = EXECUTOR_IDLE_SLEEP_MIN_NS;
+            continue;
+        }
+
+        //nothing runnable - back off instead of spinning on empty queues
+        struct timespec idle_time = { 0, idle_sleep_ns };
+        nanosleep(&idle_time, NULL);
+        if (idle_sleep_ns < EXECUTOR_IDLE_SLEEP_MAX_NS) {
+            idle_sleep_ns *= 2;
+        }
+    }
+
+    return NULL;
+}
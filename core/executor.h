@@ -0,0 +1,61 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <pthread.h>
+
+/**
+ * Stage executor - runs many pipeline stages on a small pool of worker threads.
+ * Instead of one consumer thread per plugin parked in monitor_wait, every stage
+ * exposes a non blocking step function (plugin_step) and the workers keep
+ * cycling over the stages that have work. A stage is never stepped by two
+ * workers at the same time, so the per-stage item order is preserved.
+ */
+
+// step function of a stage, returns items processed or a negative value once finished
+typedef int (*executor_step_func)(int max_items);
+
+// how many items a worker processes from one stage before moving to the next one
+#define EXECUTOR_STEP_BATCH 32
+
+typedef struct
+{
+    executor_step_func step;   /* Stage step function */
+    int running;               /* 1 while a worker is stepping this stage (atomic) */
+    int finished;              /* 1 once the stage returned finished (atomic) */
+} executor_stage_t;
+
+typedef struct
+{
+    executor_stage_t* stages;  /* Stages driven by this executor */
+    int num_stages;
+    pthread_t* workers;        /* Worker threads */
+    int num_workers;
+    int workers_started;       /* Number of workers actually created */
+    int next_worker_index;     /* Hands out a start offset to each worker (atomic) */
+    int finished_stages;       /* Stages that finished (atomic) */
+    int stop_requested;        /* Set by executor_stop (atomic) */
+} executor_t;
+
+/**
+ * Start the worker threads
+ * @param executor Executor to initialize
+ * @param steps Step functions, one per stage
+ * @param num_stages Number of stages
+ * @param num_workers Number of worker threads
+ * @return NULL on success, error message on failure
+ */
+const char* executor_start(executor_t* executor, executor_step_func* steps, int num_stages, int num_workers);
+
+/**
+ * Wait for all stages to finish and release the workers
+ * @param executor Executor to wait for
+ */
+void executor_wait(executor_t* executor);
+
+/**
+ * Stop the workers even if stages did not finish (error paths) and release them
+ * @param executor Executor to stop
+ */
+void executor_stop(executor_t* executor);
+
+#endif /* EXECUTOR_H */
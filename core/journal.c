@@ -0,0 +1,531 @@
+#define _GNU_SOURCE
+#include "journal.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// lines, payload bytes, crc32
+#define JOURNAL_RECORD_HEADER_BYTES 12
+
+#define JOURNAL_INITIAL_GROUP_BYTES (64 * 1024)
+
+static void* journal_thread(void* arg);
+static const char* commit_group(journal_t* journal);
+static const char* deliver_lines(journal_t* journal, char* payload, size_t payload_bytes, unsigned int lines);
+static void acknowledge_closed_segments(journal_t* journal);
+static const char* open_segment(journal_t* journal, unsigned long long sequence);
+static const char* recover_segments(journal_t* journal, unsigned long long* next_sequence);
+static int recover_segment(journal_t* journal, const char* path);
+static int compare_sequences(const void* a, const void* b);
+static void segment_path(const journal_t* journal, unsigned long long sequence, char* path, size_t path_size);
+static void sync_directory(const journal_t* journal);
+static int write_all(int fd, const char* data, size_t size);
+static int group_reserve(journal_group_t* group, size_t bytes);
+static uint32_t crc32_of(const char* data, size_t size);
+static void wait_until(pthread_cond_t* cond, pthread_mutex_t* mutex, unsigned long long deadline_ns);
+static unsigned long long monotonic_time_ns(void);
+
+static uint32_t g_crc_table[256];
+
+const char* journal_open(journal_t* journal, const char* directory, int batch_lines, int sync_ms,
+                         journal_deliver_func deliver, journal_drained_func drained)
+{
+    if (NULL == journal || NULL == directory || NULL == deliver) {
+        return "Invalid journal arguments";
+    }
+
+    memset(journal, 0, sizeof(journal_t));
+    journal->segment_fd = -1;
+    journal->batch_lines = (batch_lines > 0) ? batch_lines : JOURNAL_DEFAULT_BATCH_LINES;
+    journal->sync_interval_ns = (unsigned long long)((sync_ms > 0) ? sync_ms : JOURNAL_DEFAULT_SYNC_MS) * 1000000ULL;
+    journal->deliver = deliver;
+    journal->drained = drained;
+
+    //the table is built before the journal thread starts, a second journal builds the same one
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320U : crc >> 1;
+        }
+        g_crc_table[i] = crc;
+    }
+
+    if (0 != mkdir(directory, 0755) && EEXIST != errno) {
+        return "Failed to create journal directory";
+    }
+    journal->directory = strdup(directory);
+    if (NULL == journal->directory || 0 != group_reserve(&journal->pending, JOURNAL_INITIAL_GROUP_BYTES) ||
+        0 != group_reserve(&journal->committing, JOURNAL_INITIAL_GROUP_BYTES)) {
+        journal_free(journal);
+        return "Failed to allocate journal buffers";
+    }
+
+    //the lines of a crashed run go first, in the order they were read
+    unsigned long long next_sequence = 0;
+    const char* error = recover_segments(journal, &next_sequence);
+    if (NULL == error) {
+        error = open_segment(journal, next_sequence);
+    }
+    if (NULL != error) {
+        journal_free(journal);
+        return error;
+    }
+
+    //timed waits on the monotonic clock like the watchdog
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_result = pthread_cond_init(&journal->commit_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (0 != cond_result) {
+        journal_free(journal);
+        return "Failed to initialize journal condition";
+    }
+    pthread_cond_init(&journal->space_cond, NULL);
+    pthread_mutex_init(&journal->mutex, NULL);
+
+    if (0 != pthread_create(&journal->thread, NULL, journal_thread, journal)) {
+        pthread_cond_destroy(&journal->commit_cond);
+        pthread_cond_destroy(&journal->space_cond);
+        pthread_mutex_destroy(&journal->mutex);
+        journal_free(journal);
+        return "Failed to create journal thread";
+    }
+    pthread_setname_np(journal->thread, "journal");
+    journal->thread_started = 1;
+    return NULL;
+}
+
+const char* journal_append(journal_t* journal, const char* line, size_t length)
+{
+    if (NULL == journal || NULL == line || !journal->thread_started) {
+        return "Journal not open";
+    }
+    if (length + 1 > JOURNAL_MAX_GROUP_BYTES) {
+        return "Line too long for a journal group";
+    }
+
+    pthread_mutex_lock(&journal->mutex);
+    //a full group waits for the sync of the one before it, that is the backpressure on the reader;
+    //a group is full by its lines, or by its bytes so no record gets longer than recovery accepts
+    while (NULL == journal->error &&
+           (journal->pending.lines >= (unsigned int)journal->batch_lines ||
+            journal->pending.used - JOURNAL_RECORD_HEADER_BYTES + length + 1 > JOURNAL_MAX_GROUP_BYTES)) {
+        if (journal->pending.lines < (unsigned int)journal->batch_lines && !journal->pending_full) {
+            journal->pending_full = 1;
+            pthread_cond_signal(&journal->commit_cond);
+        }
+        pthread_cond_wait(&journal->space_cond, &journal->mutex);
+    }
+    if (NULL != journal->error) {
+        const char* error = journal->error;
+        pthread_mutex_unlock(&journal->mutex);
+        return error;
+    }
+
+    journal_group_t* group = &journal->pending;
+    if (0 != group_reserve(group, group->used + length + 1)) {
+        pthread_mutex_unlock(&journal->mutex);
+        return "Failed to allocate journal buffers";
+    }
+    memcpy(group->data + group->used, line, length);
+    group->data[group->used + length] = '\n';
+    group->used += length + 1;
+    group->lines++;
+
+    if (1 == group->lines) {
+        journal->pending_since_ns = monotonic_time_ns();
+        pthread_cond_signal(&journal->commit_cond);
+    } else if (group->lines == (unsigned int)journal->batch_lines) {
+        pthread_cond_signal(&journal->commit_cond);
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return NULL;
+}
+
+const char* journal_close(journal_t* journal)
+{
+    if (NULL == journal) {
+        return NULL;
+    }
+
+    if (journal->thread_started) {
+        pthread_mutex_lock(&journal->mutex);
+        journal->stop_requested = 1;
+        pthread_cond_signal(&journal->commit_cond);
+        pthread_mutex_unlock(&journal->mutex);
+        pthread_join(journal->thread, NULL);
+
+        pthread_cond_destroy(&journal->commit_cond);
+        pthread_cond_destroy(&journal->space_cond);
+        pthread_mutex_destroy(&journal->mutex);
+        journal->thread_started = 0;
+    }
+    if (journal->segment_fd >= 0) {
+        close(journal->segment_fd);
+        journal->segment_fd = -1;
+    }
+    return journal->error;
+}
+
+const char* journal_acknowledge(journal_t* journal)
+{
+    if (NULL == journal || NULL == journal->directory) {
+        return "Journal not open";
+    }
+
+    journal_close(journal);
+    const char* error = NULL;
+    char path[4096];
+    for (unsigned long long sequence = journal->first_segment; sequence <= journal->current_segment; sequence++) {
+        segment_path(journal, sequence, path, sizeof(path));
+        if (0 != unlink(path) && ENOENT != errno) {
+            error = "Failed to delete journal segment";
+            continue;
+        }
+        journal->segments_acknowledged++;
+    }
+    sync_directory(journal);
+    journal_free(journal);
+    return error;
+}
+
+void journal_free(journal_t* journal)
+{
+    if (NULL == journal) {
+        return;
+    }
+
+    journal_close(journal);
+    free(journal->pending.data);
+    free(journal->committing.data);
+    free(journal->directory);
+    memset(&journal->pending, 0, sizeof(journal_group_t));
+    memset(&journal->committing, 0, sizeof(journal_group_t));
+    journal->directory = NULL;
+}
+
+static void* journal_thread(void* arg)
+{
+    journal_t* journal = (journal_t*)arg;
+
+    pthread_mutex_lock(&journal->mutex);
+    while (1) {
+        if (0 == journal->pending.lines) {
+            if (journal->stop_requested) {
+                break;
+            }
+            //idle - a good time to look whether the closed segments went through the pipeline
+            int has_closed_segments = journal->first_segment < journal->current_segment;
+            if (has_closed_segments && NULL != journal->drained) {
+                pthread_mutex_unlock(&journal->mutex);
+                acknowledge_closed_segments(journal);
+                pthread_mutex_lock(&journal->mutex);
+                if (0 != journal->pending.lines || journal->stop_requested) {
+                    continue;
+                }
+                wait_until(&journal->commit_cond, &journal->mutex, monotonic_time_ns() + journal->sync_interval_ns);
+            } else {
+                pthread_cond_wait(&journal->commit_cond, &journal->mutex);
+            }
+            continue;
+        }
+
+        //a group is committed once it is full or its first line waited long enough
+        unsigned long long deadline_ns = journal->pending_since_ns + journal->sync_interval_ns;
+        if (!journal->stop_requested && !journal->pending_full &&
+            journal->pending.lines < (unsigned int)journal->batch_lines && monotonic_time_ns() < deadline_ns) {
+            wait_until(&journal->commit_cond, &journal->mutex, deadline_ns);
+            continue;
+        }
+
+        //the reader fills the other buffer while this group is written and synced
+        journal_group_t taken = journal->pending;
+        journal->pending = journal->committing;
+        journal->pending.used = JOURNAL_RECORD_HEADER_BYTES;
+        journal->pending.lines = 0;
+        journal->pending_full = 0;
+        journal->committing = taken;
+        pthread_cond_broadcast(&journal->space_cond);
+        pthread_mutex_unlock(&journal->mutex);
+
+        const char* error = commit_group(journal);
+
+        pthread_mutex_lock(&journal->mutex);
+        if (NULL != error) {
+            journal->error = error;
+            pthread_cond_broadcast(&journal->space_cond);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&journal->mutex);
+    return NULL;
+}
+
+// one write and one fdatasync for the whole group, then its lines enter the pipeline
+static const char* commit_group(journal_t* journal)
+{
+    journal_group_t* group = &journal->committing;
+    size_t payload_bytes = group->used - JOURNAL_RECORD_HEADER_BYTES;
+    if (journal->segment_bytes > JOURNAL_MAGIC_LENGTH && journal->segment_bytes + group->used > JOURNAL_SEGMENT_BYTES) {
+        const char* error = open_segment(journal, journal->current_segment + 1);
+        if (NULL != error) {
+            return error;
+        }
+    }
+
+    uint32_t header[3] = { group->lines, (uint32_t)payload_bytes,
+                           crc32_of(group->data + JOURNAL_RECORD_HEADER_BYTES, payload_bytes) };
+    memcpy(group->data, header, JOURNAL_RECORD_HEADER_BYTES);
+
+    unsigned long long start_ns = monotonic_time_ns();
+    if (0 != write_all(journal->segment_fd, group->data, group->used)) {
+        return "Failed to write journal group";
+    }
+    if (0 != fdatasync(journal->segment_fd)) {
+        return "Failed to sync journal segment";
+    }
+    journal->sync_time_ns += monotonic_time_ns() - start_ns;
+    journal->segment_bytes += group->used;
+    journal->commits++;
+
+    return deliver_lines(journal, group->data + JOURNAL_RECORD_HEADER_BYTES, payload_bytes, group->lines);
+}
+
+static const char* deliver_lines(journal_t* journal, char* payload, size_t payload_bytes, unsigned int lines)
+{
+    char* line = payload;
+    char* end = payload + payload_bytes;
+    for (unsigned int i = 0; i < lines && line < end; i++) {
+        char* newline = (char*)memchr(line, '\n', (size_t)(end - line));
+        if (NULL == newline) {
+            break;
+        }
+        *newline = '\0';
+        const char* error = journal->deliver(line);
+        *newline = '\n';
+        if (NULL != error) {
+            return "Failed to hand a journaled line to the pipeline";
+        }
+        journal->lines_delivered++;
+        line = newline + 1;
+    }
+    return NULL;
+}
+
+// the closed segments only hold lines that were delivered, once the pipeline drained they are done
+static void acknowledge_closed_segments(journal_t* journal)
+{
+    if (!journal->drained(journal->lines_delivered)) {
+        return;
+    }
+
+    char path[4096];
+    while (journal->first_segment < journal->current_segment) {
+        segment_path(journal, journal->first_segment, path, sizeof(path));
+        if (0 != unlink(path) && ENOENT != errno) {
+            break;
+        }
+        journal->first_segment++;
+        journal->segments_acknowledged++;
+    }
+    sync_directory(journal);
+}
+
+static const char* open_segment(journal_t* journal, unsigned long long sequence)
+{
+    char path[4096];
+    segment_path(journal, sequence, path, sizeof(path));
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return "Failed to create journal segment";
+    }
+    if (0 != write_all(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH) || 0 != fdatasync(fd)) {
+        close(fd);
+        return "Failed to write journal segment header";
+    }
+    //the new name has to survive a crash too, not only its bytes
+    sync_directory(journal);
+
+    if (journal->segment_fd >= 0) {
+        close(journal->segment_fd);
+    }
+    journal->segment_fd = fd;
+    journal->current_segment = sequence;
+    journal->segment_bytes = JOURNAL_MAGIC_LENGTH;
+    return NULL;
+}
+
+static const char* recover_segments(journal_t* journal, unsigned long long* next_sequence)
+{
+    DIR* dir = opendir(journal->directory);
+    if (NULL == dir) {
+        return "Failed to open journal directory";
+    }
+
+    unsigned long long* sequences = NULL;
+    size_t num_sequences = 0;
+    size_t capacity = 0;
+    struct dirent* entry;
+    while (NULL != (entry = readdir(dir))) {
+        unsigned long long sequence;
+        int name_length = 0;
+        if (1 != sscanf(entry->d_name, "journal-%llu.log%n", &sequence, &name_length) ||
+            '\0' != entry->d_name[name_length]) {
+            continue;
+        }
+        if (num_sequences == capacity) {
+            capacity = (0 == capacity) ? 16 : capacity * 2;
+            unsigned long long* grown = (unsigned long long*)realloc(sequences, capacity * sizeof(unsigned long long));
+            if (NULL == grown) {
+                free(sequences);
+                closedir(dir);
+                return "Failed to allocate journal buffers";
+            }
+            sequences = grown;
+        }
+        sequences[num_sequences++] = sequence;
+    }
+    closedir(dir);
+
+    qsort(sequences, num_sequences, sizeof(unsigned long long), compare_sequences);
+    char path[4096];
+    for (size_t i = 0; i < num_sequences; i++) {
+        segment_path(journal, sequences[i], path, sizeof(path));
+        if (0 != recover_segment(journal, path)) {
+            free(sequences);
+            return "Failed to hand a journaled line to the pipeline";
+        }
+    }
+
+    //the recovered segments stay until the pipeline went through them
+    journal->first_segment = (num_sequences > 0) ? sequences[0] : 0;
+    *next_sequence = (num_sequences > 0) ? sequences[num_sequences - 1] + 1 : 0;
+    free(sequences);
+    return NULL;
+}
+
+// a segment ends at its first incomplete or damaged group, nothing after it was synced
+static int recover_segment(journal_t* journal, const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (NULL == file) {
+        return 0;
+    }
+
+    char magic[JOURNAL_MAGIC_LENGTH];
+    if (JOURNAL_MAGIC_LENGTH != fread(magic, 1, JOURNAL_MAGIC_LENGTH, file) ||
+        0 != memcmp(magic, JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH)) {
+        fclose(file);
+        return 0;
+    }
+
+    journal_group_t* group = &journal->committing;
+    uint32_t header[3];
+    while (JOURNAL_RECORD_HEADER_BYTES == fread(header, 1, JOURNAL_RECORD_HEADER_BYTES, file)) {
+        if (header[1] > JOURNAL_MAX_GROUP_BYTES || 0 != group_reserve(group, header[1]) ||
+            header[1] != fread(group->data, 1, header[1], file) || header[2] != crc32_of(group->data, header[1])) {
+            break;
+        }
+        unsigned long long delivered = journal->lines_delivered;
+        if (NULL != deliver_lines(journal, group->data, header[1], header[0])) {
+            fclose(file);
+            return -1;
+        }
+        journal->lines_recovered += journal->lines_delivered - delivered;
+    }
+    fclose(file);
+    return 0;
+}
+
+static int compare_sequences(const void* a, const void* b)
+{
+    unsigned long long first = *(const unsigned long long*)a;
+    unsigned long long second = *(const unsigned long long*)b;
+    return (first > second) - (first < second);
+}
+
+static void segment_path(const journal_t* journal, unsigned long long sequence, char* path, size_t path_size)
+{
+    snprintf(path, path_size, "%s/journal-%020llu.log", journal->directory, sequence);
+}
+
+static void sync_directory(const journal_t* journal)
+{
+    int fd = open(journal->directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+static int write_all(int fd, const char* data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return -1;
+        }
+        data += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+// room for bytes in total, an empty group starts with the space for its record header
+static int group_reserve(journal_group_t* group, size_t bytes)
+{
+    if (NULL == group->data) {
+        group->used = JOURNAL_RECORD_HEADER_BYTES;
+    }
+    if (bytes <= group->capacity && NULL != group->data) {
+        return 0;
+    }
+
+    size_t capacity = (0 == group->capacity) ? JOURNAL_INITIAL_GROUP_BYTES : group->capacity;
+    while (capacity < bytes) {
+        capacity *= 2;
+    }
+    char* data = (char*)realloc(group->data, capacity);
+    if (NULL == data) {
+        return -1;
+    }
+    group->data = data;
+    group->capacity = capacity;
+    return 0;
+}
+
+static uint32_t crc32_of(const char* data, size_t size)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    uint32_t crc = 0xFFFFFFFFU;
+    for (size_t i = 0; i < size; i++) {
+        crc = g_crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFU;
+}
+
+static void wait_until(pthread_cond_t* cond, pthread_mutex_t* mutex, unsigned long long deadline_ns)
+{
+    struct timespec wake_time;
+    wake_time.tv_sec = (time_t)(deadline_ns / 1000000000ULL);
+    wake_time.tv_nsec = (long)(deadline_ns % 1000000000ULL);
+    pthread_cond_timedwait(cond, mutex, &wake_time);
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
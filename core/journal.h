@@ -0,0 +1,139 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Write-ahead journal of the input - every line is written to a segment file and synced
+ * before it enters the pipeline, so a crash does not lose a line that was accepted.
+ *
+ * Lines are committed in groups: the journal thread writes all the pending lines with one
+ * write and one fdatasync, then hands them to the pipeline, and while it syncs the next
+ * group collects. A group is committed once it holds batch_lines lines or its first line
+ * waited sync_ms, so durability costs one sync per group instead of one per line. The
+ * reader blocks only when a full group is still waiting for the previous sync.
+ *
+ * A segment is acknowledged (deleted) once the pipeline went through all of its lines -
+ * when the drained check passes after the segment was closed, or at the clean end of the
+ * run (journal_acknowledge). The segments a crash left behind are replayed through the
+ * pipeline by journal_open before any new line is read. Delivery is at least once: the
+ * lines of a segment that was not acknowledged yet are replayed whole, including the ones
+ * the pipeline already went through before the crash. Going through includes being durable
+ * wherever the pipeline puts its output, the drained check has to see to that (sync it) before
+ * it answers yes, and so does the caller before journal_acknowledge.
+ *
+ * Segment "<dir>/journal-<sequence>.log": the 8 byte magic "PLJRNL01", then one record per group:
+ *   u32 lines, u32 payload bytes, u32 crc32 of the payload (host byte order)
+ *   payload - the lines, each '\n' terminated
+ * A group a crash cut short fails its length or crc check and is skipped on recovery,
+ * none of its lines had entered the pipeline.
+ */
+
+#define JOURNAL_MAGIC "PLJRNL01"
+#define JOURNAL_MAGIC_LENGTH 8
+
+// a segment is closed (and can be acknowledged) once it holds this many bytes
+#define JOURNAL_SEGMENT_BYTES (64 * 1024 * 1024)
+
+// largest payload of one group, a group is committed early once the next line does not fit
+// (recovery treats a longer record as damaged)
+#define JOURNAL_MAX_GROUP_BYTES (4 * 1024 * 1024)
+
+#define JOURNAL_DEFAULT_BATCH_LINES 4096
+#define JOURNAL_DEFAULT_SYNC_MS 10
+
+// hands a durable line to the pipeline (the place_work of the first stage)
+typedef const char* (*journal_deliver_func)(const char* line);
+
+// 1 when every one of the lines delivered so far went through the whole pipeline
+typedef int (*journal_drained_func)(unsigned long long lines_delivered);
+
+// lines collected for one group commit, the record header is filled in at the commit
+typedef struct
+{
+    char* data;
+    size_t used;
+    size_t capacity;
+    unsigned int lines;
+} journal_group_t;
+
+typedef struct
+{
+    char* directory;
+    int segment_fd;                       /* Segment the groups go to, -1 - none open */
+    unsigned long long first_segment;     /* Oldest segment not acknowledged yet */
+    unsigned long long current_segment;   /* Sequence of the open segment */
+    size_t segment_bytes;                 /* Bytes in the open segment */
+    int batch_lines;                      /* Lines of a full group */
+    unsigned long long sync_interval_ns;  /* Longest wait of a line for its group commit */
+    journal_deliver_func deliver;
+    journal_drained_func drained;
+
+    journal_group_t pending;              /* Group the reader appends to */
+    journal_group_t committing;           /* Group being written and delivered */
+    unsigned long long pending_since_ns;  /* Monotonic time of the first pending line */
+    int pending_full;                     /* The next line does not fit into the pending group */
+
+    unsigned long long lines_recovered;   /* Lines replayed from the segments of a crashed run */
+    unsigned long long lines_delivered;   /* Lines handed to the pipeline, recovered ones included */
+    unsigned long long commits;           /* Group commits (fdatasync calls) */
+    unsigned long long sync_time_ns;      /* Time spent in write + fdatasync */
+    unsigned long long segments_acknowledged;
+    const char* error;                    /* First write / sync / delivery failure, the journal stops there */
+
+    pthread_mutex_t mutex;
+    pthread_cond_t commit_cond;           /* Signaled by the reader - a group started or filled up, or stop */
+    pthread_cond_t space_cond;            /* Signaled by the journal thread - the pending group was taken */
+    int stop_requested;
+    pthread_t thread;
+    int thread_started;
+} journal_t;
+
+/**
+ * Open the journal directory (created if missing), replay the segments a crashed run left
+ * there through deliver, then start the journal thread on a new segment
+ * @param journal Journal to initialize
+ * @param directory Journal directory
+ * @param batch_lines Lines of a full group, <= 0 - JOURNAL_DEFAULT_BATCH_LINES
+ * @param sync_ms Longest wait of a line for its group commit, <= 0 - JOURNAL_DEFAULT_SYNC_MS
+ * @param deliver Hands a durable line to the pipeline
+ * @param drained Drained check for acknowledging closed segments during the run, NULL - only at the end
+ * @return NULL on success, error message on failure
+ */
+const char* journal_open(journal_t* journal, const char* directory, int batch_lines, int sync_ms,
+                         journal_deliver_func deliver, journal_drained_func drained);
+
+/**
+ * Add an input line to the pending group (reader thread). Blocks while a full group waits
+ * for the previous commit. The line reaches the pipeline once its group is durable
+ * @param journal Open journal
+ * @param line Line content (no '\n')
+ * @param length Line length in bytes, at most JOURNAL_MAX_GROUP_BYTES - 1
+ * @return NULL on success, error message once the journal failed (the line was not taken)
+ */
+const char* journal_append(journal_t* journal, const char* line, size_t length);
+
+/**
+ * Commit and deliver the pending lines and stop the journal thread, the segments stay
+ * until journal_acknowledge
+ * @param journal Journal to close
+ * @return NULL on success, the journal error if one happened
+ */
+const char* journal_close(journal_t* journal);
+
+/**
+ * The pipeline went through every line - delete all the segments and free the journal.
+ * A run that did not end cleanly skips this, so its segments are replayed by the next one
+ * @param journal Closed journal
+ * @return NULL on success, error message on failure
+ */
+const char* journal_acknowledge(journal_t* journal);
+
+/**
+ * Free a closed journal without acknowledging it, the segments stay for recovery
+ * @param journal Closed journal
+ */
+void journal_free(journal_t* journal);
+
+#endif /* JOURNAL_H */
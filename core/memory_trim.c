@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include "memory_trim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void* memory_trim_thread(void* arg);
+static void trim_idle_stages(memory_trimmer_t* trimmer);
+static unsigned long long monotonic_time_ns(void);
+
+const char* memory_trim_start(memory_trimmer_t* trimmer, memory_trim_get_stats_func* get_stats,
+                              memory_trim_stage_func* trim, int num_stages, memory_trim_host_func host_trim,
+                              int idle_ms, size_t keep_bytes)
+{
+    if (NULL == trimmer || NULL == get_stats || NULL == trim || num_stages <= 0 || idle_ms <= 0) {
+        return "Invalid memory trim arguments";
+    }
+
+    memset(trimmer, 0, sizeof(memory_trimmer_t));
+    trimmer->stages = (memory_trim_stage_t*)calloc(num_stages, sizeof(memory_trim_stage_t));
+    if (NULL == trimmer->stages) {
+        return "Failed to allocate memory trim stages";
+    }
+
+    unsigned long long now_ns = monotonic_time_ns();
+    for (int i = 0; i < num_stages; i++) {
+        trimmer->stages[i].get_stats = get_stats[i];
+        trimmer->stages[i].trim = trim[i];
+        trimmer->stages[i].last_progress_ns = now_ns;
+    }
+    trimmer->num_stages = num_stages;
+    trimmer->host_trim = host_trim;
+    trimmer->idle_ns = (unsigned long long)idle_ms * 1000000ULL;
+    trimmer->keep_bytes = keep_bytes;
+
+    //timed waits on the monotonic clock like the watchdog
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_result = pthread_cond_init(&trimmer->stop_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (0 != cond_result) {
+        free(trimmer->stages);
+        memset(trimmer, 0, sizeof(memory_trimmer_t));
+        return "Failed to initialize memory trim condition";
+    }
+    pthread_mutex_init(&trimmer->stop_mutex, NULL);
+
+    if (0 != pthread_create(&trimmer->thread, NULL, memory_trim_thread, trimmer)) {
+        pthread_cond_destroy(&trimmer->stop_cond);
+        pthread_mutex_destroy(&trimmer->stop_mutex);
+        free(trimmer->stages);
+        memset(trimmer, 0, sizeof(memory_trimmer_t));
+        return "Failed to create memory trim thread";
+    }
+    pthread_setname_np(trimmer->thread, "memtrim");
+    trimmer->thread_started = 1;
+    return NULL;
+}
+
+void memory_trim_stop(memory_trimmer_t* trimmer)
+{
+    if (NULL == trimmer || !trimmer->thread_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&trimmer->stop_mutex);
+    trimmer->stop_requested = 1;
+    pthread_cond_signal(&trimmer->stop_cond);
+    pthread_mutex_unlock(&trimmer->stop_mutex);
+    pthread_join(trimmer->thread, NULL);
+
+    pthread_cond_destroy(&trimmer->stop_cond);
+    pthread_mutex_destroy(&trimmer->stop_mutex);
+    free(trimmer->stages);
+    trimmer->stages = NULL;
+    trimmer->num_stages = 0;
+    trimmer->thread_started = 0;
+}
+
+static void* memory_trim_thread(void* arg)
+{
+    memory_trimmer_t* trimmer = (memory_trimmer_t*)arg;
+    unsigned long long sample_interval_ns = trimmer->idle_ns / MEMORY_TRIM_SAMPLES_PER_PERIOD;
+
+    pthread_mutex_lock(&trimmer->stop_mutex);
+    while (!trimmer->stop_requested) {
+        struct timespec wake_time;
+        clock_gettime(CLOCK_MONOTONIC, &wake_time);
+        unsigned long long wake_ns = (unsigned long long)wake_time.tv_nsec + sample_interval_ns;
+        wake_time.tv_sec += (time_t)(wake_ns / 1000000000ULL);
+        wake_time.tv_nsec = (long)(wake_ns % 1000000000ULL);
+
+        pthread_cond_timedwait(&trimmer->stop_cond, &trimmer->stop_mutex, &wake_time);
+        if (trimmer->stop_requested) {
+            break;
+        }
+
+        //the trims run without our lock, memory_trim_stop only waits for the current round
+        pthread_mutex_unlock(&trimmer->stop_mutex);
+        trim_idle_stages(trimmer);
+        pthread_mutex_lock(&trimmer->stop_mutex);
+    }
+    pthread_mutex_unlock(&trimmer->stop_mutex);
+    return NULL;
+}
+
+static void trim_idle_stages(memory_trimmer_t* trimmer)
+{
+    unsigned long long now_ns = monotonic_time_ns();
+    int all_idle = 1;
+    for (int i = 0; i < trimmer->num_stages; i++) {
+        memory_trim_stage_t* stage = &trimmer->stages[i];
+        plugin_stats_t stats;
+        if (NULL == stage->get_stats || NULL != stage->get_stats(&stats)) {
+            all_idle = 0;
+            continue;
+        }
+
+        unsigned long long progress = stats.items_processed + stats.items_dropped;
+        if (progress != stage->last_progress) {
+            stage->last_progress = progress;
+            stage->last_progress_ns = now_ns;
+            stage->trimmed = 0;
+            trimmer->host_trimmed = 0;
+        }
+        if (now_ns - stage->last_progress_ns < trimmer->idle_ns) {
+            all_idle = 0;
+            continue;
+        }
+
+        if (!stage->trimmed && NULL != stage->trim) {
+            size_t released = 0;
+            if (NULL == stage->trim(trimmer->keep_bytes, &released) && released > 0) {
+                trimmer->trims++;
+                trimmer->released_bytes += released;
+            }
+        }
+        stage->trimmed = 1;
+    }
+
+    //the host pools are shared by all the stages, they are idle once the whole pipeline is
+    if (all_idle && !trimmer->host_trimmed && NULL != trimmer->host_trim) {
+        size_t released = trimmer->host_trim(trimmer->keep_bytes);
+        if (released > 0) {
+            trimmer->trims++;
+            trimmer->released_bytes += released;
+        }
+        trimmer->host_trimmed = 1;
+    }
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
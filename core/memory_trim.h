@@ -0,0 +1,83 @@
+#ifndef MEMORY_TRIM_H
+#define MEMORY_TRIM_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "../plugins/plugin_stats.h"
+
+/**
+ * Idle memory trimmer - a background thread that gives the memory a burst left
+ * behind back to the OS, so a long running analyzer sharing a host does not stay
+ * at its peak size forever.
+ *
+ * A stage whose progress counter did not move for the idle period is trimmed once
+ * (its byte ring pages past the warm minimum, plugin_trim_memory), and re-armed when
+ * it moves again. Once every stage is idle the host pools are trimmed too (the idle
+ * output batches and the free malloc memory). Under steady load nothing goes idle,
+ * and the warm minimum stays resident so a short pause does not cost page faults.
+ */
+
+// how many times per idle period the stages are sampled
+#define MEMORY_TRIM_SAMPLES_PER_PERIOD 4
+
+// bytes of every pool kept resident when no warm minimum is given
+#define MEMORY_TRIM_DEFAULT_WARM_BYTES (64 * 1024)
+
+// trim function of a stage (plugin_trim_memory)
+typedef const char* (*memory_trim_stage_func)(size_t keep_bytes, size_t* released_bytes);
+
+// stats function of a stage (plugin_get_stats), the progress counter
+typedef const char* (*memory_trim_get_stats_func)(plugin_stats_t* stats);
+
+// host pools, called once the whole pipeline is idle, returns the bytes released
+typedef size_t (*memory_trim_host_func)(size_t keep_bytes);
+
+typedef struct
+{
+    memory_trim_get_stats_func get_stats;
+    memory_trim_stage_func trim;          /* NULL - the stage has nothing to trim */
+    unsigned long long last_progress;     /* Items processed + dropped at the last change */
+    unsigned long long last_progress_ns;  /* Monotonic time of the last change */
+    int trimmed;                          /* Trimmed since the last change */
+} memory_trim_stage_t;
+
+typedef struct
+{
+    memory_trim_stage_t* stages;
+    int num_stages;
+    memory_trim_host_func host_trim;
+    int host_trimmed;                     /* Host pools trimmed since a stage last moved */
+    unsigned long long idle_ns;           /* No progress for this long is idle */
+    size_t keep_bytes;                    /* Warm minimum of every pool */
+    unsigned long long trims;             /* Stage and host trims that released memory */
+    unsigned long long released_bytes;    /* Resident bytes given back to the OS */
+    pthread_mutex_t stop_mutex;
+    pthread_cond_t stop_cond;             /* Signaled by memory_trim_stop */
+    int stop_requested;
+    pthread_t thread;
+    int thread_started;
+} memory_trimmer_t;
+
+/**
+ * Start the trimmer thread
+ * @param trimmer Trimmer to initialize
+ * @param get_stats Stats functions, one per stage (NULL entries never count as idle)
+ * @param trim Trim functions, one per stage (NULL entries are skipped)
+ * @param num_stages Number of stages
+ * @param host_trim Host pool trim, NULL - none
+ * @param idle_ms Idle period in milliseconds
+ * @param keep_bytes Warm minimum kept resident in every pool
+ * @return NULL on success, error message on failure
+ */
+const char* memory_trim_start(memory_trimmer_t* trimmer, memory_trim_get_stats_func* get_stats,
+                              memory_trim_stage_func* trim, int num_stages, memory_trim_host_func host_trim,
+                              int idle_ms, size_t keep_bytes);
+
+/**
+ * Stop the trimmer thread, must be called before the stages and the host pools are freed.
+ * trims and released_bytes stay readable
+ * @param trimmer Trimmer to stop
+ */
+void memory_trim_stop(memory_trimmer_t* trimmer);
+
+#endif /* MEMORY_TRIM_H */
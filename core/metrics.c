@@ -0,0 +1,369 @@
+#define _GNU_SOURCE
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+// a scraper that stops reading must not stall the reporter for longer than this
+#define METRICS_CLIENT_SEND_TIMEOUT_SEC 1
+#define METRICS_LISTEN_BACKLOG 8
+
+static void* metrics_reporter_thread(void* arg);
+static int render_report(metrics_reporter_t* reporter);
+static void publish_report(metrics_reporter_t* reporter);
+static void serve_client(metrics_reporter_t* reporter);
+static const char* open_listen_socket(metrics_reporter_t* reporter);
+static unsigned long long monotonic_time_ns(void);
+
+const char* metrics_reporter_start(metrics_reporter_t* reporter, const char* const* labels,
+                                   metrics_get_stats_func* get_stats, int num_stages,
+                                   const char* target, int interval_ms)
+{
+    if (NULL == reporter || NULL == labels || NULL == get_stats || num_stages <= 0 ||
+        NULL == target || interval_ms <= 0) {
+        return "Invalid metrics reporter arguments";
+    }
+
+    memset(reporter, 0, sizeof(metrics_reporter_t));
+    reporter->listen_fd = -1;
+    reporter->wake_pipe[0] = -1;
+    reporter->wake_pipe[1] = -1;
+    reporter->interval_ms = interval_ms;
+
+    reporter->is_socket = (0 == strncmp(target, METRICS_SOCKET_PREFIX, strlen(METRICS_SOCKET_PREFIX)));
+    const char* path = reporter->is_socket ? target + strlen(METRICS_SOCKET_PREFIX) : target;
+    if ('\0' == path[0]) {
+        return "Empty metrics target path";
+    }
+
+    reporter->stages = (metrics_stage_t*)calloc(num_stages, sizeof(metrics_stage_t));
+    reporter->target_path = strdup(path);
+    if (NULL == reporter->stages || NULL == reporter->target_path) {
+        metrics_reporter_stop(reporter);
+        return "Failed to allocate metrics reporter";
+    }
+    for (int i = 0; i < num_stages; i++) {
+        snprintf(reporter->stages[i].label, METRICS_LABEL_LENGTH, "%s", labels[i]);
+        reporter->stages[i].get_stats = get_stats[i];
+    }
+    reporter->num_stages = num_stages;
+
+    if (reporter->is_socket) {
+        const char* socket_error = open_listen_socket(reporter);
+        if (NULL != socket_error) {
+            metrics_reporter_stop(reporter);
+            return socket_error;
+        }
+    }
+
+    if (0 != pipe2(reporter->wake_pipe, O_CLOEXEC)) {
+        metrics_reporter_stop(reporter);
+        return "Failed to create metrics wake pipe";
+    }
+
+    reporter->last_report_ns = monotonic_time_ns();
+    if (0 != pthread_create(&reporter->thread, NULL, metrics_reporter_thread, reporter)) {
+        metrics_reporter_stop(reporter);
+        return "Failed to create metrics reporter thread";
+    }
+    pthread_setname_np(reporter->thread, "metrics");
+    reporter->thread_started = 1;
+    return NULL;
+}
+
+void metrics_reporter_stop(metrics_reporter_t* reporter)
+{
+    if (NULL == reporter) {
+        return;
+    }
+
+    if (reporter->thread_started) {
+        //the thread writes the final report on its way out
+        char wake_byte = 1;
+        if (1 != write(reporter->wake_pipe[1], &wake_byte, 1)) {
+            fprintf(stderr, "Warning: failed to wake the metrics reporter\n");
+        }
+        pthread_join(reporter->thread, NULL);
+    }
+
+    if (reporter->listen_fd >= 0) {
+        close(reporter->listen_fd);
+        unlink(reporter->target_path);
+    }
+    if (reporter->wake_pipe[0] >= 0) {
+        close(reporter->wake_pipe[0]);
+        close(reporter->wake_pipe[1]);
+    }
+    free(reporter->snapshot);
+    free(reporter->target_path);
+    free(reporter->stages);
+    memset(reporter, 0, sizeof(metrics_reporter_t));
+    reporter->listen_fd = -1;
+    reporter->wake_pipe[0] = -1;
+    reporter->wake_pipe[1] = -1;
+}
+
+// render a report every interval, in socket mode answer the clients in between
+static void* metrics_reporter_thread(void* arg)
+{
+    metrics_reporter_t* reporter = (metrics_reporter_t*)arg;
+    int stop_requested = 0;
+
+    while (!stop_requested) {
+        if (0 == render_report(reporter)) {
+            publish_report(reporter);
+        }
+
+        unsigned long long deadline_ns = monotonic_time_ns() + (unsigned long long)reporter->interval_ms * 1000000ULL;
+        while (!stop_requested) {
+            unsigned long long now_ns = monotonic_time_ns();
+            if (now_ns >= deadline_ns) {
+                break;
+            }
+
+            struct pollfd poll_fds[2] = {
+                { reporter->wake_pipe[0], POLLIN, 0 },
+                { reporter->listen_fd, POLLIN, 0 },
+            };
+            int timeout_ms = (int)((deadline_ns - now_ns + 999999ULL) / 1000000ULL);
+            int ready = poll(poll_fds, reporter->is_socket ? 2 : 1, timeout_ms);
+            if (ready < 0 && EINTR != errno) {
+                break;
+            }
+            if (ready > 0 && (poll_fds[0].revents & POLLIN)) {
+                stop_requested = 1;
+            } else if (ready > 0 && (poll_fds[1].revents & POLLIN)) {
+                serve_client(reporter);
+            }
+        }
+    }
+
+    //final numbers, so a file target ends up with the totals of the whole run
+    if (!reporter->is_socket && 0 == render_report(reporter)) {
+        publish_report(reporter);
+    }
+    return NULL;
+}
+
+// label values may hold any plugin name, escape what the text format needs
+static void write_label(FILE* out, const char* label)
+{
+    for (const char* c = label; '\0' != *c; c++) {
+        if ('\\' == *c || '"' == *c) {
+            fputc('\\', out);
+            fputc(*c, out);
+        } else if ('\n' == *c) {
+            fputs("\\n", out);
+        } else {
+            fputc(*c, out);
+        }
+    }
+}
+
+static void write_family_header(FILE* out, const char* name, const char* type, const char* help)
+{
+    fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void write_sample(FILE* out, const char* name, const char* label, const char* extra_labels, double value)
+{
+    fprintf(out, "%s{stage=\"", name);
+    write_label(out, label);
+    fprintf(out, "\"%s} %.15g\n", extra_labels ? extra_labels : "", value);
+}
+
+// render all the stage metrics into reporter->snapshot
+// returns 0 on success, -1 if the report could not be built
+static int render_report(metrics_reporter_t* reporter)
+{
+    plugin_stats_t* stats = (plugin_stats_t*)calloc(reporter->num_stages, sizeof(plugin_stats_t));
+    int* valid = (int*)calloc(reporter->num_stages, sizeof(int));
+    char* text = NULL;
+    size_t text_length = 0;
+    FILE* out = (NULL != stats && NULL != valid) ? open_memstream(&text, &text_length) : NULL;
+    if (NULL == out) {
+        free(stats);
+        free(valid);
+        return -1;
+    }
+
+    unsigned long long now_ns = monotonic_time_ns();
+    double elapsed_sec = (now_ns - reporter->last_report_ns) / 1e9;
+    reporter->last_report_ns = now_ns;
+
+    for (int i = 0; i < reporter->num_stages; i++) {
+        metrics_get_stats_func get_stats = reporter->stages[i].get_stats;
+        valid[i] = (NULL != get_stats && NULL == get_stats(&stats[i]));
+    }
+
+    write_family_header(out, "analyzer_stage_items_processed_total", "counter", "Items transformed by the stage.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_items_processed_total", reporter->stages[i].label, NULL, (double)stats[i].items_processed); }
+    }
+
+    write_family_header(out, "analyzer_stage_items_dropped_total", "counter", "Items lost by a failed transform or rejected by the next stage.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_items_dropped_total", reporter->stages[i].label, NULL, (double)stats[i].items_dropped); }
+    }
+
+    write_family_header(out, "analyzer_stage_throughput_items_per_second", "gauge", "Items per second since the previous report.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (!valid[i]) { continue; }
+        double throughput = 0.0;
+        if (elapsed_sec > 0.0 && stats[i].items_processed >= reporter->stages[i].last_items) {
+            throughput = (stats[i].items_processed - reporter->stages[i].last_items) / elapsed_sec;
+        }
+        reporter->stages[i].last_items = stats[i].items_processed;
+        write_sample(out, "analyzer_stage_throughput_items_per_second", reporter->stages[i].label, NULL, throughput);
+    }
+
+    write_family_header(out, "analyzer_stage_queue_depth", "gauge", "Items waiting in the stage input queue.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_queue_depth", reporter->stages[i].label, NULL, stats[i].queue_depth); }
+    }
+
+    write_family_header(out, "analyzer_stage_queue_capacity", "gauge", "Size of the stage input queue.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_queue_capacity", reporter->stages[i].label, NULL, stats[i].queue_capacity); }
+    }
+
+    write_family_header(out, "analyzer_stage_blocked_seconds_total", "counter", "Time spent waiting for the next stage to accept an output.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_blocked_seconds_total", reporter->stages[i].label, NULL, stats[i].blocked_time_ns / 1e9); }
+    }
+
+    write_family_header(out, "analyzer_stage_cpu_seconds_total", "counter", "CPU time of the stage thread by mode.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (!valid[i]) { continue; }
+        write_sample(out, "analyzer_stage_cpu_seconds_total", reporter->stages[i].label, ",mode=\"user\"", stats[i].user_time_ns / 1e9);
+        write_sample(out, "analyzer_stage_cpu_seconds_total", reporter->stages[i].label, ",mode=\"system\"", stats[i].system_time_ns / 1e9);
+    }
+
+    write_family_header(out, "analyzer_stage_thread_cpu_seconds_total", "counter", "CPU time of the stage from the thread CPU clock.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (valid[i]) { write_sample(out, "analyzer_stage_thread_cpu_seconds_total", reporter->stages[i].label, NULL, stats[i].cpu_time_ns / 1e9); }
+    }
+
+    write_family_header(out, "analyzer_stage_latency_seconds", "histogram", "Time to transform one item, fused stages included.");
+    for (int i = 0; i < reporter->num_stages; i++) {
+        if (!valid[i]) { continue; }
+        unsigned long long cumulative = 0;
+        char bucket_label[64];
+        for (int bucket = 0; bucket < PLUGIN_LATENCY_BUCKETS; bucket++) {
+            cumulative += stats[i].latency_buckets[bucket];
+            unsigned long long bound_ns = plugin_latency_bucket_bound_ns(bucket);
+            if (0 == bound_ns) {
+                snprintf(bucket_label, sizeof(bucket_label), ",le=\"+Inf\"");
+            } else {
+                snprintf(bucket_label, sizeof(bucket_label), ",le=\"%.9g\"", bound_ns / 1e9);
+            }
+            write_sample(out, "analyzer_stage_latency_seconds_bucket", reporter->stages[i].label, bucket_label, (double)cumulative);
+        }
+        write_sample(out, "analyzer_stage_latency_seconds_sum", reporter->stages[i].label, NULL, stats[i].latency_sum_ns / 1e9);
+        write_sample(out, "analyzer_stage_latency_seconds_count", reporter->stages[i].label, NULL, (double)cumulative);
+    }
+
+    fclose(out);
+    free(stats);
+    free(valid);
+
+    free(reporter->snapshot);
+    reporter->snapshot = text;
+    reporter->snapshot_length = text_length;
+    return 0;
+}
+
+// file mode - write a temp file next to the target and rename it over, readers never see half a report
+// socket mode - the snapshot is handed to the clients as they connect
+static void publish_report(metrics_reporter_t* reporter)
+{
+    if (reporter->is_socket || NULL == reporter->snapshot) {
+        return;
+    }
+
+    size_t temp_path_length = strlen(reporter->target_path) + sizeof(".tmp");
+    char* temp_path = (char*)malloc(temp_path_length);
+    if (NULL == temp_path) {
+        return;
+    }
+    snprintf(temp_path, temp_path_length, "%s.tmp", reporter->target_path);
+
+    FILE* report_file = fopen(temp_path, "w");
+    if (NULL == report_file) {
+        fprintf(stderr, "Warning: failed to write metrics to %s\n", temp_path);
+        free(temp_path);
+        return;
+    }
+    int write_failed = (reporter->snapshot_length != fwrite(reporter->snapshot, 1, reporter->snapshot_length, report_file));
+    write_failed |= (0 != fclose(report_file));
+    if (write_failed || 0 != rename(temp_path, reporter->target_path)) {
+        fprintf(stderr, "Warning: failed to write metrics to %s\n", reporter->target_path);
+        unlink(temp_path);
+    }
+    free(temp_path);
+}
+
+static void serve_client(metrics_reporter_t* reporter)
+{
+    int client_fd = accept4(reporter->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (client_fd < 0) {
+        return;
+    }
+
+    struct timeval send_timeout = { METRICS_CLIENT_SEND_TIMEOUT_SEC, 0 };
+    setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    size_t sent = 0;
+    while (NULL != reporter->snapshot && sent < reporter->snapshot_length) {
+        ssize_t sent_now = send(client_fd, reporter->snapshot + sent, reporter->snapshot_length - sent, MSG_NOSIGNAL);
+        if (sent_now <= 0) {
+            break;
+        }
+        sent += (size_t)sent_now;
+    }
+    close(client_fd);
+}
+
+static const char* open_listen_socket(metrics_reporter_t* reporter)
+{
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(reporter->target_path) >= sizeof(address.sun_path)) {
+        return "Metrics socket path too long";
+    }
+    strcpy(address.sun_path, reporter->target_path);
+
+    //a socket left behind by a previous run would fail the bind, anything else we leave alone
+    struct stat existing;
+    if (0 == stat(reporter->target_path, &existing) && S_ISSOCK(existing.st_mode)) {
+        unlink(reporter->target_path);
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        return "Failed to create metrics socket";
+    }
+    if (0 != bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) ||
+        0 != listen(listen_fd, METRICS_LISTEN_BACKLOG)) {
+        close(listen_fd);
+        return "Failed to listen on metrics socket";
+    }
+    reporter->listen_fd = listen_fd;
+    return NULL;
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
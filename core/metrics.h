@@ -0,0 +1,69 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include "../plugins/plugin_stats.h"
+
+/**
+ * Metrics reporter - periodically exports the counters of every stage in the
+ * Prometheus text exposition format, either to a file (replaced atomically with
+ * a rename, for the node_exporter textfile collector) or to a local Unix socket
+ * that hands the latest snapshot to every client that connects.
+ * The counters are read with plugin_get_stats, which only does relaxed atomic
+ * loads, so the stages never wait for the reporter.
+ */
+
+// prefix of a --metrics target that is a Unix socket instead of a file
+#define METRICS_SOCKET_PREFIX "unix:"
+
+// maximum length of a stage label ("rotator#2+flipper")
+#define METRICS_LABEL_LENGTH 256
+
+// stats function of a stage (plugin_get_stats)
+typedef const char* (*metrics_get_stats_func)(plugin_stats_t* stats);
+
+typedef struct
+{
+    char label[METRICS_LABEL_LENGTH];    /* Value of the stage="" label */
+    metrics_get_stats_func get_stats;     /* Source of the counters */
+    unsigned long long last_items;        /* Items at the previous report, for the throughput gauge */
+} metrics_stage_t;
+
+typedef struct
+{
+    metrics_stage_t* stages;
+    int num_stages;
+    char* target_path;       /* File path or socket path (without the prefix) */
+    int is_socket;           /* 1 - serve over a Unix socket, 0 - write a file */
+    int listen_fd;           /* Socket mode listening socket */
+    int wake_pipe[2];        /* Wakes the reporter thread up on stop */
+    int interval_ms;         /* Time between two reports */
+    char* snapshot;          /* Latest rendered report */
+    size_t snapshot_length;
+    unsigned long long last_report_ns; /* Monotonic time of the previous report */
+    pthread_t thread;
+    int thread_started;
+} metrics_reporter_t;
+
+/**
+ * Start the reporter thread
+ * @param reporter Reporter to initialize
+ * @param labels Stage labels, one per stage
+ * @param get_stats Stats functions, one per stage (NULL entries are skipped)
+ * @param num_stages Number of stages
+ * @param target File path, or "unix:<path>" for a Unix socket
+ * @param interval_ms Report interval in milliseconds
+ * @return NULL on success, error message on failure
+ */
+const char* metrics_reporter_start(metrics_reporter_t* reporter, const char* const* labels,
+                                   metrics_get_stats_func* get_stats, int num_stages,
+                                   const char* target, int interval_ms);
+
+/**
+ * Write a last report and stop the reporter thread
+ * Must be called while the stages are still alive (before plugin_fini)
+ * @param reporter Reporter to stop
+ */
+void metrics_reporter_stop(metrics_reporter_t* reporter);
+
+#endif /* METRICS_H */
@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+#include "output_sink.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static void* writer_thread(void* arg);
+static void seal_filling_batch(output_sink_t* sink, int preallocate);
+static void preallocate_ahead(output_sink_t* sink);
+static int write_batch(int fd, const output_batch_t* batch);
+static void release_sink(output_sink_t* sink);
+static size_t release_pages(char* data, size_t length);
+
+const char* output_sink_open(output_sink_t* sink, const char* path, int num_writers)
+{
+    if (NULL == sink || NULL == path || num_writers < 1 || num_writers > OUTPUT_SINK_MAX_WRITERS) {
+        return "Invalid output sink arguments";
+    }
+
+    memset(sink, 0, sizeof(output_sink_t));
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (sink->fd < 0) {
+        return "Failed to create output file";
+    }
+
+    //one batch filling, one in the hands of every writer and as many sealed behind them
+    sink->num_batches = 2 * num_writers + 1;
+    sink->batches = (output_batch_t*)calloc(sink->num_batches, sizeof(output_batch_t));
+    sink->free_batches = (output_batch_t**)calloc(sink->num_batches, sizeof(output_batch_t*));
+    sink->sealed = (output_batch_t**)calloc(sink->num_batches, sizeof(output_batch_t*));
+    sink->writers = (pthread_t*)calloc(num_writers, sizeof(pthread_t));
+    if (NULL == sink->batches || NULL == sink->free_batches || NULL == sink->sealed || NULL == sink->writers) {
+        release_sink(sink);
+        return "Failed to allocate output batches";
+    }
+    for (int i = 0; i < sink->num_batches; i++) {
+        sink->batches[i].data = (char*)malloc(OUTPUT_SINK_BATCH_BYTES);
+        if (NULL == sink->batches[i].data) {
+            release_sink(sink);
+            return "Failed to allocate output batches";
+        }
+        sink->batches[i].capacity = OUTPUT_SINK_BATCH_BYTES;
+        sink->free_batches[sink->num_free++] = &sink->batches[i];
+    }
+
+    pthread_mutex_init(&sink->mutex, NULL);
+    pthread_cond_init(&sink->sealed_cond, NULL);
+    pthread_cond_init(&sink->free_cond, NULL);
+
+    for (int i = 0; i < num_writers; i++) {
+        if (0 != pthread_create(&sink->writers[i], NULL, writer_thread, sink)) {
+            //the ones already running exit as soon as they see the stop
+            output_sink_close(sink);
+            return "Failed to create output writer thread";
+        }
+        char thread_name[16];
+        snprintf(thread_name, sizeof(thread_name), "output/%d", i);
+        pthread_setname_np(sink->writers[i], thread_name);
+        sink->num_writers++;
+    }
+    return NULL;
+}
+
+const char* output_sink_append(output_sink_t* sink, const char* line, size_t length)
+{
+    if (NULL == sink || NULL == sink->batches || NULL == line) {
+        return "Output sink not open";
+    }
+
+    pthread_mutex_lock(&sink->mutex);
+    if (NULL != sink->filling && sink->filling->length + length + 1 > sink->filling->capacity) {
+        seal_filling_batch(sink, 1);
+    }
+    while (NULL == sink->filling && 0 == sink->num_free && 0 == sink->write_errno) {
+        pthread_cond_wait(&sink->free_cond, &sink->mutex);
+    }
+    if (0 != sink->write_errno) {
+        pthread_mutex_unlock(&sink->mutex);
+        return "Failed to write output file";
+    }
+    if (NULL == sink->filling) {
+        sink->filling = sink->free_batches[--sink->num_free];
+    }
+
+    output_batch_t* batch = sink->filling;
+    if (length + 1 > batch->capacity) {
+        //only an empty batch gets here, the line is longer than a whole batch
+        char* grown = (char*)realloc(batch->data, length + 1);
+        if (NULL == grown) {
+            pthread_mutex_unlock(&sink->mutex);
+            return "Failed to allocate output batch";
+        }
+        batch->data = grown;
+        batch->capacity = length + 1;
+    }
+    memcpy(batch->data + batch->length, line, length);
+    batch->data[batch->length + length] = '\n';
+    batch->length += length + 1;
+    pthread_mutex_unlock(&sink->mutex);
+    return NULL;
+}
+
+const char* output_sink_flush(output_sink_t* sink)
+{
+    if (NULL == sink || NULL == sink->batches) {
+        return "Output sink not open";
+    }
+
+    pthread_mutex_lock(&sink->mutex);
+    if (NULL != sink->filling && sink->filling->length > 0) {
+        seal_filling_batch(sink, 1);
+    }
+    sink->flush_waiting++;
+    while ((sink->num_sealed > 0 || sink->num_writing > 0) && 0 == sink->write_errno) {
+        pthread_cond_wait(&sink->free_cond, &sink->mutex);
+    }
+    sink->flush_waiting--;
+    int write_errno = sink->write_errno;
+    pthread_mutex_unlock(&sink->mutex);
+
+    if (0 != write_errno) {
+        return "Failed to write output file";
+    }
+    if (0 != fdatasync(sink->fd)) {
+        return "Failed to sync output file";
+    }
+    return NULL;
+}
+
+size_t output_sink_trim(output_sink_t* sink, size_t keep_bytes)
+{
+    if (NULL == sink || NULL == sink->free_batches) {
+        return 0;
+    }
+
+    size_t released = 0;
+    size_t keep_batches = (keep_bytes + OUTPUT_SINK_BATCH_BYTES - 1) / OUTPUT_SINK_BATCH_BYTES;
+    pthread_mutex_lock(&sink->mutex);
+    //the free batches are a stack, the ones at the bottom are the last to be taken again
+    for (int i = 0; i + (int)keep_batches < sink->num_free; i++) {
+        released += release_pages(sink->free_batches[i]->data, sink->free_batches[i]->capacity);
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return released;
+}
+
+const char* output_sink_close(output_sink_t* sink)
+{
+    if (NULL == sink || NULL == sink->batches) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&sink->mutex);
+    if (NULL != sink->filling && sink->filling->length > 0) {
+        //the last batch is short and the file is done, no reason to preallocate past it
+        seal_filling_batch(sink, 0);
+    }
+    sink->stopping = 1;
+    pthread_cond_broadcast(&sink->sealed_cond);
+    pthread_mutex_unlock(&sink->mutex);
+
+    for (int i = 0; i < sink->num_writers; i++) {
+        pthread_join(sink->writers[i], NULL);
+    }
+
+    const char* error = NULL;
+    if (0 != sink->write_errno) {
+        error = "Failed to write output file";
+    } else if (0 != ftruncate(sink->fd, (off_t)sink->next_offset)) {
+        //drops the preallocated blocks past the end, a failure would leave garbage at the end
+        error = "Failed to trim output file";
+    }
+    if (0 != close(sink->fd) && NULL == error) {
+        error = "Failed to close output file";
+    }
+    sink->fd = -1;
+
+    pthread_cond_destroy(&sink->free_cond);
+    pthread_cond_destroy(&sink->sealed_cond);
+    pthread_mutex_destroy(&sink->mutex);
+    release_sink(sink);
+    return error;
+}
+
+// the writers take sealed batches in order, but write them concurrently - the offset says where
+static void* writer_thread(void* arg)
+{
+    output_sink_t* sink = (output_sink_t*)arg;
+
+    pthread_mutex_lock(&sink->mutex);
+    while (1) {
+        while (0 == sink->num_sealed && !sink->stopping) {
+            pthread_cond_wait(&sink->sealed_cond, &sink->mutex);
+        }
+        if (0 == sink->num_sealed) {
+            break;
+        }
+        output_batch_t* batch = sink->sealed[sink->sealed_head];
+        sink->sealed_head = (sink->sealed_head + 1) % sink->num_batches;
+        sink->num_sealed--;
+        sink->num_writing++;
+        pthread_mutex_unlock(&sink->mutex);
+
+        int write_result = write_batch(sink->fd, batch);
+
+        pthread_mutex_lock(&sink->mutex);
+        if (0 != write_result) {
+            if (0 == sink->write_errno) {
+                sink->write_errno = write_result;
+            }
+        } else {
+            sink->bytes_written += batch->length;
+            sink->batches_written++;
+        }
+        batch->length = 0;
+        sink->num_writing--;
+        sink->free_batches[sink->num_free++] = batch;
+        pthread_cond_signal(&sink->free_cond);
+        if (0 != sink->write_errno || sink->flush_waiting > 0) {
+            //an appender waiting for a batch must see the failure, a flush must not miss the signal
+            pthread_cond_broadcast(&sink->free_cond);
+        }
+    }
+    pthread_mutex_unlock(&sink->mutex);
+    return NULL;
+}
+
+// called with the mutex held - the prefix sum fixes where the batch goes in the file
+static void seal_filling_batch(output_sink_t* sink, int preallocate)
+{
+    output_batch_t* batch = sink->filling;
+    sink->filling = NULL;
+    batch->offset = sink->next_offset;
+    sink->next_offset += batch->length;
+    if (preallocate) {
+        preallocate_ahead(sink);
+    }
+
+    sink->sealed[(sink->sealed_head + sink->num_sealed) % sink->num_batches] = batch;
+    sink->num_sealed++;
+    pthread_cond_signal(&sink->sealed_cond);
+}
+
+// called with the mutex held
+static void preallocate_ahead(output_sink_t* sink)
+{
+    if (sink->preallocate_failed || sink->next_offset <= sink->preallocated) {
+        return;
+    }
+
+    //grow by what was written so far, a short output does not reserve 64MB it never uses
+    unsigned long long step = sink->next_offset;
+    if (step > OUTPUT_SINK_MAX_PREALLOCATE_BYTES) {
+        step = OUTPUT_SINK_MAX_PREALLOCATE_BYTES;
+    }
+    unsigned long long end = sink->next_offset + step;
+    //only a hint - a file system without it (or a full disk) shows up in pwrite if at all
+    if (0 != fallocate(sink->fd, FALLOC_FL_KEEP_SIZE, (off_t)sink->preallocated, (off_t)(end - sink->preallocated))) {
+        sink->preallocate_failed = 1;
+        return;
+    }
+    sink->preallocated = end;
+}
+
+// returns 0 on success, errno on failure
+static int write_batch(int fd, const output_batch_t* batch)
+{
+    size_t done = 0;
+    while (done < batch->length) {
+        ssize_t written = pwrite(fd, batch->data + done, batch->length - done, (off_t)(batch->offset + done));
+        if (written < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return errno;
+        }
+        done += (size_t)written;
+    }
+    return 0;
+}
+
+static void release_sink(output_sink_t* sink)
+{
+    if (NULL != sink->batches) {
+        for (int i = 0; i < sink->num_batches; i++) {
+            free(sink->batches[i].data);
+        }
+    }
+    free(sink->batches);
+    free(sink->free_batches);
+    free(sink->sealed);
+    free(sink->writers);
+    if (sink->fd >= 0) {
+        close(sink->fd);
+    }
+    sink->batches = NULL;
+    sink->free_batches = NULL;
+    sink->sealed = NULL;
+    sink->writers = NULL;
+    sink->fd = -1;
+}
+
+// MADV_DONTNEED the whole pages inside a buffer, returns how many of them were resident
+static size_t release_pages(char* data, size_t length)
+{
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)data + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    uintptr_t last = ((uintptr_t)data + length) & ~(uintptr_t)(page_size - 1);
+    if (last <= first) {
+        return 0;
+    }
+
+    size_t num_pages = (last - first) / page_size;
+    unsigned char* residency = (unsigned char*)malloc(num_pages);
+    if (NULL == residency) {
+        return 0;
+    }
+    size_t resident = 0;
+    if (0 == mincore((void*)first, last - first, residency)) {
+        for (size_t page = 0; page < num_pages; page++) {
+            resident += (residency[page] & 1) ? page_size : 0;
+        }
+    }
+    free(residency);
+
+    if (0 == resident || 0 != madvise((void*)first, last - first, MADV_DONTNEED)) {
+        return 0;
+    }
+    return resident;
+}
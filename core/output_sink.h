@@ -0,0 +1,114 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * Ordered parallel file output - the lines of the last stage go to a file,
+ * one per line, in the order they were appended.
+ *
+ * Lines are packed into batches. When a batch is sealed it gets its file offset
+ * from a running prefix sum of the batch lengths, so its place in the file is
+ * fixed at that moment and any writer thread may pwrite it, concurrently with
+ * the others and in any order, without changing a single byte of the result.
+ * The file is preallocated ahead of the writes (fallocate, without changing its
+ * size) so the concurrent writes do not serialize on extending it.
+ *
+ * A batch goes to the writers once it is full, the last one at close, or every
+ * batch at once with output_sink_flush, which also syncs the file.
+ *
+ * With one writer the file is written batch after batch - the serial mode the
+ * parallel one is byte-identical to.
+ */
+
+// lines are packed into batches of this size (a longer line gets a batch of its own)
+#define OUTPUT_SINK_BATCH_BYTES (256 * 1024)
+
+// the preallocation grows with the file (a step as large as what was written), up to this per step
+#define OUTPUT_SINK_MAX_PREALLOCATE_BYTES (64ULL * 1024 * 1024)
+
+// largest number of writer threads
+#define OUTPUT_SINK_MAX_WRITERS 64
+
+typedef struct
+{
+    char* data;
+    size_t length;                      /* Bytes used */
+    size_t capacity;                    /* Bytes allocated, OUTPUT_SINK_BATCH_BYTES unless a long line grew it */
+    unsigned long long offset;          /* File offset, assigned when the batch is sealed */
+} output_batch_t;
+
+typedef struct
+{
+    int fd;
+    output_batch_t* batches;            /* All the batches, each one is free, filling, sealed or being written */
+    int num_batches;
+    output_batch_t** free_batches;      /* Stack of free batches */
+    int num_free;
+    output_batch_t** sealed;            /* FIFO of sealed batches waiting for a writer */
+    int sealed_head;
+    int num_sealed;
+    int num_writing;                    /* Batches a writer took and did not hand back yet */
+    int flush_waiting;                  /* output_sink_flush waits for the writers to finish */
+    output_batch_t* filling;            /* Batch the appends go to, NULL - take a free one first */
+    unsigned long long next_offset;     /* Prefix sum - file offset of the next sealed batch */
+    unsigned long long preallocated;    /* The file is preallocated up to here */
+    int preallocate_failed;             /* The file system does not preallocate, stop trying */
+    int write_errno;                    /* First failed write, 0 - none */
+    unsigned long long bytes_written;
+    unsigned long long batches_written;
+    int stopping;                       /* output_sink_close was called, the writers exit when idle */
+    pthread_mutex_t mutex;              /* Protects all of the above */
+    pthread_cond_t sealed_cond;         /* A batch was sealed (or the sink is stopping) */
+    pthread_cond_t free_cond;           /* A batch was written and is free again */
+    pthread_t* writers;
+    int num_writers;
+} output_sink_t;
+
+/**
+ * Create (or truncate) the output file and start the writer threads
+ * @param sink Sink to initialize
+ * @param path Output file path
+ * @param num_writers Number of writer threads, 1 - serial
+ * @return NULL on success, error message on failure
+ */
+const char* output_sink_open(output_sink_t* sink, const char* path, int num_writers);
+
+/**
+ * Append a line, a '\n' is added. Blocks while every batch is waiting for a writer.
+ * Thread safe, the lines keep the order in which the calls took the sink lock
+ * @param sink Open sink
+ * @param line Line content (copied)
+ * @param length Line length in bytes
+ * @return NULL on success, error message if a write already failed
+ */
+const char* output_sink_append(output_sink_t* sink, const char* line, size_t length);
+
+/**
+ * Seal the filling batch, wait until every sealed batch is written and fdatasync the file,
+ * so what was appended before the call survives a crash. Meant for an idle sink, appends
+ * that keep coming meanwhile make it wait for them as well
+ * @param sink Open sink
+ * @return NULL on success, error message if a write or the sync failed
+ */
+const char* output_sink_flush(output_sink_t* sink);
+
+/**
+ * Return the pages of the idle batches to the OS, except the batches that hold the
+ * first keep_bytes (the ones the next appends take). The batches stay allocated and
+ * fault back in zeroed. Thread safe, meant for a sink that has been idle for a while
+ * @param sink Open sink
+ * @param keep_bytes Batch bytes kept resident (rounded up to whole batches)
+ * @return Resident bytes released
+ */
+size_t output_sink_trim(output_sink_t* sink, size_t keep_bytes);
+
+/**
+ * Write what is left, stop the writers, trim the preallocation and close the file
+ * @param sink Sink to close
+ * @return NULL on success, error message if any write failed (the file is incomplete)
+ */
+const char* output_sink_close(output_sink_t* sink);
+
+#endif /* OUTPUT_SINK_H */
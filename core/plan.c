@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include "plan.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* parse_directive(pipeline_plan_t* plan, char* line, int line_number, const stage_settings_t* defaults);
+static const char* parse_stage_setting(stage_settings_t* settings, const char* key, const char* value);
+static int parse_count(const char* text, int min_value);
+static void explain_stage(FILE* stream, const plan_run_t* run, const plan_plugin_t* plugins, int num_plugins, int head_index);
+static void format_stage_label(const plan_plugin_t* plugins, int num_plugins, int head_index, char* label, size_t label_size);
+
+const char* plan_load(pipeline_plan_t* plan, const char* path, const stage_settings_t* defaults)
+{
+    if (NULL == plan || NULL == path || NULL == defaults) {
+        return "Invalid plan arguments";
+    }
+
+    memset(plan, 0, sizeof(pipeline_plan_t));
+    plan->credits = -1;
+    FILE* file = fopen(path, "r");
+    if (NULL == file) {
+        return "Failed to open plan file";
+    }
+
+    char line[PLAN_MAX_LINE_LENGTH];
+    int line_number = 0;
+    const char* error = NULL;
+    while (NULL == error && NULL != fgets(line, sizeof(line), file)) {
+        line_number++;
+        size_t length = strlen(line);
+        if (length == sizeof(line) - 1 && '\n' != line[length - 1] && !feof(file)) {
+            error = "Line too long";
+        } else {
+            error = parse_directive(plan, line, line_number, defaults);
+        }
+        if (NULL != error) {
+            plan->error_line = line_number;
+        }
+    }
+    fclose(file);
+    if (NULL != error) {
+        return error;
+    }
+
+    if (0 == plan->num_stages) {
+        return "Plan has no stages";
+    }
+    //a stage without its own queue size takes the plan default, there is no positional one with a plan
+    for (int i = 0; i < plan->num_stages; i++) {
+        if (0 == plan->stages[i].settings.queue_size) {
+            if (0 == plan->queue_size) {
+                plan->error_line = plan->stages[i].line;
+                return "Stage without a queue size and no queue directive";
+            }
+            plan->stages[i].settings.queue_size = plan->queue_size;
+        }
+    }
+    return NULL;
+}
+
+void plan_free(pipeline_plan_t* plan)
+{
+    if (NULL == plan) {
+        return;
+    }
+    for (int i = 0; i < plan->num_stages; i++) {
+        free(plan->stages[i].plugins);
+    }
+    free(plan->stages);
+    plan->stages = NULL;
+    plan->num_stages = 0;
+}
+
+int plan_read(pipeline_plan_t* plan, const char* path, const stage_settings_t* defaults, FILE* error_stream)
+{
+    const char* error = plan_load(plan, path, defaults);
+    if (NULL == error) {
+        return 0;
+    }
+    if (plan->error_line > 0) {
+        fprintf(error_stream, "Error: %s:%d: %s\n", path, plan->error_line, error);
+    } else {
+        fprintf(error_stream, "Error: %s: %s\n", path, error);
+    }
+    plan_free(plan);
+    return -1;
+}
+
+const stage_settings_t* plan_stage_settings(const pipeline_plan_t* plan, int stage_index,
+                                            const stage_settings_t* command_line)
+{
+    if (NULL == plan || stage_index < 0 || stage_index >= plan->num_stages) {
+        return command_line;
+    }
+    return &plan->stages[stage_index].settings;
+}
+
+void plan_explain(FILE* stream, const plan_run_t* run, const plan_plugin_t* plugins, int num_plugins)
+{
+    int num_stages = 0;
+    for (int i = 0; i < num_plugins; i++) {
+        num_stages += !plugins[i].fused_into_previous;
+    }
+
+    fprintf(stream, "Execution plan: %d stages", num_stages);
+    if (run->executor_workers > 0) {
+        fprintf(stream, " on %d executor workers\n", run->executor_workers);
+    } else {
+        fprintf(stream, ", one thread per stage\n");
+    }
+    fprintf(stream, "  flow control  %s\n", run->credit_flow_control
+            ? "credits (a stage takes an item only with room for its output)"
+            : "blocking put into the next queue (--no-credits)");
+    if (NULL != run->replay_path) {
+        fprintf(stream, "  input         trace %s\n", run->replay_path);
+    } else {
+        fprintf(stream, "  input         stdin%s%s\n", (NULL != run->record_path) ? ", recorded to " : "",
+                (NULL != run->record_path) ? run->record_path : "");
+    }
+    if (NULL != run->output_path) {
+        fprintf(stream, "  output        %s, %d writer%s\n", run->output_path, run->output_writers,
+                (1 == run->output_writers) ? " (serial)" : "s in parallel");
+    }
+
+    for (int head_index = 0; head_index < num_plugins; head_index++) {
+        if (!plugins[head_index].fused_into_previous) {
+            explain_stage(stream, run, plugins, num_plugins, head_index);
+        }
+    }
+}
+
+static const char* parse_directive(pipeline_plan_t* plan, char* line, int line_number, const stage_settings_t* defaults)
+{
+    char* comment = strchr(line, '#');
+    if (NULL != comment) {
+        *comment = '\0';
+    }
+
+    char* save_ptr = NULL;
+    const char* directive = strtok_r(line, " \t\r\n", &save_ptr);
+    if (NULL == directive) {
+        return NULL;
+    }
+    const char* argument = strtok_r(NULL, " \t\r\n", &save_ptr);
+    if (NULL == argument) {
+        return "Directive without a value";
+    }
+
+    if (0 == strcmp(directive, "queue") || 0 == strcmp(directive, "workers") || 0 == strcmp(directive, "credits")) {
+        if (NULL != strtok_r(NULL, " \t\r\n", &save_ptr)) {
+            return "Unexpected text after the value";
+        }
+        if (0 == strcmp(directive, "credits")) {
+            if (0 != strcmp(argument, "on") && 0 != strcmp(argument, "off")) {
+                return "credits must be on or off";
+            }
+            plan->credits = (0 == strcmp(argument, "on"));
+            return NULL;
+        }
+        int value = parse_count(argument, 1);
+        if (value < 0) {
+            return "Invalid number";
+        }
+        if ('q' == directive[0]) {
+            plan->queue_size = value;
+        } else {
+            plan->workers = value;
+        }
+        return NULL;
+    }
+
+    if (0 != strcmp(directive, "stage")) {
+        return "Unknown directive";
+    }
+
+    plan_stage_t* grown = (plan_stage_t*)realloc(plan->stages, (plan->num_stages + 1) * sizeof(plan_stage_t));
+    if (NULL == grown) {
+        return "Failed to allocate plan stage";
+    }
+    plan->stages = grown;
+    plan_stage_t* stage = &plan->stages[plan->num_stages];
+    stage->plugins = strdup(argument);
+    if (NULL == stage->plugins) {
+        return "Failed to allocate plan stage";
+    }
+    stage->settings = *defaults;
+    stage->settings.queue_size = 0;
+    stage->line = line_number;
+    plan->num_stages++;
+
+    const char* setting;
+    while (NULL != (setting = strtok_r(NULL, " \t\r\n", &save_ptr))) {
+        const char* equals = strchr(setting, '=');
+        if (NULL == equals) {
+            return "Stage setting is not key=value";
+        }
+        char key[32];
+        size_t key_length = (size_t)(equals - setting);
+        if (key_length >= sizeof(key)) {
+            return "Unknown stage setting";
+        }
+        memcpy(key, setting, key_length);
+        key[key_length] = '\0';
+
+        const char* error = parse_stage_setting(&stage->settings, key, equals + 1);
+        if (NULL != error) {
+            return error;
+        }
+    }
+    return NULL;
+}
+
+static const char* parse_stage_setting(stage_settings_t* settings, const char* key, const char* value)
+{
+    if (0 == strcmp(key, "order")) {
+        if (0 != strcmp(value, "strict") && 0 != strcmp(value, "relaxed")) {
+            return "order must be strict or relaxed";
+        }
+        settings->relaxed_order = (0 == strcmp(value, "relaxed"));
+        return NULL;
+    }
+    if (0 == strcmp(key, "overflow")) {
+        if (0 != strcmp(value, "block") && 0 != strcmp(value, "drop")) {
+            return "overflow must be block or drop";
+        }
+        settings->overflow_drop = (0 == strcmp(value, "drop"));
+        return NULL;
+    }
+
+    //the rest are numbers, CPUs count from 0
+    int* field = NULL;
+    int min_value = 1;
+    if (0 == strcmp(key, "queue")) {
+        field = &settings->queue_size;
+    } else if (0 == strcmp(key, "partitions")) {
+        field = &settings->partitions;
+    } else if (0 == strcmp(key, "ring_bytes")) {
+        field = &settings->ring_bytes;
+    } else if (0 == strcmp(key, "compress_after")) {
+        field = &settings->compress_after;
+    } else if (0 == strcmp(key, "stack_kb")) {
+        field = &settings->stack_size_kb;
+    } else if (0 == strcmp(key, "batch")) {
+        field = &settings->credit_batch;
+    } else if (0 == strcmp(key, "cpu")) {
+        field = &settings->cpu;
+        min_value = 0;
+    } else {
+        return "Unknown stage setting";
+    }
+
+    int parsed = parse_count(value, min_value);
+    if (parsed < 0) {
+        return "Invalid stage setting value";
+    }
+    *field = parsed;
+    return NULL;
+}
+
+// decimal number not smaller than min_value, -1 if it is not one
+static int parse_count(const char* text, int min_value)
+{
+    if ('\0' == *text) {
+        return -1;
+    }
+    long value = 0;
+    for (const char* c = text; '\0' != *c; c++) {
+        if (*c < '0' || *c > '9' || value > INT_MAX / 10) {
+            return -1;
+        }
+        value = value * 10 + (*c - '0');
+    }
+    return (value >= min_value && value <= INT_MAX) ? (int)value : -1;
+}
+
+// one stage - the head at head_index and the plugins fused into it
+static void explain_stage(FILE* stream, const plan_run_t* run, const plan_plugin_t* plugins, int num_plugins, int head_index)
+{
+    const plan_plugin_t* head = &plugins[head_index];
+    const stage_settings_t* settings = &head->settings;
+    int executor_mode = (run->executor_workers > 0);
+
+    int next_index = head_index + 1;
+    while (next_index < num_plugins && plugins[next_index].fused_into_previous) {
+        next_index++;
+    }
+
+    char stage_label[PLAN_MAX_LINE_LENGTH];
+    format_stage_label(plugins, num_plugins, head_index, stage_label, sizeof(stage_label));
+    fprintf(stream, "stage %s\n", stage_label);
+
+    fprintf(stream, "  queue         %d slots", settings->queue_size);
+    if (settings->ring_bytes > 0) {
+        fprintf(stream, ", strings inline in a %d byte ring", settings->ring_bytes);
+    }
+    if (settings->compress_after > 0) {
+        fprintf(stream, ", items past %d compressed in blocks", settings->compress_after);
+    }
+    if (settings->credit_batch > 0) {
+        fprintf(stream, ", credits returned in batches of %d", settings->credit_batch);
+    }
+    fprintf(stream, "\n");
+
+    if (executor_mode) {
+        fprintf(stream, "  runs on       the executor workers, stepped by one worker at a time\n");
+    } else {
+        fprintf(stream, "  runs on       its own thread");
+        if (settings->cpu >= 0) {
+            fprintf(stream, ", pinned to cpu %d", settings->cpu);
+        }
+        if (settings->stack_size_kb > 0) {
+            fprintf(stream, ", %dKB stack", settings->stack_size_kb);
+        }
+        fprintf(stream, "\n");
+    }
+
+    //stateless plugins ignore the partitions, only a key partitioned one splits its state
+    if (settings->partitions > 1 && head->can_partition) {
+        fprintf(stream, "  partitions    %d shards if key partitioned, %s\n", settings->partitions,
+                settings->relaxed_order ? "relaxed order (each shard forwards when done)" : "input order kept (reorder buffer)");
+    }
+
+    for (int fused_index = head_index + 1; fused_index < next_index; fused_index++) {
+        fprintf(stream, "  fused         %s#%d runs in place on the same buffer, no queue or thread of its own\n",
+                plugins[fused_index].name, plugins[fused_index].instance_id);
+    }
+
+    if (NULL != head->params) {
+        fprintf(stream, "  parameters    %s (plugin_init_ex)\n", head->params);
+    }
+
+    fprintf(stream, "  overflow      %s\n", settings->overflow_drop ? "drop new items while the queue is full"
+                                                                 : "block the producer while the queue is full");
+
+    if (next_index < num_plugins) {
+        const plan_plugin_t* next = &plugins[next_index];
+        const char* forwarding = "blocking put";
+        if (!next->settings.overflow_drop && run->credit_flow_control && head->attaches_credits && next->grants_credits) {
+            forwarding = "credits";
+        } else if (!next->settings.overflow_drop && executor_mode && head->attaches_offers && next->accepts_offers) {
+            forwarding = "non blocking offer";
+        } else if (next->settings.overflow_drop) {
+            forwarding = "put, dropped there when full";
+        }
+        fprintf(stream, "  forwards to   %s#%d (%s)\n", next->name, next->instance_id, forwarding);
+    } else {
+        fprintf(stream, "  forwards to   %s\n", (NULL != run->output_path) ? "the output file" : "nothing (last stage)");
+    }
+
+    //what the exports of the plugins let the stage skip
+    fprintf(stream, "  fast paths   ");
+    int num_fast_paths = 0;
+    if (head->transforms_inplace) {
+        fprintf(stream, "%s in-place transform (no allocation per item)", num_fast_paths++ ? "," : "");
+        if (settings->ring_bytes > 0) {
+            fprintf(stream, ", transformed inside the ring (no copy out of the queue)");
+        }
+    }
+    if (next_index - head_index > 1) {
+        fprintf(stream, "%s fused in-place chain (no queue hop)", num_fast_paths++ ? "," : "");
+    }
+    for (int i = head_index; i < next_index; i++) {
+        fprintf(stream, "%s %s build of %s", num_fast_paths++ ? "," : "", plugins[i].isa_level, plugins[i].name);
+    }
+    fprintf(stream, "\n");
+}
+
+// "<plugin>#<instance>" followed by the plugins fused into the stage ("rotator#2+flipper")
+static void format_stage_label(const plan_plugin_t* plugins, int num_plugins, int head_index, char* label, size_t label_size)
+{
+    int label_length = snprintf(label, label_size, "%s#%d", plugins[head_index].name, plugins[head_index].instance_id);
+    for (int i = head_index + 1; i < num_plugins && plugins[i].fused_into_previous; i++) {
+        if (label_length < (int)label_size) {
+            label_length += snprintf(label + label_length, label_size - label_length, "+%s", plugins[i].name);
+        }
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <stdio.h>
+
+/**
+ * Pipeline plan files - the chain and its performance settings written down
+ * instead of spread over argv, so a configuration can be reviewed and kept.
+ *
+ * One directive per line, '#' starts a comment:
+ *   queue N                 default queue size of the stages
+ *   workers N               run the stages on N executor workers (no directive - one thread per stage)
+ *   credits on|off          credit flow control between the stages (default on)
+ *   stage a+b [key=value]   next stage of the chain, "a+b" fuses b into a like on the command line,
+ *                           "a:key=value,..." passes init parameters to a (plugin_init_ex) like there too
+ *
+ * Stage settings:
+ *   queue=N                 slots of the stage queue
+ *   partitions=N            shards of a key partitioned (stateful) stage
+ *   order=strict|relaxed    partitioned stages - keep the input order or forward as soon as done
+ *   ring_bytes=N            store the queued items inline in a byte ring of N bytes
+ *   compress_after=N        compress the queued items past the first N in blocks
+ *   stack_kb=N              stack size of the stage thread
+ *   batch=N                 credits handed back to the previous stage at once
+ *   overflow=block|drop     full queue - block the previous stage, or drop the new item
+ *   cpu=N                   pin the stage thread to CPU N
+ *
+ * Once the chain is resolved (command line or plan, calibration) plan_explain prints
+ * what would run - the stages, their queues, threads, fusion and forwarding (--explain).
+ */
+
+// longest line of a plan file
+#define PLAN_MAX_LINE_LENGTH 1024
+
+// settings of one stage, the same structure holds the command line values every stage starts from
+typedef struct
+{
+    int queue_size;      /* Slots of the stage queue, 0 - the plan default */
+    int partitions;      /* Shards of a key partitioned stage, 0 - one */
+    int relaxed_order;   /* Partitioned stages forward results as they finish */
+    int ring_bytes;      /* Byte ring size, 0 - one allocation per item */
+    int compress_after;  /* Hot depth of a compressed backlog, 0 - not compressed */
+    int stack_size_kb;   /* Stage thread stack, 0 - pthread default */
+    int credit_batch;    /* Credits returned at once, 0 - derived from the queue size */
+    int overflow_drop;   /* A full queue drops new items instead of blocking the previous stage */
+    int cpu;             /* CPU the stage thread is pinned to, -1 - not pinned */
+} stage_settings_t;
+
+typedef struct
+{
+    char* plugins;              /* "uppercaser+rotator" */
+    stage_settings_t settings;
+    int line;                   /* Line of the stage directive, for the messages */
+} plan_stage_t;
+
+typedef struct
+{
+    int queue_size;             /* queue directive, 0 - none */
+    int workers;                /* workers directive, 0 - none */
+    int credits;                /* credits directive, -1 - none */
+    plan_stage_t* stages;
+    int num_stages;
+    int error_line;             /* Line plan_load failed on, 0 - not a line (e.g. the file) */
+} pipeline_plan_t;
+
+// a plugin of the resolved chain, what --explain tells about it
+typedef struct
+{
+    const char* name;
+    int instance_id;
+    int fused_into_previous;    /* Runs inside the stage before it */
+    const char* params;         /* Stage parameters, NULL - none */
+    const char* isa_level;      /* Build that was loaded */
+    stage_settings_t settings;  /* Settings of its stage, read from the stage head */
+    int transforms_inplace;     /* Exports plugin_transform_inplace */
+    int can_partition;          /* Exports plugin_set_partitions */
+    int attaches_credits;       /* Exports plugin_attach_credits */
+    int grants_credits;         /* Exports plugin_take_credits */
+    int attaches_offers;        /* Exports plugin_attach_offer */
+    int accepts_offers;         /* Exports plugin_offer_work */
+} plan_plugin_t;
+
+// how the whole pipeline runs
+typedef struct
+{
+    int executor_workers;       /* 0 - one thread per stage */
+    int credit_flow_control;    /* Credits between the stages, 0 - blocking put (--no-credits) */
+    const char* replay_path;    /* Input trace, NULL - stdin */
+    const char* record_path;    /* Trace stdin is recorded to, NULL - none */
+    const char* output_path;    /* Output file, NULL - the last stage prints */
+    int output_writers;
+} plan_run_t;
+
+/**
+ * Read a plan file
+ * @param plan Plan to fill, freed with plan_free also after a failure
+ * @param path Plan file path
+ * @param defaults Settings every stage starts from (the command line options)
+ * @return NULL on success, error message on failure (plan->error_line tells where)
+ */
+const char* plan_load(pipeline_plan_t* plan, const char* path, const stage_settings_t* defaults);
+
+/**
+ * Read a plan file and print why it failed - "Error: <path>:<line>: <message>"
+ * @param plan Plan to fill, freed again after a failure
+ * @param path Plan file path
+ * @param defaults Settings every stage starts from (the command line options)
+ * @param error_stream Where the message goes
+ * @return 0 on success, -1 on failure
+ */
+int plan_read(pipeline_plan_t* plan, const char* path, const stage_settings_t* defaults, FILE* error_stream);
+
+/**
+ * Settings of a stage of the chain
+ * @param plan Plan file, NULL - the chain came from the command line
+ * @param stage_index Stage of the chain
+ * @param command_line Settings of every stage without a plan
+ * @return The settings of the plan stage, command_line without a plan (or past its stages)
+ */
+const stage_settings_t* plan_stage_settings(const pipeline_plan_t* plan, int stage_index,
+                                            const stage_settings_t* command_line);
+
+/**
+ * Print the execution plan (--explain) - the pipeline, then every stage with its queue,
+ * thread, partitions, fused plugins, parameters, forwarding and fast paths
+ * @param stream Where the plan goes
+ * @param run How the pipeline runs
+ * @param plugins Plugins of the chain
+ * @param num_plugins Number of plugins
+ */
+void plan_explain(FILE* stream, const plan_run_t* run, const plan_plugin_t* plugins, int num_plugins);
+
+/**
+ * Release the stages of a plan
+ * @param plan Plan to free
+ */
+void plan_free(pipeline_plan_t* plan);
+
+#endif /* PLAN_H */
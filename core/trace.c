@@ -0,0 +1,146 @@
+#include "trace.h"
+#include <string.h>
+
+// a 64 bit value takes at most 10 LEB128 bytes
+#define TRACE_MAX_VARINT_BYTES 10
+
+static int write_varint(FILE* file, unsigned long long value);
+static int read_varint(FILE* file, unsigned long long* value);
+
+const char* trace_writer_open(trace_writer_t* writer, const char* path)
+{
+    if (NULL == writer || NULL == path) {
+        return "Invalid trace writer arguments";
+    }
+
+    memset(writer, 0, sizeof(trace_writer_t));
+    writer->file = fopen(path, "wb");
+    if (NULL == writer->file) {
+        return "Failed to create trace file";
+    }
+    if (TRACE_MAGIC_LENGTH != fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LENGTH, writer->file)) {
+        fclose(writer->file);
+        writer->file = NULL;
+        return "Failed to write trace header";
+    }
+    return NULL;
+}
+
+const char* trace_writer_append(trace_writer_t* writer, unsigned long long timestamp_ns, const char* line, size_t length)
+{
+    if (NULL == writer || NULL == writer->file || NULL == line) {
+        return "Trace writer not open";
+    }
+
+    //deltas keep the varints short, a clock going backwards is recorded as no delay
+    unsigned long long delta_ns = (timestamp_ns > writer->last_timestamp_ns) ? timestamp_ns - writer->last_timestamp_ns : 0;
+    if (0 != write_varint(writer->file, delta_ns) || 0 != write_varint(writer->file, length) ||
+        length != fwrite(line, 1, length, writer->file)) {
+        return "Failed to write trace record";
+    }
+
+    writer->last_timestamp_ns += delta_ns;
+    writer->records++;
+    return NULL;
+}
+
+const char* trace_writer_close(trace_writer_t* writer)
+{
+    if (NULL == writer || NULL == writer->file) {
+        return NULL;
+    }
+
+    int close_result = fclose(writer->file);
+    writer->file = NULL;
+    return (0 == close_result) ? NULL : "Failed to close trace file";
+}
+
+const char* trace_reader_open(trace_reader_t* reader, const char* path)
+{
+    if (NULL == reader || NULL == path) {
+        return "Invalid trace reader arguments";
+    }
+
+    memset(reader, 0, sizeof(trace_reader_t));
+    reader->file = fopen(path, "rb");
+    if (NULL == reader->file) {
+        return "Failed to open trace file";
+    }
+
+    char magic[TRACE_MAGIC_LENGTH];
+    if (TRACE_MAGIC_LENGTH != fread(magic, 1, TRACE_MAGIC_LENGTH, reader->file) ||
+        0 != memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LENGTH)) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return "Not a trace file";
+    }
+    return NULL;
+}
+
+int trace_reader_next(trace_reader_t* reader, unsigned long long* timestamp_ns, char* line, size_t line_size)
+{
+    if (NULL == reader || NULL == reader->file || NULL == timestamp_ns || NULL == line || 0 == line_size) {
+        return -1;
+    }
+
+    //a clean end of file is only allowed between two records
+    int first_byte = fgetc(reader->file);
+    if (EOF == first_byte) {
+        return 0;
+    }
+    ungetc(first_byte, reader->file);
+
+    unsigned long long delta_ns;
+    unsigned long long length;
+    if (0 != read_varint(reader->file, &delta_ns) || 0 != read_varint(reader->file, &length)) {
+        return -1;
+    }
+    if (length >= line_size || length != fread(line, 1, (size_t)length, reader->file)) {
+        return -1;
+    }
+    line[length] = '\0';
+
+    reader->timestamp_ns += delta_ns;
+    reader->records++;
+    *timestamp_ns = reader->timestamp_ns;
+    return 1;
+}
+
+void trace_reader_close(trace_reader_t* reader)
+{
+    if (NULL == reader || NULL == reader->file) {
+        return;
+    }
+    fclose(reader->file);
+    reader->file = NULL;
+}
+
+// LEB128 - 7 bits per byte, low bits first, the high bit marks that more bytes follow
+static int write_varint(FILE* file, unsigned long long value)
+{
+    unsigned char bytes[TRACE_MAX_VARINT_BYTES];
+    int count = 0;
+    do {
+        unsigned char byte = (unsigned char)(value & 0x7F);
+        value >>= 7;
+        bytes[count++] = byte | (value ? 0x80 : 0);
+    } while (value);
+
+    return ((size_t)count == fwrite(bytes, 1, count, file)) ? 0 : -1;
+}
+
+static int read_varint(FILE* file, unsigned long long* value)
+{
+    *value = 0;
+    for (int i = 0; i < TRACE_MAX_VARINT_BYTES; i++) {
+        int byte = fgetc(file);
+        if (EOF == byte) {
+            return -1;
+        }
+        *value |= (unsigned long long)(byte & 0x7F) << (7 * i);
+        if (0 == (byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
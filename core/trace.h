@@ -0,0 +1,85 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * Input traces - every input line with the time it arrived, so a production
+ * workload (line mix and arrival timing) can be replayed offline.
+ *
+ * File layout: an 8 byte magic ("PLTRACE1") followed by one record per line:
+ *   varint  time since the previous line in ns (since recording start for the first)
+ *   varint  line length in bytes
+ *   bytes   the line, without the '\n'
+ * varints are LEB128 (7 bits per byte, high bit - more bytes follow), so a
+ * short line arriving within a few ms costs 4-6 bytes of overhead.
+ */
+
+#define TRACE_MAGIC "PLTRACE1"
+#define TRACE_MAGIC_LENGTH 8
+
+typedef struct
+{
+    FILE* file;
+    unsigned long long last_timestamp_ns;  /* Timestamp of the previous record */
+    unsigned long long records;            /* Records written so far */
+} trace_writer_t;
+
+typedef struct
+{
+    FILE* file;
+    unsigned long long timestamp_ns;       /* Timestamp of the last record read */
+    unsigned long long records;            /* Records read so far */
+} trace_reader_t;
+
+/**
+ * Create (or truncate) a trace file and write its header
+ * @param writer Writer to initialize
+ * @param path Trace file path
+ * @return NULL on success, error message on failure
+ */
+const char* trace_writer_open(trace_writer_t* writer, const char* path);
+
+/**
+ * Append one line
+ * @param writer Open writer
+ * @param timestamp_ns Arrival time since the recording started, not smaller than the previous one
+ * @param line Line content (no '\n')
+ * @param length Line length in bytes
+ * @return NULL on success, error message on failure
+ */
+const char* trace_writer_append(trace_writer_t* writer, unsigned long long timestamp_ns, const char* line, size_t length);
+
+/**
+ * Flush and close the trace file
+ * @param writer Writer to close
+ * @return NULL on success, error message on failure (the trace may be incomplete)
+ */
+const char* trace_writer_close(trace_writer_t* writer);
+
+/**
+ * Open a trace file and check its header
+ * @param reader Reader to initialize
+ * @param path Trace file path
+ * @return NULL on success, error message on failure
+ */
+const char* trace_reader_open(trace_reader_t* reader, const char* path);
+
+/**
+ * Read the next line
+ * @param reader Open reader
+ * @param timestamp_ns Set to the arrival time of the line since the recording started
+ * @param line Buffer for the line, null terminated
+ * @param line_size Size of the buffer
+ * @return 1 when a line was read, 0 at the end of the trace, -1 on a corrupt or truncated trace
+ */
+int trace_reader_next(trace_reader_t* reader, unsigned long long* timestamp_ns, char* line, size_t line_size);
+
+/**
+ * Close the trace file
+ * @param reader Reader to close
+ */
+void trace_reader_close(trace_reader_t* reader);
+
+#endif /* TRACE_H */
@@ -0,0 +1,198 @@
+#define _GNU_SOURCE
+#include "watchdog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void* watchdog_thread(void* arg);
+static void check_stages(watchdog_t* watchdog);
+static void dump_stage_states(watchdog_t* watchdog, plugin_stats_t* stats, int* valid, unsigned long long now_ns);
+static unsigned long long monotonic_time_ns(void);
+
+const char* watchdog_start(watchdog_t* watchdog, const char* const* labels,
+                           watchdog_get_stats_func* get_stats, int num_stages, int threshold_ms)
+{
+    if (NULL == watchdog || NULL == labels || NULL == get_stats || num_stages <= 0 || threshold_ms <= 0) {
+        return "Invalid watchdog arguments";
+    }
+
+    memset(watchdog, 0, sizeof(watchdog_t));
+    watchdog->stages = (watchdog_stage_t*)calloc(num_stages, sizeof(watchdog_stage_t));
+    if (NULL == watchdog->stages) {
+        return "Failed to allocate watchdog stages";
+    }
+
+    unsigned long long now_ns = monotonic_time_ns();
+    for (int i = 0; i < num_stages; i++) {
+        snprintf(watchdog->stages[i].label, WATCHDOG_LABEL_LENGTH, "%s", labels[i]);
+        watchdog->stages[i].get_stats = get_stats[i];
+        watchdog->stages[i].last_progress_ns = now_ns;
+    }
+    watchdog->num_stages = num_stages;
+    watchdog->threshold_ns = (unsigned long long)threshold_ms * 1000000ULL;
+
+    //timed waits on the monotonic clock, a wall clock jump must not fire or hide a stall
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    int cond_result = pthread_cond_init(&watchdog->stop_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    if (0 != cond_result) {
+        free(watchdog->stages);
+        memset(watchdog, 0, sizeof(watchdog_t));
+        return "Failed to initialize watchdog condition";
+    }
+    pthread_mutex_init(&watchdog->stop_mutex, NULL);
+
+    if (0 != pthread_create(&watchdog->thread, NULL, watchdog_thread, watchdog)) {
+        pthread_cond_destroy(&watchdog->stop_cond);
+        pthread_mutex_destroy(&watchdog->stop_mutex);
+        free(watchdog->stages);
+        memset(watchdog, 0, sizeof(watchdog_t));
+        return "Failed to create watchdog thread";
+    }
+    pthread_setname_np(watchdog->thread, "watchdog");
+    watchdog->thread_started = 1;
+    return NULL;
+}
+
+void watchdog_stop(watchdog_t* watchdog)
+{
+    if (NULL == watchdog || !watchdog->thread_started) {
+        return;
+    }
+
+    pthread_mutex_lock(&watchdog->stop_mutex);
+    watchdog->stop_requested = 1;
+    pthread_cond_signal(&watchdog->stop_cond);
+    pthread_mutex_unlock(&watchdog->stop_mutex);
+    pthread_join(watchdog->thread, NULL);
+
+    pthread_cond_destroy(&watchdog->stop_cond);
+    pthread_mutex_destroy(&watchdog->stop_mutex);
+    free(watchdog->stages);
+    memset(watchdog, 0, sizeof(watchdog_t));
+}
+
+static void* watchdog_thread(void* arg)
+{
+    watchdog_t* watchdog = (watchdog_t*)arg;
+    unsigned long long sample_interval_ns = watchdog->threshold_ns / WATCHDOG_SAMPLES_PER_THRESHOLD;
+
+    pthread_mutex_lock(&watchdog->stop_mutex);
+    while (!watchdog->stop_requested) {
+        struct timespec wake_time;
+        clock_gettime(CLOCK_MONOTONIC, &wake_time);
+        unsigned long long wake_ns = (unsigned long long)wake_time.tv_nsec + sample_interval_ns;
+        wake_time.tv_sec += (time_t)(wake_ns / 1000000000ULL);
+        wake_time.tv_nsec = (long)(wake_ns % 1000000000ULL);
+
+        pthread_cond_timedwait(&watchdog->stop_cond, &watchdog->stop_mutex, &wake_time);
+        if (watchdog->stop_requested) {
+            break;
+        }
+
+        //the stages are sampled without our lock, watchdog_stop only waits for the current round
+        pthread_mutex_unlock(&watchdog->stop_mutex);
+        check_stages(watchdog);
+        pthread_mutex_lock(&watchdog->stop_mutex);
+    }
+    pthread_mutex_unlock(&watchdog->stop_mutex);
+    return NULL;
+}
+
+static void check_stages(watchdog_t* watchdog)
+{
+    plugin_stats_t* stats = (plugin_stats_t*)calloc(watchdog->num_stages, sizeof(plugin_stats_t));
+    int* valid = (int*)calloc(watchdog->num_stages, sizeof(int));
+    if (NULL == stats || NULL == valid) {
+        free(stats);
+        free(valid);
+        return;
+    }
+
+    unsigned long long now_ns = monotonic_time_ns();
+    int new_stall_index = -1;
+    for (int i = 0; i < watchdog->num_stages; i++) {
+        watchdog_stage_t* stage = &watchdog->stages[i];
+        valid[i] = (NULL != stage->get_stats && NULL == stage->get_stats(&stats[i]));
+        if (!valid[i]) {
+            continue;
+        }
+
+        unsigned long long progress = stats[i].items_processed + stats[i].items_dropped;
+        int has_pending_input = (stats[i].queue_depth > 0 || stats[i].item_in_progress) && !stats[i].finished;
+        if (progress != stage->last_progress || !has_pending_input) {
+            //moving, or nothing to do - an idle stage is not stuck
+            stage->last_progress = progress;
+            stage->last_progress_ns = now_ns;
+            stage->stall_reported = 0;
+            continue;
+        }
+
+        if (!stage->stall_reported && now_ns - stage->last_progress_ns >= watchdog->threshold_ns) {
+            stage->stall_reported = 1;
+            watchdog->stalls_reported++;
+            fprintf(stderr, "[WATCHDOG] stage %s made no progress for %llu ms with %d queued item(s)%s\n",
+                    stage->label, (now_ns - stage->last_progress_ns) / 1000000ULL, stats[i].queue_depth,
+                    stats[i].item_in_progress ? " and one in progress" : "");
+            new_stall_index = i;
+        }
+    }
+
+    //one dump per round is enough, it shows every stage
+    if (new_stall_index >= 0) {
+        dump_stage_states(watchdog, stats, valid, now_ns);
+    }
+
+    free(stats);
+    free(valid);
+}
+
+// every stage upstream of a stuck one stalls too once the queues in between fill up,
+// so the stalled stage furthest down the chain is the one to look at
+static void dump_stage_states(watchdog_t* watchdog, plugin_stats_t* stats, int* valid, unsigned long long now_ns)
+{
+    int likely_cause_index = -1;
+    for (int i = 0; i < watchdog->num_stages; i++) {
+        if (valid[i] && watchdog->stages[i].stall_reported) {
+            likely_cause_index = i;
+        }
+    }
+
+    fprintf(stderr, "[WATCHDOG] %-24s %11s %8s %8s %10s %10s %9s %6s %10s\n", "stage", "queue", "waiting", "waiting",
+            "items", "dropped", "blocked", "busy", "idle");
+    fprintf(stderr, "[WATCHDOG] %-24s %11s %8s %8s %10s %10s %9s %6s %10s\n", "", "depth/cap", "cons", "prod",
+            "", "", "ms", "", "ms");
+
+    for (int i = 0; i < watchdog->num_stages; i++) {
+        watchdog_stage_t* stage = &watchdog->stages[i];
+        if (!valid[i]) {
+            fprintf(stderr, "[WATCHDOG] %-24s n/a\n", stage->label);
+            continue;
+        }
+
+        char queue_state[32];
+        snprintf(queue_state, sizeof(queue_state), "%d/%d", stats[i].queue_depth, stats[i].queue_capacity);
+        const char* state = "";
+        if (stats[i].finished) {
+            state = "finished";
+        } else if (i == likely_cause_index) {
+            state = "STALLED <- likely cause";
+        } else if (stage->stall_reported) {
+            state = "STALLED";
+        }
+        fprintf(stderr, "[WATCHDOG] %-24s %11s %8d %8d %10llu %10llu %9.1f %6s %10llu %s\n",
+                stage->label, queue_state, stats[i].waiting_consumers, stats[i].waiting_producers,
+                stats[i].items_processed, stats[i].items_dropped, stats[i].blocked_time_ns / 1e6,
+                stats[i].item_in_progress ? "yes" : "no", (now_ns - stage->last_progress_ns) / 1000000ULL, state);
+    }
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
@@ -0,0 +1,65 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <pthread.h>
+#include "../plugins/plugin_stats.h"
+
+/**
+ * Stall watchdog - a background thread that samples the progress counter of
+ * every stage. A stage that has input waiting (queued or in its hands) but did
+ * not process a single item within the threshold is reported on stderr,
+ * together with a dump of all the queues and stage counters, so a wedged
+ * transform or a lost wakeup shows up instead of a silently stuck pipeline.
+ * Every stall is reported once, the stage is re-armed when it moves again.
+ */
+
+// how many times per threshold the stages are sampled
+#define WATCHDOG_SAMPLES_PER_THRESHOLD 4
+
+// maximum length of a stage label ("rotator#2+flipper")
+#define WATCHDOG_LABEL_LENGTH 256
+
+// stats function of a stage (plugin_get_stats)
+typedef const char* (*watchdog_get_stats_func)(plugin_stats_t* stats);
+
+typedef struct
+{
+    char label[WATCHDOG_LABEL_LENGTH];    /* Stage name in the reports */
+    watchdog_get_stats_func get_stats;    /* Source of the progress counter */
+    unsigned long long last_progress;     /* Items processed + dropped at the last change */
+    unsigned long long last_progress_ns;  /* Monotonic time of the last change */
+    int stall_reported;                   /* The current stall was already reported */
+} watchdog_stage_t;
+
+typedef struct
+{
+    watchdog_stage_t* stages;
+    int num_stages;
+    unsigned long long threshold_ns;  /* No progress for this long with pending input is a stall */
+    unsigned long long stalls_reported;
+    pthread_mutex_t stop_mutex;
+    pthread_cond_t stop_cond;         /* Signaled by watchdog_stop */
+    int stop_requested;
+    pthread_t thread;
+    int thread_started;
+} watchdog_t;
+
+/**
+ * Start the watchdog thread
+ * @param watchdog Watchdog to initialize
+ * @param labels Stage labels, one per stage (copied)
+ * @param get_stats Stats functions, one per stage (NULL entries are not watched)
+ * @param num_stages Number of stages
+ * @param threshold_ms Stall threshold in milliseconds
+ * @return NULL on success, error message on failure
+ */
+const char* watchdog_start(watchdog_t* watchdog, const char* const* labels,
+                           watchdog_get_stats_func* get_stats, int num_stages, int threshold_ms);
+
+/**
+ * Stop the watchdog thread, must be called before the stages are finalized
+ * @param watchdog Watchdog to stop
+ */
+void watchdog_stop(watchdog_t* watchdog);
+
+#endif /* WATCHDOG_H */
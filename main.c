@@ -11,6 +11,25 @@
 #include <string.h>
 #include <unistd.h>
 #include <dlfcn.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <errno.h>
+#include "core/executor.h"
+#include "core/metrics.h"
+#include "core/watchdog.h"
+#include "core/trace.h"
+#include "core/output_sink.h"
+#include "core/plan.h"
+#include "core/calibration.h"
+#include "core/alloc_profile.h"
+#include "core/memory_trim.h"
+#include "core/journal.h"
+#include "plugins/plugin_stats.h"
+#include "plugins/plugin_config.h"
+#include "plugins/sync/lock_profile.h"
 
 //consts 
 #define Max_line_length 1024
@@ -19,42 +38,244 @@
 // type def for plugin functions
 typedef const char* (*plugin_get_name_func)(void);
 typedef const char* (*plugin_init_func)(int);
+typedef const char* (*plugin_init_ex_func)(const plugin_config_t*);
 typedef const char* (*plugin_fini_func)(void);
 typedef const char* (*plugin_place_work_func)(const char*);
 typedef void (*plugin_attach_func)(const char* (*)(const char*));
 typedef const char* (*plugin_wait_finished_func)(void);
+typedef int (*plugin_transform_inplace_func)(char*, int);
+typedef const char* (*plugin_fuse_func)(plugin_transform_inplace_func);
+typedef const char* (*plugin_use_executor_func)(void);
+typedef int (*plugin_step_func)(int);
+typedef int (*plugin_offer_work_func)(const char*);
+typedef void (*plugin_attach_offer_func)(plugin_offer_work_func);
+typedef const char* (*plugin_set_stack_size_func)(size_t);
+typedef const char* (*plugin_set_allocator_func)(const pipeline_allocator_t*);
+typedef const char* (*plugin_set_queue_bytes_func)(size_t);
+typedef const char* (*plugin_set_backlog_compression_func)(int);
+typedef int (*plugin_take_credits_func)(int, int);
+typedef void (*plugin_attach_credits_func)(plugin_take_credits_func);
+typedef const char* (*plugin_set_partitions_func)(int);
+typedef const char* (*plugin_set_relaxed_order_func)(int);
+typedef const char* (*plugin_set_credit_batch_func)(int);
+typedef const char* (*plugin_set_overflow_policy_func)(int);
+typedef const char* (*plugin_set_cpu_func)(int);
+typedef const char* (*plugin_set_instance_id_func)(int);
+typedef const char* (*plugin_get_stats_func)(plugin_stats_t*);
+typedef const char* (*plugin_set_lock_profile_func)(int);
+typedef const char* (*plugin_trim_memory_func)(size_t, size_t*);
+typedef const char* (*plugin_get_lock_profile_func)(int, lock_profile_t*, const char**);
 
 //define a struct to hold plugin information
 typedef struct {
     //pointer to plugin interface functions
     plugin_init_func init;
+    plugin_init_ex_func init_ex; // optional - init with the key=value parameters of the stage
     plugin_fini_func fini;
     plugin_place_work_func place_work;
     plugin_attach_func attach;
     plugin_wait_finished_func wait_finished;
     plugin_get_name_func get_name;
+    plugin_transform_inplace_func transform_inplace; // optional - only length preserving plugins export it
+    plugin_fuse_func fuse;
+    plugin_use_executor_func use_executor; // optional executor mode functions
+    plugin_step_func step;
+    plugin_offer_work_func offer_work;
+    plugin_attach_offer_func attach_offer;
+    plugin_set_stack_size_func set_stack_size;
+    plugin_set_allocator_func set_allocator;       // optional - route the stage memory through a host allocator
+    plugin_set_queue_bytes_func set_queue_bytes;   // optional - byte ring queue layout
+    plugin_set_backlog_compression_func set_backlog_compression; // optional - compress the deep backlog of the queue
+    plugin_take_credits_func take_credits;         // optional - credit flow control, grants slots of this stage's queue
+    plugin_attach_credits_func attach_credits;     // optional - credit flow control, takes credits from the next stage
+    plugin_set_partitions_func set_partitions;     // optional - shards of a stateful, key partitioned stage
+    plugin_set_relaxed_order_func set_relaxed_order; // optional - shards forward without restoring the input order
+    plugin_set_credit_batch_func set_credit_batch;   // optional - credits handed back to the previous stage at once
+    plugin_set_overflow_policy_func set_overflow_policy; // optional - drop instead of block on a full queue
+    plugin_set_cpu_func set_cpu;                 // optional - pin the stage thread
+    plugin_set_instance_id_func set_instance_id; // optional - names the stage thread "<name>#<id>"
+    plugin_get_stats_func get_stats;             // optional - items and CPU time of the stage
+    plugin_set_lock_profile_func set_lock_profile; // optional - record the contention of the input queue locks
+    plugin_get_lock_profile_func get_lock_profile; // optional - read it back at shutdown
+    plugin_trim_memory_func trim_memory;         // optional - return the idle queue memory to the OS
 
     char* plugin_name;
     void* dynamic_library_handle;
     int instance_id;       // we need this to separte contexts between same plugins instances
+    int fused_into_previous; // "a+b" on the command line - b runs inside a's thread, it has no queue/thread of its own
+    const char* isa_level;   // build that was loaded, "baseline" or one of isa_levels_best_first
+    stage_settings_t settings; // queue size and the other stage settings (command line or plan), of the stage head
+    int initialized;         // plugin_init succeeded, only those stages are waited for at cleanup
+    char* params;            // "key=value,key=value" after the plugin name ("rotator:shift=2"), NULL - none
 } plugin_handle_t;
 
 
+// stage labels and stats functions handed to the metrics reporter and the watchdog
+#define STAGE_LABEL_LENGTH 256
+typedef struct {
+    char (*labels)[STAGE_LABEL_LENGTH];
+    const char** label_ptrs;
+    plugin_get_stats_func* get_stats;
+    int num_of_stages;
+} stage_table_t;
+
+
+//command line options, they come before the queue size
+typedef struct {
+    int executor_workers;  // 0 - one consumer thread per stage (default), N - N worker threads drive all the stages
+    int lean_mode;         // --lean: small footprint per stage for very long chains
+    int stack_size_kb;     // consumer thread stack size, 0 - pthread default (LEAN_STACK_SIZE_KB in lean mode)
+    int print_stats;       // --stats: per-stage items and CPU time on stderr at shutdown
+    const char* metrics_target;  // --metrics: Prometheus text file, or unix:<path> socket, NULL - off
+    int metrics_interval_ms;     // --metrics-interval
+    int watchdog_ms;             // --watchdog-ms: report stages without progress for this long, 0 - off
+    const char* record_path;     // --record: save every input line with its arrival time, NULL - off
+    const char* replay_path;     // --replay: read the input from a recorded trace instead of stdin
+    double replay_speed;         // --replay-speed: 1 - original timing, 2 - twice as fast, 0 - no delays (max)
+    int ring_bytes;              // --ring-bytes: queues store the strings inline in a byte ring of this size, 0 - off
+    int compress_backlog;        // --compress-backlog: queued items past this depth are compressed in blocks, 0 - off
+    int partitions;              // --partitions: shards of every key partitioned (stateful) stage, 0 - one
+    int relaxed_order;           // --relaxed-order: partitioned stages forward results as they finish
+    const char* output_path;     // --output: write the lines of the last stage to this file, NULL - off
+    int output_writers;          // --output-writers: threads writing the output file, 1 - serial
+    const char* plan_path;       // --plan: the chain and its stage settings from a plan file, NULL - from argv
+    int explain;                 // --explain: print the resolved execution plan and exit
+    int calibrate;               // --calibrate: measure the plugins and let the cost model choose fusion and shards
+    int alloc_profile;           // --alloc-profile: count the allocations of every stage, reported at shutdown
+    int lock_profile;            // --lock-profile: contention of the queue and monitor locks of every stage, reported at shutdown
+    int trim_idle_ms;            // --trim-idle-ms: return the memory of stages idle this long to the OS, 0 - off
+    int trim_warm_bytes;         // --trim-warm-bytes: bytes of every pool kept resident by the trims
+    const char* journal_dir;     // --journal: write-ahead journal of the input in this directory, NULL - off
+    int journal_batch;           // --journal-batch: lines of one group commit
+    int journal_sync_ms;         // --journal-sync-ms: longest wait of a line for its group commit
+} analyzer_options_t;
+
+#define DEFAULT_METRICS_INTERVAL_MS 1000
+
+// smallest --ring-bytes, the longest line the expander can produce must fit in a ring
+#define MIN_RING_BYTES (4 * Max_line_length)
+
+// largest --partitions, same bound as PLUGIN_MAX_PARTITIONS in the SDK
+#define MAX_PARTITIONS 64
+
+#define DEFAULT_OUTPUT_WRITERS 4
+
+// lean mode defaults - plenty for the transforms, versus the 8MB a default pthread stack reserves
+#define LEAN_STACK_SIZE_KB 64
+#define LEAN_MALLOC_ARENA_MAX 2
+
+// per-ISA plugin variants built by build.sh into output/<level>/, best first
+static const char* const isa_levels_best_first[] = { "x86-64-v4", "x86-64-v3", "x86-64-v2" };
+#define NUM_OF_ISA_LEVELS ((int)(sizeof(isa_levels_best_first) / sizeof(isa_levels_best_first[0])))
+
+// --isa: NULL picks the best variant for this CPU, "baseline" or a level forces it
+static const char* g_forced_isa_level = NULL;
+
+// --lean: load plugins without a dlmopen namespace (and its own libc) per instance
+static int g_lean_mode = 0;
+
+
 static int global_plugin_instance_counter = 0;
 
+// the stage executor (--workers), cleanup must stop it before the plugins are finalized
+static executor_t g_stage_executor;
+static int g_executor_mode = 0;
+static int g_executor_running = 0;
+
+// credit flow control between stages (on unless --no-credits), a stage only takes an item
+// when the next stage granted it room for the output, so it never blocks holding work
+static int g_credit_flow_control = 1;
+
+// the metrics reporter (--metrics) reads the stages, cleanup stops it before they are finalized
+static metrics_reporter_t g_metrics_reporter;
+static int g_metrics_running = 0;
+
+// the stall watchdog (--watchdog-ms), stopped together with the reporter
+static watchdog_t g_stall_watchdog;
+static int g_watchdog_running = 0;
+
+// the idle memory trimmer (--trim-idle-ms), stopped before the stages and the output file go away
+static memory_trimmer_t g_memory_trimmer;
+static int g_memory_trimmer_running = 0;
+
+// the input journal (--journal), the lines reach the first stage from its thread once they are durable
+static journal_t g_input_journal;
+static int g_input_journal_open = 0;
+static stage_table_t g_journal_stages;            // read by the drained check of the journal thread
+static unsigned long long g_journal_last_progress = ~0ULL;
+
+// the output file (--output), the last stage forwards into it instead of into nothing
+static output_sink_t g_output_sink;
+static int g_output_sink_open = 0;
+
+//--alloc-profile - one counting allocator per plugin, alive until the process exits (fini still frees through them)
+static alloc_profile_t* g_alloc_profiles = NULL;
+
 // ####  Helper Func Declarations ### ///
 // we need to declare now to use all of them in main skip lazy compilation problems, trick we learn with pain and blood :)
 static void display_usage_help(void); 
+static int parse_options(int argc, char* argv[], analyzer_options_t* options);
+static int enable_executor_mode(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int start_stage_executor(plugin_handle_t* plugins_arr, int num_of_plugins, int num_workers);
+static void stop_stage_executor(void);
+static int cpu_supports_isa_level(int level_index);
+static int resolve_plugin_path(const char* plugin_name, char* so_file_path, size_t path_size, const char** isa_level);
+static void* load_plugin_without_namespace(const char* so_file_path, const char* plugin_name, int instance_id);
+static int set_stage_stack_size(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_stage_queue_bytes(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_stage_backlog_compression(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_partitioned_stage_options(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_stage_flow_options(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_stage_alloc_profiles(plugin_handle_t* plugins_arr, int num_of_plugins);
+static void print_alloc_profiles(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int set_stage_lock_profiles(plugin_handle_t* plugins_arr, int num_of_plugins);
+static void print_lock_profiles(plugin_handle_t* plugins_arr, int num_of_plugins, unsigned long long run_ns);
+static unsigned long long lock_profile_percentile_ns(const unsigned long long* buckets, unsigned long long count, int percent);
+static void command_line_stage_settings(const analyzer_options_t* options, int queue_size, stage_settings_t* settings);
+static void assign_stage_settings(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options,
+                                  const pipeline_plan_t* plan, int queue_size);
+static int validate_stage_settings(plugin_handle_t* plugins_arr, int num_of_plugins, int executor_workers);
+static void print_execution_plan(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options);
+static int calibrate_pipeline(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options);
+static int start_calibration_stage(void* context, int plugin_index, int* partitioned);
 static int parse_queue_size_arg(const char* argument_string);
 static int load_single_plugin_with_dlmopen(plugin_handle_t* plugin_handle, const char* plugin_name);
 //static int load_single_plugin(plugin_handle_t* plugin_handle, const char* plugin_name);
 static int extract_plugin_funcs(plugin_handle_t* plugin_handle, const char* plugin_name);
+static char** expand_fused_stage_args(int num_of_args, char* stage_args[], int* num_of_plugins, int** fused_flags, char*** stage_params);
+static int split_stage_params(char* params_text, plugin_param_t* params, int max_params);
+static void free_expanded_names(char** plugin_names, int num_of_plugins);
 static plugin_handle_t* load_all_plugins(int num_of_plugins, char* plugin_names[]);
-static int init_all_plugins(plugin_handle_t* plugins_arr, int num_of_plugins, int queue_size);
+static int init_all_plugins(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int validate_fused_stages(plugin_handle_t* plugins_arr, int num_of_plugins);
+static int fuse_plugin_stages(plugin_handle_t* plugins_arr, int num_of_plugins);
+static void send_end_to_all_stages(plugin_handle_t* plugins_arr, int num_of_plugins);
 static void connect_plugins_in_pipeline_chain(plugin_handle_t* plugins_arr, int num_of_plugins);
-static int read_input_and_process(plugin_handle_t* first_plugin_in_chain);
+static int read_input_and_process(plugin_handle_t* first_plugin_in_chain, const analyzer_options_t* options);
+static int replay_trace_into_pipeline(plugin_handle_t* first_plugin_in_chain, const char* trace_path, double speed);
+static unsigned long long monotonic_time_ns(void);
 static void free_plugin_resources(plugin_handle_t* plugin_handle);
 static void cleanup_all_plugins_in_range(plugin_handle_t* plugins_arr, int num_of_plugins);
+static void print_stage_stats(plugin_handle_t* plugins_arr, int num_of_plugins);
+static void format_stage_label(plugin_handle_t* plugins_arr, int num_of_plugins, int stage_index, char* label, size_t label_size);
+static int start_metrics_reporter(plugin_handle_t* plugins_arr, int num_of_plugins, const char* target, int interval_ms);
+static void stop_metrics_reporter(void);
+static int build_stage_table(plugin_handle_t* plugins_arr, int num_of_plugins, stage_table_t* table);
+static void free_stage_table(stage_table_t* table);
+static int start_stall_watchdog(plugin_handle_t* plugins_arr, int num_of_plugins, int threshold_ms);
+static void stop_stall_watchdog(void);
+static int start_memory_trimmer(plugin_handle_t* plugins_arr, int num_of_plugins, int idle_ms, int warm_bytes);
+static void stop_memory_trimmer(void);
+static int open_input_journal(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options);
+static int close_input_journal(void);
+static void finish_input_journal(int acknowledge);
+static int input_journal_drained(unsigned long long lines_delivered);
+static size_t trim_host_memory(size_t keep_bytes);
+static size_t resident_memory_bytes(void);
+static int open_output_file(const char* path, int num_writers);
+static int close_output_file(void);
+static int sync_output_file(void);
+static const char* place_work_into_output_file(const char* line);
 
 
 /// TO BE DELETED !!!! 
@@ -73,70 +294,302 @@ static void cleanup_all_plugins_in_range(plugin_handle_t* plugins_arr, int num_o
 int main(int argc, char* argv[]) 
 {
     //step 1 - parse command line arguments
-    // echo <string_to_manipulate> | ./output/analayzer <queue_size> <plugin1> ...
+    // echo <string_to_manipulate> | ./output/analayzer [options] <queue_size> <plugin1> ...
     // program path+name, queue size, plugin1,.... => min 3 args
-    if (argc < 3) 
+    analyzer_options_t options;
+    int first_positional_arg = parse_options(argc, argv, &options);
+    if (-1 == first_positional_arg)
     {
-        fprintf(stderr, "Error: Not enough arguments.\n");
         display_usage_help();
         return 1;
     }
+    argc -= first_positional_arg - 1;
+    argv += first_positional_arg - 1;
+
+    //the chain comes from the plan file, or from the queue size and the plugin arguments
+    pipeline_plan_t plan;
+    memset(&plan, 0, sizeof(plan));
+    int queue_size_for_plugins = 0;
+    int num_of_stage_args = 0;
+    char** stage_args = NULL;
+    if(NULL != options.plan_path)
+    {
+        if(argc > 1)
+        {
+            fprintf(stderr, "Error: --plan replaces the queue size and plugin arguments.\n");
+            display_usage_help();
+            return 1;
+        }
+        //the command line options are the defaults of every stage
+        stage_settings_t defaults;
+        command_line_stage_settings(&options, 0, &defaults);
+        if(0 != plan_read(&plan, options.plan_path, &defaults, stderr))
+        {
+            return 1;
+        }
+        num_of_stage_args = plan.num_stages;
+        stage_args = (char**)calloc(plan.num_stages, sizeof(char*));
+        for(int stage_index = 0; NULL != stage_args && stage_index < plan.num_stages; stage_index++)
+        {
+            stage_args[stage_index] = plan.stages[stage_index].plugins;
+        }
+        //the plan settles the mode of the whole pipeline too
+        if(plan.workers > 0)
+        {
+            options.executor_workers = plan.workers;
+        }
+        if(plan.credits >= 0)
+        {
+            g_credit_flow_control = plan.credits;
+        }
+    }
+    else
+    {
+        if (argc < 3) 
+        {
+            fprintf(stderr, "Error: Not enough arguments.\n");
+            display_usage_help();
+            return 1;
+        }
+
+        queue_size_for_plugins = parse_queue_size_arg(argv[1]);
+        if(-1 == queue_size_for_plugins)
+        {
+            fprintf(stderr, "Error: Invalid queue size argument.\n");
+            display_usage_help();
+            return 1;
+        }
+        num_of_stage_args = argc - 2;
+        stage_args = &argv[2];
+    }
 
-    int queue_size_for_plugins = parse_queue_size_arg(argv[1]);
-    if(-1 == queue_size_for_plugins)
+    //each argument is a stage, "a+b+c" is one stage made of fused plugins, "a:key=value" passes parameters to a
+    int total_num_of_plugins = 0;
+    int* fused_flags = NULL;
+    char** stage_params = NULL;
+    char** plugin_names_from_args = (NULL == stage_args) ? NULL :
+        expand_fused_stage_args(num_of_stage_args, stage_args, &total_num_of_plugins, &fused_flags, &stage_params);
+    if(NULL != options.plan_path)
+    {
+        free(stage_args);
+    }
+    if(NULL == plugin_names_from_args)
     {
-        fprintf(stderr, "Error: Invalid queue size argument.\n");
+        plan_free(&plan);
+        fprintf(stderr, "Error: Invalid plugin list.\n");
         display_usage_help();
         return 1;
     }
-
-    int total_num_of_plugins = argc - 2;
-    char** plugin_names_from_args = &argv[2];
     
     //step 2 - load all plugins dynamically
     plugin_handle_t* loaded_plugins_arr = load_all_plugins(total_num_of_plugins, plugin_names_from_args);
+    free_expanded_names(plugin_names_from_args, total_num_of_plugins);
     if(NULL == loaded_plugins_arr)
     {
+        plan_free(&plan);
+        free(fused_flags);
+        free_expanded_names(stage_params, total_num_of_plugins);
         fprintf(stderr, "Error: Failed occur while loading plugins.\n");
         display_usage_help();
         return 1;
     }
+    for(int plugin_index = 0; plugin_index < total_num_of_plugins; plugin_index++)
+    {
+        loaded_plugins_arr[plugin_index].fused_into_previous = fused_flags[plugin_index];
+        loaded_plugins_arr[plugin_index].params = stage_params[plugin_index]; //the handle owns them now
+    }
+    free(fused_flags);
+    free(stage_params);
+    assign_stage_settings(loaded_plugins_arr, total_num_of_plugins, &options,
+                          (NULL != options.plan_path) ? &plan : NULL, queue_size_for_plugins);
+    plan_free(&plan);
+
+    //--calibrate - the measured costs decide the fusion and the shards, before anything is checked or started
+    if(options.calibrate && 0 != calibrate_pipeline(loaded_plugins_arr, total_num_of_plugins, &options))
+    {
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    //check the fused stages before we start any thread, so a bad combination fails fast
+    if(0 != validate_fused_stages(loaded_plugins_arr, total_num_of_plugins))
+    {
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        display_usage_help();
+        return 1;
+    }
+    if(0 != validate_stage_settings(loaded_plugins_arr, total_num_of_plugins, options.executor_workers))
+    {
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    //--explain - everything is resolved, nothing started yet
+    if(options.explain)
+    {
+        print_execution_plan(loaded_plugins_arr, total_num_of_plugins, &options);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 0;
+    }
+
+    //the stage settings go to the plugins before init, each setter skips the stages that did not ask for it
+    if(0 != set_stage_stack_size(loaded_plugins_arr, total_num_of_plugins) ||
+       0 != set_stage_queue_bytes(loaded_plugins_arr, total_num_of_plugins) ||
+       0 != set_stage_backlog_compression(loaded_plugins_arr, total_num_of_plugins) ||
+       0 != set_partitioned_stage_options(loaded_plugins_arr, total_num_of_plugins) ||
+       0 != set_stage_flow_options(loaded_plugins_arr, total_num_of_plugins) ||
+       (options.alloc_profile && 0 != set_stage_alloc_profiles(loaded_plugins_arr, total_num_of_plugins)) ||
+       (options.lock_profile && 0 != set_stage_lock_profiles(loaded_plugins_arr, total_num_of_plugins)))
+    {
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    //executor mode - the plugins must know before init, so they skip creating their own thread
+    if(options.executor_workers > 0 && 0 != enable_executor_mode(loaded_plugins_arr, total_num_of_plugins))
+    {
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
 
     //step 3 - initialize all plugins - construct the pipeline
-    int init_result = init_all_plugins(loaded_plugins_arr, total_num_of_plugins, queue_size_for_plugins);
-    if(-1 == init_result)
+    int init_result = init_all_plugins(loaded_plugins_arr, total_num_of_plugins);
+    if(0 != init_result)
     {
         fprintf(stderr, "Error: Failed occur while initializing plugins.\n");
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins); //the stages that did start must drain
         cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
         return 2; // TODO: check again if this is should be 2 and make a clear define error codes in a header file
     }
 
+    if(g_executor_mode && 0 != start_stage_executor(loaded_plugins_arr, total_num_of_plugins, options.executor_workers))
+    {
+        fprintf(stderr, "Error: Failed to start the stage executor.\n");
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 2;
+    }
+
+    //step 3.5 - fused plugins run inside the thread of the stage they belong to
+    if(0 != fuse_plugin_stages(loaded_plugins_arr, total_num_of_plugins))
+    {
+        fprintf(stderr, "Error: Failed occur while fusing plugin stages.\n");
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins); //the threads are already running, let them finish
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 2;
+    }
+
+    //the file must be there before the last stage is attached to it
+    if(NULL != options.output_path && 0 != open_output_file(options.output_path, options.output_writers))
+    {
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
     //step 4 - connect plugins in a pipeline chain
     connect_plugins_in_pipeline_chain(loaded_plugins_arr, total_num_of_plugins);
 
+    if(NULL != options.metrics_target &&
+       0 != start_metrics_reporter(loaded_plugins_arr, total_num_of_plugins, options.metrics_target, options.metrics_interval_ms))
+    {
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    if(options.watchdog_ms > 0 && 0 != start_stall_watchdog(loaded_plugins_arr, total_num_of_plugins, options.watchdog_ms))
+    {
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    if(options.trim_idle_ms > 0 &&
+       0 != start_memory_trimmer(loaded_plugins_arr, total_num_of_plugins, options.trim_idle_ms, options.trim_warm_bytes))
+    {
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    //the journal replays what a crashed run left before the first new line is read
+    if(NULL != options.journal_dir && 0 != open_input_journal(loaded_plugins_arr, total_num_of_plugins, &options))
+    {
+        stop_memory_trimmer();
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins);
+        cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
+        return 1;
+    }
+
+    unsigned long long run_start_ns = monotonic_time_ns();
+
     //step 5 - read input lines and process them through the pipeline - the main part of the program logic
-    //read from stdin and send to the first plugin in the chain
-    int read_and_processing_result = read_input_and_process(&loaded_plugins_arr[0]);
+    //read from stdin (or a recorded trace) and send to the first plugin in the chain
+    int read_and_processing_result = read_input_and_process(&loaded_plugins_arr[0], &options);
     if( 0 != read_and_processing_result)
     {
         fprintf(stderr, "Error: Failed occur while reading input and processing.\n");
+        finish_input_journal(0); //the segments stay for the next run
+        send_end_to_all_stages(loaded_plugins_arr, total_num_of_plugins); //no <END> went through, the threads are still waiting
         cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
         return 1;
     }
 
     //step 6 - wait for all plugins to finish processing before cleanup
     for(int plugin_index = 0; plugin_index < total_num_of_plugins; plugin_index++) {
-        if(loaded_plugins_arr[plugin_index].wait_finished) {
+        if(loaded_plugins_arr[plugin_index].wait_finished && !loaded_plugins_arr[plugin_index].fused_into_previous) {
             loaded_plugins_arr[plugin_index].wait_finished();
         }
     }
 
+    //the trimmer also trims the output batches, it must be gone before the sink closes
+    stop_memory_trimmer();
+
+    //the journal lets its segments go only once what they became is on disk in the output too
+    int output_synced = !g_input_journal_open || 0 == sync_output_file();
+
+    //the last stage forwarded <END>, everything it produced is in the sink
+    int output_result = close_output_file();
+
+    //every journaled line went all the way through, the next run has nothing to recover
+    finish_input_journal(0 == output_result && output_synced);
+
+    //the stages are done but not finalized yet, their stats are still there
+    if(options.print_stats)
+    {
+        print_stage_stats(loaded_plugins_arr, total_num_of_plugins);
+        if(NULL != options.output_path)
+        {
+            fprintf(stderr, "output: %llu bytes in %llu batches, %d writers\n",
+                    g_output_sink.bytes_written, g_output_sink.batches_written, options.output_writers);
+        }
+        if(options.trim_idle_ms > 0)
+        {
+            fprintf(stderr, "memory trim: %llu trims, %llu bytes returned to the OS\n",
+                    g_memory_trimmer.trims, g_memory_trimmer.released_bytes);
+        }
+        if(NULL != options.journal_dir)
+        {
+            fprintf(stderr, "journal: %llu lines (%llu recovered) in %llu group commits, %.1f ms in write+sync, %llu segments acknowledged\n",
+                    g_input_journal.lines_delivered, g_input_journal.lines_recovered, g_input_journal.commits,
+                    (double)g_input_journal.sync_time_ns / 1e6, g_input_journal.segments_acknowledged);
+        }
+    }
+    if(options.alloc_profile)
+    {
+        print_alloc_profiles(loaded_plugins_arr, total_num_of_plugins);
+    }
+    if(options.lock_profile)
+    {
+        print_lock_profiles(loaded_plugins_arr, total_num_of_plugins, monotonic_time_ns() - run_start_ns);
+    }
+
     //step 7 - graceful shutdown all the plugins - after processing is done or error
     cleanup_all_plugins_in_range(loaded_plugins_arr, total_num_of_plugins);
     //step 8 - clean up all resources allocated for plugins and the mass we allocated for them
     //step 9 - print exit 
     printf("Pipeline shutdown complete\n");
-    return 0; 
+    return (0 == output_result) ? 0 : 1; 
 }
 
 
@@ -204,11 +657,9 @@ static int load_single_plugin_with_dlmopen(plugin_handle_t* plugin_handle, const
         return 1;
     }
 
-    //make the .so file path
-    int len = snprintf(so_file_path, sizeof(so_file_path), "output/%s.so", plugin_name);
-    if(len >= MAX_FILE_NAME_LENGTH || len < 0) 
+    //make the .so file path - the best ISA variant for this CPU, or the baseline build
+    if(0 != resolve_plugin_path(plugin_name, so_file_path, sizeof(so_file_path), &plugin_handle->isa_level))
     {
-        fprintf(stderr, "ERROR: Plugin path too long: %s\n", plugin_name);
         return 1;
     }
 
@@ -226,7 +677,15 @@ static int load_single_plugin_with_dlmopen(plugin_handle_t* plugin_handle, const
     // we use dlmopen to load each instance into a separate namespace
     // this func allows us to use multiple instances of the same plugin to have separate global state
     // OLD: plugin_handle->dynamic_library_handle = dlmopen(LM_ID_NEWLM, so_file_path, RTLD_NOW);
-    plugin_handle->dynamic_library_handle = dlmopen(LM_ID_NEWLM, so_file_path, RTLD_NOW | RTLD_LOCAL);
+    // in lean mode we skip the namespaces (each one costs a full libc and glibc allows only 16)
+    if(g_lean_mode)
+    {
+        plugin_handle->dynamic_library_handle = load_plugin_without_namespace(so_file_path, plugin_name, plugin_handle->instance_id);
+    }
+    else
+    {
+        plugin_handle->dynamic_library_handle = dlmopen(LM_ID_NEWLM, so_file_path, RTLD_NOW | RTLD_LOCAL);
+    }
     if (NULL == plugin_handle->dynamic_library_handle)
     {
         fprintf(stderr, "fail occur while loading plugin %s from %s: %s\n", plugin_name, so_file_path, dlerror());
@@ -292,6 +751,38 @@ static int extract_plugin_funcs(plugin_handle_t* plugin_handle, const char* plug
         return EXIT_FAILURE;
     }
 
+    //optional functions - older plugins may not have them, so NULL is fine here
+    plugin_handle->init_ex = (plugin_init_ex_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_init_ex");
+    plugin_handle->fuse = (plugin_fuse_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_fuse");
+    plugin_handle->transform_inplace = (plugin_transform_inplace_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_transform_inplace");
+    plugin_handle->use_executor = (plugin_use_executor_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_use_executor");
+    plugin_handle->step = (plugin_step_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_step");
+    plugin_handle->offer_work = (plugin_offer_work_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_offer_work");
+    plugin_handle->attach_offer = (plugin_attach_offer_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_attach_offer");
+    plugin_handle->set_stack_size = (plugin_set_stack_size_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_stack_size");
+    plugin_handle->set_allocator = (plugin_set_allocator_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_allocator");
+    plugin_handle->set_queue_bytes = (plugin_set_queue_bytes_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_queue_bytes");
+    plugin_handle->set_backlog_compression = (plugin_set_backlog_compression_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_backlog_compression");
+    plugin_handle->take_credits = (plugin_take_credits_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_take_credits");
+    plugin_handle->attach_credits = (plugin_attach_credits_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_attach_credits");
+    plugin_handle->set_partitions = (plugin_set_partitions_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_partitions");
+    plugin_handle->set_relaxed_order = (plugin_set_relaxed_order_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_relaxed_order");
+    plugin_handle->set_credit_batch = (plugin_set_credit_batch_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_credit_batch");
+    plugin_handle->set_overflow_policy = (plugin_set_overflow_policy_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_overflow_policy");
+    plugin_handle->set_cpu = (plugin_set_cpu_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_cpu");
+    plugin_handle->set_instance_id = (plugin_set_instance_id_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_instance_id");
+    plugin_handle->get_stats = (plugin_get_stats_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_get_stats");
+    plugin_handle->set_lock_profile = (plugin_set_lock_profile_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_set_lock_profile");
+    plugin_handle->get_lock_profile = (plugin_get_lock_profile_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_get_lock_profile");
+    plugin_handle->trim_memory = (plugin_trim_memory_func)dlsym(plugin_handle->dynamic_library_handle, "plugin_trim_memory");
+    dlerror(); //clear the error of a missing optional symbol
+
+    //the stage thread is named after the instance, so top -H / perf can tell the stages apart
+    if(NULL != plugin_handle->set_instance_id)
+    {
+        plugin_handle->set_instance_id(plugin_handle->instance_id);
+    }
+
     return EXIT_SUCCESS;
 
 }
@@ -319,10 +810,8 @@ static plugin_handle_t* load_all_plugins(int num_of_plugins, char* plugin_names[
         if(0 != single_plugin_load_result)
         {
             fprintf(stderr, "Error: Failed to load plugin: %s\n", plugin_names[current_plugin_index]);
-            //cleanup all the plugins we have loaded so far
+            //cleanup all the plugins we have loaded so far (it also frees the array)
             cleanup_all_plugins_in_range(plugins_array, current_plugin_index);
-
-            free(plugins_array);
             return NULL;
         }
 
@@ -331,9 +820,8 @@ static plugin_handle_t* load_all_plugins(int num_of_plugins, char* plugin_names[
         if(0 != extract_result)
         {
             fprintf(stderr, "Error: Failed to extract functions from plugin: %s\n", plugin_names[current_plugin_index]);
-            //cleanup all the plugins we have loaded so far
+            //cleanup all the plugins we have loaded so far (it also frees the array)
             cleanup_all_plugins_in_range(plugins_array, current_plugin_index + 1); //include this one
-            free(plugins_array);
             return NULL;
         }
     }
@@ -341,9 +829,9 @@ static plugin_handle_t* load_all_plugins(int num_of_plugins, char* plugin_names[
     return plugins_array;
 }
 
-static int init_all_plugins(plugin_handle_t* plugins_arr, int num_of_plugins, int queue_size)
+static int init_all_plugins(plugin_handle_t* plugins_arr, int num_of_plugins)
 {
-    if(NULL == plugins_arr || num_of_plugins <= 0 || queue_size <= 0)
+    if(NULL == plugins_arr || num_of_plugins <= 0)
     {
         return 1;
     }
@@ -352,20 +840,119 @@ static int init_all_plugins(plugin_handle_t* plugins_arr, int num_of_plugins, in
     int current_plugin_index;
     for(current_plugin_index = 0; current_plugin_index < num_of_plugins; current_plugin_index++)
     {
-        const char* init_error = plugins_arr[current_plugin_index].init(queue_size);
+        //fused plugins have no queue and thread of their own
+        if(plugins_arr[current_plugin_index].fused_into_previous)
+        {
+            continue;
+        }
+
+        const char* init_error = NULL;
+        if(NULL != plugins_arr[current_plugin_index].params)
+        {
+            //validate_stage_settings already checked the syntax, this copy is split for the init only
+            plugin_param_t params[PLUGIN_MAX_PARAMS];
+            char* params_text = strdup(plugins_arr[current_plugin_index].params);
+            if(NULL == params_text)
+            {
+                fprintf(stderr, "Error: Failed to allocate the parameters of plugin %s\n", plugins_arr[current_plugin_index].plugin_name);
+                return 1;
+            }
+            plugin_config_t config = { plugins_arr[current_plugin_index].settings.queue_size, params, 0 };
+            config.num_params = split_stage_params(params_text, params, PLUGIN_MAX_PARAMS);
+            init_error = (config.num_params < 0) ? "Invalid stage parameters" : plugins_arr[current_plugin_index].init_ex(&config);
+            free(params_text);
+        }
+        else
+        {
+            init_error = plugins_arr[current_plugin_index].init(plugins_arr[current_plugin_index].settings.queue_size);
+        }
         if(NULL != init_error)
         {
             fprintf(stderr, "Error: plugin_init function is NULL for plugin%s: %s\n", plugins_arr[current_plugin_index].plugin_name, init_error);
-            //clean with safe rollback
-            cleanup_all_plugins_in_range(plugins_arr, current_plugin_index);
+            //the caller rolls back - it owns the array and must stop the stages that already started
+            return 1;
+        }
+        plugins_arr[current_plugin_index].initialized = 1;
+
+    }
+
+    return 0;
+}
+
+static int validate_fused_stages(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    if(NULL == plugins_arr || num_of_plugins <= 0)
+    {
+        return 1;
+    }
+
+    int stage_head_index = 0;
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous)
+        {
+            stage_head_index = current_index;
+            continue;
+        }
+
+        if(NULL == plugins_arr[current_index].transform_inplace || NULL == plugins_arr[stage_head_index].fuse)
+        {
+            fprintf(stderr, "Error: plugin %s cannot be fused into %s (no in-place transform)\n",
+                    plugins_arr[current_index].plugin_name, plugins_arr[stage_head_index].plugin_name);
             return 1;
         }
+    }
+
+    return 0;
+}
+
+static int fuse_plugin_stages(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    if(NULL == plugins_arr || num_of_plugins <= 0)
+    {
+        return 1;
+    }
+
+    int stage_head_index = 0;
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous)
+        {
+            stage_head_index = current_index;
+            continue;
+        }
 
+        plugin_handle_t* stage_head = &plugins_arr[stage_head_index];
+        const char* fuse_error = stage_head->fuse(plugins_arr[current_index].transform_inplace);
+        if(NULL != fuse_error)
+        {
+            fprintf(stderr, "Error: failed to fuse %s into %s: %s\n",
+                    plugins_arr[current_index].plugin_name, stage_head->plugin_name, fuse_error);
+            return 1;
+        }
     }
 
     return 0;
 }
 
+// used when we fail after the threads started but before the chain is connected,
+// every stage needs its own <END> so plugin_wait_finished will not block forever
+static void send_end_to_all_stages(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    if(NULL == plugins_arr)
+    {
+        return;
+    }
+
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous && NULL != plugins_arr[current_index].place_work)
+        {
+            plugins_arr[current_index].place_work("<END>");
+        }
+    }
+}
+
 static void connect_plugins_in_pipeline_chain(plugin_handle_t* plugins_arr, int num_of_plugins)
 {
     if(NULL == plugins_arr || num_of_plugins <= 0)
@@ -373,25 +960,68 @@ static void connect_plugins_in_pipeline_chain(plugin_handle_t* plugins_arr, int
         return;
     }
 
-    //connect each plugin to the next one
-    for(int current_index = 0; current_index < num_of_plugins - 1; current_index++) // we stop at n-1 in order to avoid overflow in the last plugin
+    //connect each stage to the next one, fused plugins are skipped because they live inside their stage
+    int previous_stage_index = 0;
+    for(int current_index = 1; current_index < num_of_plugins; current_index++)
+    {
+        if(plugins_arr[current_index].fused_into_previous)
+        {
+            continue;
+        }
+        plugins_arr[previous_stage_index].attach(plugins_arr[current_index].place_work);
+        //a stage that drops on overflow never blocks its producer, credits or offers would wait for room instead
+        int next_stage_drops = plugins_arr[current_index].settings.overflow_drop;
+        //in executor mode a worker must never block on a full queue, so stages forward with offer_work
+        if(g_executor_mode && !next_stage_drops && NULL != plugins_arr[previous_stage_index].attach_offer && NULL != plugins_arr[current_index].offer_work)
+        {
+            plugins_arr[previous_stage_index].attach_offer(plugins_arr[current_index].offer_work);
+        }
+        if(g_credit_flow_control && !next_stage_drops && NULL != plugins_arr[previous_stage_index].attach_credits && NULL != plugins_arr[current_index].take_credits)
+        {
+            plugins_arr[previous_stage_index].attach_credits(plugins_arr[current_index].take_credits);
+        }
+        previous_stage_index = current_index;
+    }
+
+    if(g_output_sink_open)
     {
-        int next_index = current_index + 1;
-        plugins_arr[current_index].attach(plugins_arr[next_index].place_work);
+        plugins_arr[previous_stage_index].attach(place_work_into_output_file);
     }
 
     // usleep(10000); 
 }
 
-static int read_input_and_process(plugin_handle_t* first_plugin_in_chain)
+static int read_input_and_process(plugin_handle_t* first_plugin_in_chain, const analyzer_options_t* options)
 {
     if(NULL == first_plugin_in_chain)
     {
         return 1;
     }
 
+    if(NULL != options->replay_path)
+    {
+        return replay_trace_into_pipeline(first_plugin_in_chain, options->replay_path, options->replay_speed);
+    }
+
+    //--record - the lines go to the pipeline as usual, and to the trace with the time they arrived
+    trace_writer_t trace_writer;
+    int recording = 0;
+    unsigned long long record_start_ns = 0;
+    if(NULL != options->record_path)
+    {
+        const char* trace_error = trace_writer_open(&trace_writer, options->record_path);
+        if(NULL != trace_error)
+        {
+            fprintf(stderr, "Error: %s: %s\n", trace_error, options->record_path);
+            return 1;
+        }
+        recording = 1;
+        record_start_ns = monotonic_time_ns();
+    }
+
     char input_line_buffer[Max_line_length];
     int end_signal_received = 0;
+    int result = 0; //every exit goes through the end, the trace must be closed on failure too
 
 
     while(NULL != fgets(input_line_buffer, sizeof(input_line_buffer), stdin) )
@@ -401,6 +1031,37 @@ static int read_input_and_process(plugin_handle_t* first_plugin_in_chain)
         if(line_len > 0 && input_line_buffer[line_len - 1] == '\n')
         {
             input_line_buffer[line_len - 1] = '\0'; //insert null instead of \n
+            line_len--;
+        }
+
+        //a failing trace must not take the pipeline down, we just stop recording
+        if(recording)
+        {
+            const char* trace_error = trace_writer_append(&trace_writer, monotonic_time_ns() - record_start_ns, input_line_buffer, line_len);
+            if(NULL != trace_error)
+            {
+                fprintf(stderr, "Warning: %s, recording stopped: %s\n", trace_error, options->record_path);
+                trace_writer_close(&trace_writer);
+                recording = 0;
+            }
+        }
+
+        //--journal - <END> is not journaled, it goes in once every line before it is durable
+        if(g_input_journal_open)
+        {
+            if( 0 == strcmp(input_line_buffer, "<END>") )
+            {
+                end_signal_received = 1;
+                break;
+            }
+            const char* journal_error = journal_append(&g_input_journal, input_line_buffer, line_len);
+            if(NULL != journal_error)
+            {
+                fprintf(stderr, "Error: %s: %s\n", journal_error, options->journal_dir);
+                result = 1;
+                break;
+            }
+            continue;
         }
 
         //send to the first plugin in the chain
@@ -408,7 +1069,8 @@ static int read_input_and_process(plugin_handle_t* first_plugin_in_chain)
         if(NULL != place_work_error)
         {
             fprintf(stderr, "Error: Failed to place work to plugin %s: %s\n", first_plugin_in_chain->plugin_name, place_work_error);
-            return 1;
+            result = 1;
+            break;
         }
 
         //check for EOF - if we dont get <END> we will not halt
@@ -419,6 +1081,25 @@ static int read_input_and_process(plugin_handle_t* first_plugin_in_chain)
         }
     }
 
+    //the last group is committed and delivered before <END> can follow it
+    //(after a failure the journal stays open, main closes it without acknowledging)
+    if(0 == result && g_input_journal_open)
+    {
+        if(0 != close_input_journal())
+        {
+            result = 1;
+        }
+        else if(end_signal_received)
+        {
+            const char* place_work_error = first_plugin_in_chain->place_work("<END>");
+            if(NULL != place_work_error)
+            {
+                fprintf(stderr, "Error: Failed to place work to plugin %s: %s\n", first_plugin_in_chain->plugin_name, place_work_error);
+                result = 1;
+            }
+        }
+    }
+
     // TODO: check in the piazza / the pdf instructor notes if we need to send <END> on EOF
     // there is no clear instruction about it, friend said if its not had <END> its should hang, but it makes sense to me to do it
     // for now i commented it out 
@@ -433,87 +1114,1875 @@ static int read_input_and_process(plugin_handle_t* first_plugin_in_chain)
         // }
     // }
 
+    if(recording)
+    {
+        const char* trace_error = trace_writer_close(&trace_writer);
+        if(NULL != trace_error)
+        {
+            fprintf(stderr, "Warning: %s: %s\n", trace_error, options->record_path);
+        }
+    }
 
-    return 0;
+    return result;
 }
 
-static void free_plugin_resources(plugin_handle_t* plugin_handle)
+// feed the lines of a recorded trace to the pipeline, each one at its recorded time divided by speed
+// (speed 0 - as fast as the pipeline takes them). A trace always ends the run - <END> is sent
+// after the last line when the recording did not have one.
+static int replay_trace_into_pipeline(plugin_handle_t* first_plugin_in_chain, const char* trace_path, double speed)
 {
-    if(NULL == plugin_handle)
+    trace_reader_t trace_reader;
+    const char* trace_error = trace_reader_open(&trace_reader, trace_path);
+    if(NULL != trace_error)
     {
-        return;
+        fprintf(stderr, "Error: %s: %s\n", trace_error, trace_path);
+        return 1;
     }
 
-    if(NULL != plugin_handle->plugin_name)
+    char input_line_buffer[Max_line_length];
+    unsigned long long line_timestamp_ns = 0;
+    unsigned long long replay_start_ns = monotonic_time_ns();
+    int end_signal_sent = 0;
+    int read_result;
+
+    while(!end_signal_sent && 1 == (read_result = trace_reader_next(&trace_reader, &line_timestamp_ns, input_line_buffer, sizeof(input_line_buffer))))
     {
-        //free plugin name
-        free(plugin_handle->plugin_name);
-        plugin_handle->plugin_name = NULL;
+        if(speed > 0)
+        {
+            //absolute deadlines - the time spent in place_work does not add up over the trace
+            unsigned long long due_ns = replay_start_ns + (unsigned long long)((double)line_timestamp_ns / speed);
+            struct timespec due_time = { (time_t)(due_ns / 1000000000ULL), (long)(due_ns % 1000000000ULL) };
+            while(EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due_time, NULL))
+            {
+            }
+        }
+
+        const char* place_work_error = first_plugin_in_chain->place_work(input_line_buffer);
+        if(NULL != place_work_error)
+        {
+            fprintf(stderr, "Error: Failed to place work to plugin %s: %s\n", first_plugin_in_chain->plugin_name, place_work_error);
+            trace_reader_close(&trace_reader);
+            return 1;
+        }
+        end_signal_sent = (0 == strcmp(input_line_buffer, "<END>"));
     }
 
-    if(NULL != plugin_handle->dynamic_library_handle)
+    unsigned long long replayed_lines = trace_reader.records;
+    trace_reader_close(&trace_reader);
+    if(-1 == read_result && !end_signal_sent)
     {
-        dlclose(plugin_handle->dynamic_library_handle);
-        plugin_handle->dynamic_library_handle = NULL;
+        fprintf(stderr, "Warning: Trace is corrupt or truncated after %llu lines: %s\n", replayed_lines, trace_path);
     }
 
-    
+    if(!end_signal_sent)
+    {
+        const char* place_work_error = first_plugin_in_chain->place_work("<END>");
+        if(NULL != place_work_error)
+        {
+            fprintf(stderr, "Error: Failed to place work to plugin %s: %s\n", first_plugin_in_chain->plugin_name, place_work_error);
+            return 1;
+        }
+    }
 
-    plugin_handle->instance_id = 0;
+    double elapsed_sec = (double)(monotonic_time_ns() - replay_start_ns) / 1e9;
+    fprintf(stderr, "Replay: %llu lines in %.3f s (recorded over %.3f s)\n",
+            replayed_lines, elapsed_sec, (double)line_timestamp_ns / 1e9);
+    return 0;
 }
 
-static void cleanup_all_plugins_in_range(plugin_handle_t* plugins_arr, int num_of_plugins)
+static unsigned long long monotonic_time_ns(void)
 {
-    if(NULL == plugins_arr || num_of_plugins <= 0)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// split the stage arguments into plugin names - "uppercaser+rotator" becomes two plugins,
+// the second one marked as fused into the first
+static char** expand_fused_stage_args(int num_of_args, char* stage_args[], int* num_of_plugins, int** fused_flags, char*** stage_params)
+{
+    if(num_of_args <= 0 || NULL == stage_args || NULL == num_of_plugins || NULL == fused_flags || NULL == stage_params)
+    {
+        return NULL;
+    }
+
+    int total_names = 0;
+    for(int arg_index = 0; arg_index < num_of_args; arg_index++)
+    {
+        total_names++;
+        for(const char* c = stage_args[arg_index]; *c != '\0'; c++)
+        {
+            if('+' == *c)
+            {
+                total_names++;
+            }
+        }
+    }
+
+    char** plugin_names = (char**)calloc(total_names, sizeof(char*));
+    char** params = (char**)calloc(total_names, sizeof(char*));
+    int* flags = (int*)calloc(total_names, sizeof(int));
+    if(NULL == plugin_names || NULL == params || NULL == flags)
+    {
+        free(plugin_names);
+        free(params);
+        free(flags);
+        return NULL;
+    }
+
+    int name_index = 0;
+    int expand_failed = 0;
+    for(int arg_index = 0; arg_index < num_of_args && !expand_failed; arg_index++)
+    {
+        const char* segment_start = stage_args[arg_index];
+        int first_in_stage = 1;
+        while(1)
+        {
+            const char* segment_end = strchr(segment_start, '+');
+            size_t segment_len = segment_end ? (size_t)(segment_end - segment_start) : strlen(segment_start);
+            //"name:key=value,..." - the parameters go to plugin_init_ex of the stage
+            const char* params_start = memchr(segment_start, ':', segment_len);
+            size_t name_len = params_start ? (size_t)(params_start - segment_start) : segment_len;
+            if(0 == name_len)
+            {
+                fprintf(stderr, "Error: empty plugin name in stage '%s'\n", stage_args[arg_index]);
+                expand_failed = 1;
+                break;
+            }
+            //a fused plugin is never initialized, only the stage head has an init to take them
+            if(NULL != params_start && !first_in_stage)
+            {
+                fprintf(stderr, "Error: parameters of a fused plugin in stage '%s', only the first plugin of a stage takes them\n", stage_args[arg_index]);
+                expand_failed = 1;
+                break;
+            }
+
+            plugin_names[name_index] = strndup(segment_start, name_len);
+            if(NULL != params_start)
+            {
+                params[name_index] = strndup(params_start + 1, segment_len - name_len - 1);
+            }
+            if(NULL == plugin_names[name_index] || (NULL != params_start && NULL == params[name_index]))
+            {
+                expand_failed = 1;
+                break;
+            }
+            flags[name_index] = !first_in_stage;
+            name_index++;
+            first_in_stage = 0;
+
+            if(NULL == segment_end)
+            {
+                break;
+            }
+            segment_start = segment_end + 1;
+        }
+    }
+
+    if(expand_failed)
+    {
+        free_expanded_names(plugin_names, total_names);
+        free_expanded_names(params, total_names);
+        free(flags);
+        return NULL;
+    }
+
+    *num_of_plugins = total_names;
+    *fused_flags = flags;
+    *stage_params = params;
+    return plugin_names;
+}
+
+// splits "key=value,key=value" in place, returns the number of parameters or -1 (error printed)
+static int split_stage_params(char* params_text, plugin_param_t* params, int max_params)
+{
+    int num_params = 0;
+    char* save_ptr = NULL;
+    for(char* param = strtok_r(params_text, ",", &save_ptr); NULL != param; param = strtok_r(NULL, ",", &save_ptr))
+    {
+        char* equals = strchr(param, '=');
+        if(NULL == equals || equals == param)
+        {
+            fprintf(stderr, "Error: stage parameter '%s' is not key=value\n", param);
+            return -1;
+        }
+        if(num_params == max_params)
+        {
+            fprintf(stderr, "Error: more than %d stage parameters\n", max_params);
+            return -1;
+        }
+        *equals = '\0';
+        params[num_params].key = param;
+        params[num_params].value = equals + 1;
+        num_params++;
+    }
+    if(0 == num_params)
+    {
+        fprintf(stderr, "Error: ':' without stage parameters\n");
+        return -1;
+    }
+    return num_params;
+}
+
+static void free_expanded_names(char** plugin_names, int num_of_plugins)
+{
+    if(NULL == plugin_names)
     {
         return;
     }
+    for(int name_index = 0; name_index < num_of_plugins; name_index++)
+    {
+        free(plugin_names[name_index]);
+    }
+    free(plugin_names);
+}
 
-    for(int wait_index = 0; wait_index < num_of_plugins; wait_index++)
+static int cpu_supports_isa_level(int level_index)
+{
+#if defined(__x86_64__)
+    //__builtin_cpu_supports only takes string literals
+    __builtin_cpu_init();
+    switch(level_index)
     {
-        //wait until all plugins will finish processing
-        //TOCHECK: are we sure we need to wait for all of them? what if one of them failed to initialize? or get into deadlock? חס וחלילה
-        if(NULL != plugins_arr[wait_index].wait_finished)
+        case 0: return __builtin_cpu_supports("x86-64-v4");
+        case 1: return __builtin_cpu_supports("x86-64-v3");
+        case 2: return __builtin_cpu_supports("x86-64-v2");
+        default: return 0;
+    }
+#else
+    (void)level_index;
+    return 0;
+#endif
+}
+
+// pick output/<level>/<plugin>.so for the best level the CPU supports and that was built,
+// otherwise the baseline output/<plugin>.so
+static int resolve_plugin_path(const char* plugin_name, char* so_file_path, size_t path_size, const char** isa_level)
+{
+    *isa_level = "baseline";
+    int len;
+    int use_baseline = (NULL != g_forced_isa_level && 0 == strcmp(g_forced_isa_level, "baseline"));
+
+    for(int level_index = 0; level_index < NUM_OF_ISA_LEVELS && !use_baseline; level_index++)
+    {
+        const char* level = isa_levels_best_first[level_index];
+        if(NULL != g_forced_isa_level && 0 != strcmp(g_forced_isa_level, level))
         {
-            const char* wait_error = plugins_arr[wait_index].wait_finished();
-            if(NULL != wait_error)
+            continue;
+        }
+
+        if(!cpu_supports_isa_level(level_index))
+        {
+            if(NULL != g_forced_isa_level)
             {
-                fprintf(stderr, "Warning: plugin_wait_finished returned error for plugin %s: %s\n", 
-                        plugins_arr[wait_index].plugin_name, wait_error);
-                plugins_arr[wait_index].wait_finished(); // try again מה כבר יקרה YOLO
-                //fprintf(stderr, "Warning: plugin_wait_finished returned error for plugin %s: %s\n", plugins_arr[wait_index].plugin_name, wait_error);
+                fprintf(stderr, "ERROR: this CPU does not support %s\n", level);
+                return 1;
             }
+            continue;
+        }
+
+        len = snprintf(so_file_path, path_size, "output/%s/%s.so", level, plugin_name);
+        if(len < 0 || (size_t)len >= path_size)
+        {
+            fprintf(stderr, "ERROR: Plugin path too long: %s\n", plugin_name);
+            return 1;
+        }
+        if(0 == access(so_file_path, R_OK))
+        {
+            *isa_level = level;
+            return 0;
+        }
+        if(NULL != g_forced_isa_level)
+        {
+            fprintf(stderr, "ERROR: no %s build of plugin %s (%s)\n", level, plugin_name, so_file_path);
+            return 1;
         }
     }
 
-    //finalize  and free resources from all plugins
-    for(int fini_index = 0; fini_index < num_of_plugins; fini_index++)
+    len = snprintf(so_file_path, path_size, "output/%s.so", plugin_name);
+    if(len < 0 || (size_t)len >= path_size) 
     {
-        
+        fprintf(stderr, "ERROR: Plugin path too long: %s\n", plugin_name);
+        return 1;
+    }
+    return 0;
+}
 
-        if(NULL != plugins_arr[fini_index].fini)
+// lean mode loading - plain dlopen, the plugins share the analyzer's libc and malloc
+// the first instance of a plugin maps the .so file itself, every other instance needs its own
+// copy of the globals, so we load a private copy of the file
+// the copy name has the instance id in it - the loader reuses an already loaded object with the same name
+static void* load_plugin_without_namespace(const char* so_file_path, const char* plugin_name, int instance_id)
+{
+    void* already_loaded = dlopen(so_file_path, RTLD_NOW | RTLD_LOCAL | RTLD_NOLOAD);
+    if(NULL == already_loaded)
+    {
+        return dlopen(so_file_path, RTLD_NOW | RTLD_LOCAL);
+    }
+    dlclose(already_loaded); //drop the reference RTLD_NOLOAD took
+
+    char copy_dir[] = "/tmp/analyzer-XXXXXX";
+    if(NULL == mkdtemp(copy_dir))
+    {
+        return NULL;
+    }
+    char copy_path[MAX_FILE_NAME_LENGTH];
+    int len = snprintf(copy_path, sizeof(copy_path), "%s/%s.%d.so", copy_dir, plugin_name, instance_id);
+    if(len < 0 || len >= (int)sizeof(copy_path))
+    {
+        rmdir(copy_dir);
+        return NULL;
+    }
+
+    int source_fd = open(so_file_path, O_RDONLY | O_CLOEXEC);
+    int copy_fd = open(copy_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0700);
+    struct stat source_stat;
+    off_t copied = 0;
+    if(source_fd >= 0 && copy_fd >= 0 && 0 == fstat(source_fd, &source_stat))
+    {
+        while(copied < source_stat.st_size)
         {
-            const char* fini_error = plugins_arr[fini_index].fini();
-            if(NULL != fini_error)
+            ssize_t sent = sendfile(copy_fd, source_fd, &copied, source_stat.st_size - copied);
+            if(sent <= 0)
             {
-                //plugins_arr[fini_index].fini();
-                fprintf(stderr, "Warning: plugin_fini returned error for plugin %s: %s\n", 
-                        plugins_arr[fini_index].plugin_name, fini_error);        
+                break;
             }
         }
+    }
+
+    void* handle = NULL;
+    if(source_fd >= 0 && copy_fd >= 0 && copied == source_stat.st_size)
+    {
+        handle = dlopen(copy_path, RTLD_NOW | RTLD_LOCAL);
+    }
+    if(source_fd >= 0)
+    {
+        close(source_fd);
+    }
+    if(copy_fd >= 0)
+    {
+        close(copy_fd);
+    }
+    //the mapping keeps the copy alive, nothing is left behind on disk
+    unlink(copy_path);
+    rmdir(copy_dir);
+    return handle;
+}
+
+static int set_stage_stack_size(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous || 0 == plugin->settings.stack_size_kb)
+        {
+            continue;
+        }
+        if(NULL == plugin->set_stack_size)
+        {
+            fprintf(stderr, "Error: plugin %s does not support setting the stack size\n", plugin->plugin_name);
+            return 1;
+        }
 
-        //free all resources allocated for this plugin
-        free_plugin_resources(&plugins_arr[fini_index]);
+        const char* stack_error = plugin->set_stack_size((size_t)plugin->settings.stack_size_kb * 1024);
+        if(NULL != stack_error)
+        {
+            fprintf(stderr, "Error: failed to set the stack size of %s: %s\n", plugin->plugin_name, stack_error);
+            return 1;
+        }
     }
+    return 0;
+}
 
-    free(plugins_arr);
+static int set_stage_queue_bytes(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous || 0 == plugin->settings.ring_bytes)
+        {
+            continue;
+        }
+        if(NULL == plugin->set_queue_bytes)
+        {
+            fprintf(stderr, "Error: plugin %s does not support the byte ring queue\n", plugin->plugin_name);
+            return 1;
+        }
+
+        const char* ring_error = plugin->set_queue_bytes((size_t)plugin->settings.ring_bytes);
+        if(NULL != ring_error)
+        {
+            fprintf(stderr, "Error: failed to set the queue ring of %s: %s\n", plugin->plugin_name, ring_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int set_stage_backlog_compression(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous || 0 == plugin->settings.compress_after)
+        {
+            continue;
+        }
+        if(NULL == plugin->set_backlog_compression)
+        {
+            fprintf(stderr, "Error: plugin %s does not support backlog compression\n", plugin->plugin_name);
+            return 1;
+        }
+
+        const char* backlog_error = plugin->set_backlog_compression(plugin->settings.compress_after);
+        if(NULL != backlog_error)
+        {
+            fprintf(stderr, "Error: failed to set the backlog compression of %s: %s\n", plugin->plugin_name, backlog_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// partitions and relaxed order, stateless plugins ignore both so only the stages that have them are told
+static int set_partitioned_stage_options(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+
+        const char* partition_error = NULL;
+        if(plugin->settings.partitions > 0 && NULL != plugin->set_partitions)
+        {
+            partition_error = plugin->set_partitions(plugin->settings.partitions);
+        }
+        if(NULL == partition_error && plugin->settings.relaxed_order && NULL != plugin->set_relaxed_order)
+        {
+            partition_error = plugin->set_relaxed_order(1);
+        }
+        if(NULL != partition_error)
+        {
+            fprintf(stderr, "Error: failed to set the partitions of %s: %s\n", plugin->plugin_name, partition_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// credit batch, overflow policy and CPU placement - only plan files set them
+static int set_stage_flow_options(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+
+        const char* flow_error = NULL;
+        const char* missing_setter = NULL;
+        if(plugin->settings.credit_batch > 0)
+        {
+            if(NULL == plugin->set_credit_batch) missing_setter = "batch";
+            else flow_error = plugin->set_credit_batch(plugin->settings.credit_batch);
+        }
+        if(NULL == flow_error && NULL == missing_setter && plugin->settings.overflow_drop)
+        {
+            if(NULL == plugin->set_overflow_policy) missing_setter = "overflow";
+            else flow_error = plugin->set_overflow_policy(1);
+        }
+        if(NULL == flow_error && NULL == missing_setter && plugin->settings.cpu >= 0)
+        {
+            if(NULL == plugin->set_cpu) missing_setter = "cpu";
+            else flow_error = plugin->set_cpu(plugin->settings.cpu);
+        }
+        if(NULL != missing_setter)
+        {
+            fprintf(stderr, "Error: plugin %s does not support the %s setting\n", plugin->plugin_name, missing_setter);
+            return 1;
+        }
+        if(NULL != flow_error)
+        {
+            fprintf(stderr, "Error: failed to set the flow options of %s: %s\n", plugin->plugin_name, flow_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// --alloc-profile - every stage allocates through a counting allocator of its own
+static int set_stage_alloc_profiles(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    g_alloc_profiles = (alloc_profile_t*)calloc(num_of_plugins, sizeof(alloc_profile_t));
+    if(NULL == g_alloc_profiles)
+    {
+        fprintf(stderr, "Error: Failed to allocate the allocation profiles.\n");
+        return 1;
+    }
+
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        //a fused plugin transforms in place inside its stage, it has nothing of its own to count
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+        if(NULL == plugin->set_allocator)
+        {
+            fprintf(stderr, "Error: plugin %s does not support --alloc-profile (no plugin_set_allocator)\n", plugin->plugin_name);
+            return 1;
+        }
+        pipeline_allocator_t counting_allocator;
+        alloc_profile_init(&g_alloc_profiles[current_index], &counting_allocator);
+        const char* allocator_error = plugin->set_allocator(&counting_allocator);
+        if(NULL != allocator_error)
+        {
+            fprintf(stderr, "Error: Failed to set the allocator of plugin %s: %s\n", plugin->plugin_name, allocator_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// --lock-profile - the input queue of every stage records the contention of its locks
+static int set_stage_lock_profiles(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        //a fused plugin has no queue of its own
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+        if(NULL == plugin->set_lock_profile || NULL == plugin->get_lock_profile)
+        {
+            fprintf(stderr, "Error: plugin %s does not support --lock-profile (no plugin_set_lock_profile)\n", plugin->plugin_name);
+            return 1;
+        }
+        const char* lock_profile_error = plugin->set_lock_profile(1);
+        if(NULL != lock_profile_error)
+        {
+            fprintf(stderr, "Error: Failed to enable the lock profile of plugin %s: %s\n", plugin->plugin_name, lock_profile_error);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the stage settings the command line options stand for, the same for every stage
+static void command_line_stage_settings(const analyzer_options_t* options, int queue_size, stage_settings_t* settings)
+{
+    memset(settings, 0, sizeof(stage_settings_t));
+    settings->queue_size = queue_size;
+    settings->partitions = options->partitions;
+    settings->relaxed_order = options->relaxed_order;
+    settings->ring_bytes = options->ring_bytes;
+    settings->compress_after = options->compress_backlog;
+    settings->stack_size_kb = options->stack_size_kb;
+    settings->cpu = -1;
+}
+
+// every plugin gets the settings of its stage, from the plan or the same command line values for all
+static void assign_stage_settings(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options,
+                                  const pipeline_plan_t* plan, int queue_size)
+{
+    stage_settings_t command_line_settings;
+    command_line_stage_settings(options, queue_size, &command_line_settings);
+
+    int stage_index = -1;
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous)
+        {
+            stage_index++;
+        }
+        plugins_arr[current_index].settings = *plan_stage_settings(plan, stage_index, &command_line_settings);
+    }
+}
+
+// the command line checks its values while parsing, plan values are checked here
+static int validate_stage_settings(plugin_handle_t* plugins_arr, int num_of_plugins, int executor_workers)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        const stage_settings_t* settings = &plugins_arr[current_index].settings;
+        const char* plugin_name = plugins_arr[current_index].plugin_name;
+        if(plugins_arr[current_index].fused_into_previous)
+        {
+            continue;
+        }
+        if(NULL != plugins_arr[current_index].params)
+        {
+            if(NULL == plugins_arr[current_index].init_ex)
+            {
+                fprintf(stderr, "Error: stage %s: the plugin takes no parameters (no plugin_init_ex)\n", plugin_name);
+                return 1;
+            }
+            plugin_param_t params[PLUGIN_MAX_PARAMS];
+            char* params_text = strdup(plugins_arr[current_index].params);
+            int num_params = (NULL == params_text) ? -1 : split_stage_params(params_text, params, PLUGIN_MAX_PARAMS);
+            free(params_text);
+            if(num_params < 0)
+            {
+                fprintf(stderr, "Error: stage %s: invalid parameters '%s'\n", plugin_name, plugins_arr[current_index].params);
+                return 1;
+            }
+        }
+        if(settings->partitions > MAX_PARTITIONS)
+        {
+            fprintf(stderr, "Error: stage %s: partitions must be 1 to %d\n", plugin_name, MAX_PARTITIONS);
+            return 1;
+        }
+        if(settings->ring_bytes > 0 && settings->ring_bytes < MIN_RING_BYTES)
+        {
+            fprintf(stderr, "Error: stage %s: ring_bytes must be at least %d\n", plugin_name, MIN_RING_BYTES);
+            return 1;
+        }
+        //the backlog replaces the separate strings of the pointer layout, a ring has none
+        if(settings->compress_after > 0 && settings->ring_bytes > 0)
+        {
+            fprintf(stderr, "Error: stage %s: compress_after and ring_bytes do not go together\n", plugin_name);
+            return 1;
+        }
+        if(settings->cpu >= 0 && (settings->cpu >= CPU_SETSIZE || settings->cpu >= sysconf(_SC_NPROCESSORS_CONF)))
+        {
+            fprintf(stderr, "Error: stage %s: no cpu %d on this machine\n", plugin_name, settings->cpu);
+            return 1;
+        }
+        //the executor workers run every stage, there is no stage thread to pin
+        if(settings->cpu >= 0 && executor_workers > 0)
+        {
+            fprintf(stderr, "Error: stage %s: cpu placement needs one thread per stage (no workers)\n", plugin_name);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void free_plugin_resources(plugin_handle_t* plugin_handle)
+{
+    if(NULL == plugin_handle)
+    {
+        return;
+    }
+
+    if(NULL != plugin_handle->plugin_name)
+    {
+        //free plugin name
+        free(plugin_handle->plugin_name);
+        plugin_handle->plugin_name = NULL;
+    }
+
+    free(plugin_handle->params);
+    plugin_handle->params = NULL;
+
+    if(NULL != plugin_handle->dynamic_library_handle)
+    {
+        dlclose(plugin_handle->dynamic_library_handle);
+        plugin_handle->dynamic_library_handle = NULL;
+    }
+
+    
+
+    plugin_handle->instance_id = 0;
+}
+
+static void cleanup_all_plugins_in_range(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    if(NULL == plugins_arr || num_of_plugins <= 0)
+    {
+        return;
+    }
+
+    //in executor mode the stages only move while the workers run, without them waiting would block forever
+    int can_wait_for_stages = !g_executor_mode || g_executor_running;
+
+    for(int wait_index = 0; wait_index < num_of_plugins && can_wait_for_stages; wait_index++)
+    {
+        //wait until all plugins will finish processing
+        //TOCHECK: are we sure we need to wait for all of them? what if one of them failed to initialize? or get into deadlock? חס וחלילה
+        if(NULL != plugins_arr[wait_index].wait_finished && !plugins_arr[wait_index].fused_into_previous &&
+           plugins_arr[wait_index].initialized)
+        {
+            const char* wait_error = plugins_arr[wait_index].wait_finished();
+            if(NULL != wait_error)
+            {
+                fprintf(stderr, "Warning: plugin_wait_finished returned error for plugin %s: %s\n", 
+                        plugins_arr[wait_index].plugin_name, wait_error);
+                plugins_arr[wait_index].wait_finished(); // try again מה כבר יקרה YOLO
+                //fprintf(stderr, "Warning: plugin_wait_finished returned error for plugin %s: %s\n", plugins_arr[wait_index].plugin_name, wait_error);
+            }
+        }
+    }
+
+    //the workers may still be inside plugin_step, they must be gone before plugin_fini frees the queues
+    stop_stage_executor();
+    //same for the metrics reporter, it writes its last report while the stats are still there
+    stop_metrics_reporter();
+    stop_stall_watchdog();
+    stop_memory_trimmer();
+    //on the error paths the file was not closed yet, whatever arrived is kept
+    close_output_file();
+
+    //finalize  and free resources from all plugins
+    for(int fini_index = 0; fini_index < num_of_plugins; fini_index++)
+    {
+        
+
+        if(NULL != plugins_arr[fini_index].fini)
+        {
+            const char* fini_error = plugins_arr[fini_index].fini();
+            if(NULL != fini_error)
+            {
+                //plugins_arr[fini_index].fini();
+                fprintf(stderr, "Warning: plugin_fini returned error for plugin %s: %s\n", 
+                        plugins_arr[fini_index].plugin_name, fini_error);        
+            }
+        }
+
+        //free all resources allocated for this plugin
+        free_plugin_resources(&plugins_arr[fini_index]);
+    }
+
+    free(plugins_arr);
+}
+
+// parse the --options before the queue size
+// returns the index of the first positional argument, -1 on invalid option
+static int parse_options(int argc, char* argv[], analyzer_options_t* options)
+{
+    memset(options, 0, sizeof(analyzer_options_t));
+    options->trim_warm_bytes = MEMORY_TRIM_DEFAULT_WARM_BYTES;
+
+    int arg_index = 1;
+    int replay_speed_given = 0;
+    while(arg_index < argc && 0 == strncmp(argv[arg_index], "--", 2))
+    {
+        if(0 == strcmp(argv[arg_index], "--workers") && arg_index + 1 < argc)
+        {
+            //same rules as the queue size - a positive number
+            options->executor_workers = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->executor_workers)
+            {
+                fprintf(stderr, "Error: Invalid --workers value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--isa") && arg_index + 1 < argc)
+        {
+            const char* level = argv[arg_index + 1];
+            int is_known_level = (0 == strcmp(level, "auto") || 0 == strcmp(level, "baseline"));
+            for(int level_index = 0; level_index < NUM_OF_ISA_LEVELS; level_index++)
+            {
+                is_known_level |= (0 == strcmp(level, isa_levels_best_first[level_index]));
+            }
+            if(!is_known_level)
+            {
+                fprintf(stderr, "Error: Unknown --isa level: %s\n", level);
+                return -1;
+            }
+            g_forced_isa_level = (0 == strcmp(level, "auto")) ? NULL : level;
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--stats"))
+        {
+            options->print_stats = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--metrics") && arg_index + 1 < argc)
+        {
+            options->metrics_target = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--metrics-interval") && arg_index + 1 < argc)
+        {
+            options->metrics_interval_ms = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->metrics_interval_ms)
+            {
+                fprintf(stderr, "Error: Invalid --metrics-interval value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--watchdog-ms") && arg_index + 1 < argc)
+        {
+            options->watchdog_ms = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->watchdog_ms)
+            {
+                fprintf(stderr, "Error: Invalid --watchdog-ms value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--trim-idle-ms") && arg_index + 1 < argc)
+        {
+            options->trim_idle_ms = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->trim_idle_ms)
+            {
+                fprintf(stderr, "Error: Invalid --trim-idle-ms value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--trim-warm-bytes") && arg_index + 1 < argc)
+        {
+            //0 is fine here, everything idle goes back
+            options->trim_warm_bytes = (0 == strcmp(argv[arg_index + 1], "0")) ? 0 : parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->trim_warm_bytes)
+            {
+                fprintf(stderr, "Error: Invalid --trim-warm-bytes value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--journal") && arg_index + 1 < argc)
+        {
+            options->journal_dir = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--journal-batch") && arg_index + 1 < argc)
+        {
+            options->journal_batch = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->journal_batch)
+            {
+                fprintf(stderr, "Error: Invalid --journal-batch value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--journal-sync-ms") && arg_index + 1 < argc)
+        {
+            options->journal_sync_ms = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->journal_sync_ms)
+            {
+                fprintf(stderr, "Error: Invalid --journal-sync-ms value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--record") && arg_index + 1 < argc)
+        {
+            options->record_path = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--replay") && arg_index + 1 < argc)
+        {
+            options->replay_path = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--replay-speed") && arg_index + 1 < argc)
+        {
+            const char* speed_arg = argv[arg_index + 1];
+            char* end_ptr = NULL;
+            options->replay_speed = (0 == strcmp(speed_arg, "max")) ? 0 : strtod(speed_arg, &end_ptr);
+            if(NULL != end_ptr && ('\0' != *end_ptr || !(options->replay_speed > 0)))
+            {
+                fprintf(stderr, "Error: Invalid --replay-speed value: %s\n", speed_arg);
+                return -1;
+            }
+            replay_speed_given = 1;
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--ring-bytes") && arg_index + 1 < argc)
+        {
+            options->ring_bytes = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->ring_bytes || options->ring_bytes < MIN_RING_BYTES)
+            {
+                fprintf(stderr, "Error: Invalid --ring-bytes value: %s (at least %d)\n", argv[arg_index + 1], MIN_RING_BYTES);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--compress-backlog") && arg_index + 1 < argc)
+        {
+            options->compress_backlog = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->compress_backlog)
+            {
+                fprintf(stderr, "Error: Invalid --compress-backlog value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--partitions") && arg_index + 1 < argc)
+        {
+            options->partitions = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->partitions || options->partitions > MAX_PARTITIONS)
+            {
+                fprintf(stderr, "Error: Invalid --partitions value: %s (1 to %d)\n", argv[arg_index + 1], MAX_PARTITIONS);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--relaxed-order"))
+        {
+            options->relaxed_order = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--output") && arg_index + 1 < argc)
+        {
+            options->output_path = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--output-writers") && arg_index + 1 < argc)
+        {
+            options->output_writers = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->output_writers || options->output_writers > OUTPUT_SINK_MAX_WRITERS)
+            {
+                fprintf(stderr, "Error: Invalid --output-writers value: %s (1 to %d)\n", argv[arg_index + 1], OUTPUT_SINK_MAX_WRITERS);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--plan") && arg_index + 1 < argc)
+        {
+            options->plan_path = argv[arg_index + 1];
+            arg_index += 2;
+        }
+        else if(0 == strcmp(argv[arg_index], "--explain"))
+        {
+            options->explain = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--calibrate"))
+        {
+            options->calibrate = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--alloc-profile"))
+        {
+            options->alloc_profile = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--lock-profile"))
+        {
+            options->lock_profile = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--no-credits"))
+        {
+            g_credit_flow_control = 0;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--lean"))
+        {
+            options->lean_mode = 1;
+            arg_index++;
+        }
+        else if(0 == strcmp(argv[arg_index], "--stack-size") && arg_index + 1 < argc)
+        {
+            options->stack_size_kb = parse_queue_size_arg(argv[arg_index + 1]);
+            if(-1 == options->stack_size_kb)
+            {
+                fprintf(stderr, "Error: Invalid --stack-size value: %s\n", argv[arg_index + 1]);
+                return -1;
+            }
+            arg_index += 2;
+        }
+        else
+        {
+            fprintf(stderr, "Error: Unknown option: %s\n", argv[arg_index]);
+            return -1;
+        }
+    }
+
+    if(0 == options->metrics_interval_ms)
+    {
+        options->metrics_interval_ms = DEFAULT_METRICS_INTERVAL_MS;
+    }
+    if(0 == options->output_writers)
+    {
+        options->output_writers = DEFAULT_OUTPUT_WRITERS;
+    }
+    if(0 == options->journal_batch)
+    {
+        options->journal_batch = JOURNAL_DEFAULT_BATCH_LINES;
+    }
+    if(0 == options->journal_sync_ms)
+    {
+        options->journal_sync_ms = JOURNAL_DEFAULT_SYNC_MS;
+    }
+
+    if(NULL != options->record_path && NULL != options->replay_path)
+    {
+        fprintf(stderr, "Error: --record and --replay cannot be used together\n");
+        return -1;
+    }
+    //a trace is already a durable copy of the input
+    if(NULL != options->journal_dir && NULL != options->replay_path)
+    {
+        fprintf(stderr, "Error: --journal and --replay cannot be used together\n");
+        return -1;
+    }
+    if(!replay_speed_given)
+    {
+        options->replay_speed = 1.0;
+    }
+
+    if(options->lean_mode)
+    {
+        g_lean_mode = 1;
+        if(0 == options->stack_size_kb)
+        {
+            options->stack_size_kb = LEAN_STACK_SIZE_KB;
+        }
+        //all the plugins share our malloc now, no need for an arena per thread
+        mallopt(M_ARENA_MAX, LEAN_MALLOC_ARENA_MAX);
+    }
+
+    return arg_index;
+}
+
+static int enable_executor_mode(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+
+        if(NULL == plugin->use_executor || NULL == plugin->step)
+        {
+            fprintf(stderr, "Error: plugin %s does not support executor mode\n", plugin->plugin_name);
+            return 1;
+        }
+
+        const char* executor_error = plugin->use_executor();
+        if(NULL != executor_error)
+        {
+            fprintf(stderr, "Error: failed to enable executor mode for %s: %s\n", plugin->plugin_name, executor_error);
+            return 1;
+        }
+    }
+
+    g_executor_mode = 1;
+    return 0;
+}
+
+static int start_stage_executor(plugin_handle_t* plugins_arr, int num_of_plugins, int num_workers)
+{
+    executor_step_func* steps = (executor_step_func*)calloc(num_of_plugins, sizeof(executor_step_func));
+    if(NULL == steps)
+    {
+        return 1;
+    }
+
+    int num_of_stages = 0;
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous)
+        {
+            steps[num_of_stages++] = plugins_arr[current_index].step;
+        }
+    }
+
+    const char* executor_error = executor_start(&g_stage_executor, steps, num_of_stages, num_workers);
+    free(steps);
+    if(NULL != executor_error)
+    {
+        fprintf(stderr, "Error: %s\n", executor_error);
+        return 1;
+    }
+
+    g_executor_running = 1;
+    return 0;
+}
+
+static void stop_stage_executor(void)
+{
+    if(!g_executor_running)
+    {
+        return;
+    }
+    executor_stop(&g_stage_executor);
+    g_executor_running = 0;
+}
+
+// one line per stage (fused plugins are listed with the stage that runs them)
+// goes to stderr so the pipeline output on stdout stays the same
+static void print_stage_stats(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    fprintf(stderr, "%-32s %10s %10s %10s %10s\n", "stage", "items", "cpu_ms", "user_ms", "sys_ms");
+
+    for(int stage_index = 0; stage_index < num_of_plugins; stage_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[stage_index];
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+
+        char stage_label[MAX_FILE_NAME_LENGTH];
+        format_stage_label(plugins_arr, num_of_plugins, stage_index, stage_label, sizeof(stage_label));
+
+        plugin_stats_t stats;
+        if(NULL == plugin->get_stats || NULL != plugin->get_stats(&stats))
+        {
+            fprintf(stderr, "%-32s %10s\n", stage_label, "n/a");
+            continue;
+        }
+        fprintf(stderr, "%-32s %10llu %10.3f %10.3f %10.3f\n", stage_label, stats.items_processed,
+                stats.cpu_time_ns / 1e6, stats.user_time_ns / 1e6, stats.system_time_ns / 1e6);
+        if(plugin->settings.compress_after > 0)
+        {
+            fprintf(stderr, "  backlog: %llu blocks compressed, %llu -> %llu bytes (%.1fx), peak %llu bytes\n",
+                    stats.backlog_blocks, stats.backlog_plain_bytes, stats.backlog_compressed_bytes,
+                    (stats.backlog_compressed_bytes > 0) ? (double)stats.backlog_plain_bytes / stats.backlog_compressed_bytes : 0.0,
+                    stats.backlog_peak_bytes);
+        }
+    }
+}
+
+// --alloc-profile report - the stages are done, what is still in flight is their queue and leftovers
+static void print_alloc_profiles(plugin_handle_t* plugins_arr, int num_of_plugins)
+{
+    fprintf(stderr, "%-32s %10s %12s %11s %11s %12s %12s\n", "stage", "items", "allocs/item", "bytes/item", "frees/item", "peak_bytes", "in_flight");
+
+    for(int stage_index = 0; NULL != g_alloc_profiles && stage_index < num_of_plugins; stage_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[stage_index];
+        if(plugin->fused_into_previous)
+        {
+            continue;
+        }
+
+        char stage_label[MAX_FILE_NAME_LENGTH];
+        format_stage_label(plugins_arr, num_of_plugins, stage_index, stage_label, sizeof(stage_label));
+
+        plugin_stats_t stats;
+        unsigned long long items = 0;
+        if(NULL != plugin->get_stats && NULL == plugin->get_stats(&stats))
+        {
+            items = stats.items_processed;
+        }
+        alloc_profile_t profile;
+        alloc_profile_snapshot(&g_alloc_profiles[stage_index], &profile);
+        double per_item = (items > 0) ? 1.0 / (double)items : 0;
+        fprintf(stderr, "%-32s %10llu %12.2f %11.1f %11.2f %12llu %12llu\n", stage_label, items,
+                profile.allocations * per_item, profile.bytes_allocated * per_item, profile.frees * per_item,
+                profile.peak_bytes_in_flight, profile.bytes_in_flight);
+    }
+}
+
+// --lock-profile report - one line per lock of every stage, then the wait/hold histograms of the
+// contended ones and how much of the run all the stages together spent waiting for and holding locks
+static void print_lock_profiles(plugin_handle_t* plugins_arr, int num_of_plugins, unsigned long long run_ns)
+{
+    fprintf(stderr, "%-32s %-12s %12s %10s %9s %10s %10s %10s %10s\n", "stage", "lock", "acquired", "contended", "contend%",
+            "wait_ms", "wait_p99", "hold_ms", "hold_p99");
+
+    unsigned long long total_acquisitions = 0;
+    unsigned long long total_wait_ns = 0;
+    unsigned long long total_hold_ns = 0;
+    for(int stage_index = 0; stage_index < num_of_plugins; stage_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[stage_index];
+        if(plugin->fused_into_previous || NULL == plugin->get_lock_profile)
+        {
+            continue;
+        }
+
+        char stage_label[MAX_FILE_NAME_LENGTH];
+        format_stage_label(plugins_arr, num_of_plugins, stage_index, stage_label, sizeof(stage_label));
+
+        lock_profile_t profile;
+        const char* lock_name = NULL;
+        for(int lock = 0; NULL == plugin->get_lock_profile(lock, &profile, &lock_name); lock++)
+        {
+            unsigned long long hold_count = 0;
+            for(int bucket = 0; bucket < LOCK_PROFILE_BUCKETS; bucket++)
+            {
+                hold_count += profile.hold_buckets[bucket];
+            }
+            double contended_percent = (profile.acquisitions > 0) ? 100.0 * profile.contended / profile.acquisitions : 0;
+            fprintf(stderr, "%-32s %-12s %12llu %10llu %8.2f%% %10.3f %8llu ns %10.3f %8llu ns\n", stage_label, lock_name,
+                    profile.acquisitions, profile.contended, contended_percent, profile.wait_sum_ns / 1e6,
+                    lock_profile_percentile_ns(profile.wait_buckets, profile.contended, 99), profile.hold_sum_ns / 1e6,
+                    lock_profile_percentile_ns(profile.hold_buckets, hold_count, 99));
+
+            //the histograms only for the locks threads actually waited on, bucket upper bounds in ns
+            if(profile.contended > 0)
+            {
+                const unsigned long long* histograms[2] = { profile.wait_buckets, profile.hold_buckets };
+                for(int histogram = 0; histogram < 2; histogram++)
+                {
+                    fprintf(stderr, "%-32s   %s", "", (0 == histogram) ? "wait" : "hold");
+                    for(int bucket = 0; bucket < LOCK_PROFILE_BUCKETS; bucket++)
+                    {
+                        if(0 == histograms[histogram][bucket])
+                        {
+                            continue;
+                        }
+                        unsigned long long bound = lock_profile_bucket_bound_ns(bucket);
+                        if(0 == bound)
+                        {
+                            fprintf(stderr, " +Inf:%llu", histograms[histogram][bucket]);
+                        }
+                        else
+                        {
+                            fprintf(stderr, " %llu:%llu", bound, histograms[histogram][bucket]);
+                        }
+                    }
+                    fprintf(stderr, "\n");
+                }
+            }
+
+            total_acquisitions += profile.acquisitions;
+            total_wait_ns += profile.wait_sum_ns;
+            total_hold_ns += profile.hold_sum_ns;
+        }
+    }
+
+    //summed over all the threads, so with several stages busy at once it can pass 100% of the run
+    double run_ms = run_ns / 1e6;
+    fprintf(stderr, "locks: %llu acquisitions, %.3f ms waiting (%.2f%% of the %.3f ms run), %.3f ms held (%.2f%%)\n",
+            total_acquisitions, total_wait_ns / 1e6, (run_ns > 0) ? 100.0 * total_wait_ns / run_ns : 0, run_ms,
+            total_hold_ns / 1e6, (run_ns > 0) ? 100.0 * total_hold_ns / run_ns : 0);
+}
+
+// upper bound of the histogram bucket holding the given percentile, 0 without samples
+static unsigned long long lock_profile_percentile_ns(const unsigned long long* buckets, unsigned long long count, int percent)
+{
+    if(0 == count)
+    {
+        return 0;
+    }
+    unsigned long long wanted = (count * (unsigned long long)percent + 99) / 100;
+    unsigned long long seen = 0;
+    for(int bucket = 0; bucket < LOCK_PROFILE_BUCKETS - 1; bucket++)
+    {
+        seen += buckets[bucket];
+        if(seen >= wanted)
+        {
+            return lock_profile_bucket_bound_ns(bucket);
+        }
+    }
+    //past the last bound, report the last finite one
+    return lock_profile_bucket_bound_ns(LOCK_PROFILE_BUCKETS - 2);
+}
+
+// --calibrate - measure every plugin, let the cost model choose the fusion and the shards, print both plans
+static int calibrate_pipeline(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options)
+{
+    calibration_target_t* targets = (calibration_target_t*)calloc(num_of_plugins, sizeof(calibration_target_t));
+    calibration_result_t* results = (calibration_result_t*)calloc(num_of_plugins, sizeof(calibration_result_t));
+    calibration_plugin_t* costs = (calibration_plugin_t*)calloc(num_of_plugins, sizeof(calibration_plugin_t));
+    int* plan_arrays = (int*)calloc(4 * (size_t)num_of_plugins, sizeof(int));
+    if(NULL == targets || NULL == results || NULL == costs || NULL == plan_arrays)
+    {
+        fprintf(stderr, "Error: Failed to allocate the calibration.\n");
+        free(targets);
+        free(results);
+        free(costs);
+        free(plan_arrays);
+        return 1;
+    }
+
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        targets[current_index].name = plugin->plugin_name;
+        targets[current_index].params = plugin->params;
+        targets[current_index].queue_size = plugin->settings.queue_size;
+        targets[current_index].transform_inplace = plugin->transform_inplace;
+        targets[current_index].place_work = plugin->place_work;
+        targets[current_index].step = plugin->step;
+        targets[current_index].attach = plugin->attach;
+    }
+    double handoff_ns = calibration_measure_handoff_ns(CALIBRATION_HANDOFF_ITEMS);
+    int measure_result = (handoff_ns < 0) ? -1 :
+        calibration_measure_plugins(targets, num_of_plugins, start_calibration_stage, plugins_arr, results);
+    free(targets);
+    if(0 != measure_result)
+    {
+        fprintf(stderr, "Error: Calibration failed.\n");
+        free(results);
+        free(costs);
+        free(plan_arrays);
+        return 1;
+    }
+
+    //the stages share the CPUs, or the executor workers when there are fewer of them
+    int cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(cpus < 1)
+    {
+        cpus = 1;
+    }
+    if(options->executor_workers > 0 && options->executor_workers < cpus)
+    {
+        cpus = options->executor_workers;
+    }
+    int max_partitions = (cpus < MAX_PARTITIONS) ? cpus : MAX_PARTITIONS;
+
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        costs[current_index].stage_ns = results[current_index].stage_ns;
+        costs[current_index].inplace_ns = results[current_index].inplace_ns;
+        costs[current_index].partitioned = results[current_index].partitioned;
+        //the parameters belong to the init of a stage head, a plugin that did not run alone is left as it is
+        costs[current_index].must_start_stage = (0 == current_index) || NULL != plugins_arr[current_index].params ||
+                                                !results[current_index].measured;
+    }
+
+    calibration_plan_t given_plan = { plan_arrays, plan_arrays + num_of_plugins, 0, 0, 0, 0 };
+    calibration_plan_t chosen_plan = { plan_arrays + 2 * num_of_plugins, plan_arrays + 3 * num_of_plugins, 0, 0, 0, 0 };
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        given_plan.fused_into_previous[current_index] = plugins_arr[current_index].fused_into_previous;
+        given_plan.partitions[current_index] = (plugins_arr[current_index].settings.partitions > 1) ? plugins_arr[current_index].settings.partitions : 1;
+    }
+    calibration_predict(costs, num_of_plugins, handoff_ns, cpus, &given_plan);
+    const char* model_error = calibration_choose_plan(costs, num_of_plugins, handoff_ns, cpus, max_partitions, &chosen_plan);
+    if(NULL != model_error)
+    {
+        fprintf(stderr, "Error: %s\n", model_error);
+        free(results);
+        free(costs);
+        free(plan_arrays);
+        return 1;
+    }
+
+    //the report goes to stderr, stdout belongs to the pipeline
+    char cost_text[32];
+    char inplace_text[32];
+    calibration_format_cost(handoff_ns, cost_text, sizeof(cost_text));
+    fprintf(stderr, "Calibration: %d plugins, %d cpu%s, queue handoff %s/line\n", num_of_plugins, cpus, (1 == cpus) ? "" : "s", cost_text);
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        const calibration_result_t* result = &results[current_index];
+        char plugin_label[MAX_FILE_NAME_LENGTH];
+        snprintf(plugin_label, sizeof(plugin_label), "%s#%d", plugins_arr[current_index].plugin_name, plugins_arr[current_index].instance_id);
+        if(!result->measured)
+        {
+            fprintf(stderr, "  %-16s not measured, keeps a stage of its own\n", plugin_label);
+            continue;
+        }
+        calibration_format_cost(result->stage_ns, cost_text, sizeof(cost_text));
+        calibration_format_cost(result->inplace_ns, inplace_text, sizeof(inplace_text));
+        fprintf(stderr, "  %-16s %s%s/line as a stage", plugin_label,
+                (result->stage_ns >= CALIBRATION_PLUGIN_TIMEOUT_MS * 1e6) ? ">= " : "", cost_text);
+        if(result->inplace_ns >= 0)
+        {
+            fprintf(stderr, ", %s/line fused", inplace_text);
+        }
+        fprintf(stderr, "%s\n", result->partitioned ? ", key partitioned" : "");
+    }
+
+    char bottleneck_text[32];
+    calibration_format_cost(chosen_plan.bottleneck_ns, bottleneck_text, sizeof(bottleneck_text));
+    fprintf(stderr, "Chosen plan: %d stages, predicted %.0f lines/s (slowest stage %s#%d, %s/line), as given %.0f lines/s\n",
+            chosen_plan.num_stages, chosen_plan.throughput, plugins_arr[chosen_plan.bottleneck].plugin_name,
+            plugins_arr[chosen_plan.bottleneck].instance_id, bottleneck_text, given_plan.throughput);
+
+    //apply it - a new stage head keeps the settings of the stage it was in, a stateful one gets its shards
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugins_arr[current_index].fused_into_previous = chosen_plan.fused_into_previous[current_index];
+        if(costs[current_index].partitioned && !chosen_plan.fused_into_previous[current_index])
+        {
+            plugins_arr[current_index].settings.partitions = chosen_plan.partitions[current_index];
+        }
+    }
+    for(int stage_head_index = 0; stage_head_index < num_of_plugins; stage_head_index++)
+    {
+        if(plugins_arr[stage_head_index].fused_into_previous)
+        {
+            continue;
+        }
+        char stage_label[MAX_FILE_NAME_LENGTH];
+        format_stage_label(plugins_arr, num_of_plugins, stage_head_index, stage_label, sizeof(stage_label));
+        fprintf(stderr, "  stage %s", stage_label);
+        if(costs[stage_head_index].partitioned && plugins_arr[stage_head_index].settings.partitions > 1)
+        {
+            fprintf(stderr, " partitions=%d", plugins_arr[stage_head_index].settings.partitions);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    free(results);
+    free(costs);
+    free(plan_arrays);
+    return 0;
+}
+
+// --calibrate - runs inside the calibration child: the plugin starts as an executor stage with its parameters
+static int start_calibration_stage(void* context, int plugin_index, int* partitioned)
+{
+    plugin_handle_t* plugin_handle = &((plugin_handle_t*)context)[plugin_index];
+    if(NULL == plugin_handle->use_executor || NULL != plugin_handle->use_executor())
+    {
+        return -1;
+    }
+    const char* init_error = NULL;
+    if(NULL != plugin_handle->params && NULL != plugin_handle->init_ex)
+    {
+        plugin_param_t params[PLUGIN_MAX_PARAMS];
+        char params_text[Max_line_length];
+        snprintf(params_text, sizeof(params_text), "%s", plugin_handle->params);
+        plugin_config_t config = { plugin_handle->settings.queue_size, params, 0 };
+        config.num_params = split_stage_params(params_text, params, PLUGIN_MAX_PARAMS);
+        init_error = (config.num_params < 0) ? "Invalid stage parameters" : plugin_handle->init_ex(&config);
+    }
+    else
+    {
+        init_error = plugin_handle->init(plugin_handle->settings.queue_size);
+    }
+    if(NULL != init_error)
+    {
+        return -1;
+    }
+
+    plugin_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+    *partitioned = (NULL != plugin_handle->get_stats && NULL == plugin_handle->get_stats(&stats) && stats.partitions > 0);
+    return 0;
+}
+
+// --explain - what the pipeline would run, after the command line and the plan file were resolved
+static void print_execution_plan(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options)
+{
+    plan_plugin_t* plan_plugins = (plan_plugin_t*)calloc(num_of_plugins, sizeof(plan_plugin_t));
+    if(NULL == plan_plugins)
+    {
+        fprintf(stderr, "Error: Failed to allocate the execution plan.\n");
+        return;
+    }
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        plugin_handle_t* plugin = &plugins_arr[current_index];
+        plan_plugin_t* plan_plugin = &plan_plugins[current_index];
+        plan_plugin->name = plugin->plugin_name;
+        plan_plugin->instance_id = plugin->instance_id;
+        plan_plugin->fused_into_previous = plugin->fused_into_previous;
+        plan_plugin->params = plugin->params;
+        plan_plugin->isa_level = plugin->isa_level;
+        plan_plugin->settings = plugin->settings;
+        plan_plugin->transforms_inplace = (NULL != plugin->transform_inplace);
+        plan_plugin->can_partition = (NULL != plugin->set_partitions);
+        plan_plugin->attaches_credits = (NULL != plugin->attach_credits);
+        plan_plugin->grants_credits = (NULL != plugin->take_credits);
+        plan_plugin->attaches_offers = (NULL != plugin->attach_offer);
+        plan_plugin->accepts_offers = (NULL != plugin->offer_work);
+    }
+
+    plan_run_t run = { options->executor_workers, g_credit_flow_control, options->replay_path,
+                       options->record_path, options->output_path, options->output_writers };
+    plan_explain(stdout, &run, plan_plugins, num_of_plugins);
+    free(plan_plugins);
+}
+
+// "<plugin>#<instance>" followed by the plugins fused into the stage ("rotator#2+flipper")
+static void format_stage_label(plugin_handle_t* plugins_arr, int num_of_plugins, int stage_index, char* label, size_t label_size)
+{
+    int label_length = snprintf(label, label_size, "%s#%d", plugins_arr[stage_index].plugin_name, plugins_arr[stage_index].instance_id);
+    for(int fused_index = stage_index + 1; fused_index < num_of_plugins && plugins_arr[fused_index].fused_into_previous; fused_index++)
+    {
+        if(label_length < (int)label_size)
+        {
+            label_length += snprintf(label + label_length, label_size - label_length, "+%s", plugins_arr[fused_index].plugin_name);
+        }
+    }
+}
+
+// one entry per stage for the monitoring threads, the fused plugins are part of the stage label
+static int build_stage_table(plugin_handle_t* plugins_arr, int num_of_plugins, stage_table_t* table)
+{
+    memset(table, 0, sizeof(stage_table_t));
+    table->labels = calloc(num_of_plugins, STAGE_LABEL_LENGTH);
+    table->label_ptrs = (const char**)calloc(num_of_plugins, sizeof(char*));
+    table->get_stats = (plugin_get_stats_func*)calloc(num_of_plugins, sizeof(plugin_get_stats_func));
+    if(NULL == table->labels || NULL == table->label_ptrs || NULL == table->get_stats)
+    {
+        free_stage_table(table);
+        return 1;
+    }
+
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(plugins_arr[current_index].fused_into_previous)
+        {
+            continue;
+        }
+        format_stage_label(plugins_arr, num_of_plugins, current_index, table->labels[table->num_of_stages], STAGE_LABEL_LENGTH);
+        table->label_ptrs[table->num_of_stages] = table->labels[table->num_of_stages];
+        table->get_stats[table->num_of_stages] = plugins_arr[current_index].get_stats;
+        table->num_of_stages++;
+    }
+    return 0;
+}
+
+static void free_stage_table(stage_table_t* table)
+{
+    free(table->labels);
+    free(table->label_ptrs);
+    free(table->get_stats);
+    memset(table, 0, sizeof(stage_table_t));
+}
+
+static int start_metrics_reporter(plugin_handle_t* plugins_arr, int num_of_plugins, const char* target, int interval_ms)
+{
+    stage_table_t table;
+    if(0 != build_stage_table(plugins_arr, num_of_plugins, &table))
+    {
+        return 1;
+    }
+
+    const char* metrics_error = metrics_reporter_start(&g_metrics_reporter, table.label_ptrs, table.get_stats,
+                                                       table.num_of_stages, target, interval_ms);
+    free_stage_table(&table);
+    if(NULL != metrics_error)
+    {
+        fprintf(stderr, "Error: failed to start the metrics reporter: %s\n", metrics_error);
+        return 1;
+    }
+
+    g_metrics_running = 1;
+    return 0;
+}
+
+static int start_stall_watchdog(plugin_handle_t* plugins_arr, int num_of_plugins, int threshold_ms)
+{
+    stage_table_t table;
+    if(0 != build_stage_table(plugins_arr, num_of_plugins, &table))
+    {
+        return 1;
+    }
+
+    const char* watchdog_error = watchdog_start(&g_stall_watchdog, table.label_ptrs, table.get_stats,
+                                                table.num_of_stages, threshold_ms);
+    free_stage_table(&table);
+    if(NULL != watchdog_error)
+    {
+        fprintf(stderr, "Error: failed to start the watchdog: %s\n", watchdog_error);
+        return 1;
+    }
+
+    g_watchdog_running = 1;
+    return 0;
+}
+
+static void stop_stall_watchdog(void)
+{
+    if(!g_watchdog_running)
+    {
+        return;
+    }
+    watchdog_stop(&g_stall_watchdog);
+    g_watchdog_running = 0;
+}
+
+static int start_memory_trimmer(plugin_handle_t* plugins_arr, int num_of_plugins, int idle_ms, int warm_bytes)
+{
+    stage_table_t table;
+    memory_trim_stage_func* trim_funcs = (memory_trim_stage_func*)calloc(num_of_plugins, sizeof(memory_trim_stage_func));
+    if(NULL == trim_funcs || 0 != build_stage_table(plugins_arr, num_of_plugins, &table))
+    {
+        free(trim_funcs);
+        return 1;
+    }
+    //same order as the stage table - the stage heads
+    int stage_index = 0;
+    for(int current_index = 0; current_index < num_of_plugins; current_index++)
+    {
+        if(!plugins_arr[current_index].fused_into_previous)
+        {
+            trim_funcs[stage_index++] = plugins_arr[current_index].trim_memory;
+        }
+    }
+
+    const char* trim_error = memory_trim_start(&g_memory_trimmer, table.get_stats, trim_funcs,
+                                               table.num_of_stages, trim_host_memory, idle_ms, (size_t)warm_bytes);
+    free_stage_table(&table);
+    free(trim_funcs);
+    if(NULL != trim_error)
+    {
+        fprintf(stderr, "Error: failed to start the memory trimmer: %s\n", trim_error);
+        return 1;
+    }
+
+    g_memory_trimmer_running = 1;
+    return 0;
+}
+
+static void stop_memory_trimmer(void)
+{
+    if(!g_memory_trimmer_running)
+    {
+        return;
+    }
+    memory_trim_stop(&g_memory_trimmer);
+    g_memory_trimmer_running = 0;
+}
+
+static int open_input_journal(plugin_handle_t* plugins_arr, int num_of_plugins, const analyzer_options_t* options)
+{
+    //the drained check reads the stages from the journal thread until the journal is finished
+    if(0 != build_stage_table(plugins_arr, num_of_plugins, &g_journal_stages))
+    {
+        return 1;
+    }
+
+    const char* journal_error = journal_open(&g_input_journal, options->journal_dir, options->journal_batch,
+                                             options->journal_sync_ms, plugins_arr[0].place_work, input_journal_drained);
+    if(NULL != journal_error)
+    {
+        fprintf(stderr, "Error: failed to open the journal: %s: %s\n", journal_error, options->journal_dir);
+        free_stage_table(&g_journal_stages);
+        return 1;
+    }
+    if(g_input_journal.lines_recovered > 0)
+    {
+        fprintf(stderr, "Journal: recovered %llu lines of an earlier run from %s\n",
+                g_input_journal.lines_recovered, options->journal_dir);
+    }
+
+    g_input_journal_open = 1;
+    return 0;
+}
+
+// commit the pending lines and stop the journal thread, the stages get no more lines from it
+static int close_input_journal(void)
+{
+    if(!g_input_journal_open)
+    {
+        return 0;
+    }
+    const char* journal_error = journal_close(&g_input_journal);
+    if(NULL != journal_error)
+    {
+        fprintf(stderr, "Error: journal failed: %s\n", journal_error);
+        return 1;
+    }
+    return 0;
+}
+
+// acknowledge - the run ended cleanly and the segments go, otherwise they stay for the next run
+static void finish_input_journal(int acknowledge)
+{
+    if(!g_input_journal_open)
+    {
+        return;
+    }
+    close_input_journal();
+    if(acknowledge)
+    {
+        const char* journal_error = journal_acknowledge(&g_input_journal);
+        if(NULL != journal_error)
+        {
+            fprintf(stderr, "Warning: %s: the next run replays its lines again\n", journal_error);
+        }
+    }
+    else
+    {
+        journal_free(&g_input_journal);
+    }
+    free_stage_table(&g_journal_stages);
+    g_input_journal_open = 0;
+}
+
+// the journal thread asks before it deletes closed segments - every line it delivered went through
+// the first stage, no stage holds or queues an item, and nothing moved since the previous look
+// (an item between taking it off a queue and marking it in progress shows up as a move).
+// With --output the lines the last stage produced sit in the sink batches, they are written
+// and synced here before the answer is yes, or a crash right after would lose them.
+// The shards of a partitioned stage queue items the stats do not count, such a pipeline is never
+// considered drained and its segments go at the end of the run.
+static int input_journal_drained(unsigned long long lines_delivered)
+{
+    unsigned long long progress = 0;
+    int idle = 1;
+    for(int stage_index = 0; stage_index < g_journal_stages.num_of_stages; stage_index++)
+    {
+        plugin_stats_t stats;
+        if(NULL == g_journal_stages.get_stats[stage_index] || NULL != g_journal_stages.get_stats[stage_index](&stats) ||
+           stats.partitions > 0)
+        {
+            return 0;
+        }
+        if(stats.queue_depth > 0 || stats.item_in_progress ||
+           (0 == stage_index && stats.items_processed + stats.items_dropped < lines_delivered))
+        {
+            idle = 0;
+        }
+        progress += stats.items_processed + stats.items_dropped;
+    }
+
+    int unchanged = (progress == g_journal_last_progress);
+    g_journal_last_progress = progress;
+    if(!idle || !unchanged)
+    {
+        return 0;
+    }
+    return !g_output_sink_open || NULL == output_sink_flush(&g_output_sink);
+}
+
+// host pools of an idle pipeline - the free output batches, then the free malloc memory
+// the plugins share (item copies of the pointer queues, transform outputs)
+static size_t trim_host_memory(size_t keep_bytes)
+{
+    size_t released = 0;
+    if(g_output_sink_open)
+    {
+        released += output_sink_trim(&g_output_sink, keep_bytes);
+    }
+
+    //malloc_trim does not say how much it gave back, the resident size does
+    size_t resident_before = resident_memory_bytes();
+    malloc_trim(keep_bytes);
+    size_t resident_after = resident_memory_bytes();
+    if(resident_after < resident_before)
+    {
+        released += resident_before - resident_after;
+    }
+    return released;
+}
+
+// resident set size of the process, from /proc/self/statm
+static size_t resident_memory_bytes(void)
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if(NULL == statm)
+    {
+        return 0;
+    }
+    unsigned long total_pages = 0;
+    unsigned long resident_pages = 0;
+    int fields = fscanf(statm, "%lu %lu", &total_pages, &resident_pages);
+    fclose(statm);
+    return (2 == fields) ? (size_t)resident_pages * (size_t)sysconf(_SC_PAGESIZE) : 0;
+}
+
+static int open_output_file(const char* path, int num_writers)
+{
+    const char* sink_error = output_sink_open(&g_output_sink, path, num_writers);
+    if(NULL != sink_error)
+    {
+        fprintf(stderr, "Error: %s: %s\n", sink_error, path);
+        return -1;
+    }
+    g_output_sink_open = 1;
+    return 0;
+}
+
+// returns 0 when everything the last stage produced is in the file
+static int sync_output_file(void)
+{
+    if(!g_output_sink_open)
+    {
+        return 0;
+    }
+    const char* sink_error = output_sink_flush(&g_output_sink);
+    if(NULL != sink_error)
+    {
+        fprintf(stderr, "Error: %s\n", sink_error);
+        return -1;
+    }
+    return 0;
+}
+
+static int close_output_file(void)
+{
+    if(!g_output_sink_open)
+    {
+        return 0;
+    }
+    g_output_sink_open = 0;
+    const char* sink_error = output_sink_close(&g_output_sink);
+    if(NULL != sink_error)
+    {
+        fprintf(stderr, "Error: %s\n", sink_error);
+        return -1;
+    }
+    return 0;
+}
+
+// place_work of the output file - the last stage is attached to it like to a next stage
+static const char* place_work_into_output_file(const char* line)
+{
+    if(NULL == line)
+    {
+        return "Invalid line";
+    }
+    if(0 == strcmp(line, "<END>"))
+    {
+        return NULL;
+    }
+    return output_sink_append(&g_output_sink, line, strlen(line));
+}
+
+static void stop_metrics_reporter(void)
+{
+    if(!g_metrics_running)
+    {
+        return;
+    }
+    metrics_reporter_stop(&g_metrics_reporter);
+    g_metrics_running = 0;
 }
 
 static void display_usage_help(void) {
     printf("Usage: ./analyzer <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
+    printf("       ./analyzer [options] <queue_size> <plugin1> <plugin2> ... <pluginN>\n");
+    printf("       ./analyzer [options] --plan <plan_file>\n");
+    printf("Options:\n");
+    printf("  --workers N  Run all stages on N worker threads instead of one thread per stage\n");
+    printf("  --isa LEVEL  Plugin build to load: auto (default, best for this CPU), baseline,\n");
+    printf("               x86-64-v2, x86-64-v3 or x86-64-v4\n");
+    printf("  --lean       Small per-stage footprint for long chains: no linker namespace per plugin,\n");
+    printf("               %dKB thread stacks, shared malloc arenas\n", LEAN_STACK_SIZE_KB);
+    printf("  --stack-size KB  Stack size of the stage threads\n");
+    printf("  --ring-bytes N  Store the queued strings inline in a byte ring of N bytes per stage\n");
+    printf("               (at least %d) instead of one allocation per item\n", MIN_RING_BYTES);
+    printf("  --compress-backlog N  Keep only N queued items per stage as separate strings, a deeper backlog\n");
+    printf("               goes into blocks compressed in memory (less memory, more CPU), not with --ring-bytes\n");
+    printf("  --no-credits  Forward with a blocking put instead of credit based flow control\n");
+    printf("  --partitions N  Split every stateful stage (counter) by key over N threads, output order is kept\n");
+    printf("  --relaxed-order  Partitioned stages forward each line as soon as it is done (order not kept)\n");
+    printf("  --plan FILE  Take the chain and the per-stage settings (queue, partitions, order, ring_bytes,\n");
+    printf("               compress_after, stack_kb, batch, overflow, cpu) from a plan file instead of the arguments\n");
+    printf("  --explain    Print the resolved execution plan (fusion, threads, placement, fast paths) and exit\n");
+    printf("  --calibrate  Time every plugin and the queue handoff on this machine at startup, then choose\n");
+    printf("               the fusion and the shards of the stateful stages for the best predicted throughput\n");
+    printf("  --stats      Print items and user/system CPU time of every stage to stderr at shutdown\n");
+    printf("  --alloc-profile  Count the allocations of every stage (SDK allocator hook) and print\n");
+    printf("               allocations, bytes and frees per item and the peak bytes in flight at shutdown\n");
+    printf("  --lock-profile  Profile the queue and monitor locks of every stage and print acquisitions,\n");
+    printf("               contended acquisitions and wait/hold time histograms at shutdown\n");
+    printf("  --metrics TARGET  Export the stage metrics in Prometheus text format to a file,\n");
+    printf("               or serve them on a Unix socket with unix:<path>\n");
+    printf("  --metrics-interval MS  Time between two metrics reports (default %d)\n", DEFAULT_METRICS_INTERVAL_MS);
+    printf("  --watchdog-ms MS  Report on stderr any stage with pending input and no progress for MS\n");
+    printf("  --trim-idle-ms MS  Return the memory of stages idle for MS (byte ring pages, output batches,\n");
+    printf("               free malloc memory) to the OS, re-armed when they get busy again\n");
+    printf("  --trim-warm-bytes N  Bytes of every pool the trims keep resident (default %d)\n", MEMORY_TRIM_DEFAULT_WARM_BYTES);
+    printf("  --journal DIR  Write every input line to a write-ahead journal in DIR before it enters the\n");
+    printf("               pipeline, the lines a crashed run left there are processed first - at least\n");
+    printf("               once, lines that went through before the crash may be processed again\n");
+    printf("  --journal-batch N  Lines of one journal group commit (one fdatasync, default %d)\n", JOURNAL_DEFAULT_BATCH_LINES);
+    printf("  --journal-sync-ms MS  Longest wait of a line for its group commit (default %d)\n", JOURNAL_DEFAULT_SYNC_MS);
+    printf("  --record FILE  Save every input line with its arrival time to a trace file\n");
+    printf("  --replay FILE  Read the input from a trace instead of stdin, <END> is sent after the last line\n");
+    printf("  --replay-speed X  Replay X times faster than recorded (default 1), or max for no delays\n");
+    printf("  --output FILE  Write the lines of the last stage to FILE, one per line\n");
+    printf("  --output-writers N  Threads writing the output file in parallel (default %d, 1 - serial),\n", DEFAULT_OUTPUT_WRITERS);
+    printf("               the file is the same for any N\n");
     printf("Arguments:\n");
     printf("  queue_size  Maximum number of items in each plugin's queue \n");
     printf("  plugin1..N  Names of plugins to load (without .so extension)\n");
+    printf("              join plugins with '+' to fuse them into one stage (e.g. uppercaser+rotator),\n");
+    printf("              every plugin after the first must support in-place transform (all but expander)\n");
+    printf("              name:key=value,... passes init parameters to the plugin of a stage (plugin_init_ex),\n");
+    printf("              every plugin takes workers, batch and pool_bytes, typewriter delay_us, rotator shift,\n");
+    printf("              drain depth, similarity (percent) and max_children\n");
     printf("Available plugins:\n");
     printf("  logger      - Logs all strings that pass through\n");
     printf("  typewriter  - Simulates typewriter effect with delays\n");
@@ -521,10 +2990,14 @@ static void display_usage_help(void) {
     printf("  rotator     - Move every character to the right. Last character moves to the beginning.\n");
     printf("  flipper     - Reverses the order of characters\n");
     printf("  expander    - Expands each character with spaces\n");
+    printf("  counter     - Counts the lines per first word, prints the top keys before <END>\n");
+    printf("  drain       - Groups lines into templates, forwards the template id and the variable words\n");
     printf("Example:\n");
     printf("  ./analyzer 20 uppercaser rotator logger\n");
     printf("  echo 'hello' | ./analyzer 20 uppercaser rotator logger\n");
     printf("  echo '<END>' | ./analyzer 20 uppercaser rotator logger\n");
+    printf("  echo 'hello' | ./analyzer 20 uppercaser+rotator+flipper logger\n");
+    printf("  echo 'hello' | ./analyzer 20 rotator:shift=2 typewriter:delay_us=1000\n");
 }
 
 
@@ -0,0 +1,213 @@
+// This counter plugin forwards every line unchanged and counts the lines per key
+// (the first word of the line). At the end of the stream it emits the most frequent
+// keys as "<count> <key>" lines, most frequent first, before <END>.
+//
+// It is the example of a stateful, key partitioned plugin: with plugin_set_partitions(N)
+// the counts are split over N shards, each on its own thread, without any lock.
+
+#include "plugin_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// number of keys emitted at the end of the stream
+#define COUNTER_TOP_KEYS 10
+
+// initial number of slots of a shard table, grows by doubling at 50% load
+#define COUNTER_INITIAL_SLOTS 64
+
+typedef struct
+{
+    char* key;                  // NULL - free slot
+    unsigned long long count;
+} counter_entry_t;
+
+// counts of one shard, open addressing with linear probing
+typedef struct
+{
+    counter_entry_t* entries;
+    size_t num_slots;           // power of two
+    size_t num_keys;
+} counter_table_t;
+
+static size_t counter_key_length(const char* line)
+{
+    size_t length = 0;
+    while ('\0' != line[length] && ' ' != line[length] && '\t' != line[length]) {
+        length++;
+    }
+    return length;
+}
+
+static unsigned long long counter_hash(const char* key, size_t length)
+{
+    //FNV-1a, a different seed than the dispatcher so a shard still spreads over its slots
+    unsigned long long hash = 0x84222325cbf29ce4ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// slot of the key, or the free slot where it belongs
+static counter_entry_t* counter_find(counter_table_t* table, const char* key, size_t length)
+{
+    size_t mask = table->num_slots - 1;
+    size_t slot = (size_t)counter_hash(key, length) & mask;
+    while (NULL != table->entries[slot].key) {
+        const char* stored = table->entries[slot].key;
+        if (0 == strncmp(stored, key, length) && '\0' == stored[length]) {
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return &table->entries[slot];
+}
+
+static int counter_grow(counter_table_t* table)
+{
+    counter_table_t grown = { NULL, table->num_slots * 2, table->num_keys };
+    grown.entries = (counter_entry_t*)calloc(grown.num_slots, sizeof(counter_entry_t));
+    if (NULL == grown.entries) {
+        return -1;
+    }
+    for (size_t i = 0; i < table->num_slots; i++) {
+        if (NULL != table->entries[i].key) {
+            *counter_find(&grown, table->entries[i].key, strlen(table->entries[i].key)) = table->entries[i];
+        }
+    }
+    free(table->entries);
+    *table = grown;
+    return 0;
+}
+
+static void* counter_create_state(void)
+{
+    counter_table_t* table = (counter_table_t*)calloc(1, sizeof(counter_table_t));
+    if (NULL == table) {
+        return NULL;
+    }
+    table->num_slots = COUNTER_INITIAL_SLOTS;
+    table->entries = (counter_entry_t*)calloc(table->num_slots, sizeof(counter_entry_t));
+    if (NULL == table->entries) {
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+static void counter_destroy_state(void* state)
+{
+    counter_table_t* table = (counter_table_t*)state;
+    if (NULL == table) {
+        return;
+    }
+    for (size_t i = 0; i < table->num_slots; i++) {
+        free(table->entries[i].key);
+    }
+    free(table->entries);
+    free(table);
+}
+
+static size_t counter_extract_key(const char* item, const char** key)
+{
+    *key = item;
+    return counter_key_length(item);
+}
+
+static const char* counter_process(void* state, const char* item)
+{
+    counter_table_t* table = (counter_table_t*)state;
+    size_t item_length = strlen(item);
+
+    //a line we cannot count is still forwarded
+    if (NULL != table && (2 * (table->num_keys + 1) <= table->num_slots || 0 == counter_grow(table))) {
+        size_t key_length = counter_key_length(item);
+        counter_entry_t* entry = counter_find(table, item, key_length);
+        if (NULL == entry->key) {
+            entry->key = (char*)malloc(key_length + 1);
+            if (NULL != entry->key) {
+                memcpy(entry->key, item, key_length);
+                entry->key[key_length] = '\0';
+                table->num_keys++;
+            }
+        }
+        if (NULL != entry->key) {
+            entry->count++;
+        }
+    }
+
+    char* output = (char*)plugin_alloc(item_length + 1);
+    if (NULL == output) {
+        return NULL;
+    }
+    memcpy(output, item, item_length + 1);
+    return output;
+}
+
+// most frequent first, equal counts by key so the output does not depend on the shards
+static int counter_compare(const void* left, const void* right)
+{
+    const counter_entry_t* a = (const counter_entry_t*)left;
+    const counter_entry_t* b = (const counter_entry_t*)right;
+    if (a->count != b->count) {
+        return (a->count > b->count) ? -1 : 1;
+    }
+    return strcmp(a->key, b->key);
+}
+
+// every key lives in exactly one shard, so merging is collecting and sorting
+static void counter_merge(void** states, int num_shards, plugin_emit_func emit)
+{
+    size_t total_keys = 0;
+    for (int i = 0; i < num_shards; i++) {
+        if (NULL != states[i]) {
+            total_keys += ((counter_table_t*)states[i])->num_keys;
+        }
+    }
+    if (0 == total_keys) {
+        return;
+    }
+
+    counter_entry_t* all_keys = (counter_entry_t*)malloc(total_keys * sizeof(counter_entry_t));
+    if (NULL == all_keys) {
+        log_error(&g_plugin_context, "failed to allocate the key summary");
+        return;
+    }
+    size_t collected = 0;
+    for (int i = 0; i < num_shards; i++) {
+        counter_table_t* table = (counter_table_t*)states[i];
+        for (size_t slot = 0; NULL != table && slot < table->num_slots; slot++) {
+            if (NULL != table->entries[slot].key) {
+                all_keys[collected++] = table->entries[slot];
+            }
+        }
+    }
+    qsort(all_keys, collected, sizeof(counter_entry_t), counter_compare);
+
+    for (size_t i = 0; i < collected && i < COUNTER_TOP_KEYS; i++) {
+        size_t line_size = strlen(all_keys[i].key) + 24;
+        char* line = (char*)malloc(line_size);
+        if (NULL != line) {
+            snprintf(line, line_size, "%llu %s", all_keys[i].count, all_keys[i].key);
+            emit(line);
+            free(line);
+        }
+    }
+    free(all_keys);
+}
+
+static const plugin_partition_ops_t g_counter_ops = {
+    counter_extract_key,
+    counter_create_state,
+    counter_destroy_state,
+    counter_process,
+    counter_merge,
+    0,
+};
+
+const char* plugin_init(int queue_size)
+{
+    return common_plugin_init_partitioned(&g_counter_ops, "counter", queue_size);
+}
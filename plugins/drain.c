@@ -0,0 +1,535 @@
+// This drain plugin mines log templates (the Drain algorithm): every line is matched to a
+// template - its constant words, with <*> where the lines of the template differ - and is
+// forwarded as the template id and the words at the <*> positions only:
+//
+//   T<id>\t<template>\t<parameters>   the template is new or just got another <*>
+//   T<id>\t<parameters>               the template is the one last sent for this id
+//
+// <parameters> are the words of the <*> positions, space separated, so the template text with
+// its <*> replaced in order gives the line back (runs of blanks become one space). T0 is a line
+// with too many words to be mined, forwarded as its only parameter.
+//
+// Matching goes down a parse tree of fixed depth: the word count, then the first "depth" words
+// (a word with a digit takes the <*> branch, it is most likely a variable). The leaf holds the
+// templates of that prefix, the line joins the most similar one - equal words / all words - if
+// it reaches the similarity threshold, and starts a new template otherwise.
+//
+// Words are interned once (a number per distinct word), the tree edges are one hash table of
+// (node, word) pairs, and the nodes, templates and word text live in arenas allocated in
+// large chunks, so a line costs a few hash lookups and no allocation once its words are known.
+//
+// Parameters (plugin_init_ex): depth (words in the tree, default 2), similarity (percent, default 40),
+// max_children (branches of a node before new words share the <*> branch, default 100).
+
+#include "plugin_common.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DRAIN_DEFAULT_DEPTH 2
+#define DRAIN_DEFAULT_SIMILARITY 40
+#define DRAIN_DEFAULT_MAX_CHILDREN 100
+
+// longer lines are forwarded as T0
+#define DRAIN_MAX_WORDS 1024
+
+// word 0 is the wildcard, a template position that varies
+#define DRAIN_WILDCARD 0
+
+// arena chunk for the word text and the template words
+#define DRAIN_ARENA_CHUNK_BYTES (256 * 1024)
+
+// first allocation of the nodes, templates, words and hash tables, they grow by doubling
+#define DRAIN_INITIAL_ENTRIES 4096
+
+typedef struct drain_chunk
+{
+    struct drain_chunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+} drain_chunk_t;
+
+typedef struct
+{
+    const char* text;
+    uint32_t length;
+    uint32_t has_digit;
+} drain_word_t;
+
+typedef struct
+{
+    uint32_t num_children;
+    uint32_t first_template;    // leaf - its templates, 0 - none
+} drain_node_t;
+
+typedef struct
+{
+    uint32_t* words;            // word ids, DRAIN_WILDCARD at the variable positions
+    uint32_t num_words;
+    uint32_t num_wildcards;
+    uint32_t next;              // next template of the same leaf, 0 - last
+    unsigned long long lines;
+} drain_template_t;
+
+// tree edge, child 0 - free slot (the root is nobody's child)
+typedef struct
+{
+    uint32_t parent;
+    uint32_t key;               // word id, or the word count below the root
+    uint32_t child;
+} drain_edge_t;
+
+typedef struct
+{
+    drain_chunk_t* chunks;
+
+    drain_word_t* words;        // by id
+    uint32_t num_words;
+    uint32_t word_capacity;
+    uint32_t* word_slots;       // open addressing, word id, 0 - free (the wildcard is never looked up)
+    size_t word_slot_mask;
+
+    drain_node_t* nodes;        // node 0 - the root
+    uint32_t num_nodes;
+    uint32_t node_capacity;
+    drain_edge_t* edges;
+    size_t edge_slot_mask;
+    size_t num_edges;
+
+    drain_template_t* templates; // by id, 0 - T0
+    uint32_t num_templates;
+    uint32_t template_capacity;
+} drain_tree_t;
+
+static int g_depth = DRAIN_DEFAULT_DEPTH;
+static int g_similarity_percent = DRAIN_DEFAULT_SIMILARITY;
+static uint32_t g_max_children = DRAIN_DEFAULT_MAX_CHILDREN;
+
+// built by plugin_init, freed by plugin_fini, only the stage thread touches it in between
+static drain_tree_t g_tree;
+
+static void* drain_arena_alloc(drain_tree_t* tree, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    drain_chunk_t* chunk = tree->chunks;
+    if (NULL == chunk || chunk->capacity - chunk->used < size) {
+        size_t capacity = (size > DRAIN_ARENA_CHUNK_BYTES) ? size : DRAIN_ARENA_CHUNK_BYTES;
+        chunk = (drain_chunk_t*)malloc(sizeof(drain_chunk_t) + capacity);
+        if (NULL == chunk) {
+            return NULL;
+        }
+        chunk->next = tree->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        tree->chunks = chunk;
+    }
+    void* memory = chunk->data + chunk->used;
+    chunk->used += size;
+    return memory;
+}
+
+// doubles an array of entries, the ids stay valid
+static int drain_grow(void** entries, uint32_t* capacity, size_t entry_size)
+{
+    void* grown = realloc(*entries, (size_t)*capacity * 2 * entry_size);
+    if (NULL == grown) {
+        return -1;
+    }
+    *entries = grown;
+    *capacity *= 2;
+    return 0;
+}
+
+static uint64_t drain_hash_text(const char* text, size_t length)
+{
+    //FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uint64_t drain_hash_edge(uint32_t parent, uint32_t key)
+{
+    uint64_t hash = ((uint64_t)parent << 32 | key) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+static int drain_tree_init(drain_tree_t* tree)
+{
+    memset(tree, 0, sizeof(drain_tree_t));
+    tree->word_capacity = DRAIN_INITIAL_ENTRIES;
+    tree->node_capacity = DRAIN_INITIAL_ENTRIES;
+    tree->template_capacity = DRAIN_INITIAL_ENTRIES;
+    tree->word_slot_mask = 2 * DRAIN_INITIAL_ENTRIES - 1;
+    tree->edge_slot_mask = 2 * DRAIN_INITIAL_ENTRIES - 1;
+    tree->words = (drain_word_t*)malloc(tree->word_capacity * sizeof(drain_word_t));
+    tree->word_slots = (uint32_t*)calloc(tree->word_slot_mask + 1, sizeof(uint32_t));
+    tree->nodes = (drain_node_t*)malloc(tree->node_capacity * sizeof(drain_node_t));
+    tree->edges = (drain_edge_t*)calloc(tree->edge_slot_mask + 1, sizeof(drain_edge_t));
+    tree->templates = (drain_template_t*)malloc(tree->template_capacity * sizeof(drain_template_t));
+    if (NULL == tree->words || NULL == tree->word_slots || NULL == tree->nodes || NULL == tree->edges ||
+        NULL == tree->templates) {
+        return -1;
+    }
+
+    tree->words[DRAIN_WILDCARD] = (drain_word_t){ "<*>", 3, 0 };
+    tree->num_words = 1;
+    memset(&tree->nodes[0], 0, sizeof(drain_node_t));
+    tree->num_nodes = 1;
+    memset(&tree->templates[0], 0, sizeof(drain_template_t));
+    tree->num_templates = 1;
+    return 0;
+}
+
+static void drain_tree_free(drain_tree_t* tree)
+{
+    while (NULL != tree->chunks) {
+        drain_chunk_t* next = tree->chunks->next;
+        free(tree->chunks);
+        tree->chunks = next;
+    }
+    free(tree->words);
+    free(tree->word_slots);
+    free(tree->nodes);
+    free(tree->edges);
+    free(tree->templates);
+    memset(tree, 0, sizeof(drain_tree_t));
+}
+
+static uint32_t* drain_find_word_slot(drain_tree_t* tree, const char* text, size_t length, uint64_t hash)
+{
+    size_t slot = (size_t)hash & tree->word_slot_mask;
+    while (0 != tree->word_slots[slot]) {
+        const drain_word_t* word = &tree->words[tree->word_slots[slot]];
+        if (word->length == length && 0 == memcmp(word->text, text, length)) {
+            break;
+        }
+        slot = (slot + 1) & tree->word_slot_mask;
+    }
+    return &tree->word_slots[slot];
+}
+
+static int drain_grow_word_slots(drain_tree_t* tree)
+{
+    size_t num_slots = (tree->word_slot_mask + 1) * 2;
+    uint32_t* slots = (uint32_t*)calloc(num_slots, sizeof(uint32_t));
+    if (NULL == slots) {
+        return -1;
+    }
+    free(tree->word_slots);
+    tree->word_slots = slots;
+    tree->word_slot_mask = num_slots - 1;
+    for (uint32_t id = 1; id < tree->num_words; id++) {
+        const drain_word_t* word = &tree->words[id];
+        *drain_find_word_slot(tree, word->text, word->length, drain_hash_text(word->text, word->length)) = id;
+    }
+    return 0;
+}
+
+// id of the word, a new word gets the next one, 0 (never a word) - out of memory
+static uint32_t drain_intern(drain_tree_t* tree, const char* text, size_t length)
+{
+    uint64_t hash = drain_hash_text(text, length);
+    uint32_t* slot = drain_find_word_slot(tree, text, length, hash);
+    if (0 != *slot) {
+        return *slot;
+    }
+
+    if (2 * ((size_t)tree->num_words + 1) > tree->word_slot_mask + 1) {
+        if (0 != drain_grow_word_slots(tree)) {
+            return 0;
+        }
+        slot = drain_find_word_slot(tree, text, length, hash);
+    }
+    if (tree->num_words == tree->word_capacity &&
+        0 != drain_grow((void**)&tree->words, &tree->word_capacity, sizeof(drain_word_t))) {
+        return 0;
+    }
+    char* stored = (char*)drain_arena_alloc(tree, length);
+    if (NULL == stored) {
+        return 0;
+    }
+    memcpy(stored, text, length);
+
+    uint32_t has_digit = 0;
+    for (size_t i = 0; i < length && !has_digit; i++) {
+        has_digit = (text[i] >= '0' && text[i] <= '9');
+    }
+    uint32_t id = tree->num_words++;
+    tree->words[id] = (drain_word_t){ stored, (uint32_t)length, has_digit };
+    *slot = id;
+    return id;
+}
+
+static drain_edge_t* drain_find_edge(drain_tree_t* tree, uint32_t parent, uint32_t key)
+{
+    size_t slot = (size_t)drain_hash_edge(parent, key) & tree->edge_slot_mask;
+    while (0 != tree->edges[slot].child && (tree->edges[slot].parent != parent || tree->edges[slot].key != key)) {
+        slot = (slot + 1) & tree->edge_slot_mask;
+    }
+    return &tree->edges[slot];
+}
+
+static int drain_grow_edges(drain_tree_t* tree)
+{
+    drain_edge_t* old_edges = tree->edges;
+    size_t old_slots = tree->edge_slot_mask + 1;
+    tree->edges = (drain_edge_t*)calloc(old_slots * 2, sizeof(drain_edge_t));
+    if (NULL == tree->edges) {
+        tree->edges = old_edges;
+        return -1;
+    }
+    tree->edge_slot_mask = old_slots * 2 - 1;
+    for (size_t i = 0; i < old_slots; i++) {
+        if (0 != old_edges[i].child) {
+            *drain_find_edge(tree, old_edges[i].parent, old_edges[i].key) = old_edges[i];
+        }
+    }
+    free(old_edges);
+    return 0;
+}
+
+// child of parent under key, created if missing, 0 - out of memory
+static uint32_t drain_child(drain_tree_t* tree, uint32_t parent, uint32_t key)
+{
+    drain_edge_t* edge = drain_find_edge(tree, parent, key);
+    if (0 != edge->child) {
+        return edge->child;
+    }
+
+    if (2 * (tree->num_edges + 1) > tree->edge_slot_mask + 1) {
+        if (0 != drain_grow_edges(tree)) {
+            return 0;
+        }
+        edge = drain_find_edge(tree, parent, key);
+    }
+    if (tree->num_nodes == tree->node_capacity &&
+        0 != drain_grow((void**)&tree->nodes, &tree->node_capacity, sizeof(drain_node_t))) {
+        return 0;
+    }
+    uint32_t child = tree->num_nodes++;
+    memset(&tree->nodes[child], 0, sizeof(drain_node_t));
+    tree->nodes[parent].num_children++;
+    *edge = (drain_edge_t){ parent, key, child };
+    tree->num_edges++;
+    return child;
+}
+
+// leaf of a line - its word count, then its first words; a word with a digit, or any new
+// word once the node is full, goes down the <*> branch
+static uint32_t drain_leaf(drain_tree_t* tree, const uint32_t* words, uint32_t num_words)
+{
+    uint32_t node = drain_child(tree, 0, num_words);
+    for (uint32_t i = 0; 0 != node && i < num_words && i < (uint32_t)g_depth; i++) {
+        uint32_t key = tree->words[words[i]].has_digit ? DRAIN_WILDCARD : words[i];
+        if (DRAIN_WILDCARD != key && 0 == drain_find_edge(tree, node, key)->child &&
+            tree->nodes[node].num_children + 1 >= g_max_children) {
+            key = DRAIN_WILDCARD;
+        }
+        node = drain_child(tree, node, key);
+    }
+    return node;
+}
+
+// most similar template of the leaf - most equal words, then most wildcards - if it is similar enough
+static uint32_t drain_match(drain_tree_t* tree, uint32_t leaf, const uint32_t* words, uint32_t num_words)
+{
+    uint32_t best = 0;
+    uint32_t best_equal = 0;
+    uint32_t best_wildcards = 0;
+    for (uint32_t id = tree->nodes[leaf].first_template; 0 != id; id = tree->templates[id].next) {
+        const drain_template_t* candidate = &tree->templates[id];
+        uint32_t equal = 0;
+        for (uint32_t i = 0; i < num_words; i++) {
+            equal += (candidate->words[i] == words[i]);
+        }
+        if (0 == best || equal > best_equal || (equal == best_equal && candidate->num_wildcards > best_wildcards)) {
+            best = id;
+            best_equal = equal;
+            best_wildcards = candidate->num_wildcards;
+        }
+    }
+    if (0 != best && num_words > 0 && 100ULL * best_equal < (unsigned long long)g_similarity_percent * num_words) {
+        return 0;
+    }
+    return best;
+}
+
+static uint32_t drain_new_template(drain_tree_t* tree, uint32_t leaf, const uint32_t* words, uint32_t num_words)
+{
+    if (tree->num_templates == tree->template_capacity &&
+        0 != drain_grow((void**)&tree->templates, &tree->template_capacity, sizeof(drain_template_t))) {
+        return 0;
+    }
+    uint32_t* stored = (uint32_t*)drain_arena_alloc(tree, (num_words > 0 ? num_words : 1) * sizeof(uint32_t));
+    if (NULL == stored) {
+        return 0;
+    }
+    memcpy(stored, words, num_words * sizeof(uint32_t));
+
+    uint32_t id = tree->num_templates++;
+    tree->templates[id] = (drain_template_t){ stored, num_words, 0, tree->nodes[leaf].first_template, 0 };
+    tree->nodes[leaf].first_template = id;
+    return id;
+}
+
+static char* drain_append(char* output, const char* text, size_t length)
+{
+    memcpy(output, text, length);
+    return output + length;
+}
+
+// "T0\t<line>" - the line is its own parameter
+static const char* drain_raw_line(const char* line)
+{
+    size_t length = strlen(line);
+    char* output = (char*)plugin_alloc(length + 4);
+    if (NULL == output) {
+        return NULL;
+    }
+    memcpy(output, "T0\t", 3);
+    memcpy(output + 3, line, length + 1);
+    return output;
+}
+
+static void drain_destroy(void)
+{
+    drain_tree_free(&g_tree);
+}
+
+static const char* drain_transform(const char* line)
+{
+    if (NULL == line) {
+        return NULL;
+    }
+
+    //the words of the line, as offsets into it and as interned ids
+    static uint32_t word_starts[DRAIN_MAX_WORDS];
+    static uint32_t word_lengths[DRAIN_MAX_WORDS];
+    static uint32_t words[DRAIN_MAX_WORDS];
+    uint32_t num_words = 0;
+    size_t position = 0;
+    size_t line_length = strlen(line);
+    while (position < line_length) {
+        while (position < line_length && (' ' == line[position] || '\t' == line[position])) {
+            position++;
+        }
+        size_t start = position;
+        while (position < line_length && ' ' != line[position] && '\t' != line[position]) {
+            position++;
+        }
+        if (position == start) {
+            break;
+        }
+        if (num_words == DRAIN_MAX_WORDS) {
+            return drain_raw_line(line);
+        }
+        word_starts[num_words] = (uint32_t)start;
+        word_lengths[num_words] = (uint32_t)(position - start);
+        words[num_words] = drain_intern(&g_tree, line + start, position - start);
+        if (0 == words[num_words]) {
+            return drain_raw_line(line);
+        }
+        num_words++;
+    }
+
+    uint32_t leaf = drain_leaf(&g_tree, words, num_words);
+    if (0 == leaf) {
+        return drain_raw_line(line);
+    }
+    int changed = 0;
+    uint32_t id = drain_match(&g_tree, leaf, words, num_words);
+    if (0 == id) {
+        id = drain_new_template(&g_tree, leaf, words, num_words);
+        if (0 == id) {
+            return drain_raw_line(line);
+        }
+        changed = 1;
+    }
+
+    //the words the template does not share with the line become variable
+    drain_template_t* template = &g_tree.templates[id];
+    size_t template_length = 0;
+    for (uint32_t i = 0; i < num_words; i++) {
+        if (DRAIN_WILDCARD != template->words[i] && template->words[i] != words[i]) {
+            template->words[i] = DRAIN_WILDCARD;
+            template->num_wildcards++;
+            changed = 1;
+        }
+        template_length += g_tree.words[template->words[i]].length + 1;
+    }
+    template->lines++;
+
+    //"T<id>", the template when it changed, then the parameters
+    char* output = (char*)plugin_alloc(16 + (changed ? template_length + 1 : 0) + line_length + 1);
+    if (NULL == output) {
+        return NULL;
+    }
+    char* end = output + sprintf(output, "T%u\t", id);
+    if (changed) {
+        for (uint32_t i = 0; i < num_words; i++) {
+            const drain_word_t* word = &g_tree.words[template->words[i]];
+            end = drain_append(end, word->text, word->length);
+            *end++ = ' ';
+        }
+        if (num_words > 0) {
+            end--;
+        }
+        *end++ = '\t';
+    }
+    char* parameters = end;
+    for (uint32_t i = 0; i < num_words; i++) {
+        if (DRAIN_WILDCARD == template->words[i]) {
+            if (end != parameters) {
+                *end++ = ' ';
+            }
+            end = drain_append(end, line + word_starts[i], word_lengths[i]);
+        }
+    }
+    *end = '\0';
+    return output;
+}
+
+const char* plugin_init(int queue_size)
+{
+    //the stage thread is using the tree
+    if (g_plugin_context.initialized) {
+        return "Plugin already initialized";
+    }
+
+    long depth = DRAIN_DEFAULT_DEPTH;
+    long similarity = DRAIN_DEFAULT_SIMILARITY;
+    long max_children = DRAIN_DEFAULT_MAX_CHILDREN;
+    const char* error = plugin_param_long("depth", 1, 16, &depth);
+    if (NULL == error) {
+        error = plugin_param_long("similarity", 1, 100, &similarity);
+    }
+    if (NULL == error) {
+        error = plugin_param_long("max_children", 2, 1000000, &max_children);
+    }
+    if (NULL != error) {
+        return error;
+    }
+    g_depth = (int)depth;
+    g_similarity_percent = (int)similarity;
+    g_max_children = (uint32_t)max_children;
+
+    //a plugin_init after a failed one starts from an empty tree
+    drain_tree_free(&g_tree);
+    if (0 != drain_tree_init(&g_tree)) {
+        drain_tree_free(&g_tree);
+        return "Failed to allocate the parse tree";
+    }
+    error = common_plugin_init(drain_transform, "drain", queue_size);
+    if (NULL != error) {
+        drain_tree_free(&g_tree);
+        return error;
+    }
+    common_plugin_set_destroy(drain_destroy);
+    return NULL;
+}
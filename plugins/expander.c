@@ -12,7 +12,7 @@ static const char* expander_transform(const char* input_to_expand)
     int input_len = strlen(input_to_expand);
     //handle empty string case - return empty string
     if (0 == input_len) {
-        char* result = (char*)malloc(1);
+        char* result = (char*)plugin_alloc(1);
         if (result) {
             result[0] = '\0';
         }
@@ -21,7 +21,7 @@ static const char* expander_transform(const char* input_to_expand)
 
     
     int new_len_after_expanded = input_len * 2 - 1; //[char and space] + only char without space at the end
-    char* after_expanding_result = (char*)malloc(new_len_after_expanded + 1);
+    char* after_expanding_result = (char*)plugin_alloc(new_len_after_expanded + 1);
     if (NULL == after_expanding_result)
     {
         return NULL; // TODO: should we log an error here instead of returning NULL?
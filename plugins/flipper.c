@@ -4,6 +4,22 @@
 #include <string.h>
 #include <stdlib.h>
 
+static int flipper_transform_inplace(char* buffer, int length)
+{
+    if (NULL == buffer) {
+        return -1;
+    }
+
+    //swap from both ends toward the middle
+    for (int left = 0, right = length - 1; left < right; left++, right--)
+    {
+        char tmp = buffer[left];
+        buffer[left] = buffer[right];
+        buffer[right] = tmp;
+    }
+    return 0;
+}
+
 static const char* flipper_transform(const char* input_to_flip)
 {
     if (NULL == input_to_flip) {
@@ -11,32 +27,25 @@ static const char* flipper_transform(const char* input_to_flip)
     }
 
     int input_len = strlen(input_to_flip);
-    //handle empty string case, return empty string as well
-    if (0 == input_len) {
-        char* result = (char*)malloc(1);
-        if (result) {
-            result[0] = '\0';
-        }
-        return result; 
-    }
-
-    char* after_flipping_result = (char*)malloc(input_len + 1);
+    char* after_flipping_result = (char*)plugin_alloc(input_len + 1);
     if (NULL == after_flipping_result)
     {
         return NULL; // TODO: should we log an error here instead of returning NULL?
     }
 
-    for (int i = 0; i < input_len; i++)
-    {
-        after_flipping_result[i] = input_to_flip[input_len - 1 - i];
-    }
-
-    after_flipping_result[input_len] = '\0'; //add the terminal of end string
+    memcpy(after_flipping_result, input_to_flip, input_len + 1);
+    flipper_transform_inplace(after_flipping_result, input_len);
 
     return after_flipping_result;
 }
 
+PLUGIN_EXPORT
+int plugin_transform_inplace(char* buffer, int length)
+{
+    return flipper_transform_inplace(buffer, length);
+}
+
 const char* plugin_init(int queue_size) 
 {
-    return common_plugin_init(flipper_transform, "flipper", queue_size);
+    return common_plugin_init_inplace(flipper_transform, flipper_transform_inplace, "flipper", queue_size);
 }
@@ -5,27 +5,44 @@
 
 
 //This logger plugin simply logs the strings it receives to stdout with [logger] prefix
+//the string itself is not changed, so the in-place variant only prints it
+static int logger_transform_inplace(char* buffer, int length)
+{
+    (void)length;
+    if (NULL == buffer) {
+        return -1;
+    }
+    fprintf(stdout, "[logger] %s\n", buffer);
+    fflush(stdout);
+    return 0;
+}
+
 static const char* logger_transform(const char* input_to_log) 
 {
     if (NULL == input_to_log) {
         return NULL;
     }
-    // Print to stdout with [logger] prefix
-    fprintf(stdout, "[logger] %s\n", input_to_log);
-    fflush(stdout);
     
     // Return a copy of the string for the next plugin
     size_t input_chars_len = strlen(input_to_log);
-    char* copy_of_log_input = (char*)malloc(input_chars_len + 1);
+    char* copy_of_log_input = (char*)plugin_alloc(input_chars_len + 1);
     if (NULL == copy_of_log_input) {
         return NULL;
     }
     strcpy(copy_of_log_input, input_to_log);
-    
+
+    // Print to stdout with [logger] prefix
+    logger_transform_inplace(copy_of_log_input, (int)input_chars_len);
     return copy_of_log_input;
 }
 
+PLUGIN_EXPORT
+int plugin_transform_inplace(char* buffer, int length)
+{
+    return logger_transform_inplace(buffer, length);
+}
+
 const char* plugin_init(int queue_size) 
 {
-    return common_plugin_init(logger_transform, "logger", queue_size);
-}
\ No newline at end of file
+    return common_plugin_init_inplace(logger_transform, logger_transform_inplace, "logger", queue_size);
+}
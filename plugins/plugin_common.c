@@ -1,25 +1,97 @@
 #define _GNU_SOURCE
 #include "plugin_common.h"
+#include "plugin_partition.h"
+#include "sync/async_log.h"
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/resource.h>
 
 //create a global plugin context because each plugin has its own instance
 plugin_context_t g_plugin_context = {0};
 
+//set by plugin_use_executor before plugin_init - kept outside the context because init clears it
+static int g_use_external_executor = 0;
+
+//set by plugin_set_allocator before plugin_init, used for the queue and every item of this plugin
+static pipeline_allocator_t g_plugin_allocator = {0};
+
+//set by plugin_set_stack_size before plugin_init, 0 keeps the pthread default (usually 8MB reserved)
+static size_t g_consumer_stack_size = 0;
+
+//set by plugin_set_instance_id before plugin_init, used in the consumer thread name
+static int g_instance_id = 0;
+
+//set by plugin_set_queue_bytes before plugin_init, 0 - the queue keeps an array of string pointers
+static size_t g_queue_ring_bytes = 0;
+
+//set by plugin_set_partitions before plugin_init, only used by key partitioned plugins
+static int g_num_partitions = 1;
+
+//set by plugin_set_relaxed_order before plugin_init, shards forward without restoring the input order
+static int g_relaxed_order = 0;
+
+//set by plugin_set_credit_batch before plugin_init, 0 - the queue derives it from its size
+static int g_credit_batch = 0;
+
+//set by plugin_set_overflow_policy before plugin_init, 1 - plugin_place_work drops when the queue is full
+static int g_overflow_drop = 0;
+
+//set by plugin_set_cpu before plugin_init, -1 - the consumer thread may run anywhere
+static int g_consumer_cpu = -1;
+
+//set by plugin_set_backlog_compression before plugin_init, 0 - every queued item is a separate string
+static int g_backlog_hot_items = 0;
+
+//set by plugin_set_lock_profile before plugin_init, the input queue locks record their contention here
+static int g_lock_profile_enabled = 0;
+static lock_profile_t g_lock_profiles[CONSUMER_PRODUCER_PROFILED_LOCKS];
+
+//set by common_plugin_init* callers after init, plugin_fini releases the plugin state with it
+static void (*g_destroy_function)(void) = NULL;
+
+//defined by every plugin, weak so the SDK still links into the tests that have no plugin_init
+extern const char* plugin_init(int queue_size) __attribute__((weak));
+
+//the config of a running plugin_init_ex, NULL under a plain plugin_init
+static const plugin_config_t* g_plugin_config = NULL;
+static int g_param_read[PLUGIN_MAX_PARAMS];
+static char g_param_error[128];
+//workers key of the running plugin_init_ex, 0 - not given; only a key partitioned plugin has workers
+static long g_workers_param = 0;
+
+static char* process_item(plugin_context_t* plugin_context, char* input_string);
+static char* transform_item(plugin_context_t* plugin_context, char* input_string);
+static void sample_thread_rusage(unsigned long long* user_time_ns, unsigned long long* system_time_ns);
+static unsigned long long thread_cpu_time_ns(void);
+static unsigned long long monotonic_time_ns(void);
+static void record_item_latency(plugin_context_t* plugin_context, unsigned long long latency_ns);
+static void store_thread_cpu_times(plugin_context_t* plugin_context);
+static void name_consumer_thread(plugin_context_t* plugin_context);
+static void wait_for_credits(plugin_context_t* plugin_context);
+static const char* check_params_read(void);
+static const char* init_plugin_context(const char* (*process_function)(const char*), plugin_inplace_func inplace_function,
+                                       const plugin_partition_ops_t* partition_ops, const char* name, int queue_size);
+
 
 /* /////////////////////  */
 //  Logging Functions
 /* /////////////////////  */
 
+// both go through the async backend - the calling stage only copies a record into
+// its thread ring, a background thread prints it (same format as before)
 void log_info(plugin_context_t* plugin_context, const char* message)
 {
     if (NULL == plugin_context || NULL == message) {
         return;
     }
     
-    fprintf(stdout, "[INFO][%s] - %s\n", plugin_context->name ? plugin_context->name : "Unknown", message);
+    async_log_write(ASYNC_LOG_INFO, plugin_context->name ? plugin_context->name : "Unknown", message,
+                    __builtin_return_address(0));
 }
 
 void log_error(plugin_context_t* plugin_context, const char* error_message)
@@ -30,7 +102,8 @@ void log_error(plugin_context_t* plugin_context, const char* error_message)
         return;
     }
     
-    fprintf(stderr, "[ERROR][%s] - %s\n", plugin_context->name ? plugin_context->name : "Unknown", error_message);
+    async_log_write(ASYNC_LOG_ERROR, plugin_context->name ? plugin_context->name : "Unknown", error_message,
+                    __builtin_return_address(0));
 }
 
 
@@ -43,6 +116,8 @@ void* plugin_consumer_thread(void* arg)
         return NULL;
     }
 
+    name_consumer_thread(plugin_context);
+
     //signal that the thread is ready
     // this is used to notify the main thread that the consumer thread is ready to process items
 
@@ -53,10 +128,26 @@ void* plugin_consumer_thread(void* arg)
 
     pthread_mutex_unlock(&plugin_context->ready_mutex);
 
+    //key partitioned stage - this thread only routes the items to the shard threads
+    if (NULL != plugin_context->partition) {
+        plugin_partition_dispatch(plugin_context->partition);
+        store_thread_cpu_times(plugin_context);
+        return NULL;
+    }
+
+    //byte ring queue - the item is read and transformed in place inside the ring and released once forwarded
+    int read_in_place = (NULL != plugin_context->queue->ring.buffer);
+
     while(!plugin_context->finished) 
     {
+        //no credit for an output - wait here, before we take an item, so nothing is held while blocked
+        if (NULL != plugin_context->next_take_credits && 0 == plugin_context->credits) {
+            wait_for_credits(plugin_context);
+        }
+
         //get next item from queue, blocks if empty
-        char* input_string = consumer_producer_get(plugin_context->queue);
+        char* input_string = read_in_place ? consumer_producer_peek(plugin_context->queue)
+                                           : consumer_producer_get(plugin_context->queue);
 
         if (NULL == input_string) {
             if (plugin_context->finished) break;
@@ -65,7 +156,11 @@ void* plugin_consumer_thread(void* arg)
 
         //we should exit if finished flag set during shutdown
         if (plugin_context->finished) {
-            free(input_string); 
+            if (read_in_place) {
+                consumer_producer_release(plugin_context->queue);
+            } else {
+                plugin_free(input_string); 
+            }
             break;
         }
 
@@ -77,34 +172,239 @@ void* plugin_consumer_thread(void* arg)
             
             plugin_context->finished = 1;
             consumer_producer_signal_finished(plugin_context->queue);
-            free(input_string);
+            if (read_in_place) {
+                consumer_producer_release(plugin_context->queue);
+            } else {
+                plugin_free(input_string);
+            }
             break;
         }
 
         // if got into this  line so the input string is not a <END>, so we need to process it
-        const char* processed = plugin_context->process_function(input_string);
+        __atomic_store_n(&plugin_context->stats.item_in_progress, 1, __ATOMIC_RELAXED);
+        unsigned long long process_start_ns = monotonic_time_ns();
+        char* processed = read_in_place ? transform_item(plugin_context, input_string)
+                                        : process_item(plugin_context, input_string);
+        unsigned long long process_end_ns = monotonic_time_ns();
+        record_item_latency(plugin_context, process_end_ns - process_start_ns);
         if (NULL != processed) 
         {
             if (plugin_context->next_place_work) {
-                plugin_context->next_place_work(processed);
+                //the put blocks while the next queue is full, that wait is the backpressure we report
+                if (NULL != plugin_context->next_place_work(processed)) {
+                    __atomic_add_fetch(&plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+                }
+                if (plugin_context->credits > 0) {
+                    plugin_context->credits--;
+                }
+                __atomic_add_fetch(&plugin_context->stats.blocked_time_ns, monotonic_time_ns() - process_end_ns, __ATOMIC_RELAXED);
             }
-            
-            if (processed != input_string) {
-                free((char*)processed);
+            if (processed != input_string || !read_in_place) {
+                plugin_free(processed);
             }
+        } else {
+            __atomic_add_fetch(&plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+        }
+        if (read_in_place) {
+            consumer_producer_release(plugin_context->queue);
+        }
+        __atomic_store_n(&plugin_context->stats.item_in_progress, 0, __ATOMIC_RELAXED);
+
+        //the user/system split is only known inside the thread, refresh it now and then
+        unsigned long long items = __atomic_add_fetch(&plugin_context->stats.items_processed, 1, __ATOMIC_RELAXED);
+        if (0 == items % PLUGIN_RUSAGE_SAMPLE_INTERVAL) {
+            unsigned long long user_time_ns, system_time_ns;
+            sample_thread_rusage(&user_time_ns, &system_time_ns);
+            __atomic_store_n(&plugin_context->stats.user_time_ns, user_time_ns, __ATOMIC_RELAXED);
+            __atomic_store_n(&plugin_context->stats.system_time_ns, system_time_ns, __ATOMIC_RELAXED);
         }
-        free(input_string);
     }
-    
+
+    //the thread clock goes away with the thread, keep the final numbers for plugin_get_stats
+    store_thread_cpu_times(plugin_context);
     return NULL;
 }
 
 
+// user and system CPU time of the calling thread
+static void sample_thread_rusage(unsigned long long* user_time_ns, unsigned long long* system_time_ns)
+{
+    struct rusage thread_usage;
+    if (0 != getrusage(RUSAGE_THREAD, &thread_usage)) {
+        *user_time_ns = 0;
+        *system_time_ns = 0;
+        return;
+    }
+    *user_time_ns = (unsigned long long)thread_usage.ru_utime.tv_sec * 1000000000ULL +
+                    (unsigned long long)thread_usage.ru_utime.tv_usec * 1000ULL;
+    *system_time_ns = (unsigned long long)thread_usage.ru_stime.tv_sec * 1000000000ULL +
+                      (unsigned long long)thread_usage.ru_stime.tv_usec * 1000ULL;
+}
+
+// monotonic clock for latencies, clock_gettime goes through the vDSO so it is cheap per item
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+// only the thread running the stage writes the counters, relaxed atomics are enough for the readers
+static void record_item_latency(plugin_context_t* plugin_context, unsigned long long latency_ns)
+{
+    __atomic_add_fetch(&plugin_context->stats.latency_buckets[plugin_latency_bucket(latency_ns)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin_context->stats.latency_sum_ns, latency_ns, __ATOMIC_RELAXED);
+}
+
+// CPU time of the calling thread from its thread clock
+static unsigned long long thread_cpu_time_ns(void)
+{
+    struct timespec cpu_time;
+    if (0 != clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu_time)) {
+        return 0;
+    }
+    return (unsigned long long)cpu_time.tv_sec * 1000000000ULL + (unsigned long long)cpu_time.tv_nsec;
+}
+
+// called by the consumer thread right before it returns
+static void store_thread_cpu_times(plugin_context_t* plugin_context)
+{
+    unsigned long long user_time_ns, system_time_ns;
+    sample_thread_rusage(&user_time_ns, &system_time_ns);
+
+    unsigned long long cpu_time_ns = thread_cpu_time_ns();
+
+    __atomic_store_n(&plugin_context->stats.user_time_ns, user_time_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&plugin_context->stats.system_time_ns, system_time_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&plugin_context->stats.cpu_time_ns, cpu_time_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&plugin_context->thread_exited, 1, __ATOMIC_RELEASE);
+}
+
+// block until the next stage grants credits, the wait counts as blocked time
+// on an error the stage goes back to the blocking put (no credit flow control)
+static void wait_for_credits(plugin_context_t* plugin_context)
+{
+    unsigned long long wait_start_ns = monotonic_time_ns();
+    int granted = plugin_context->next_take_credits(PLUGIN_CREDIT_REQUEST, 1);
+    __atomic_add_fetch(&plugin_context->stats.blocked_time_ns, monotonic_time_ns() - wait_start_ns, __ATOMIC_RELAXED);
+
+    if (granted > 0) {
+        plugin_context->credits = granted;
+    } else {
+        log_error(plugin_context, "failed to take credits from the next stage, forwarding without them");
+        plugin_context->next_take_credits = NULL;
+    }
+}
+
+// "<name>#<id>" so top -H and perf show which stage a thread belongs to
+// long names are cut so the id always fits in the 15 characters pthread allows
+// called by the consumer thread itself, naming the calling thread is a cheap prctl
+static void name_consumer_thread(plugin_context_t* plugin_context)
+{
+    char id_suffix[12] = "";
+    if (plugin_context->instance_id > 0) {
+        snprintf(id_suffix, sizeof(id_suffix), "#%d", plugin_context->instance_id);
+    }
+
+    const char* name = plugin_context->name ? plugin_context->name : "plugin";
+    size_t suffix_length = strlen(id_suffix);
+    size_t name_room = (PLUGIN_THREAD_NAME_LENGTH - 1) - suffix_length;
+    size_t name_length = strlen(name) < name_room ? strlen(name) : name_room;
+
+    char* thread_name = plugin_context->stats.thread_name;
+    memcpy(thread_name, name, name_length);
+    memcpy(thread_name + name_length, id_suffix, suffix_length + 1);
+
+    //only a hint for the tools, a failure here must not fail the init
+    pthread_setname_np(pthread_self(), thread_name);
+}
+
+
+// run the plugin transform (and the fused ones) on an item we own
+// returns the output string, owned by the caller - may be the same buffer as the input
+// the input is freed here if it was not reused, NULL means the item was dropped
+static char* process_item(plugin_context_t* plugin_context, char* input_string)
+{
+    //executor mode of a partitioned stage - the shard of the item runs right here
+    if (NULL != plugin_context->partition) {
+        return plugin_partition_process_inline(plugin_context->partition, input_string);
+    }
+
+    char* processed = transform_item(plugin_context, input_string);
+    if (processed != input_string) {
+        plugin_free(input_string);
+    }
+    return processed;
+}
+
+// same as process_item but the input is never freed - it may live inside the queue ring
+// returns the input buffer itself (rewritten in place), a new plugin_alloc buffer, or NULL
+static char* transform_item(plugin_context_t* plugin_context, char* input_string)
+{
+    // the dequeued string is ours, so in-place plugins rewrite it directly without allocating
+    char* processed = NULL;
+    if (plugin_context->inplace_function) {
+        if (0 == plugin_context->inplace_function(input_string, (int)strlen(input_string))) {
+            processed = input_string;
+        }
+    } else {
+        processed = (char*)plugin_context->process_function(input_string);
+    }
+
+    //run the fused stages on the same buffer, no queue hop and no copy between them
+    if (NULL != processed && plugin_context->fused_count > 0) {
+        int processed_len = (int)strlen(processed);
+        for (int i = 0; i < plugin_context->fused_count; i++) {
+            if (0 != plugin_context->fused_functions[i](processed, processed_len)) {
+                log_error(plugin_context, "fused transform failed, dropping item");
+                if (processed != input_string) {
+                    plugin_free(processed);
+                }
+                processed = NULL;
+                break;
+            }
+        }
+    }
+    return processed;
+}
+
+
 /// עדי של העתיד שלום, החלק הבא זה לממש את ההחלק של הINIT ////
 // בהצלחה גיבור
 const char* common_plugin_init(const char* (*process_function)(const char*), 
                               const char* name, int queue_size) {
+    return init_plugin_context(process_function, NULL, NULL, name, queue_size);
+}
+
+const char* common_plugin_init_inplace(const char* (*process_function)(const char*),
+                              plugin_inplace_func inplace_function, const char* name, int queue_size) {
+    return init_plugin_context(process_function, inplace_function, NULL, name, queue_size);
+}
+
+const char* common_plugin_init_partitioned(const plugin_partition_ops_t* ops, const char* name, int queue_size) {
+    if (NULL == ops || NULL == ops->process) {
+        return "Partitioned plugin without a process callback";
+    }
+    return init_plugin_context(NULL, NULL, ops, name, queue_size);
+}
+
+void common_plugin_set_destroy(void (*destroy_function)(void)) {
+    g_destroy_function = destroy_function;
+}
+
+static const char* init_plugin_context(const char* (*process_function)(const char*), plugin_inplace_func inplace_function,
+                                       const plugin_partition_ops_t* partition_ops, const char* name, int queue_size) {
     
+    //the plugin read its parameters before calling here, one left over is not a parameter of this stage
+    const char* param_error = check_params_read();
+    if (NULL != param_error) {
+        return param_error;
+    }
+    if (NULL == partition_ops && g_workers_param > 1) {
+        snprintf(g_param_error, sizeof(g_param_error), "Parameter workers needs a key partitioned plugin");
+        return g_param_error;
+    }
+
     //clean context fresh start
     memset(&g_plugin_context, 0, sizeof(plugin_context_t));
     
@@ -120,7 +420,9 @@ const char* common_plugin_init(const char* (*process_function)(const char*),
 
 
     g_plugin_context.name = name;
+    g_plugin_context.instance_id = g_instance_id;
     g_plugin_context.process_function = process_function;
+    g_plugin_context.inplace_function = inplace_function;
     
     //init queue
     g_plugin_context.queue = (consumer_producer_t*)malloc(sizeof(consumer_producer_t));
@@ -133,7 +435,34 @@ const char* common_plugin_init(const char* (*process_function)(const char*),
     }
 
     memset(g_plugin_context.queue, 0, sizeof(consumer_producer_t));
-    const char* error = consumer_producer_init(g_plugin_context.queue, queue_size);
+    //the queue shares the plugin allocator, so dequeued items and transform outputs are released the same way
+    const char* error = (g_queue_ring_bytes > 0)
+        ? consumer_producer_init_byte_ring(g_plugin_context.queue, queue_size, g_queue_ring_bytes, &g_plugin_allocator)
+        : consumer_producer_init_with_allocator(g_plugin_context.queue, queue_size, &g_plugin_allocator);
+
+    if (NULL == error && g_credit_batch > 0) {
+        consumer_producer_set_credit_batch(g_plugin_context.queue, g_credit_batch);
+    }
+    if (NULL == error && g_backlog_hot_items > 0) {
+        int hot_items = (g_backlog_hot_items < queue_size) ? g_backlog_hot_items : queue_size;
+        error = consumer_producer_set_backlog_compression(g_plugin_context.queue, hot_items);
+        if (NULL != error) {
+            consumer_producer_destroy(g_plugin_context.queue);
+        }
+    }
+    if (NULL == error && g_lock_profile_enabled) {
+        memset(g_lock_profiles, 0, sizeof(g_lock_profiles));
+        consumer_producer_set_lock_profiles(g_plugin_context.queue, g_lock_profiles);
+    }
+
+    //the shards exist before the consumer thread starts routing to them
+    if (NULL == error && NULL != partition_ops) {
+        error = plugin_partition_create(&g_plugin_context, partition_ops, g_num_partitions, queue_size,
+                                        !g_use_external_executor, g_relaxed_order, &g_plugin_context.partition);
+        if (NULL != error) {
+            consumer_producer_destroy(g_plugin_context.queue);
+        }
+    }
 
     if (error) {
         free(g_plugin_context.queue);
@@ -142,9 +471,36 @@ const char* common_plugin_init(const char* (*process_function)(const char*),
         return error;
     }
     
-    //consumer thread
-    if (pthread_create(&g_plugin_context.consumer_thread, NULL, plugin_consumer_thread, &g_plugin_context) != 0) 
+    //in executor mode the stage is driven by plugin_step from the host worker threads
+    if (g_use_external_executor) {
+        g_plugin_context.initialized = 1;
+        return NULL;
+    }
+
+    //consumer thread - with a small stack when the host asked for it (long chains), on its CPU if placed
+    pthread_attr_t thread_attr;
+    pthread_attr_t* thread_attr_ptr = NULL;
+    if ((g_consumer_stack_size > 0 || g_consumer_cpu >= 0) && 0 == pthread_attr_init(&thread_attr)) {
+        thread_attr_ptr = &thread_attr;
+        if (g_consumer_stack_size > 0 && 0 != pthread_attr_setstacksize(&thread_attr, g_consumer_stack_size)) {
+            pthread_attr_destroy(&thread_attr);
+            thread_attr_ptr = NULL;
+        }
+    }
+    if (NULL != thread_attr_ptr && g_consumer_cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(g_consumer_cpu, &cpu_set);
+        pthread_attr_setaffinity_np(thread_attr_ptr, sizeof(cpu_set), &cpu_set);
+    }
+
+    int create_result = pthread_create(&g_plugin_context.consumer_thread, thread_attr_ptr, plugin_consumer_thread, &g_plugin_context);
+    if (NULL != thread_attr_ptr) {
+        pthread_attr_destroy(thread_attr_ptr);
+    }
+    if (create_result != 0) 
     {
+        plugin_partition_destroy(g_plugin_context.partition);
         consumer_producer_destroy(g_plugin_context.queue);
         free(g_plugin_context.queue);
         pthread_cond_destroy(&g_plugin_context.ready_cond);
@@ -178,6 +534,16 @@ const char* common_plugin_init(const char* (*process_function)(const char*),
 PLUGIN_EXPORT
 const char* plugin_place_work(const char* str) {
     if (!g_plugin_context.initialized || !str) { return "Plugin not ready"; }
+
+    //overflow drop - a full queue costs the item, not the caller's time (<END> always gets in)
+    if (g_overflow_drop && 0 != strcmp(str, "<END>")) {
+        int put_result = consumer_producer_try_put(g_plugin_context.queue, str);
+        if (1 == put_result) {
+            __atomic_add_fetch(&g_plugin_context.stats.items_dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+        return (0 == put_result) ? NULL : "Failed to queue item";
+    }
     
     return consumer_producer_put(g_plugin_context.queue, str);
 }
@@ -187,6 +553,470 @@ void plugin_attach(const char* (*next_place_work)(const char*)) {
     g_plugin_context.next_place_work = next_place_work;
 }
 
+PLUGIN_EXPORT
+int plugin_offer_work(const char* str) {
+    if (!g_plugin_context.initialized || !str) { return -1; }
+
+    return consumer_producer_try_put(g_plugin_context.queue, str);
+}
+
+PLUGIN_EXPORT
+void plugin_attach_offer(int (*next_offer_work)(const char*)) {
+    g_plugin_context.next_offer_work = next_offer_work;
+}
+
+PLUGIN_EXPORT
+int plugin_take_credits(int wanted, int wait) {
+    if (!g_plugin_context.initialized || NULL == g_plugin_context.queue) { return -1; }
+
+    return consumer_producer_take_credits(g_plugin_context.queue, wanted, wait);
+}
+
+PLUGIN_EXPORT
+void plugin_attach_credits(int (*next_take_credits)(int, int)) {
+    g_plugin_context.next_take_credits = next_take_credits;
+    g_plugin_context.credits = 0;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_allocator(const pipeline_allocator_t* allocator) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+
+    if (NULL == allocator) {
+        memset(&g_plugin_allocator, 0, sizeof(pipeline_allocator_t));
+        return NULL;
+    }
+    if (NULL == allocator->allocate || NULL == allocator->deallocate) {
+        return "Allocator must provide allocate and deallocate";
+    }
+    g_plugin_allocator = *allocator;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_stack_size(size_t stack_size) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (stack_size > 0 && stack_size < (size_t)PTHREAD_STACK_MIN) { return "Stack size below PTHREAD_STACK_MIN"; }
+
+    g_consumer_stack_size = stack_size;
+    return NULL;
+}
+
+void* plugin_alloc(size_t size) {
+    return allocator_alloc(&g_plugin_allocator, size);
+}
+
+void plugin_free(void* ptr) {
+    allocator_free(&g_plugin_allocator, ptr);
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_queue_bytes(size_t ring_bytes) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (ring_bytes > 0 && ring_bytes < byte_ring_record_size(0)) { return "Ring size too small"; }
+
+    g_queue_ring_bytes = ring_bytes;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_partitions(int num_partitions) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (num_partitions < 1 || num_partitions > PLUGIN_MAX_PARTITIONS) { return "Invalid number of partitions"; }
+
+    g_num_partitions = num_partitions;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_relaxed_order(int relaxed) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+
+    g_relaxed_order = relaxed ? 1 : 0;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_credit_batch(int credit_batch) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (credit_batch < 0) { return "Invalid credit batch"; }
+
+    g_credit_batch = credit_batch;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_overflow_policy(int drop) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+
+    g_overflow_drop = drop ? 1 : 0;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_cpu(int cpu) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (cpu < -1 || cpu >= CPU_SETSIZE) { return "Invalid CPU"; }
+
+    g_consumer_cpu = cpu;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_trim_memory(size_t keep_bytes, size_t* released_bytes) {
+    if (NULL == released_bytes) { return "Invalid released bytes pointer"; }
+    if (!g_plugin_context.initialized) { return "Plugin not ready"; }
+
+    //the shard queues keep pointers only, their items went back to the allocator already
+    *released_bytes = consumer_producer_trim(g_plugin_context.queue, keep_bytes);
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_backlog_compression(int hot_items) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (hot_items < 0) { return "Invalid hot depth"; }
+
+    g_backlog_hot_items = hot_items;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_lock_profile(int enabled) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+
+    g_lock_profile_enabled = enabled ? 1 : 0;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_get_lock_profile(int lock, lock_profile_t* profile, const char** lock_name) {
+    if (NULL == profile || NULL == lock_name) { return "Invalid lock profile pointer"; }
+    if (!g_plugin_context.initialized) { return "Plugin not ready"; }
+    if (!g_lock_profile_enabled) { return "Lock profile not enabled"; }
+    if (NULL == consumer_producer_lock_name(lock)) { return "No such lock"; }
+
+    //the holders write the counters without atomics, the host reads them once the stage finished
+    *profile = g_lock_profiles[lock];
+    *lock_name = consumer_producer_lock_name(lock);
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_init_ex(const plugin_config_t* config) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (NULL == config || config->num_params < 0 || config->num_params > PLUGIN_MAX_PARAMS ||
+        (config->num_params > 0 && NULL == config->params)) {
+        return "Invalid plugin config";
+    }
+    for (int i = 0; i < config->num_params; i++) {
+        if (NULL == config->params[i].key || NULL == config->params[i].value) {
+            return "Invalid plugin config";
+        }
+        for (int j = 0; j < i; j++) {
+            if (0 == strcmp(config->params[i].key, config->params[j].key)) {
+                snprintf(g_param_error, sizeof(g_param_error), "Duplicate parameter %s", config->params[i].key);
+                return g_param_error;
+            }
+        }
+    }
+
+    g_plugin_config = config;
+    memset(g_param_read, 0, sizeof(g_param_read));
+
+    //the generic keys go through the setters, so they get the same checks
+    long workers = g_num_partitions;
+    long batch = g_credit_batch;
+    long pool_bytes = (long)g_queue_ring_bytes;
+    g_workers_param = 0;
+    const char* error = plugin_param_long("workers", 1, PLUGIN_MAX_PARTITIONS, &g_workers_param);
+    if (g_workers_param > 0) {
+        workers = g_workers_param;
+    }
+    if (NULL == error) {
+        error = plugin_param_long("batch", 0, INT_MAX, &batch);
+    }
+    if (NULL == error) {
+        error = plugin_param_long("pool_bytes", 0, INT_MAX, &pool_bytes);
+    }
+    if (NULL == error) {
+        error = plugin_set_partitions((int)workers);
+    }
+    if (NULL == error) {
+        error = plugin_set_credit_batch((int)batch);
+    }
+    if (NULL == error) {
+        error = plugin_set_queue_bytes((size_t)pool_bytes);
+    }
+    if (NULL == error) {
+        error = (NULL != plugin_init) ? plugin_init(config->queue_size) : "Plugin has no plugin_init";
+    }
+
+    g_plugin_config = NULL;
+    g_workers_param = 0;
+    return error;
+}
+
+const char* plugin_param_long(const char* key, long min_value, long max_value, long* value) {
+    if (NULL == key || NULL == value) { return "Invalid parameter arguments"; }
+    if (NULL == g_plugin_config) { return NULL; }
+
+    for (int i = 0; i < g_plugin_config->num_params; i++) {
+        if (0 != strcmp(g_plugin_config->params[i].key, key)) {
+            continue;
+        }
+        g_param_read[i] = 1;
+        const char* text = g_plugin_config->params[i].value;
+        char* end = NULL;
+        errno = 0;
+        long parsed = strtol(text, &end, 10);
+        if ('\0' == *text || '\0' != *end || 0 != errno || parsed < min_value || parsed > max_value) {
+            snprintf(g_param_error, sizeof(g_param_error), "Invalid value for parameter %s (%ld to %ld)",
+                     key, min_value, max_value);
+            return g_param_error;
+        }
+        *value = parsed;
+        return NULL;
+    }
+    return NULL;
+}
+
+// NULL when every parameter of the running plugin_init_ex was read
+static const char* check_params_read(void) {
+    if (NULL == g_plugin_config) {
+        return NULL;
+    }
+    for (int i = 0; i < g_plugin_config->num_params; i++) {
+        if (!g_param_read[i]) {
+            snprintf(g_param_error, sizeof(g_param_error), "Unknown parameter %s", g_plugin_config->params[i].key);
+            return g_param_error;
+        }
+    }
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_set_instance_id(int instance_id) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+    if (instance_id < 0) { return "Invalid instance id"; }
+
+    g_instance_id = instance_id;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_get_stats(plugin_stats_t* stats) {
+    if (NULL == stats) { return "Invalid stats pointer"; }
+    if (!g_plugin_context.initialized) { return "Plugin not ready"; }
+
+    plugin_context_t* plugin_context = &g_plugin_context;
+    stats->items_processed = __atomic_load_n(&plugin_context->stats.items_processed, __ATOMIC_RELAXED);
+    stats->user_time_ns = __atomic_load_n(&plugin_context->stats.user_time_ns, __ATOMIC_RELAXED);
+    stats->system_time_ns = __atomic_load_n(&plugin_context->stats.system_time_ns, __ATOMIC_RELAXED);
+    stats->cpu_time_ns = __atomic_load_n(&plugin_context->stats.cpu_time_ns, __ATOMIC_RELAXED);
+    memcpy(stats->thread_name, plugin_context->stats.thread_name, PLUGIN_THREAD_NAME_LENGTH);
+    stats->items_dropped = __atomic_load_n(&plugin_context->stats.items_dropped, __ATOMIC_RELAXED);
+    stats->blocked_time_ns = __atomic_load_n(&plugin_context->stats.blocked_time_ns, __ATOMIC_RELAXED);
+    stats->latency_sum_ns = __atomic_load_n(&plugin_context->stats.latency_sum_ns, __ATOMIC_RELAXED);
+    for (int bucket = 0; bucket < PLUGIN_LATENCY_BUCKETS; bucket++) {
+        stats->latency_buckets[bucket] = __atomic_load_n(&plugin_context->stats.latency_buckets[bucket], __ATOMIC_RELAXED);
+    }
+
+    //read without the queue lock, a slightly stale depth is fine for monitoring
+    stats->queue_depth = __atomic_load_n(&plugin_context->queue->count, __ATOMIC_RELAXED);
+    stats->queue_capacity = plugin_context->queue->capacity;
+    stats->waiting_consumers = __atomic_load_n(&plugin_context->queue->not_empty_monitor.waiting_count, __ATOMIC_RELAXED);
+    stats->waiting_producers = __atomic_load_n(&plugin_context->queue->not_full_monitor.waiting_count, __ATOMIC_RELAXED) +
+                               __atomic_load_n(&plugin_context->queue->credit_monitor.waiting_count, __ATOMIC_RELAXED);
+    stats->finished = __atomic_load_n(&plugin_context->finished, __ATOMIC_RELAXED);
+    stats->backlog_items = __atomic_load_n(&plugin_context->queue->backlog.num_items, __ATOMIC_RELAXED);
+    stats->backlog_blocks = __atomic_load_n(&plugin_context->queue->backlog.blocks_compressed, __ATOMIC_RELAXED);
+    stats->backlog_plain_bytes = __atomic_load_n(&plugin_context->queue->backlog.plain_bytes, __ATOMIC_RELAXED);
+    stats->backlog_compressed_bytes = __atomic_load_n(&plugin_context->queue->backlog.compressed_bytes, __ATOMIC_RELAXED);
+    stats->backlog_peak_bytes = __atomic_load_n(&plugin_context->queue->backlog.peak_resident_bytes, __ATOMIC_RELAXED);
+
+    //in executor mode the item a stage holds is the output waiting for the next stage
+    stats->item_in_progress = __atomic_load_n(&plugin_context->stats.item_in_progress, __ATOMIC_RELAXED) ||
+                              NULL != __atomic_load_n(&plugin_context->pending_output, __ATOMIC_RELAXED);
+
+    //a running consumer thread - its own CPU clock is exact, the user/system split is the last sample
+    if (plugin_context->thread_created && !__atomic_load_n(&plugin_context->thread_exited, __ATOMIC_ACQUIRE)) {
+        clockid_t thread_clock;
+        struct timespec cpu_time;
+        if (0 == pthread_getcpuclockid(plugin_context->consumer_thread, &thread_clock) &&
+            0 == clock_gettime(thread_clock, &cpu_time)) {
+            stats->cpu_time_ns = (unsigned long long)cpu_time.tv_sec * 1000000000ULL + (unsigned long long)cpu_time.tv_nsec;
+        }
+    }
+    //a partitioned stage also runs on its shard threads
+    stats->cpu_time_ns += plugin_partition_cpu_time_ns(plugin_context->partition);
+    stats->partitions = (NULL != plugin_context->partition) ? g_num_partitions : 0;
+    return NULL;
+}
+
+PLUGIN_EXPORT
+const char* plugin_use_executor(void) {
+    if (g_plugin_context.initialized) { return "Plugin already initialized"; }
+
+    g_use_external_executor = 1;
+    return NULL;
+}
+
+// forward the pending output without blocking
+// returns 1 when the downstream queue is full and the output is still pending
+static int flush_pending_output(plugin_context_t* plugin_context)
+{
+    if (NULL == plugin_context->pending_output) {
+        return 0;
+    }
+
+    if (plugin_context->next_offer_work) {
+        int offer_result = plugin_context->next_offer_work(plugin_context->pending_output);
+        if (1 == offer_result) {
+            //blocked downstream - the time counts from the first refused offer until it is accepted
+            if (0 == plugin_context->blocked_since_ns) {
+                plugin_context->blocked_since_ns = monotonic_time_ns();
+            }
+            return 1;
+        }
+        if (0 != plugin_context->blocked_since_ns) {
+            __atomic_add_fetch(&plugin_context->stats.blocked_time_ns, monotonic_time_ns() - plugin_context->blocked_since_ns, __ATOMIC_RELAXED);
+            plugin_context->blocked_since_ns = 0;
+        }
+        if (0 != offer_result) {
+            log_error(plugin_context, "failed to forward item, dropping it");
+            __atomic_add_fetch(&plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+        }
+    } else if (plugin_context->next_place_work) {
+        //next stage has no offer function, fall back to the blocking put
+        plugin_context->next_place_work(plugin_context->pending_output);
+    }
+
+    plugin_free(plugin_context->pending_output);
+    plugin_context->pending_output = NULL;
+    return 0;
+}
+
+PLUGIN_EXPORT
+int plugin_step(int max_items) {
+    plugin_context_t* plugin_context = &g_plugin_context;
+    if (!plugin_context->initialized || NULL == plugin_context->queue) {
+        return 0;
+    }
+
+    //idle stage - return before paying for the CPU accounting below
+    if (NULL == plugin_context->pending_output && !plugin_context->end_pending && !plugin_context->finished &&
+        0 == __atomic_load_n(&plugin_context->queue->count, __ATOMIC_RELAXED) &&
+        (NULL == plugin_context->partition || !plugin_partition_has_deferred(plugin_context->partition))) {
+        return 0;
+    }
+
+    //the stage runs on whichever worker picked it, so its CPU time is the sum of the steps
+    //the thread clock is exact, getrusage only gives a tick based user/system split
+    unsigned long long user_before_ns, system_before_ns;
+    sample_thread_rusage(&user_before_ns, &system_before_ns);
+    unsigned long long cpu_before_ns = thread_cpu_time_ns();
+
+    int processed_count = 0;
+    while (!plugin_context->finished) {
+        //an output that did not fit downstream must go first to keep the order
+        if (1 == flush_pending_output(plugin_context)) {
+            break;
+        }
+        //lines of a merge (and the <END> behind them) go out before anything else
+        if (NULL != plugin_context->partition) {
+            plugin_context->pending_output = plugin_partition_take_deferred(plugin_context->partition);
+            if (NULL != plugin_context->pending_output) {
+                continue;
+            }
+        }
+        if (plugin_context->end_pending) {
+            plugin_context->finished = 1;
+            consumer_producer_signal_finished(plugin_context->queue);
+            break;
+        }
+        if (processed_count >= max_items) {
+            break;
+        }
+
+        //no credit for an output - leave the item in the queue and let the worker run another stage
+        if (NULL != plugin_context->next_take_credits && 0 == plugin_context->credits) {
+            int granted = plugin_context->next_take_credits(PLUGIN_CREDIT_REQUEST, 0);
+            if (granted < 0) {
+                log_error(plugin_context, "failed to take credits from the next stage, forwarding without them");
+                plugin_context->next_take_credits = NULL;
+            } else if (0 == granted) {
+                if (0 == plugin_context->blocked_since_ns) {
+                    plugin_context->blocked_since_ns = monotonic_time_ns();
+                }
+                break;
+            } else {
+                plugin_context->credits = granted;
+                if (0 != plugin_context->blocked_since_ns) {
+                    __atomic_add_fetch(&plugin_context->stats.blocked_time_ns, monotonic_time_ns() - plugin_context->blocked_since_ns, __ATOMIC_RELAXED);
+                    plugin_context->blocked_since_ns = 0;
+                }
+            }
+        }
+
+        char* input_string = consumer_producer_try_get(plugin_context->queue);
+        if (NULL == input_string) {
+            break;
+        }
+
+        if (0 == strcmp(input_string, "<END>")) {
+            //forward <END> like any other item, we are finished once it is accepted downstream
+            plugin_context->end_pending = 1;
+            if (NULL != plugin_context->partition && 0 == plugin_partition_end_inline(plugin_context->partition, input_string)) {
+                plugin_free(input_string);
+            } else {
+                plugin_context->pending_output = input_string;
+            }
+            continue;
+        }
+
+        unsigned long long process_start_ns = monotonic_time_ns();
+        char* processed = process_item(plugin_context, input_string);
+        record_item_latency(plugin_context, monotonic_time_ns() - process_start_ns);
+        processed_count++;
+        if (NULL == processed) {
+            //a partitioned stage keeps items in its state, that is not a loss
+            if (NULL == plugin_context->partition) {
+                __atomic_add_fetch(&plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+            }
+            continue;
+        }
+        if (plugin_context->next_place_work || plugin_context->next_offer_work) {
+            plugin_context->pending_output = processed;
+            if (plugin_context->credits > 0) {
+                plugin_context->credits--;
+            }
+        } else {
+            plugin_free(processed);
+        }
+    }
+
+    unsigned long long user_after_ns, system_after_ns;
+    sample_thread_rusage(&user_after_ns, &system_after_ns);
+    __atomic_add_fetch(&plugin_context->stats.items_processed, processed_count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin_context->stats.user_time_ns, user_after_ns - user_before_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin_context->stats.system_time_ns, system_after_ns - system_before_ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&plugin_context->stats.cpu_time_ns, thread_cpu_time_ns() - cpu_before_ns, __ATOMIC_RELAXED);
+
+    return plugin_context->finished ? PLUGIN_STEP_FINISHED : processed_count;
+}
+
+PLUGIN_EXPORT
+const char* plugin_fuse(plugin_inplace_func next_inplace) {
+    if (!g_plugin_context.initialized) { return "Plugin not ready"; }
+    if (NULL == next_inplace) { return "Fused stage has no in-place transform"; }
+    if (NULL != g_plugin_context.partition) { return "A partitioned stage cannot run fused transforms"; }
+    if (g_plugin_context.fused_count >= MAX_FUSED_STAGES) { return "Too many fused stages"; }
+
+    g_plugin_context.fused_functions[g_plugin_context.fused_count++] = next_inplace;
+    return NULL;
+}
+
 PLUGIN_EXPORT
 const char* plugin_wait_finished(void) {
     if (!g_plugin_context.initialized || !g_plugin_context.queue) {
@@ -202,6 +1032,7 @@ const char* plugin_fini(void) {
     }
     //mark as finished to stop the consumer thread
     g_plugin_context.finished = 1;
+    plugin_partition_stop(g_plugin_context.partition);
 
     //wakeup all the waiting threads to process shutdown
     if (NULL != g_plugin_context.queue)
@@ -210,8 +1041,19 @@ const char* plugin_fini(void) {
     }
 
     if (g_plugin_context.thread_created) {  pthread_join(g_plugin_context.consumer_thread, NULL);  }
+    plugin_partition_destroy(g_plugin_context.partition);
+
+    //no thread touches the plugin state any more
+    if (NULL != g_destroy_function) {
+        g_destroy_function();
+        g_destroy_function = NULL;
+    }
+
+    //the stage threads are gone, print the log records they left behind
+    async_log_flush();
 
     //cleanup resources 
+    plugin_free(g_plugin_context.pending_output);
     if (g_plugin_context.queue) {
         consumer_producer_destroy(g_plugin_context.queue);
         free(g_plugin_context.queue);
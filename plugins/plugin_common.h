@@ -13,6 +13,64 @@
  * 
  * Plugin developers only need to implement their transformation logic.
  */ 
+
+// Maximum number of in-place transforms that can be fused after a stage
+#define MAX_FUSED_STAGES 16
+
+// plugin_step return value once the stage forwarded <END>
+#define PLUGIN_STEP_FINISHED -1
+
+// the consumer thread refreshes its user/system CPU split every this many items
+#define PLUGIN_RUSAGE_SAMPLE_INTERVAL 64
+
+// credits asked from the next stage at once (credit flow control)
+#define PLUGIN_CREDIT_REQUEST 16
+
+// upper bound for plugin_set_partitions
+#define PLUGIN_MAX_PARTITIONS 64
+
+/**
+ * Optional in-place variant of a plugin transformation.
+ * Length preserving plugins rewrite the buffer they receive instead of returning
+ * a new malloc'd copy, so several of them can run back to back on the same buffer.
+ * @param buffer Null terminated string owned by the caller, modified in place
+ * @param length Length of the string (strlen)
+ * @return 0 on success, -1 on failure
+ */
+typedef int (*plugin_inplace_func)(char* buffer, int length);
+
+/**
+ * Forward a line to the next stage from a merge hook (the line is copied)
+ */
+typedef void (*plugin_emit_func)(const char* line);
+
+/**
+ * Callbacks of a stateful, key partitioned plugin (common_plugin_init_partitioned).
+ * The stage runs on plugin_set_partitions shards, each with a private state that only
+ * its own thread touches - items with the same key always go to the same shard, so the
+ * state needs no lock. Outputs leave in input order.
+ */
+typedef struct
+{
+    // key of an item, points into the item - items with equal keys share a shard
+    // returns the key length, *key left NULL (or no extract_key) means the whole item is the key
+    size_t (*extract_key)(const char* item, const char** key);
+    // private state of one shard, NULL is a valid state
+    void* (*create_state)(void);
+    // release a state returned by create_state (may be NULL)
+    void (*destroy_state)(void* state);
+    // process an item with the state of its shard
+    // returns a plugin_alloc'd output, or NULL if the item produces nothing (kept in the state)
+    const char* (*process)(void* state, const char* item);
+    // called with every shard idle at the end of the stream (and each window close),
+    // emit forwards the aggregated lines in front of <END>. May be NULL
+    void (*merge)(void** states, int num_shards, plugin_emit_func emit);
+    // close a window every this many items - merge runs between two items (0 - end of stream only)
+    int window_items;
+} plugin_partition_ops_t;
+
+// partition state of a stage (plugin_partition.c)
+typedef struct plugin_partition plugin_partition_t;
  
 // Plugin context structure 
 typedef struct 
@@ -21,13 +79,26 @@ typedef struct
     consumer_producer_t* queue;                    // Input queue 
     pthread_t consumer_thread;                     // Consumer thread handle
     const char* (*next_place_work)(const char*);   // Next plugin's place_work function 
+    int (*next_offer_work)(const char*);           // Next plugin's non blocking offer_work (executor mode)
+    char* pending_output;                          // Output not yet accepted downstream (executor mode)
+    int end_pending;                               // pending_output is the <END> marker
     const char* (*process_function)(const char*);  // Plugin-specific processing function 
+    plugin_inplace_func inplace_function;          // Optional in-place variant of process_function
+    plugin_inplace_func fused_functions[MAX_FUSED_STAGES]; // In-place transforms of stages fused after this one
+    int fused_count;                               // Number of fused transforms
     int initialized;                               // Initialization flag 
     int finished;                                  // Finished processing flag 
     int thread_created;                            // Thread creation flag
     pthread_mutex_t  ready_mutex;                   // helper mutex for thread safety
     pthread_cond_t ready_cond;                    // Helper condition var for signaling 
     int thread_ready;                             // helper flag in order indicate that thread is ready
+    int instance_id;                              // Host instance id, part of the thread name (0 - not set)
+    plugin_stats_t stats;                         // Items and CPU time of this stage (updated with atomics)
+    int thread_exited;                            // consumer thread stored its final CPU times and returned
+    unsigned long long blocked_since_ns;          // executor mode - first refused offer of pending_output (or credit request)
+    int (*next_take_credits)(int, int);           // Next plugin's take_credits, NULL - no credit flow control
+    int credits;                                  // Items the next stage accepts without blocking
+    plugin_partition_t* partition;                // Shards of a key partitioned stage, NULL otherwise
 } plugin_context_t; 
  
 // global plugin context, each plugin has its own instance/context
@@ -42,8 +113,24 @@ extern plugin_context_t g_plugin_context;
 void* plugin_consumer_thread(void* arg); 
  
 
+/** 
+ * Allocate memory for a transform result 
+ * Transforms must use this instead of malloc, the buffer is released by the 
+ * infrastructure through the allocator the host installed (malloc by default) 
+ * @param size Number of bytes 
+ * @return Pointer to the memory or NULL on failure 
+ */ 
+void* plugin_alloc(size_t size); 
+
+/** 
+ * Release memory returned by plugin_alloc (or a dequeued item of this plugin) 
+ * @param ptr Pointer to release 
+ */ 
+void plugin_free(void* ptr); 
+
 /** 
  * Print error message in the format [ERROR][Plugin Name] - message 
+ * The line is printed by a background thread and rate limited per call site (sync/async_log.h) 
  * @param context Plugin context 
  * @param message Error message 
  */ 
@@ -51,6 +138,7 @@ void log_error(plugin_context_t* context, const char* message);
  
 /** 
  * Print info message in the format [INFO][Plugin Name] - message 
+ * The line is printed by a background thread and rate limited per call site (sync/async_log.h) 
  * @param context Plugin context 
  * @param message Info message 
  */ 
@@ -73,6 +161,39 @@ const char* plugin_get_name(void);
 */ 
 const char* common_plugin_init(const char* (*process_function)(const char*), 
 const char* name, int queue_size); 
+
+/**
+* Same as common_plugin_init, for plugins that also provide an in-place transform.
+* When set, the consumer thread transforms the dequeued buffer directly and skips
+* the allocation of process_function.
+* @param process_function Plugin-specific processing function
+* @param inplace_function In-place variant of process_function (may be NULL)
+* @param name Plugin name
+* @param queue_size Maximum number of items that can be queued
+* @return NULL on success, error message on failure
+*/
+const char* common_plugin_init_inplace(const char* (*process_function)(const char*),
+plugin_inplace_func inplace_function, const char* name, int queue_size);
+
+/**
+* Same as common_plugin_init, for stateful plugins whose state is split by key.
+* The consumer thread only hashes the key and routes the item to its shard, one thread
+* per shard runs ops->process with that shard's state. Results are put back in input
+* order before they are forwarded. In executor mode the shards run inline in plugin_step.
+* @param ops Plugin callbacks (copied)
+* @param name Plugin name
+* @param queue_size Maximum number of items that can be queued (also per shard)
+* @return NULL on success, error message on failure
+*/
+const char* common_plugin_init_partitioned(const plugin_partition_ops_t* ops, const char* name, int queue_size);
+
+/**
+* Register the release of the state a plugin built in its plugin_init (a parse tree, tables).
+* plugin_fini calls it once the stage threads are gone. Call it after a successful
+* common_plugin_init*, a failed init leaves the state to the plugin
+* @param destroy_function Releases the plugin state (NULL - nothing to release)
+*/
+void common_plugin_set_destroy(void (*destroy_function)(void));
 /** 
 * Initialize the plugin with the specified queue size - calls 
 common_plugin_init 
@@ -82,6 +203,29 @@ common_plugin_init
 */ 
 __attribute__((visibility("default")))  
 const char* plugin_init(int queue_size); 
+/**
+* Initialize the plugin with per-stage parameters instead of plugin_init.
+* Applies the generic keys (workers, batch, pool_bytes - plugin_config.h) as if the
+* matching plugin_set_* had been called, then runs the plugin's own plugin_init, which
+* reads its keys with plugin_param_long. A key nobody read fails the init before the
+* stage is created, so a typo never goes unnoticed
+* @param config Queue size and parameters
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_init_ex(const plugin_config_t* config);
+
+/**
+* Read an integer parameter of plugin_init_ex, for the plugin_init of a plugin
+* (before the common_plugin_init* call). Under a plain plugin_init there are no parameters
+* @param key Parameter name
+* @param min_value Smallest accepted value
+* @param max_value Largest accepted value
+* @param value Set to the parameter, left unchanged if the stage does not have it
+* @return NULL on success (also when the key is absent), error message if the value is not a number in range
+*/
+const char* plugin_param_long(const char* key, long min_value, long max_value, long* value);
+
 /** 
 * Finalize the plugin - drain queue and terminate thread gracefully (i.e. 
 pthread_join) 
@@ -113,6 +257,212 @@ shutdown
 __attribute__((visibility("default")))  
 const char* plugin_wait_finished(void);
 
+/**
+* Fuse a following stage into this one - its in-place transform runs on the same
+* buffer inside this plugin's consumer thread, without a queue hop in between
+* Must be called after plugin_init and before any work is placed
+* @param next_inplace In-place transform of the fused stage (plugin_transform_inplace)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_fuse(plugin_inplace_func next_inplace);
+
+/**
+* Switch the plugin to executor mode - no consumer thread is created, the host
+* drives the stage by calling plugin_step from its own worker threads
+* Must be called before plugin_init
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_use_executor(void);
+
+/**
+* Route all the memory of this plugin (queue ring, item copies, transform outputs)
+* through the given allocator. Must be called before plugin_init
+* @param allocator Allocator vtable (copied), NULL restores malloc/free
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_allocator(const pipeline_allocator_t* allocator);
+
+/**
+* Set the stack size of the consumer thread, lets very long chains keep their
+* memory footprint small. Must be called before plugin_init
+* @param stack_size Stack size in bytes, 0 restores the pthread default
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_stack_size(size_t stack_size);
+
+/**
+* Run the stage for up to max_items items without ever blocking
+* An output the next stage cannot accept yet is kept and retried on the next call
+* @param max_items Maximum number of items to process in this call
+* @return number of items processed (0 when idle or blocked downstream),
+*         PLUGIN_STEP_FINISHED after <END> was forwarded
+*/
+__attribute__((visibility("default")))
+int plugin_step(int max_items);
+
+/**
+* Non blocking version of plugin_place_work
+* @param str The string to process (copied into the queue)
+* @return 0 on success, 1 if the queue is full, -1 on error
+*/
+__attribute__((visibility("default")))
+int plugin_offer_work(const char* str);
+
+/**
+* Attach the non blocking offer function of the next plugin (executor mode)
+* @param next_offer_work Function pointer to the next plugin's offer_work
+*/
+__attribute__((visibility("default")))
+void plugin_attach_offer(int (*next_offer_work)(const char*));
+
+/**
+* Store the queued strings inline in a byte ring of the given size instead of one
+* allocation per item. The consumer thread transforms in-place plugins directly
+* inside the ring. The queue_size given to plugin_init still bounds the item count.
+* Must be called before plugin_init
+* @param ring_bytes Ring size in bytes, 0 restores the array of string pointers
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_queue_bytes(size_t ring_bytes);
+
+/**
+* Grant credits of this stage's queue to the previous stage (credit flow control)
+* Each credit keeps one queue slot for the caller, so forwarding that many items never blocks
+* @param wanted Maximum number of credits
+* @param wait 1 - block until at least one credit is free, 0 - return right away
+* @return Number of credits granted, -1 on error
+*/
+__attribute__((visibility("default")))
+int plugin_take_credits(int wanted, int wait);
+
+/**
+* Attach the take_credits function of the next plugin - the stage then takes an input
+* item only while it holds a credit for its output, and waits for credits (thread mode)
+* or yields to the executor (executor mode) without holding any work
+* @param next_take_credits Function pointer to the next plugin's take_credits
+*/
+__attribute__((visibility("default")))
+void plugin_attach_credits(int (*next_take_credits)(int, int));
+
+/**
+* Set the number of shards of a key partitioned (stateful) stage, each runs on its
+* own thread with its own state. Stateless plugins ignore it.
+* Must be called before plugin_init
+* @param num_partitions Number of shards, 1 to PLUGIN_MAX_PARTITIONS
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_partitions(int num_partitions);
+
+/**
+* Let the shards of a partitioned stage forward each result as soon as it is ready
+* instead of in input order - no reorder wait behind a slow item, but the output order
+* changes between runs. The merged lines still come after every item. Stateless plugins
+* ignore it. Must be called before plugin_init
+* @param relaxed 1 - relaxed order, 0 - input order (default)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_relaxed_order(int relaxed);
+
+/**
+* Set how many freed queue slots are handed back to the previous stage at once
+* (credit flow control). Larger batches wake the producer less often, smaller ones
+* keep it busier. Must be called before plugin_init
+* @param credit_batch Slots per batch, capped at the queue size (0 - derived from the queue size)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_credit_batch(int credit_batch);
+
+/**
+* Choose what plugin_place_work does when the queue is full: block the caller
+* (default) or drop the item and count it in items_dropped. <END> is never dropped.
+* The host must not attach credits or offer_work into a dropping stage, they would
+* wait for room instead. Must be called before plugin_init
+* @param drop 1 - drop when full, 0 - block
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_overflow_policy(int drop);
+
+/**
+* Pin the consumer thread of this stage to one CPU (thread mode, the shards of a
+* partitioned stage are not pinned). Must be called before plugin_init
+* @param cpu CPU number, -1 - not pinned (default)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_cpu(int cpu);
+
+/**
+* Return the idle memory of this stage to the OS - the pages of its byte ring queue
+* (plugin_set_queue_bytes) while the queue is empty, except the first keep_bytes.
+* Safe to call while the stage is running, the host calls it once the stage went idle
+* @param keep_bytes Ring bytes kept resident (warm) for the next burst
+* @param released_bytes Set to the resident bytes released
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_trim_memory(size_t keep_bytes, size_t* released_bytes);
+
+/**
+* Record the contention of the input queue locks (queue_mutex and the mutexes of its
+* monitors) - acquisitions, contended acquisitions, wait and hold time histograms.
+* Every lock and unlock then reads the clock, so this is a measuring mode.
+* The shard queues of a partitioned stage are not profiled. Must be called before plugin_init
+* @param enabled 1 - profile, 0 - plain locks (default)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_lock_profile(int enabled);
+
+/**
+* Compress the deep backlog of the input queue - only the first hot_items queued items
+* stay separate strings, the rest are packed into blocks that are compressed once full
+* and decompressed when the consumer reaches them. Trades CPU on both ends of the queue
+* for memory when a slow stage builds a large backlog. Not with plugin_set_queue_bytes,
+* the shard queues of a partitioned stage are not compressed. Must be called before plugin_init
+* @param hot_items Items kept uncompressed (capped at the queue size), 0 - off (default)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_backlog_compression(int hot_items);
+
+/**
+* Read the contention profile of one input queue lock, call it after plugin_wait_finished
+* and before plugin_fini (the counters are written without atomics)
+* @param lock Lock index, 0 .. CONSUMER_PRODUCER_PROFILED_LOCKS - 1
+* @param profile Filled with the profile of the lock
+* @param lock_name Set to the name of the lock ("queue_mutex", "not_full" ...)
+* @return NULL on success, error message on failure (also past the last lock)
+*/
+__attribute__((visibility("default")))
+const char* plugin_get_lock_profile(int lock, lock_profile_t* profile, const char** lock_name);
+
+/**
+* Set the instance id of this stage, the consumer thread is named "<name>#<id>"
+* so top/perf can tell the stages apart. Must be called before plugin_init
+* @param instance_id Instance id given by the host (0 - name only)
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_set_instance_id(int instance_id);
+
+/**
+* Read the statistics of this stage, safe to call while the stage is running
+* The CPU time of a running consumer thread is read live from its thread clock
+* @param stats Filled with the current statistics
+* @return NULL on success, error message on failure
+*/
+__attribute__((visibility("default")))
+const char* plugin_get_stats(plugin_stats_t* stats);
+
 
 #define PLUGIN_EXPORT __attribute__((visibility("default"))) //makes the function visible to the linker as a shared object
 
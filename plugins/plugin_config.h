@@ -0,0 +1,31 @@
+#ifndef PLUGIN_CONFIG_H
+#define PLUGIN_CONFIG_H
+
+/**
+ * Per-stage init parameters, handed to plugin_init_ex.
+ * key=value pairs from the command line ("rotator:shift=3") or a plan file stage line.
+ * Shared by the plugins and the host (main.c), so it must only hold plain data.
+ *
+ * The SDK honors the generic keys for every plugin, the others belong to the plugin:
+ *   workers=N               shards of a key partitioned (stateful) stage, same as plugin_set_partitions
+ *   batch=N                 credits handed back to the previous stage at once, same as plugin_set_credit_batch
+ *   pool_bytes=N            queue byte ring size, same as plugin_set_queue_bytes
+ */
+
+// most parameters of one stage
+#define PLUGIN_MAX_PARAMS 16
+
+typedef struct
+{
+    const char* key;
+    const char* value;
+} plugin_param_t;
+
+typedef struct
+{
+    int queue_size;                 /* Same as the plugin_init argument */
+    const plugin_param_t* params;   /* Only read during plugin_init_ex, the host may free them afterwards */
+    int num_params;
+} plugin_config_t;
+
+#endif /* PLUGIN_CONFIG_H */
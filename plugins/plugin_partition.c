@@ -0,0 +1,531 @@
+#define _GNU_SOURCE
+#include "plugin_partition.h"
+#include "sync/reorder_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// FNV-1a, the key of every item is hashed once by the dispatcher
+#define PARTITION_HASH_OFFSET 14695981039346656037ULL
+#define PARTITION_HASH_PRIME 1099511628211ULL
+
+typedef struct
+{
+    plugin_partition_t* partition;
+    int index;
+    void* state;                        // private state, only this shard's thread touches it
+    consumer_producer_t queue;          // items routed to this shard
+    unsigned long long* sequences;      // sequence number of each queued item, ring of window entries
+    unsigned long long dispatched;      // items put into the queue (dispatcher only)
+    unsigned long long taken;           // items taken from the queue (shard thread only)
+    pthread_t thread;
+    int thread_created;
+    int thread_joined;
+    int thread_exited;                  // the thread stored its final CPU time and returned
+    unsigned long long cpu_time_ns;     // final CPU time of the thread
+} partition_shard_t;
+
+struct plugin_partition
+{
+    plugin_context_t* plugin_context;
+    plugin_partition_ops_t ops;
+    int num_shards;
+    partition_shard_t* shards;
+    int threaded;                       // one thread per shard (thread mode)
+    int relaxed_order;                  // shards forward right away, the reorder buffer only counts items in flight
+    int window;                         // items in flight at most, size of the reorder window
+    reorder_buffer_t reorder;           // puts the shard results back in input order
+    pthread_mutex_t credit_mutex;       // thread mode - the shards and the dispatcher share the stage's credits
+    unsigned long long window_count;    // items since the last window close
+    char** deferred;                    // executor mode - merge lines not handed out yet
+    int deferred_count;
+    int deferred_next;
+    int deferred_capacity;
+};
+
+// the merge hook only gets a line, this is the partition it belongs to
+// (one stage per plugin instance, like g_plugin_context)
+static plugin_partition_t* g_merging_partition = NULL;
+
+static void name_shard_thread(partition_shard_t* shard);
+static void* shard_thread(void* arg);
+static int shard_of(plugin_partition_t* partition, const char* item);
+static int route_item(plugin_partition_t* partition, const char* item);
+static void forward_ready(plugin_partition_t* partition);
+static void forward_output(plugin_partition_t* partition, const char* output);
+static void take_output_credit(plugin_partition_t* partition);
+static void close_window(plugin_partition_t* partition);
+static void run_merge(plugin_partition_t* partition, plugin_emit_func emit);
+static void emit_downstream(const char* line);
+static void emit_deferred(const char* line);
+static void stop_shard_threads(plugin_partition_t* partition);
+static unsigned long long partition_time_ns(clockid_t clock);
+
+
+const char* plugin_partition_create(plugin_context_t* plugin_context, const plugin_partition_ops_t* ops,
+                                    int num_shards, int queue_size, int threaded, int relaxed_order,
+                                    plugin_partition_t** partition_out)
+{
+    if (NULL == plugin_context || NULL == ops || NULL == ops->process || NULL == partition_out) {
+        return "Invalid partition arguments";
+    }
+    if (num_shards < 1 || num_shards > PLUGIN_MAX_PARTITIONS || queue_size <= 0) {
+        return "Invalid number of partitions";
+    }
+
+    plugin_partition_t* partition = (plugin_partition_t*)calloc(1, sizeof(plugin_partition_t));
+    if (NULL == partition) {
+        return "Failed to allocate partition";
+    }
+    partition->shards = (partition_shard_t*)calloc(num_shards, sizeof(partition_shard_t));
+    if (NULL == partition->shards) {
+        free(partition);
+        return "Failed to allocate partition shards";
+    }
+    pthread_mutex_init(&partition->credit_mutex, NULL);
+    partition->plugin_context = plugin_context;
+    partition->ops = *ops;
+    partition->num_shards = num_shards;
+    partition->threaded = threaded;
+    partition->relaxed_order = relaxed_order;
+    //every shard queue full plus the item each shard is working on
+    partition->window = num_shards * (queue_size + 1);
+    *partition_out = partition;
+
+    for (int i = 0; i < num_shards; i++) {
+        partition_shard_t* shard = &partition->shards[i];
+        shard->partition = partition;
+        shard->index = i;
+        if (NULL != ops->create_state) {
+            shard->state = ops->create_state();
+        }
+    }
+    if (!threaded) {
+        return NULL;
+    }
+
+    const char* error = reorder_buffer_init(&partition->reorder, partition->window);
+    for (int i = 0; i < num_shards && NULL == error; i++) {
+        partition_shard_t* shard = &partition->shards[i];
+        shard->sequences = (unsigned long long*)calloc(partition->window, sizeof(unsigned long long));
+        if (NULL == shard->sequences) {
+            error = "Failed to allocate shard sequences";
+            break;
+        }
+        error = consumer_producer_init(&shard->queue, queue_size);
+        if (NULL == error && 0 != pthread_create(&shard->thread, NULL, shard_thread, shard)) {
+            consumer_producer_destroy(&shard->queue);
+            error = "Failed to create shard thread";
+        }
+        if (NULL != error) {
+            //destroy only releases the shards that got a queue
+            free(shard->sequences);
+            shard->sequences = NULL;
+            break;
+        }
+        shard->thread_created = 1;
+    }
+
+    if (NULL != error) {
+        plugin_partition_destroy(partition);
+        *partition_out = NULL;
+    }
+    return error;
+}
+
+void plugin_partition_dispatch(plugin_partition_t* partition)
+{
+    plugin_context_t* plugin_context = partition->plugin_context;
+
+    while (!plugin_context->finished) {
+        char* input_string = consumer_producer_get(plugin_context->queue);
+        if (NULL == input_string) {
+            if (plugin_context->finished) break;
+            continue;
+        }
+        if (plugin_context->finished) {
+            plugin_free(input_string);
+            break;
+        }
+
+        if (0 == strcmp(input_string, "<END>")) {
+            //every shard result and the merged lines go out in front of <END>
+            close_window(partition);
+            stop_shard_threads(partition);
+            if (plugin_context->next_place_work) {
+                plugin_context->next_place_work(input_string);
+            }
+            plugin_context->finished = 1;
+            consumer_producer_signal_finished(plugin_context->queue);
+            plugin_free(input_string);
+            break;
+        }
+
+        int routed = route_item(partition, input_string);
+        plugin_free(input_string);
+        if (0 != routed) {
+            break; //stopped while waiting for the window
+        }
+
+        if (partition->ops.window_items > 0 && ++partition->window_count >= (unsigned long long)partition->ops.window_items) {
+            close_window(partition);
+        }
+    }
+}
+
+char* plugin_partition_process_inline(plugin_partition_t* partition, char* input_string)
+{
+    partition_shard_t* shard = &partition->shards[shard_of(partition, input_string)];
+    char* output = (char*)partition->ops.process(shard->state, input_string);
+    plugin_free(input_string);
+
+    //the output of this item is forwarded before the merged lines (plugin_step flushes it first)
+    if (partition->ops.window_items > 0 && ++partition->window_count >= (unsigned long long)partition->ops.window_items) {
+        partition->window_count = 0;
+        run_merge(partition, emit_deferred);
+    }
+    return output;
+}
+
+int plugin_partition_end_inline(plugin_partition_t* partition, const char* end_marker)
+{
+    partition->window_count = 0;
+    run_merge(partition, emit_deferred);
+
+    //<END> leaves after the merged lines
+    int lines_before = partition->deferred_count;
+    g_merging_partition = partition;
+    emit_deferred(end_marker);
+    g_merging_partition = NULL;
+    return (partition->deferred_count > lines_before) ? 0 : -1;
+}
+
+int plugin_partition_has_deferred(plugin_partition_t* partition)
+{
+    return partition->deferred_next < partition->deferred_count;
+}
+
+char* plugin_partition_take_deferred(plugin_partition_t* partition)
+{
+    if (partition->deferred_next >= partition->deferred_count) {
+        partition->deferred_next = 0;
+        partition->deferred_count = 0;
+        return NULL;
+    }
+    return partition->deferred[partition->deferred_next++];
+}
+
+void plugin_partition_stop(plugin_partition_t* partition)
+{
+    if (NULL != partition && partition->threaded) {
+        reorder_buffer_close(&partition->reorder);
+    }
+}
+
+void plugin_partition_destroy(plugin_partition_t* partition)
+{
+    if (NULL == partition) {
+        return;
+    }
+
+    if (partition->threaded) {
+        stop_shard_threads(partition);
+        for (int i = 0; i < partition->num_shards; i++) {
+            partition_shard_t* shard = &partition->shards[i];
+            if (NULL != shard->sequences) {
+                consumer_producer_destroy(&shard->queue);
+                free(shard->sequences);
+            }
+        }
+        reorder_buffer_destroy(&partition->reorder);
+    }
+
+    for (int i = 0; i < partition->num_shards; i++) {
+        if (NULL != partition->ops.destroy_state) {
+            partition->ops.destroy_state(partition->shards[i].state);
+        }
+    }
+    for (int i = partition->deferred_next; i < partition->deferred_count; i++) {
+        plugin_free(partition->deferred[i]);
+    }
+    free(partition->deferred);
+    free(partition->shards);
+    pthread_mutex_destroy(&partition->credit_mutex);
+    free(partition);
+}
+
+unsigned long long plugin_partition_cpu_time_ns(plugin_partition_t* partition)
+{
+    if (NULL == partition || !partition->threaded) {
+        return 0;
+    }
+
+    unsigned long long cpu_time_ns = 0;
+    for (int i = 0; i < partition->num_shards; i++) {
+        partition_shard_t* shard = &partition->shards[i];
+        clockid_t thread_clock;
+        if (!shard->thread_created) {
+            continue;
+        }
+        if (__atomic_load_n(&shard->thread_exited, __ATOMIC_ACQUIRE)) {
+            cpu_time_ns += shard->cpu_time_ns;
+        } else if (0 == pthread_getcpuclockid(shard->thread, &thread_clock)) {
+            cpu_time_ns += partition_time_ns(thread_clock);
+        }
+    }
+    return cpu_time_ns;
+}
+
+
+/*** HELPER FUNCTIONS ***/
+
+// "<stage thread name>/<shard>" so top -H shows the shards next to their dispatcher
+static void name_shard_thread(partition_shard_t* shard)
+{
+    const char* base_name = shard->partition->plugin_context->name ? shard->partition->plugin_context->name : "plugin";
+    char thread_name[PLUGIN_THREAD_NAME_LENGTH];
+    char suffix[8];
+    snprintf(suffix, sizeof(suffix), "/%d", shard->index);
+    int name_room = (int)(PLUGIN_THREAD_NAME_LENGTH - 1 - strlen(suffix));
+    snprintf(thread_name, sizeof(thread_name), "%.*s%s", name_room, base_name, suffix);
+    pthread_setname_np(pthread_self(), thread_name);
+}
+
+static void* shard_thread(void* arg)
+{
+    partition_shard_t* shard = (partition_shard_t*)arg;
+    plugin_partition_t* partition = shard->partition;
+    plugin_context_t* plugin_context = partition->plugin_context;
+
+    name_shard_thread(shard);
+
+    while (1) {
+        char* item = consumer_producer_get(&shard->queue);
+        if (NULL == item) {
+            break;
+        }
+        //the dispatcher keeps the real <END>, this one only stops the shard
+        if (0 == strcmp(item, "<END>")) {
+            consumer_producer_free_item(&shard->queue, item);
+            break;
+        }
+
+        //the dispatcher wrote the sequence before the put, the queue lock orders the two
+        unsigned long long seq = shard->sequences[shard->taken % (unsigned long long)partition->window];
+        shard->taken++;
+
+        unsigned long long process_start_ns = partition_time_ns(CLOCK_MONOTONIC);
+        char* output = (char*)partition->ops.process(shard->state, item);
+        unsigned long long latency_ns = partition_time_ns(CLOCK_MONOTONIC) - process_start_ns;
+        consumer_producer_free_item(&shard->queue, item);
+
+        __atomic_add_fetch(&plugin_context->stats.latency_buckets[plugin_latency_bucket(latency_ns)], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&plugin_context->stats.latency_sum_ns, latency_ns, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&plugin_context->stats.items_processed, 1, __ATOMIC_RELAXED);
+
+        if (partition->relaxed_order) {
+            //no sequencing - forward now, a slow item elsewhere does not hold this one back
+            if (NULL != output) {
+                forward_output(partition, output);
+                plugin_free(output);
+            }
+            reorder_buffer_retire(&partition->reorder);
+        } else if (reorder_buffer_complete(&partition->reorder, seq, output)) {
+            forward_ready(partition);
+        }
+    }
+
+    shard->cpu_time_ns = partition_time_ns(CLOCK_THREAD_CPUTIME_ID);
+    __atomic_store_n(&shard->thread_exited, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static int shard_of(plugin_partition_t* partition, const char* item)
+{
+    if (1 == partition->num_shards) {
+        return 0;
+    }
+
+    const char* key = NULL;
+    size_t key_length = (NULL != partition->ops.extract_key) ? partition->ops.extract_key(item, &key) : 0;
+    if (NULL == key) {
+        key = item;
+        key_length = strlen(item);
+    }
+
+    unsigned long long hash = PARTITION_HASH_OFFSET;
+    for (size_t i = 0; i < key_length; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= PARTITION_HASH_PRIME;
+    }
+    return (int)(hash % (unsigned long long)partition->num_shards);
+}
+
+// hand an item to its shard, blocks while the reorder window or the shard queue is full
+// returns -1 once the stage is stopped
+static int route_item(plugin_partition_t* partition, const char* item)
+{
+    partition_shard_t* shard = &partition->shards[shard_of(partition, item)];
+
+    unsigned long long seq;
+    if (0 != reorder_buffer_reserve(&partition->reorder, &seq)) {
+        return -1;
+    }
+    shard->sequences[shard->dispatched % (unsigned long long)partition->window] = seq;
+    shard->dispatched++;
+
+    if (NULL != consumer_producer_put(&shard->queue, item)) {
+        //the item is lost, its turn must still pass or the window stalls
+        shard->dispatched--;
+        __atomic_add_fetch(&partition->plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+        if (partition->relaxed_order) {
+            reorder_buffer_retire(&partition->reorder);
+        } else if (reorder_buffer_complete(&partition->reorder, seq, NULL)) {
+            forward_ready(partition);
+        }
+    }
+    return 0;
+}
+
+// emitter - forward every result that is next in line
+static void forward_ready(plugin_partition_t* partition)
+{
+    char* output = NULL;
+    while (reorder_buffer_pop(&partition->reorder, &output)) {
+        if (NULL != output) {
+            forward_output(partition, output);
+            plugin_free(output);
+        }
+    }
+}
+
+// put to the next stage with a credit like any other output, the wait is the backpressure we report
+static void forward_output(plugin_partition_t* partition, const char* output)
+{
+    plugin_context_t* plugin_context = partition->plugin_context;
+    if (NULL == plugin_context->next_place_work) {
+        return;
+    }
+
+    unsigned long long forward_start_ns = partition_time_ns(CLOCK_MONOTONIC);
+    take_output_credit(partition);
+    if (NULL != plugin_context->next_place_work(output)) {
+        __atomic_add_fetch(&plugin_context->stats.items_dropped, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&plugin_context->stats.blocked_time_ns, partition_time_ns(CLOCK_MONOTONIC) - forward_start_ns, __ATOMIC_RELAXED);
+}
+
+// credit flow control - wait for credits once the stage used its last one, so the put
+// goes into a slot kept for it; on an error the stage goes back to the blocking put
+static void take_output_credit(plugin_partition_t* partition)
+{
+    plugin_context_t* plugin_context = partition->plugin_context;
+    pthread_mutex_lock(&partition->credit_mutex);
+    if (NULL != plugin_context->next_take_credits && 0 == plugin_context->credits) {
+        int granted = plugin_context->next_take_credits(PLUGIN_CREDIT_REQUEST, 1);
+        if (granted > 0) {
+            plugin_context->credits = granted;
+        } else {
+            log_error(plugin_context, "failed to take credits from the next stage, forwarding without them");
+            plugin_context->next_take_credits = NULL;
+        }
+    }
+    if (plugin_context->credits > 0) {
+        plugin_context->credits--;
+    }
+    pthread_mutex_unlock(&partition->credit_mutex);
+}
+
+// thread mode - wait until every routed item was forwarded, then merge with all the shards idle
+static void close_window(plugin_partition_t* partition)
+{
+    partition->window_count = 0;
+    if (NULL == partition->ops.merge) {
+        return;
+    }
+    //the shards wrote their states before handing in the results, the buffer lock orders that before the merge
+    if (0 != reorder_buffer_wait_drained(&partition->reorder)) {
+        return;
+    }
+    run_merge(partition, emit_downstream);
+}
+
+static void run_merge(plugin_partition_t* partition, plugin_emit_func emit)
+{
+    if (NULL == partition->ops.merge) {
+        return;
+    }
+
+    void* states[PLUGIN_MAX_PARTITIONS];
+    for (int i = 0; i < partition->num_shards; i++) {
+        states[i] = partition->shards[i].state;
+    }
+
+    g_merging_partition = partition;
+    partition->ops.merge(states, partition->num_shards, emit);
+    g_merging_partition = NULL;
+}
+
+static void emit_downstream(const char* line)
+{
+    if (NULL != g_merging_partition && NULL != line) {
+        forward_output(g_merging_partition, line);
+    }
+}
+
+// executor mode - a blocking put could stall the worker, plugin_step offers the lines later
+static void emit_deferred(const char* line)
+{
+    plugin_partition_t* partition = g_merging_partition;
+    if (NULL == partition || NULL == line) {
+        return;
+    }
+
+    if (partition->deferred_count == partition->deferred_capacity) {
+        int new_capacity = (0 == partition->deferred_capacity) ? 16 : partition->deferred_capacity * 2;
+        char** grown = (char**)realloc(partition->deferred, new_capacity * sizeof(char*));
+        if (NULL == grown) {
+            log_error(partition->plugin_context, "failed to keep a merged line, dropping it");
+            return;
+        }
+        partition->deferred = grown;
+        partition->deferred_capacity = new_capacity;
+    }
+
+    size_t length = strlen(line);
+    char* copy = (char*)plugin_alloc(length + 1);
+    if (NULL == copy) {
+        log_error(partition->plugin_context, "failed to copy a merged line, dropping it");
+        return;
+    }
+    memcpy(copy, line, length + 1);
+    partition->deferred[partition->deferred_count++] = copy;
+}
+
+// an extra <END> per shard queue stops its thread once the items before it are done
+static void stop_shard_threads(plugin_partition_t* partition)
+{
+    for (int i = 0; i < partition->num_shards; i++) {
+        partition_shard_t* shard = &partition->shards[i];
+        if (shard->thread_created && !shard->thread_joined) {
+            consumer_producer_put(&shard->queue, "<END>");
+        }
+    }
+    for (int i = 0; i < partition->num_shards; i++) {
+        partition_shard_t* shard = &partition->shards[i];
+        if (shard->thread_created && !shard->thread_joined) {
+            pthread_join(shard->thread, NULL);
+            shard->thread_joined = 1;
+        }
+    }
+}
+
+static unsigned long long partition_time_ns(clockid_t clock)
+{
+    struct timespec now;
+    if (0 != clock_gettime(clock, &now)) {
+        return 0;
+    }
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
@@ -0,0 +1,90 @@
+#ifndef PLUGIN_PARTITION_H
+#define PLUGIN_PARTITION_H
+
+#include "plugin_common.h"
+
+/**
+ * Key partitioned stages - internal to the SDK (plugin_common.c), plugins only
+ * see plugin_partition_ops_t and common_plugin_init_partitioned.
+ *
+ * Thread mode: the stage consumer thread becomes the dispatcher. It hashes the key
+ * of every item, takes a sequence number from the reorder buffer and puts the item
+ * into the queue of its shard. Each shard thread owns one state, the shard that
+ * completes the oldest outstanding item forwards everything that is ready in order
+ * (relaxed order: every shard forwards its own results right away).
+ * Executor mode: no threads, plugin_step runs the shard of each item inline.
+ */
+
+/**
+ * Create the shards of a stage
+ * @param plugin_context Stage the shards belong to
+ * @param ops Plugin callbacks (copied)
+ * @param num_shards Number of shards
+ * @param queue_size Capacity of each shard queue
+ * @param threaded 1 - one thread per shard (thread mode), 0 - inline (executor mode)
+ * @param relaxed_order 1 - each shard forwards its results as soon as they are ready (thread mode)
+ * @param partition Set to the new partition
+ * @return NULL on success, error message on failure
+ */
+const char* plugin_partition_create(plugin_context_t* plugin_context, const plugin_partition_ops_t* ops,
+                                    int num_shards, int queue_size, int threaded, int relaxed_order,
+                                    plugin_partition_t** partition);
+
+/**
+ * Dispatcher loop, run by the consumer thread of the stage (thread mode)
+ * Returns once <END> was forwarded or the stage was stopped
+ * @param partition Partition of the stage
+ */
+void plugin_partition_dispatch(plugin_partition_t* partition);
+
+/**
+ * Process an item with the state of its shard on the calling thread (executor mode)
+ * @param partition Partition of the stage
+ * @param input_string Item, freed here
+ * @return Output owned by the caller, NULL if the item produced nothing
+ */
+char* plugin_partition_process_inline(plugin_partition_t* partition, char* input_string);
+
+/**
+ * End of stream in executor mode - run the merge hook, its lines and then the
+ * end marker are kept until plugin_partition_take_deferred hands them out
+ * @param partition Partition of the stage
+ * @param end_marker The <END> item (copied)
+ * @return 0 on success, -1 if the end marker could not be kept
+ */
+int plugin_partition_end_inline(plugin_partition_t* partition, const char* end_marker);
+
+/**
+ * Lines left by a merge in executor mode are waiting
+ * @param partition Partition of the stage
+ * @return 1 if plugin_partition_take_deferred has a line, 0 otherwise
+ */
+int plugin_partition_has_deferred(plugin_partition_t* partition);
+
+/**
+ * Next line left by a merge in executor mode
+ * @param partition Partition of the stage
+ * @return plugin_alloc'd line owned by the caller, NULL if there is none
+ */
+char* plugin_partition_take_deferred(plugin_partition_t* partition);
+
+/**
+ * Wake a dispatcher blocked on the reorder window (plugin_fini before the join)
+ * @param partition Partition of the stage
+ */
+void plugin_partition_stop(plugin_partition_t* partition);
+
+/**
+ * Stop the shard threads that are still running and release everything
+ * @param partition Partition of the stage
+ */
+void plugin_partition_destroy(plugin_partition_t* partition);
+
+/**
+ * CPU time of the shard threads, live while they run
+ * @param partition Partition of the stage
+ * @return CPU time in nanoseconds
+ */
+unsigned long long plugin_partition_cpu_time_ns(plugin_partition_t* partition);
+
+#endif /* PLUGIN_PARTITION_H */
@@ -0,0 +1,52 @@
+#ifndef PLUGIN_PMR_HPP
+#define PLUGIN_PMR_HPP
+
+/**
+ * C++ binding of the pipeline allocator vtable to std::pmr (C++17).
+ * An embedding service passes the result to each plugin's plugin_set_allocator
+ * before plugin_init, e.g. a monotonic_buffer_resource per job (released in one
+ * shot after the job) or an unsynchronized_pool_resource per thread.
+ * The memory resource must outlive the plugins and, since every stage runs on
+ * its own thread, must be thread safe unless the host serializes the stages.
+ */
+
+#include <cstddef>
+#include <memory_resource>
+
+extern "C" {
+#include "sync/allocator.h"
+}
+
+namespace pipeline {
+
+inline void* pmr_allocate(void* context, std::size_t size)
+{
+    try {
+        return static_cast<std::pmr::memory_resource*>(context)->allocate(size, alignof(std::max_align_t));
+    } catch (...) {
+        return nullptr; // the C side reports allocation failures with NULL
+    }
+}
+
+inline void pmr_deallocate(void* context, void* ptr, std::size_t size)
+{
+    static_cast<std::pmr::memory_resource*>(context)->deallocate(ptr, size, alignof(std::max_align_t));
+}
+
+/**
+ * Build an allocator vtable that forwards to the given memory resource
+ * @param resource Memory resource used for all pipeline memory
+ * @return Allocator to pass to plugin_set_allocator
+ */
+inline pipeline_allocator_t make_allocator(std::pmr::memory_resource* resource)
+{
+    pipeline_allocator_t allocator;
+    allocator.allocate = pmr_allocate;
+    allocator.deallocate = pmr_deallocate;
+    allocator.context = resource;
+    return allocator;
+}
+
+} // namespace pipeline
+
+#endif /* PLUGIN_PMR_HPP */
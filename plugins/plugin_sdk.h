@@ -1,6 +1,11 @@
 #ifndef PLUGIN_SDK_H
 #define PLUGIN_SDK_H
 
+#include "sync/allocator.h"
+#include "sync/lock_profile.h"
+#include "plugin_stats.h"
+#include "plugin_config.h"
+
 /** 
  * this file for defining the interface of a plugin system.
  * provides the necessary function declarations for plugin management.
@@ -22,6 +27,15 @@ const char* plugin_get_name(void);
 const char* plugin_init(int queue_size); 
 
 
+/** 
+* Initialize the plugin with key=value parameters (optional), in place of plugin_init 
+* The generic keys (plugin_config.h) are applied by the SDK, the rest by the plugin 
+* @param config Queue size and parameters, an unknown key fails the init 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_init_ex(const plugin_config_t* config);
+
+
 /** 
 * Finalize the plugin - terminate thread gracefully 
 * @return NULL on success, error message on failure 
@@ -54,4 +68,187 @@ shutdown
 */ 
 const char* plugin_wait_finished(void);
 
+
+/** 
+* Fuse a following stage into this plugin's consumer thread (optional)
+* @param next_inplace In-place transform of the fused stage
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_fuse(int (*next_inplace)(char*, int));
+
+
+/** 
+* In-place transform of a length preserving plugin (optional export)
+* Only plugins exporting this symbol can be fused into a previous stage
+* @param buffer Null terminated string modified in place
+* @param length Length of the string
+* @return 0 on success, -1 on failure 
+*/ 
+int plugin_transform_inplace(char* buffer, int length);
+
+
+/** 
+* Executor mode (optional): run the stage from host worker threads instead of 
+* a dedicated consumer thread. plugin_use_executor must be called before plugin_init 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_use_executor(void);
+
+
+/** 
+* Use a host supplied allocator for all plugin memory (optional) 
+* Must be called before plugin_init 
+* @param allocator Allocator vtable, NULL restores malloc/free 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_allocator(const pipeline_allocator_t* allocator);
+
+
+/** 
+* Set the consumer thread stack size (optional), before plugin_init 
+* @param stack_size Stack size in bytes, 0 restores the default 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_stack_size(size_t stack_size);
+
+
+/** 
+* Store queued strings inline in a byte ring (optional), before plugin_init 
+* @param ring_bytes Ring size in bytes, 0 restores one allocation per item 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_queue_bytes(size_t ring_bytes);
+
+
+/** 
+* Grant credits of this stage's queue to the previous stage (optional) 
+* @param wanted Maximum number of credits 
+* @param wait 1 - block until a credit is free, 0 - return right away 
+* @return Number of credits granted, -1 on error 
+*/ 
+int plugin_take_credits(int wanted, int wait);
+
+
+/** 
+* Attach the next plugin's take_credits (optional), items are then forwarded only with a credit 
+* @param next_take_credits Function pointer to the next plugin's take_credits 
+*/ 
+void plugin_attach_credits(int (*next_take_credits)(int, int));
+
+
+/** 
+* Process up to max_items items without blocking (executor mode) 
+* @param max_items Maximum number of items to process 
+* @return items processed, or -1 once <END> was forwarded 
+*/ 
+int plugin_step(int max_items);
+
+
+/** 
+* Non blocking place_work 
+* @param str The string to process 
+* @return 0 on success, 1 if the queue is full, -1 on error 
+*/ 
+int plugin_offer_work(const char* str);
+
+
+/** 
+* Attach the next plugin's non blocking offer function (executor mode) 
+* @param next_offer_work Function pointer to the next plugin's offer_work 
+*/ 
+void plugin_attach_offer(int (*next_offer_work)(const char*));
+
+
+/** 
+* Number of shards of a stateful, key partitioned plugin (optional), before plugin_init 
+* @param num_partitions Shards, each on its own thread with its own state 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_partitions(int num_partitions);
+
+
+/** 
+* Forward the results of a partitioned plugin without restoring the input order (optional) 
+* Must be called before plugin_init 
+* @param relaxed 1 - relaxed order, 0 - input order (default) 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_relaxed_order(int relaxed);
+
+
+/** 
+* Freed queue slots handed back to the previous stage at once (optional), before plugin_init 
+* @param credit_batch Slots per batch (0 - derived from the queue size) 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_credit_batch(int credit_batch);
+
+
+/** 
+* Drop new items instead of blocking the caller while the queue is full (optional) 
+* Must be called before plugin_init 
+* @param drop 1 - drop when full, 0 - block (default) 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_overflow_policy(int drop);
+
+
+/** 
+* Pin the consumer thread to a CPU (optional), before plugin_init 
+* @param cpu CPU number, -1 - not pinned 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_cpu(int cpu);
+
+
+/** 
+* Return the idle queue memory of this plugin to the OS (optional) 
+* @param keep_bytes Bytes kept resident for the next burst 
+* @param released_bytes Set to the bytes released 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_trim_memory(size_t keep_bytes, size_t* released_bytes);
+
+
+/** 
+* Record the contention of the input queue locks (optional), before plugin_init 
+* @param enabled 1 - profile, 0 - plain locks 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_lock_profile(int enabled);
+
+
+/** 
+* Compress the input queue backlog past hot_items items (optional), before plugin_init 
+* @param hot_items Items kept uncompressed, 0 - off 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_backlog_compression(int hot_items);
+
+
+/** 
+* Read the contention profile of one input queue lock (optional), before plugin_fini 
+* @param lock Lock index, from 0 until an error comes back 
+* @param profile Filled with the profile of the lock 
+* @param lock_name Set to the name of the lock 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_get_lock_profile(int lock, lock_profile_t* profile, const char** lock_name);
+
+
+/** 
+* Set the instance id used in the consumer thread name (optional), before plugin_init 
+* @param instance_id Instance id given by the host 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_set_instance_id(int instance_id);
+
+
+/** 
+* Read the items and per-stage user/system CPU time of this plugin (optional) 
+* @param stats Filled with the current statistics 
+* @return NULL on success, error message on failure 
+*/ 
+const char* plugin_get_stats(plugin_stats_t* stats);
+
 #endif /* PLUGIN_SDK_H */
\ No newline at end of file
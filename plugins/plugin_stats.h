@@ -0,0 +1,63 @@
+#ifndef PLUGIN_STATS_H
+#define PLUGIN_STATS_H
+
+/**
+ * Per-stage runtime statistics, filled by plugin_get_stats.
+ * Shared by the plugins and the host (main.c), so it must only hold plain data.
+ */
+
+// pthread names are limited to 16 bytes including the terminator
+#define PLUGIN_THREAD_NAME_LENGTH 16
+
+// item latency histogram - bucket i counts items that took up to 1us * 4^i,
+// the last bucket is everything above (+Inf), so the range is 1us .. ~1s
+#define PLUGIN_LATENCY_BUCKETS 12
+#define PLUGIN_LATENCY_FIRST_BOUND_NS 1000ULL
+
+typedef struct
+{
+    unsigned long long items_processed;     /* Items transformed by this stage (not counting <END>) */
+    unsigned long long cpu_time_ns;         /* CPU time spent by the stage, from the thread CPU clock */
+    unsigned long long user_time_ns;        /* User part of the CPU time (getrusage of the stage thread) */
+    unsigned long long system_time_ns;      /* System part of the CPU time */
+    char thread_name[PLUGIN_THREAD_NAME_LENGTH]; /* Name of the consumer thread, "" in executor mode */
+    unsigned long long items_dropped;       /* Items lost - failed transform, rejected by the next stage or dropped by a full queue (overflow drop) */
+    unsigned long long blocked_time_ns;     /* Time spent waiting for the next stage to accept an output */
+    int queue_depth;                        /* Items waiting in the input queue right now */
+    int queue_capacity;                     /* Size of the input queue */
+    unsigned long long latency_sum_ns;      /* Sum of the item latencies (transform, fused stages included) */
+    unsigned long long latency_buckets[PLUGIN_LATENCY_BUCKETS]; /* Item latency histogram, not cumulative */
+    int item_in_progress;                   /* 1 while the stage holds an item it did not hand on yet */
+    int finished;                           /* 1 once the stage forwarded <END> */
+    int waiting_consumers;                  /* Threads parked on the "not empty" monitor of the input queue */
+    int waiting_producers;                  /* Threads parked on the "not full" monitor of the input queue */
+    int partitions;                         /* Shards of a key partitioned (stateful) stage, 0 - not partitioned */
+    int backlog_items;                      /* Queued items held in the compressed backlog (part of queue_depth) */
+    unsigned long long backlog_blocks;      /* Backlog blocks compressed so far */
+    unsigned long long backlog_plain_bytes; /* Their plain size */
+    unsigned long long backlog_compressed_bytes; /* Their compressed size */
+    unsigned long long backlog_peak_bytes;  /* Most memory the backlog held at once */
+} plugin_stats_t;
+
+// upper bound of a latency bucket in ns, 0 for the last (+Inf) bucket
+static inline unsigned long long plugin_latency_bucket_bound_ns(int bucket)
+{
+    if (bucket >= PLUGIN_LATENCY_BUCKETS - 1) {
+        return 0;
+    }
+    return PLUGIN_LATENCY_FIRST_BOUND_NS << (2 * bucket);
+}
+
+// histogram bucket of a latency
+static inline int plugin_latency_bucket(unsigned long long latency_ns)
+{
+    int bucket = 0;
+    unsigned long long bound = PLUGIN_LATENCY_FIRST_BOUND_NS;
+    while (bucket < PLUGIN_LATENCY_BUCKETS - 1 && latency_ns > bound) {
+        bound <<= 2;
+        bucket++;
+    }
+    return bucket;
+}
+
+#endif /* PLUGIN_STATS_H */
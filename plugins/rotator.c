@@ -2,7 +2,42 @@
 #include <string.h>
 #include <stdlib.h>
 
+// positions every char moves right, the "shift" init parameter (plugin_init_ex)
+static int g_rotation_shift = 1;
+
+static void reverse_chars(char* begin, char* end)
+{
+    while (begin < --end) {
+        char c = *begin;
+        *begin++ = *end;
+        *end = c;
+    }
+}
+
 //this plugin move every char one position to the right in circular manner (the last becomes the first)
+static int rotator_transform_inplace(char* buffer, int length)
+{
+    if (NULL == buffer) {
+        return -1;
+    }
+    if (length <= 1) {
+        return 0; //nothing to rotate
+    }
+
+    int shift = g_rotation_shift % length;
+    if (1 == shift) {
+        char last_char = buffer[length - 1];
+        memmove(buffer + 1, buffer, length - 1);
+        buffer[0] = last_char; //insert the lastchar at the beginning
+    } else if (shift > 1) {
+        //rotate right by reversing the whole line and then both parts
+        reverse_chars(buffer, buffer + length);
+        reverse_chars(buffer, buffer + shift);
+        reverse_chars(buffer + shift, buffer + length);
+    }
+    return 0;
+}
+
 static const char* rotator_transform(const char* input_to_rotate)
 {
     if (NULL == input_to_rotate) {
@@ -10,31 +45,31 @@ static const char* rotator_transform(const char* input_to_rotate)
     }
 
     int input_len = strlen(input_to_rotate);
-    //handle empty string case - return empty string
-    if (0 == input_len) {
-        char* result = (char*)malloc(1);
-        if (result) {
-            result[0] = '\0';
-        }
-        return result; 
-    }
-
-    char* after_rotation_result = (char*)malloc(input_len + 1);
+    char* after_rotation_result = (char*)plugin_alloc(input_len + 1);
     if (NULL == after_rotation_result)
     {
         return NULL; // TODO: should we log an error here instead of returning NULL?
     }
 
-    after_rotation_result[0] = input_to_rotate[input_len - 1]; //insert the lastchar at the beginning
-    for (int i = 1; i < input_len; i++) {
-        after_rotation_result[i] = input_to_rotate[i - 1];
-    }
-    after_rotation_result[input_len] = '\0'; // indicate end of string
+    memcpy(after_rotation_result, input_to_rotate, input_len + 1);
+    rotator_transform_inplace(after_rotation_result, input_len);
 
     return after_rotation_result;
 }
 
+PLUGIN_EXPORT
+int plugin_transform_inplace(char* buffer, int length)
+{
+    return rotator_transform_inplace(buffer, length);
+}
+
 const char* plugin_init(int queue_size) 
 {
-    return common_plugin_init(rotator_transform, "rotator", queue_size);
-}
\ No newline at end of file
+    long shift = 1;
+    const char* error = plugin_param_long("shift", 0, 1000000, &shift);
+    if (NULL != error) {
+        return error;
+    }
+    g_rotation_shift = (int)shift;
+    return common_plugin_init_inplace(rotator_transform, rotator_transform_inplace, "rotator", queue_size);
+}
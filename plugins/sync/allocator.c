@@ -0,0 +1,57 @@
+#include "allocator.h"
+#include <stdlib.h>
+#include <string.h>
+
+// custom allocators get the block size back on deallocate (like std::pmr does),
+// we keep it in a small header in front of the block - 16 bytes so the alignment stays the same
+#define ALLOCATOR_HEADER_SIZE 16
+
+static int is_custom_allocator(const pipeline_allocator_t* allocator)
+{
+    return NULL != allocator && NULL != allocator->allocate && NULL != allocator->deallocate;
+}
+
+void* allocator_alloc(const pipeline_allocator_t* allocator, size_t size)
+{
+    if (!is_custom_allocator(allocator)) {
+        return malloc(size);
+    }
+
+    char* block = (char*)allocator->allocate(allocator->context, size + ALLOCATOR_HEADER_SIZE);
+    if (NULL == block) {
+        return NULL;
+    }
+    memcpy(block, &size, sizeof(size_t));
+    return block + ALLOCATOR_HEADER_SIZE;
+}
+
+void allocator_free(const pipeline_allocator_t* allocator, void* ptr)
+{
+    if (NULL == ptr) {
+        return;
+    }
+    if (!is_custom_allocator(allocator)) {
+        free(ptr);
+        return;
+    }
+
+    char* block = (char*)ptr - ALLOCATOR_HEADER_SIZE;
+    size_t size;
+    memcpy(&size, block, sizeof(size_t));
+    allocator->deallocate(allocator->context, block, size + ALLOCATOR_HEADER_SIZE);
+}
+
+char* allocator_strdup(const pipeline_allocator_t* allocator, const char* str)
+{
+    if (NULL == str) {
+        return NULL;
+    }
+
+    size_t len = strlen(str);
+    char* copy = (char*)allocator_alloc(allocator, len + 1);
+    if (NULL == copy) {
+        return NULL;
+    }
+    memcpy(copy, str, len + 1);
+    return copy;
+}
@@ -0,0 +1,41 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+
+/**
+ * Allocator vtable used for every message buffer and queue ring of a stage.
+ * An embedding application can route all pipeline memory through its own
+ * allocator (arena per job, pool per thread ...). A zeroed allocator means
+ * plain malloc/free.
+ */
+typedef struct {
+    void* (*allocate)(void* context, size_t size);             /* Returns NULL on failure */
+    void (*deallocate)(void* context, void* ptr, size_t size); /* Gets the size given to allocate */
+    void* context;                                             /* Passed back to both functions */
+} pipeline_allocator_t;
+
+/**
+ * Allocate memory through the allocator
+ * @param allocator Allocator to use (NULL or zeroed means malloc)
+ * @param size Number of bytes
+ * @return Pointer to the memory or NULL on failure
+ */
+void* allocator_alloc(const pipeline_allocator_t* allocator, size_t size);
+
+/**
+ * Release memory returned by allocator_alloc of the same allocator
+ * @param allocator Allocator the memory came from
+ * @param ptr Pointer to release (NULL is ignored)
+ */
+void allocator_free(const pipeline_allocator_t* allocator, void* ptr);
+
+/**
+ * Duplicate a string through the allocator
+ * @param allocator Allocator to use
+ * @param str String to copy
+ * @return The copy or NULL on failure
+ */
+char* allocator_strdup(const pipeline_allocator_t* allocator, const char* str);
+
+#endif /* ALLOCATOR_H */
@@ -0,0 +1,276 @@
+#define _GNU_SOURCE
+#include "async_log.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// probes before a call site takes over the slot it hashes to
+#define ASYNC_LOG_SITE_PROBES 4
+
+// one log call, copied as is into the ring - the formatting happens on the flusher thread
+typedef struct {
+    const char* source;                     /* Plugin name, not copied */
+    unsigned int suppressed;                /* Records of this call site dropped by the rate limit before this one */
+    unsigned short length;                  /* Bytes used in message */
+    unsigned char level;                    /* async_log_level_t */
+    char message[ASYNC_LOG_MESSAGE_LENGTH]; /* Null terminated */
+} async_log_record_t;
+
+// token bucket of one call site, only touched by the thread owning the ring
+typedef struct {
+    const void* call_site;
+    unsigned long long refill_ns;   /* Last time tokens were added */
+    unsigned int tokens;
+    unsigned int suppressed;        /* Dropped since the last record that went through */
+} async_log_site_t;
+
+typedef struct async_log_ring {
+    async_log_record_t records[ASYNC_LOG_RING_RECORDS];
+    unsigned int head;                  /* Next record to print, written by the flusher (atomic) */
+    unsigned int tail;                  /* Next free record, written by the owner thread (atomic) */
+    unsigned long long dropped;         /* Records lost on a full ring (atomic) */
+    unsigned long long dropped_reported;/* Part of dropped the flusher already reported */
+    async_log_site_t sites[ASYNC_LOG_CALL_SITES];
+    struct async_log_ring* next;        /* Registry list, protected by g_registry_mutex */
+} async_log_ring_t;
+
+// every thread that logs gets a ring, the flusher walks all of them
+static pthread_mutex_t g_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_flusher_cond = PTHREAD_COND_INITIALIZER;
+static async_log_ring_t* g_rings = NULL;
+static pthread_t g_flusher_thread;
+static int g_flusher_running = 0;
+static int g_flusher_stop = 0;
+
+// bumped when async_log_flush frees the rings, a thread holding an older ring makes a new one
+static unsigned int g_ring_generation = 1;
+static __thread async_log_ring_t* t_ring = NULL;
+static __thread unsigned int t_ring_generation = 0;
+
+static FILE* g_info_stream = NULL;
+static FILE* g_error_stream = NULL;
+
+static void* async_log_flusher_thread(void* arg);
+static async_log_ring_t* get_thread_ring(void);
+static int drain_ring(async_log_ring_t* ring);
+static int take_rate_token(async_log_ring_t* ring, const void* call_site, unsigned int* suppressed);
+static unsigned long long monotonic_time_ns(void);
+
+
+void async_log_write(async_log_level_t level, const char* source, const char* message, const void* call_site)
+{
+    if (NULL == message) {
+        return;
+    }
+
+    async_log_ring_t* ring = get_thread_ring();
+    if (NULL == ring) {
+        //no ring (out of memory) - better a slow log line than a lost one
+        fprintf(ASYNC_LOG_ERROR == level ? stderr : stdout, "[%s][%s] - %s\n",
+                ASYNC_LOG_ERROR == level ? "ERROR" : "INFO", source ? source : "Unknown", message);
+        return;
+    }
+
+    unsigned int suppressed = 0;
+    if (!take_rate_token(ring, call_site, &suppressed)) {
+        return;
+    }
+
+    //only this thread moves tail, the flusher only moves head
+    unsigned int tail = ring->tail;
+    unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (tail - head >= ASYNC_LOG_RING_RECORDS) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    async_log_record_t* record = &ring->records[tail % ASYNC_LOG_RING_RECORDS];
+    size_t length = strnlen(message, ASYNC_LOG_MESSAGE_LENGTH - 1);
+    memcpy(record->message, message, length);
+    record->message[length] = '\0';
+    record->length = (unsigned short)length;
+    record->level = (unsigned char)level;
+    record->source = source;
+    record->suppressed = suppressed;
+
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void async_log_flush(void)
+{
+    pthread_mutex_lock(&g_registry_mutex);
+    int flusher_running = g_flusher_running;
+    g_flusher_stop = 1;
+    pthread_cond_signal(&g_flusher_cond);
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    if (flusher_running) {
+        pthread_join(g_flusher_thread, NULL);
+    }
+
+    //no flusher anymore and (per the contract) no writers - print what is left and start over
+    pthread_mutex_lock(&g_registry_mutex);
+    async_log_ring_t* ring = g_rings;
+    while (NULL != ring) {
+        async_log_ring_t* next = ring->next;
+        drain_ring(ring);
+        free(ring);
+        ring = next;
+    }
+    g_rings = NULL;
+    g_flusher_running = 0;
+    g_flusher_stop = 0;
+    __atomic_add_fetch(&g_ring_generation, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    fflush(g_info_stream ? g_info_stream : stdout);
+    fflush(g_error_stream ? g_error_stream : stderr);
+}
+
+void async_log_set_output(FILE* info_stream, FILE* error_stream)
+{
+    g_info_stream = info_stream;
+    g_error_stream = error_stream;
+}
+
+
+// the ring of the calling thread, created (and the flusher started) on first use
+static async_log_ring_t* get_thread_ring(void)
+{
+    unsigned int generation = __atomic_load_n(&g_ring_generation, __ATOMIC_ACQUIRE);
+    if (NULL != t_ring && t_ring_generation == generation) {
+        return t_ring;
+    }
+
+    async_log_ring_t* ring = (async_log_ring_t*)calloc(1, sizeof(async_log_ring_t));
+    if (NULL == ring) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&g_registry_mutex);
+    ring->next = g_rings;
+    g_rings = ring;
+    if (!g_flusher_running) {
+        //if the thread cannot start, the records wait for async_log_flush
+        g_flusher_stop = 0;
+        if (0 == pthread_create(&g_flusher_thread, NULL, async_log_flusher_thread, NULL)) {
+            pthread_setname_np(g_flusher_thread, "log-flusher");
+            g_flusher_running = 1;
+        }
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+
+    t_ring = ring;
+    t_ring_generation = generation;
+    return ring;
+}
+
+static void* async_log_flusher_thread(void* arg)
+{
+    (void)arg;
+    long flush_period_ms = ASYNC_LOG_FLUSH_MIN_MS;
+
+    pthread_mutex_lock(&g_registry_mutex);
+    while (!g_flusher_stop) {
+        int printed = 0;
+        for (async_log_ring_t* ring = g_rings; NULL != ring; ring = ring->next) {
+            printed += drain_ring(ring);
+        }
+        if (printed > 0) {
+            fflush(g_info_stream ? g_info_stream : stdout);
+            flush_period_ms = ASYNC_LOG_FLUSH_MIN_MS;
+        } else if (flush_period_ms < ASYNC_LOG_FLUSH_MAX_MS) {
+            //quiet - poll less often, writers never wake us up (that would cost them a syscall)
+            flush_period_ms = (flush_period_ms * 2 > ASYNC_LOG_FLUSH_MAX_MS) ? ASYNC_LOG_FLUSH_MAX_MS : flush_period_ms * 2;
+        }
+
+        struct timespec wake_time;
+        clock_gettime(CLOCK_REALTIME, &wake_time);
+        long wake_ns = wake_time.tv_nsec + flush_period_ms * 1000000L;
+        wake_time.tv_sec += wake_ns / 1000000000L;
+        wake_time.tv_nsec = wake_ns % 1000000000L;
+        pthread_cond_timedwait(&g_flusher_cond, &g_registry_mutex, &wake_time);
+    }
+    pthread_mutex_unlock(&g_registry_mutex);
+    return NULL;
+}
+
+// print the records of one ring, returns how many were printed
+static int drain_ring(async_log_ring_t* ring)
+{
+    unsigned int head = ring->head;
+    unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    int printed = 0;
+
+    for (; head != tail; head++) {
+        async_log_record_t* record = &ring->records[head % ASYNC_LOG_RING_RECORDS];
+        int is_error = (ASYNC_LOG_ERROR == record->level);
+        FILE* stream = is_error ? (g_error_stream ? g_error_stream : stderr) : (g_info_stream ? g_info_stream : stdout);
+
+        fprintf(stream, "[%s][%s] - %.*s", is_error ? "ERROR" : "INFO",
+                record->source ? record->source : "Unknown", (int)record->length, record->message);
+        if (record->suppressed > 0) {
+            fprintf(stream, " (%u similar messages suppressed)", record->suppressed);
+        }
+        fputc('\n', stream);
+        printed++;
+    }
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    unsigned long long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+    if (dropped > ring->dropped_reported) {
+        fprintf(g_error_stream ? g_error_stream : stderr, "[ERROR][async_log] - %llu log records dropped, ring full\n",
+                dropped - ring->dropped_reported);
+        ring->dropped_reported = dropped;
+        printed++;
+    }
+    return printed;
+}
+
+// token bucket per call site, returns 1 when the record may go out
+// *suppressed gets the number of records of this site dropped since the last one that went out
+static int take_rate_token(async_log_ring_t* ring, const void* call_site, unsigned int* suppressed)
+{
+    uintptr_t hash = ((uintptr_t)call_site >> 4) * 2654435761u;
+    async_log_site_t* site = NULL;
+    for (int probe = 0; probe < ASYNC_LOG_SITE_PROBES && NULL == site; probe++) {
+        async_log_site_t* candidate = &ring->sites[(hash + probe) % ASYNC_LOG_CALL_SITES];
+        if (candidate->call_site == call_site || NULL == candidate->call_site) {
+            site = candidate;
+        }
+    }
+
+    unsigned long long now_ns = monotonic_time_ns();
+    if (NULL == site || site->call_site != call_site) {
+        //new call site (or it takes over a busy slot) - starts with a full bucket
+        site = (NULL != site) ? site : &ring->sites[hash % ASYNC_LOG_CALL_SITES];
+        site->call_site = call_site;
+        site->refill_ns = now_ns;
+        site->tokens = ASYNC_LOG_RATE_BURST;
+        site->suppressed = 0;
+    }
+
+    unsigned long long new_tokens = (now_ns - site->refill_ns) * ASYNC_LOG_RATE_PER_SEC / 1000000000ULL;
+    if (new_tokens > 0) {
+        site->tokens = (site->tokens + new_tokens > ASYNC_LOG_RATE_BURST) ? ASYNC_LOG_RATE_BURST : (unsigned int)(site->tokens + new_tokens);
+        site->refill_ns = now_ns;
+    }
+
+    if (0 == site->tokens) {
+        site->suppressed++;
+        return 0;
+    }
+    site->tokens--;
+    *suppressed = site->suppressed;
+    site->suppressed = 0;
+    return 1;
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
@@ -0,0 +1,59 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include <stdio.h>
+
+/**
+ * Asynchronous logging backend for log_info / log_error.
+ * The calling thread only copies a small fixed-size record into its own ring
+ * (single producer / single consumer, no lock, no syscall) and a background
+ * flusher thread formats and prints the records. Every thread has a token
+ * bucket per call site, so an error storm from one place in the code costs a
+ * few records per second and a "suppressed" count instead of stalling the
+ * stages on the stdio locks. A full ring drops the record and counts it,
+ * the writer never waits.
+ */
+
+// records per thread ring
+#define ASYNC_LOG_RING_RECORDS 256
+// message bytes kept in a record, longer messages are cut
+#define ASYNC_LOG_MESSAGE_LENGTH 112
+// rate limit per call site - a burst of this many records, then ASYNC_LOG_RATE_PER_SEC
+#define ASYNC_LOG_RATE_BURST 10
+#define ASYNC_LOG_RATE_PER_SEC 10
+// call sites tracked per thread, more sites share the slots
+#define ASYNC_LOG_CALL_SITES 64
+// flusher polling period, doubles while idle up to the max
+#define ASYNC_LOG_FLUSH_MIN_MS 5
+#define ASYNC_LOG_FLUSH_MAX_MS 200
+
+typedef enum {
+    ASYNC_LOG_INFO = 0,   /* "[INFO][source] - message" on the info stream (stdout) */
+    ASYNC_LOG_ERROR = 1   /* "[ERROR][source] - message" on the error stream (stderr) */
+} async_log_level_t;
+
+/**
+ * Queue a log record, never blocks
+ * The flusher thread is started on the first call
+ * @param level Record level
+ * @param source Name printed in the second bracket, must stay valid until async_log_flush
+ * @param message Message to print (copied, cut at ASYNC_LOG_MESSAGE_LENGTH - 1 bytes)
+ * @param call_site Identifies the caller for the rate limit (usually __builtin_return_address(0))
+ */
+void async_log_write(async_log_level_t level, const char* source, const char* message, const void* call_site);
+
+/**
+ * Print everything still queued and stop the flusher thread
+ * Call it once no other thread logs anymore (plugin_fini). A later
+ * async_log_write starts the backend again.
+ */
+void async_log_flush(void);
+
+/**
+ * Redirect the output (tests), must be called before the first record
+ * @param info_stream Stream for INFO records (NULL - stdout)
+ * @param error_stream Stream for ERROR records (NULL - stderr)
+ */
+void async_log_set_output(FILE* info_stream, FILE* error_stream);
+
+#endif /* ASYNC_LOG_H */
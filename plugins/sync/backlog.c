@@ -0,0 +1,255 @@
+#include "backlog.h"
+#include "lz_codec.h"
+#include <string.h>
+
+static backlog_block_t* new_block(backlog_t* backlog, size_t capacity);
+static void free_block(backlog_t* backlog, backlog_block_t* block);
+static void unlink_head(backlog_t* backlog);
+static void replace_block_data(backlog_t* backlog, backlog_block_t* block, char* data, size_t capacity);
+
+
+void backlog_init(backlog_t* backlog, const pipeline_allocator_t* allocator)
+{
+    if (NULL == backlog) {
+        return;
+    }
+    memset(backlog, 0, sizeof(backlog_t));
+    if (NULL != allocator) {
+        backlog->allocator = *allocator;
+    }
+}
+
+int backlog_append(backlog_t* backlog, const char* item, size_t length)
+{
+    if (NULL == backlog || NULL == item) {
+        return -1;
+    }
+
+    backlog_block_t* tail = backlog->tail;
+    if (NULL == tail || tail->capacity - tail->used < length + 1) {
+        backlog_block_t* block = new_block(backlog, (length + 1 > BACKLOG_BLOCK_BYTES) ? length + 1 : BACKLOG_BLOCK_BYTES);
+        if (NULL == block) {
+            return -1;
+        }
+        if (NULL == backlog->compress_next) {
+            backlog->compress_next = block;
+        }
+        if (NULL == tail) {
+            backlog->head = block;
+        } else {
+            tail->next = block;
+        }
+        backlog->tail = block;
+        tail = block;
+    }
+
+    memcpy(tail->data + tail->used, item, length + 1);
+    tail->used += length + 1;
+    tail->num_items++;
+    backlog->num_items++;
+    return 0;
+}
+
+backlog_block_t* backlog_begin_compress(backlog_t* backlog)
+{
+    if (NULL == backlog || NULL != backlog->compressing) {
+        return NULL;
+    }
+    //the tail still takes items, the consumer may be reading the head already - it stays plain
+    while (NULL != backlog->compress_next && backlog->compress_next != backlog->tail) {
+        backlog_block_t* block = backlog->compress_next;
+        backlog->compress_next = block->next;
+        if (block != backlog->head) {
+            backlog->compressing = block;
+            return block;
+        }
+    }
+    return NULL;
+}
+
+// a block the codec cannot shrink (or no memory for it) gets no staged data, it stays plain
+void backlog_compress(backlog_t* backlog, backlog_block_t* block)
+{
+    block->staged = NULL;
+    block->staged_size = 0;
+    if (NULL == backlog->scratch) {
+        backlog->scratch = (char*)allocator_alloc(&backlog->allocator, LZ_COMPRESS_BOUND(BACKLOG_BLOCK_BYTES));
+    }
+
+    //only the compressing thread touches the scratch buffer, and nobody writes a sealed block
+    size_t compressed_size = (NULL == backlog->scratch || block->used > BACKLOG_BLOCK_BYTES)
+        ? 0 : lz_compress(block->data, block->used, backlog->scratch, LZ_COMPRESS_BOUND(BACKLOG_BLOCK_BYTES));
+    char* compressed = (compressed_size > 0 && compressed_size < block->used)
+        ? (char*)allocator_alloc(&backlog->allocator, compressed_size) : NULL;
+    if (NULL != compressed) {
+        memcpy(compressed, backlog->scratch, compressed_size);
+        block->staged = compressed;
+        block->staged_size = compressed_size;
+    }
+}
+
+void backlog_end_compress(backlog_t* backlog, backlog_block_t* block)
+{
+    backlog->compressing = NULL;
+    if (block->detached || block == backlog->head) {
+        allocator_free(&backlog->allocator, block->staged);
+        block->staged = NULL;
+        if (block->detached) {
+            free_block(backlog, block);
+        }
+        return;
+    }
+    if (NULL == block->staged) {
+        return;
+    }
+
+    backlog->blocks_compressed++;
+    backlog->plain_bytes += block->used;
+    backlog->compressed_bytes += block->staged_size;
+    replace_block_data(backlog, block, block->staged, block->staged_size);
+    block->compressed_size = block->staged_size;
+    block->staged = NULL;
+}
+
+backlog_block_t* backlog_begin_decompress(backlog_t* backlog)
+{
+    if (NULL == backlog || NULL == backlog->head || 0 == backlog->head->compressed_size ||
+        NULL != backlog->decompressing) {
+        return NULL;
+    }
+    backlog->decompressing = backlog->head;
+    return backlog->head;
+}
+
+// a corrupt block (or no memory for it) gets no staged data
+void backlog_decompress(backlog_t* backlog, backlog_block_t* block)
+{
+    block->staged = (char*)allocator_alloc(&backlog->allocator, block->used);
+    if (NULL != block->staged &&
+        lz_decompress(block->data, block->compressed_size, block->staged, block->used) != block->used) {
+        allocator_free(&backlog->allocator, block->staged);
+        block->staged = NULL;
+    }
+}
+
+int backlog_end_decompress(backlog_t* backlog, backlog_block_t* block)
+{
+    backlog->decompressing = NULL;
+    if (NULL != block->staged) {
+        replace_block_data(backlog, block, block->staged, block->used);
+        block->compressed_size = 0;
+        block->staged = NULL;
+        return 0;
+    }
+
+    //the items cannot be read any more, the consumer moves on to the next block
+    int dropped = block->num_items;
+    backlog->num_items -= dropped;
+    backlog->blocks_dropped++;
+    unlink_head(backlog);
+    free_block(backlog, block);
+    return dropped;
+}
+
+const char* backlog_peek(backlog_t* backlog)
+{
+    if (NULL == backlog || 0 == backlog->num_items || 0 != backlog->head->compressed_size) {
+        return NULL;
+    }
+    return backlog->head->data + backlog->read_offset;
+}
+
+void backlog_release(backlog_t* backlog)
+{
+    if (NULL == backlog || 0 == backlog->num_items || 0 != backlog->head->compressed_size) {
+        return;
+    }
+
+    backlog_block_t* head = backlog->head;
+    backlog->read_offset += strlen(head->data + backlog->read_offset) + 1;
+    head->num_items--;
+    backlog->num_items--;
+    if (head->num_items > 0) {
+        return;
+    }
+
+    unlink_head(backlog);
+    //the codec still works on it, backlog_end_compress frees it
+    if (head == backlog->compressing) {
+        head->detached = 1;
+        return;
+    }
+    free_block(backlog, head);
+}
+
+void backlog_destroy(backlog_t* backlog)
+{
+    if (NULL == backlog) {
+        return;
+    }
+    while (NULL != backlog->head) {
+        backlog_block_t* next = backlog->head->next;
+        free_block(backlog, backlog->head);
+        backlog->head = next;
+    }
+    allocator_free(&backlog->allocator, backlog->scratch);
+    backlog->scratch = NULL;
+    backlog->tail = NULL;
+    backlog->compress_next = NULL;
+    backlog->compressing = NULL;
+    backlog->decompressing = NULL;
+    backlog->read_offset = 0;
+    backlog->num_items = 0;
+}
+
+static backlog_block_t* new_block(backlog_t* backlog, size_t capacity)
+{
+    backlog_block_t* block = (backlog_block_t*)allocator_alloc(&backlog->allocator, sizeof(backlog_block_t));
+    if (NULL == block) {
+        return NULL;
+    }
+    memset(block, 0, sizeof(backlog_block_t));
+    block->data = (char*)allocator_alloc(&backlog->allocator, capacity);
+    if (NULL == block->data) {
+        allocator_free(&backlog->allocator, block);
+        return NULL;
+    }
+    block->capacity = capacity;
+    backlog->resident_bytes += capacity;
+    if (backlog->resident_bytes > backlog->peak_resident_bytes) {
+        backlog->peak_resident_bytes = backlog->resident_bytes;
+    }
+    return block;
+}
+
+// the head is done with, the next block (or nothing) follows
+static void unlink_head(backlog_t* backlog)
+{
+    backlog_block_t* head = backlog->head;
+    backlog->head = head->next;
+    if (backlog->tail == head) {
+        backlog->tail = NULL;
+    }
+    if (backlog->compress_next == head) {
+        backlog->compress_next = head->next;
+    }
+    backlog->read_offset = 0;
+}
+
+static void free_block(backlog_t* backlog, backlog_block_t* block)
+{
+    backlog->resident_bytes -= block->capacity;
+    allocator_free(&backlog->allocator, block->data);
+    allocator_free(&backlog->allocator, block);
+}
+
+static void replace_block_data(backlog_t* backlog, backlog_block_t* block, char* data, size_t capacity)
+{
+    allocator_free(&backlog->allocator, block->data);
+    backlog->resident_bytes = backlog->resident_bytes - block->capacity + capacity;
+    if (backlog->resident_bytes > backlog->peak_resident_bytes) {
+        backlog->peak_resident_bytes = backlog->resident_bytes;
+    }
+    block->data = data;
+    block->capacity = capacity;
+}
@@ -0,0 +1,134 @@
+#ifndef BACKLOG_H
+#define BACKLOG_H
+
+#include <stddef.h>
+#include "allocator.h"
+
+/**
+ * Compressed backlog of a deep queue - the items past the hot depth of a queue are
+ * packed back to back ('\0' separated) into blocks instead of one allocation each.
+ * A full block is compressed with lz_codec, the oldest block is decompressed again
+ * when the consumer reaches it. So only the two ends of the backlog are plain bytes,
+ * everything in between (the cold part) takes its compressed size.
+ *
+ * Not thread safe, the queue calls it with its lock held. The codec itself runs without
+ * the lock: a begin call hands out a block, backlog_compress / backlog_decompress work on
+ * it while the other side of the queue goes on, the end call puts the result in place.
+ */
+
+// plain bytes of a block before it is compressed, an item longer than that gets a block of its own
+#define BACKLOG_BLOCK_BYTES (64 * 1024)
+
+typedef struct backlog_block
+{
+    struct backlog_block* next;
+    char* data;             /* Plain items, or the compressed block */
+    size_t capacity;        /* Bytes allocated for data */
+    size_t used;            /* Plain bytes written (the decompressed size of a compressed block) */
+    size_t compressed_size; /* Size of the compressed data, 0 - data holds the plain items */
+    int num_items;
+    char* staged;           /* Codec output waiting for its end call, NULL - the codec failed */
+    size_t staged_size;
+    int detached;           /* Read up while it was compressed, backlog_end_compress frees it */
+} backlog_block_t;
+
+typedef struct
+{
+    backlog_block_t* head;              /* Oldest block, always plain once the consumer reads it */
+    backlog_block_t* tail;              /* Block new items go into */
+    size_t read_offset;                 /* Next item in head */
+    int num_items;                      /* Items in all the blocks */
+    backlog_block_t* compress_next;     /* Oldest block that was not given to the codec yet */
+    backlog_block_t* compressing;       /* Block handed out by backlog_begin_compress */
+    backlog_block_t* decompressing;     /* Head handed out by backlog_begin_decompress */
+    pipeline_allocator_t allocator;     /* Blocks and scratch buffer (zeroed = malloc) */
+    char* scratch;                      /* Compression output before it is copied to its own block */
+    size_t resident_bytes;              /* Bytes allocated for the blocks right now */
+    size_t peak_resident_bytes;
+    unsigned long long blocks_compressed; /* Full blocks the codec shrank */
+    unsigned long long plain_bytes;     /* Their plain bytes */
+    unsigned long long compressed_bytes; /* Their compressed bytes */
+    unsigned long long blocks_dropped;  /* Blocks that did not decompress, their items are lost */
+} backlog_t;
+
+/**
+ * Initialize an empty backlog
+ * @param backlog Backlog to initialize
+ * @param allocator Allocator for the blocks (copied, NULL means malloc)
+ */
+void backlog_init(backlog_t* backlog, const pipeline_allocator_t* allocator);
+
+/**
+ * Append an item, starts a new tail block once the item does not fit into the old one
+ * (the old one is sealed and waits for backlog_begin_compress)
+ * @param backlog Backlog to append to
+ * @param item String to copy
+ * @param length String length
+ * @return 0 on success, -1 if the memory ran out
+ */
+int backlog_append(backlog_t* backlog, const char* item, size_t length);
+
+/**
+ * Hand out the oldest sealed block for compression, one block at a time
+ * @param backlog Backlog to compress
+ * @return The block, NULL if none is sealed or another one is being compressed
+ */
+backlog_block_t* backlog_begin_compress(backlog_t* backlog);
+
+/**
+ * Compress a block from backlog_begin_compress into its staged buffer, without the lock
+ * @param backlog Backlog the block belongs to
+ * @param block Block to compress
+ */
+void backlog_compress(backlog_t* backlog, backlog_block_t* block);
+
+/**
+ * Put the compressed data in place - unless the block became the head meanwhile (it stays
+ * plain) or was read up (it is freed). A block the codec could not shrink stays plain
+ * @param backlog Backlog the block belongs to
+ * @param block Block from backlog_begin_compress
+ */
+void backlog_end_compress(backlog_t* backlog, backlog_block_t* block);
+
+/**
+ * Hand out the head block if it is compressed
+ * @param backlog Backlog to read
+ * @return The head, NULL if it is plain or another consumer decompresses it already
+ */
+backlog_block_t* backlog_begin_decompress(backlog_t* backlog);
+
+/**
+ * Decompress a block from backlog_begin_decompress into its staged buffer, without the lock
+ * @param backlog Backlog the block belongs to
+ * @param block Block to decompress
+ */
+void backlog_decompress(backlog_t* backlog, backlog_block_t* block);
+
+/**
+ * Put the plain data in place, a block that did not decompress is dropped with its items
+ * @param backlog Backlog the block belongs to
+ * @param block Block from backlog_begin_decompress
+ * @return Number of items dropped, 0 on success
+ */
+int backlog_end_decompress(backlog_t* backlog, backlog_block_t* block);
+
+/**
+ * Oldest item. The item stays valid until backlog_release
+ * @param backlog Backlog with num_items > 0
+ * @return The item, NULL if the backlog is empty or its head is still compressed
+ */
+const char* backlog_peek(backlog_t* backlog);
+
+/**
+ * Remove the item returned by backlog_peek, frees its block once it is used up
+ * @param backlog Backlog to take from
+ */
+void backlog_release(backlog_t* backlog);
+
+/**
+ * Free every block
+ * @param backlog Backlog to destroy, empty and reusable afterwards
+ */
+void backlog_destroy(backlog_t* backlog);
+
+#endif /* BACKLOG_H */
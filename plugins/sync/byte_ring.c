@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include "byte_ring.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// header value that sends the consumer back to offset 0
+#define BYTE_RING_WRAP_MARKER UINT32_MAX
+
+static void skip_wrap_space(byte_ring_t* ring);
+static size_t resident_bytes(char* start, size_t length, size_t page_size);
+
+
+size_t byte_ring_record_size(size_t length)
+{
+    size_t record_size = BYTE_RING_ALIGNMENT + length + 1;
+    return (record_size + BYTE_RING_ALIGNMENT - 1) & ~(size_t)(BYTE_RING_ALIGNMENT - 1);
+}
+
+int byte_ring_init(byte_ring_t* ring, char* buffer, size_t size)
+{
+    if (NULL == ring || NULL == buffer) {
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(byte_ring_t));
+    ring->buffer = buffer;
+    ring->size = size & ~(size_t)(BYTE_RING_ALIGNMENT - 1);
+    return (ring->size >= byte_ring_record_size(0)) ? 0 : -1;
+}
+
+char* byte_ring_reserve(byte_ring_t* ring, size_t length)
+{
+    size_t record_size = byte_ring_record_size(length);
+    if (0 != ring->reserved || record_size > ring->size || length >= BYTE_RING_WRAP_MARKER) {
+        return NULL;
+    }
+
+    //empty - start over at 0 so the largest record fits
+    if (0 == ring->used) {
+        ring->head = 0;
+        ring->tail = 0;
+    }
+
+    //free bytes right after tail: up to the end of the buffer, or up to head once tail wrapped behind it
+    int tail_behind_head = (ring->tail < ring->head) || (ring->tail == ring->head && ring->used > 0);
+    size_t contiguous = tail_behind_head ? ring->head - ring->tail : ring->size - ring->tail;
+
+    if (record_size > contiguous) {
+        //does not fit before the end - skip the rest of the buffer if the start has room
+        if (tail_behind_head || record_size > ring->head) {
+            return NULL;
+        }
+        size_t skipped = ring->size - ring->tail;
+        if (skipped >= BYTE_RING_ALIGNMENT) {
+            *(uint32_t*)(ring->buffer + ring->tail) = BYTE_RING_WRAP_MARKER;
+        }
+        ring->used += skipped;
+        ring->tail = 0;
+    }
+
+    char* record = ring->buffer + ring->tail;
+    *(uint32_t*)record = (uint32_t)length;
+    ring->tail += record_size;
+    if (ring->tail == ring->size) {
+        ring->tail = 0;
+    }
+    ring->used += record_size;
+    ring->reserved = record_size;
+    return record + BYTE_RING_ALIGNMENT;
+}
+
+void byte_ring_commit(byte_ring_t* ring)
+{
+    if (0 == ring->reserved) {
+        return;
+    }
+    ring->reserved = 0;
+    ring->records++;
+}
+
+char* byte_ring_peek(byte_ring_t* ring, size_t* length)
+{
+    if (0 == ring->records) {
+        return NULL;
+    }
+
+    skip_wrap_space(ring);
+    char* record = ring->buffer + ring->head;
+    if (NULL != length) {
+        *length = *(uint32_t*)record;
+    }
+    return record + BYTE_RING_ALIGNMENT;
+}
+
+void byte_ring_release(byte_ring_t* ring)
+{
+    if (0 == ring->records) {
+        return;
+    }
+
+    skip_wrap_space(ring);
+    size_t record_size = byte_ring_record_size(*(uint32_t*)(ring->buffer + ring->head));
+    ring->head += record_size;
+    if (ring->head == ring->size) {
+        ring->head = 0;
+    }
+    ring->used -= record_size;
+    ring->records--;
+}
+
+size_t byte_ring_trim(byte_ring_t* ring, size_t keep_bytes)
+{
+    if (NULL == ring || NULL == ring->buffer || 0 != ring->used || 0 != ring->reserved) {
+        return 0;
+    }
+
+    //only whole pages inside the buffer, the allocator may keep its own data around it
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t first = ((uintptr_t)ring->buffer + (keep_bytes < ring->size ? keep_bytes : ring->size) + page_size - 1) &
+                      ~(uintptr_t)(page_size - 1);
+    uintptr_t last = ((uintptr_t)ring->buffer + ring->size) & ~(uintptr_t)(page_size - 1);
+    if (last <= first) {
+        return 0;
+    }
+
+    //count what is resident first, pages the last burst did not touch are not released twice
+    size_t released = resident_bytes((char*)first, last - first, page_size);
+    if (0 == released || 0 != madvise((void*)first, last - first, MADV_DONTNEED)) {
+        return 0;
+    }
+    return released;
+}
+
+// resident part of a page aligned range, from mincore
+static size_t resident_bytes(char* start, size_t length, size_t page_size)
+{
+    size_t num_pages = length / page_size;
+    unsigned char* residency = (unsigned char*)malloc(num_pages);
+    if (NULL == residency) {
+        return 0;
+    }
+    size_t resident = 0;
+    if (0 == mincore(start, length, residency)) {
+        for (size_t page = 0; page < num_pages; page++) {
+            resident += (residency[page] & 1) ? page_size : 0;
+        }
+    }
+    free(residency);
+    return resident;
+}
+
+// the producer left the end of the buffer empty, the next record is at 0
+static void skip_wrap_space(byte_ring_t* ring)
+{
+    size_t remaining = ring->size - ring->head;
+    if (remaining < BYTE_RING_ALIGNMENT || BYTE_RING_WRAP_MARKER == *(uint32_t*)(ring->buffer + ring->head)) {
+        ring->used -= remaining;
+        ring->head = 0;
+    }
+}
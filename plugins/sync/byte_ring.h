@@ -0,0 +1,87 @@
+#ifndef BYTE_RING_H
+#define BYTE_RING_H
+
+#include <stddef.h>
+
+/**
+ * Variable length records stored back to back in one buffer.
+ * A record is an 8 byte header (the string length) followed by the string and
+ * its '\0', padded to BYTE_RING_ALIGNMENT. A record never wraps around - when it
+ * does not fit before the end of the buffer the producer leaves a wrap marker
+ * and starts again at offset 0. Not thread safe, the queue that owns the ring
+ * (consumer_producer_t) holds its mutex around every call.
+ *
+ * One reservation may be open at a time, records become visible to the
+ * consumer in order once committed.
+ */
+
+// record start alignment and header size
+#define BYTE_RING_ALIGNMENT 8
+
+typedef struct
+{
+    char* buffer;     /* Record storage, owned by the caller */
+    size_t size;      /* Usable bytes in buffer, multiple of BYTE_RING_ALIGNMENT */
+    size_t head;      /* Offset of the oldest record */
+    size_t tail;      /* Offset of the next record */
+    size_t used;      /* Bytes taken by records, the open reservation and skipped wrap space */
+    size_t reserved;  /* Size of the open reservation, 0 - none */
+    int records;      /* Committed records not released yet */
+} byte_ring_t;
+
+/**
+ * Bytes a string of the given length takes in the ring
+ * @param length String length (without '\0')
+ * @return Record size including header and padding
+ */
+size_t byte_ring_record_size(size_t length);
+
+/**
+ * Initialize a ring over a caller provided buffer
+ * @param ring Ring to initialize
+ * @param buffer Storage, at least size bytes, aligned to BYTE_RING_ALIGNMENT
+ * @param size Buffer size in bytes (rounded down to BYTE_RING_ALIGNMENT)
+ * @return 0 on success, -1 if the buffer is too small for any record
+ */
+int byte_ring_init(byte_ring_t* ring, char* buffer, size_t size);
+
+/**
+ * Reserve room for a string of the given length
+ * @param ring Ring
+ * @param length String length, the returned slot has length + 1 bytes
+ * @return Slot to write the string and its '\0' into, NULL if there is no room now
+ *         (or a reservation is already open)
+ */
+char* byte_ring_reserve(byte_ring_t* ring, size_t length);
+
+/**
+ * Publish the open reservation as the newest record
+ * @param ring Ring
+ */
+void byte_ring_commit(byte_ring_t* ring);
+
+/**
+ * Oldest committed record, read (and modified) in place until byte_ring_release
+ * @param ring Ring
+ * @param length Set to the string length, may be NULL
+ * @return The null terminated string inside the ring, NULL if there is no record
+ */
+char* byte_ring_peek(byte_ring_t* ring, size_t* length);
+
+/**
+ * Drop the oldest committed record and give its bytes back to the producer
+ * @param ring Ring
+ */
+void byte_ring_release(byte_ring_t* ring);
+
+/**
+ * Give the pages of an empty ring back to the OS, except the first keep_bytes the next
+ * records go to (an empty ring starts over at offset 0). The pages stay mapped and come
+ * back zeroed on the next touch. Does nothing while the ring holds a record.
+ * @param ring Ring
+ * @param keep_bytes Bytes at the start of the buffer kept resident (warm)
+ * @return Resident bytes released
+ */
+size_t byte_ring_trim(byte_ring_t* ring, size_t keep_bytes);
+
+#endif /* BYTE_RING_H */
@@ -1,5 +1,6 @@
 #define _GNU_SOURCE
 #include "consumer_producer.h"
+#include "async_log.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -7,9 +8,45 @@
 
 // static function declaration
 static void cleanup_partial_init(consumer_producer_t* queue, int stage);
+static const char* init_queue(consumer_producer_t* queue, int capacity, size_t ring_bytes,
+                              const pipeline_allocator_t* allocator);
+static int has_storage(consumer_producer_t* queue);
+static char* take_ring_item_copy(consumer_producer_t* queue);
+static int has_free_slot(consumer_producer_t* queue);
+static void take_free_slot(consumer_producer_t* queue);
+static int return_free_slot(consumer_producer_t* queue);
+static void signal_free_slots(consumer_producer_t* queue);
+static int goes_to_backlog(consumer_producer_t* queue);
+static int append_to_backlog(consumer_producer_t* queue, const char* item, backlog_block_t** sealed);
+static void compress_sealed_block(consumer_producer_t* queue, backlog_block_t* sealed);
+static const char* take_backlog_item_copy(consumer_producer_t* queue, char** item, int* dropped);
+static void log_dropped_backlog_items(int dropped);
 
 
 const char* consumer_producer_init(consumer_producer_t* queue, int capacity)
+{
+    return consumer_producer_init_with_allocator(queue, capacity, NULL);
+}
+
+const char* consumer_producer_init_with_allocator(consumer_producer_t* queue, int capacity,
+                                                  const pipeline_allocator_t* allocator)
+{
+    return init_queue(queue, capacity, 0, allocator);
+}
+
+const char* consumer_producer_init_byte_ring(consumer_producer_t* queue, int capacity, size_t ring_bytes,
+                                             const pipeline_allocator_t* allocator)
+{
+    if (ring_bytes < byte_ring_record_size(0))
+    {
+        return "Invalid ring size";
+    }
+    return init_queue(queue, capacity, ring_bytes, allocator);
+}
+
+// ring_bytes 0 - array of string pointers, otherwise the strings go inline into a byte ring of that size
+static const char* init_queue(consumer_producer_t* queue, int capacity, size_t ring_bytes,
+                              const pipeline_allocator_t* allocator)
 {
     if (NULL == queue)
     {
@@ -25,16 +62,40 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity)
 
     // initialize the queue
     queue->capacity = capacity;
+    queue->slots = capacity;
     queue->count = 0;
     queue->head = 0;
     queue->tail = 0;
     queue->items = NULL;
     queue->mutex_initialized = 0; 
+    queue->credits = capacity;
+    queue->credit_batch = capacity / CONSUMER_PRODUCER_CREDIT_BATCH_DIVISOR;
+    if (queue->credit_batch < 1) {
+        queue->credit_batch = 1;
+    } else if (queue->credit_batch > CONSUMER_PRODUCER_MAX_CREDIT_BATCH) {
+        queue->credit_batch = CONSUMER_PRODUCER_MAX_CREDIT_BATCH;
+    }
+    if (NULL != allocator) {
+        queue->allocator = *allocator;
+    }
 
-    queue->items = (char**)calloc(capacity, sizeof(char*));
-    if (NULL == queue->items) 
+    if (ring_bytes > 0)
     {
-        return "Failed to allocate memory for items";
+        char* ring_buffer = (char*)allocator_alloc(&queue->allocator, ring_bytes);
+        if (NULL == ring_buffer)
+        {
+            return "Failed to allocate memory for the ring";
+        }
+        byte_ring_init(&queue->ring, ring_buffer, ring_bytes);
+    }
+    else
+    {
+        queue->items = (char**)allocator_alloc(&queue->allocator, capacity * sizeof(char*));
+        if (NULL == queue->items) 
+        {
+            return "Failed to allocate memory for items";
+        }
+        memset(queue->items, 0, capacity * sizeof(char*));
     }
     
     // init mutex and handle peaceful destruction 
@@ -66,6 +127,13 @@ const char* consumer_producer_init(consumer_producer_t* queue, int capacity)
         return "Failed to initialize finished_monitor";
     }
 
+    //init credit_monitor
+    if(0 != monitor_init(&queue->credit_monitor))
+    {
+        cleanup_partial_init(queue, 4);
+        return "Failed to initialize credit_monitor";
+    }
+
     monitor_signal(&queue->not_full_monitor); // signal that queue is not full
     return NULL; // success
 }
@@ -79,33 +147,42 @@ void consumer_producer_destroy(consumer_producer_t* queue) {
     monitor_signal(&queue->not_full_monitor);
     monitor_signal(&queue->not_empty_monitor);
     monitor_signal(&queue->finished_monitor);
+    monitor_signal(&queue->credit_monitor);
 
     if(queue->mutex_initialized) //lock the mutex before destroying
     {
-        pthread_mutex_lock(&queue->queue_mutex);
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
     }
 
     // free the items in the queue
     if (NULL != queue->items) 
     {
-        for (int i = 0; i < queue->capacity; i++) {
+        for (int i = 0; i < queue->slots; i++) {
             if (NULL != queue->items[i]) {
-                free(queue->items[i]);
+                allocator_free(&queue->allocator, queue->items[i]);
                 queue->items[i] = NULL;
             }
         }
-        free(queue->items);
+        allocator_free(&queue->allocator, queue->items);
         queue->items = NULL;
     }
+    backlog_destroy(&queue->backlog);
+    //the byte ring items live inside the ring
+    if (NULL != queue->ring.buffer)
+    {
+        allocator_free(&queue->allocator, queue->ring.buffer);
+        memset(&queue->ring, 0, sizeof(byte_ring_t));
+    }
 
     if (queue->mutex_initialized) {
-        pthread_mutex_unlock(&queue->queue_mutex);
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
     }
 
     // destroy the synchronization monitors
     monitor_destroy(&queue->not_full_monitor);
     monitor_destroy(&queue->not_empty_monitor);
     monitor_destroy(&queue->finished_monitor);
+    monitor_destroy(&queue->credit_monitor);
 
     // destroy the mutex
     if (queue->mutex_initialized) {
@@ -115,6 +192,7 @@ void consumer_producer_destroy(consumer_producer_t* queue) {
 
     //reset the remining fields
     queue->capacity = 0;
+    queue->slots = 0;
     queue->count = 0;
     queue->head = 0;
     queue->tail = 0;
@@ -134,28 +212,68 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item)
         return "Queue or item pointer is NULL";
     }
 
+    if (NULL != queue->ring.buffer) {
+        //byte ring - the copy goes straight into the ring, no allocation
+        //a line is short, copying it under the lock is cheaper than a second lock round trip for the commit
+        size_t item_length = strlen(item);
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+        char* slot = has_free_slot(queue) ? byte_ring_reserve(&queue->ring, item_length) : NULL;
+        if (NULL != slot) {
+            take_free_slot(queue);
+            memcpy(slot, item, item_length + 1);
+            byte_ring_commit(&queue->ring);
+            queue->count++;
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+            monitor_signal(&queue->not_empty_monitor);
+            return NULL;
+        }
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+        //full (or the item can never fit) - wait for room like any producer
+        slot = consumer_producer_reserve(queue, item_length);
+        if (NULL == slot) {
+            return "Item does not fit in the queue ring";
+        }
+        memcpy(slot, item, item_length + 1);
+        consumer_producer_commit(queue);
+        return NULL;
+    }
+
     if (NULL == queue->items) {
         return "Queue items array is not initialized";
     }
     
+    //reset before the second check - a slot freed between the check and the wait keeps the monitor signaled
+    int reset_done = 0;
     while (1) {
-        pthread_mutex_lock(&queue->queue_mutex);
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
         
-        if (queue->count < queue->capacity) {
-            size_t len = strlen(item);
-            char* copy_of_item = (char*)malloc(len + 1);
+        if (has_free_slot(queue) && goes_to_backlog(queue)) {
+            backlog_block_t* sealed = NULL;
+            int appended = (0 == append_to_backlog(queue, item, &sealed));
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+            if (!appended) {
+                return "Failed to append item to the backlog";
+            }
+            monitor_signal(&queue->not_empty_monitor);
+            compress_sealed_block(queue, sealed);
+            return NULL;
+        }
+
+        if (has_free_slot(queue)) {
+            char* copy_of_item = allocator_strdup(&queue->allocator, item);
             if (NULL == copy_of_item) {
-                pthread_mutex_unlock(&queue->queue_mutex);
+                lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
                 return "Failed to copy item string";
             }
-            strcpy(copy_of_item, item);
+            take_free_slot(queue);
             
             //Add item
             queue->items[queue->tail] = copy_of_item;
-            queue->tail = (queue->tail + 1) % queue->capacity;
+            queue->tail = (queue->tail + 1) % queue->slots;
             queue->count++;
             
-            pthread_mutex_unlock(&queue->queue_mutex);
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
             
             //asignal that queue is not empty (wake up consumers)
             monitor_signal(&queue->not_empty_monitor);
@@ -164,10 +282,15 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item)
         }
         
         // Condition not met - prepare to wait
-        pthread_mutex_unlock(&queue->queue_mutex);
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (!reset_done) {
+            monitor_reset(&queue->not_full_monitor);
+            reset_done = 1;
+            continue;
+        }
         
         // Wait for condition to change
-        monitor_reset(&queue->not_full_monitor);
+        reset_done = 0;
         if (0 != monitor_wait(&queue->not_full_monitor)) {
             return "Failed to wait for not_full condition";
         }
@@ -182,38 +305,75 @@ char* consumer_producer_get(consumer_producer_t* queue) {
         return NULL;
     }
     
-    if (NULL == queue->items) {
+    if (!has_storage(queue)) {
         return NULL;
     }
 
     
+    int reset_done = 0;
     while (1) {
-        pthread_mutex_lock(&queue->queue_mutex);
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+
+        if (NULL != queue->ring.buffer && queue->count > 0) {
+            char* item = take_ring_item_copy(queue);
+            int slots_published = (NULL != item) && return_free_slot(queue);
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+            if (slots_published) {
+                signal_free_slots(queue);
+            }
+            return item;
+        }
 
         
+        //the array holds the older items, the backlog is next once it ran empty
+        int dropped = 0;
+        if (queue->count > 0 && queue->count == queue->backlog.num_items) {
+            char* item = NULL;
+            const char* error = take_backlog_item_copy(queue, &item, &dropped);
+            if (NULL != item || NULL != error) {
+                int slots_published = (NULL != item) && return_free_slot(queue);
+                lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+                log_dropped_backlog_items(dropped);
+                if (slots_published) {
+                    signal_free_slots(queue);
+                }
+                return item; //NULL if the copy failed, waiting would not bring the item
+            }
+            //another consumer decompresses the oldest block, or it was dropped - wait and look again
+        }
+
         // Check condition while holding lock
-        if (queue->count > 0) {
+        else if (queue->count > 0) {
 
             // Items available - perform operation
             char* item = queue->items[queue->head];
             queue->items[queue->head] = NULL;
-            queue->head = (queue->head + 1) % queue->capacity;
+            queue->head = (queue->head + 1) % queue->slots;
             queue->count--;
+            int slots_published = return_free_slot(queue);
             
             // Release lock before signaling
-            pthread_mutex_unlock(&queue->queue_mutex);
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
             
-            // Signal that queue is not full (wake up producers)
-            monitor_signal(&queue->not_full_monitor);
+            // Signal that queue is not full (wake up producers) - once the freed slots are published
+            if (slots_published) {
+                signal_free_slots(queue);
+            }
             
             return item; // Success
         }
         
         // Condition not met - prepare to wait
-        pthread_mutex_unlock(&queue->queue_mutex);
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        log_dropped_backlog_items(dropped);
+        if (!reset_done) {
+            monitor_reset(&queue->not_empty_monitor);
+            reset_done = 1;
+            continue;
+        }
         
         // Wait for condition to change
-        monitor_reset(&queue->not_empty_monitor);
+        reset_done = 0;
         if (0 != monitor_wait(&queue->not_empty_monitor)) {
             return NULL; // Wait failed
         }
@@ -224,6 +384,345 @@ char* consumer_producer_get(consumer_producer_t* queue) {
 }
 
 
+int consumer_producer_try_put(consumer_producer_t* queue, const char* item) {
+    if (NULL == queue || NULL == item || !has_storage(queue)) {
+        return -1;
+    }
+
+    if (NULL != queue->ring.buffer) {
+        size_t item_length = strlen(item);
+        if (byte_ring_record_size(item_length) > queue->ring.size) {
+            return -1;
+        }
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+        char* slot = has_free_slot(queue) ? byte_ring_reserve(&queue->ring, item_length) : NULL;
+        if (NULL != slot) {
+            take_free_slot(queue);
+        }
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (NULL == slot) {
+            return 1;
+        }
+        memcpy(slot, item, item_length + 1);
+        consumer_producer_commit(queue);
+        return 0;
+    }
+
+    //cheap check first so a full queue does not cost a malloc on every retry
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    int is_full = !has_free_slot(queue);
+    if (!is_full && goes_to_backlog(queue)) {
+        //the backlog copies the item into its block, no allocation per item
+        backlog_block_t* sealed = NULL;
+        int appended = (0 == append_to_backlog(queue, item, &sealed));
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (!appended) {
+            return -1;
+        }
+        monitor_signal(&queue->not_empty_monitor);
+        compress_sealed_block(queue, sealed);
+        return 0;
+    }
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+    if (is_full) {
+        return 1;
+    }
+
+    //copy outside the lock, we dont want malloc inside the critical section
+    char* copy_of_item = allocator_strdup(&queue->allocator, item);
+    if (NULL == copy_of_item) {
+        return -1;
+    }
+
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    if (!has_free_slot(queue)) {
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        allocator_free(&queue->allocator, copy_of_item);
+        return 1; //filled up meanwhile - caller keeps the item and tries again later
+    }
+    if (goes_to_backlog(queue)) {
+        //the hot part filled up meanwhile, the item has to queue behind the backlog
+        allocator_free(&queue->allocator, copy_of_item);
+        backlog_block_t* sealed = NULL;
+        int appended = (0 == append_to_backlog(queue, item, &sealed));
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (!appended) {
+            return -1;
+        }
+        monitor_signal(&queue->not_empty_monitor);
+        compress_sealed_block(queue, sealed);
+        return 0;
+    }
+    take_free_slot(queue);
+
+    queue->items[queue->tail] = copy_of_item;
+    queue->tail = (queue->tail + 1) % queue->slots;
+    queue->count++;
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+    monitor_signal(&queue->not_empty_monitor);
+    return 0;
+}
+
+char* consumer_producer_try_get(consumer_producer_t* queue) {
+    if (NULL == queue || !has_storage(queue)) {
+        return NULL;
+    }
+
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    if (0 == queue->count) {
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        return NULL;
+    }
+
+    if (NULL != queue->ring.buffer) {
+        char* item = take_ring_item_copy(queue);
+        int slots_published = (NULL != item) && return_free_slot(queue);
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (slots_published) {
+            signal_free_slots(queue);
+        }
+        return item;
+    }
+
+    if (queue->count == queue->backlog.num_items) {
+        //NULL too while another consumer decompresses the oldest block
+        char* item = NULL;
+        int dropped = 0;
+        take_backlog_item_copy(queue, &item, &dropped);
+        int slots_published = (NULL != item) && return_free_slot(queue);
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        log_dropped_backlog_items(dropped);
+        if (slots_published) {
+            signal_free_slots(queue);
+        }
+        return item;
+    }
+
+    char* item = queue->items[queue->head];
+    queue->items[queue->head] = NULL;
+    queue->head = (queue->head + 1) % queue->slots;
+    queue->count--;
+    int slots_published = return_free_slot(queue);
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+    //a blocked producer may be waiting for this slot
+    if (slots_published) {
+        signal_free_slots(queue);
+    }
+    return item;
+}
+
+
+char* consumer_producer_reserve(consumer_producer_t* queue, size_t length) {
+    if (NULL == queue || NULL == queue->ring.buffer) {
+        return NULL;
+    }
+    if (byte_ring_record_size(length) > queue->ring.size) {
+        return NULL; //would wait forever
+    }
+
+    //the reset happens before a second check, so a release that lands between
+    //the check and the wait leaves the monitor signaled
+    int reset_done = 0;
+    while (1) {
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+
+        //room for one more item and for its bytes - the ring refuses while another reservation is open
+        char* slot = has_free_slot(queue) ? byte_ring_reserve(&queue->ring, length) : NULL;
+        if (NULL != slot) {
+            take_free_slot(queue);
+        }
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        if (NULL != slot) {
+            return slot;
+        }
+
+        if (!reset_done) {
+            monitor_reset(&queue->not_full_monitor);
+            reset_done = 1;
+            continue;
+        }
+        reset_done = 0;
+        if (0 != monitor_wait(&queue->not_full_monitor)) {
+            return NULL;
+        }
+    }
+}
+
+void consumer_producer_commit(consumer_producer_t* queue) {
+    if (NULL == queue || NULL == queue->ring.buffer) {
+        return;
+    }
+
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    byte_ring_commit(&queue->ring);
+    queue->count++;
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+    monitor_signal(&queue->not_empty_monitor);
+    //the ring refuses other reservations while this one is open, a producer may be waiting for it to close
+    monitor_signal(&queue->not_full_monitor);
+}
+
+char* consumer_producer_peek(consumer_producer_t* queue) {
+    if (NULL == queue || NULL == queue->ring.buffer) {
+        return NULL;
+    }
+
+    //same check / reset / check / wait order as consumer_producer_reserve
+    int reset_done = 0;
+    while (1) {
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+        if (queue->count > 0) {
+            //only the consumer moves head, the item stays put until it is released
+            char* item = byte_ring_peek(&queue->ring, NULL);
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+            return item;
+        }
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+        if (!reset_done) {
+            monitor_reset(&queue->not_empty_monitor);
+            reset_done = 1;
+            continue;
+        }
+        reset_done = 0;
+        if (0 != monitor_wait(&queue->not_empty_monitor)) {
+            return NULL;
+        }
+    }
+}
+
+void consumer_producer_release(consumer_producer_t* queue) {
+    if (NULL == queue || NULL == queue->ring.buffer) {
+        return;
+    }
+
+    int slots_published = 0;
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    if (queue->count > 0) {
+        byte_ring_release(&queue->ring);
+        queue->count--;
+        slots_published = return_free_slot(queue);
+    }
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+    if (slots_published) {
+        signal_free_slots(queue);
+    }
+}
+
+int consumer_producer_take_credits(consumer_producer_t* queue, int wanted, int wait) {
+    if (NULL == queue || !has_storage(queue) || wanted <= 0) {
+        return -1;
+    }
+
+    int reset_done = 0;
+    while (1) {
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+        //from now on the consumer publishes freed slots in batches
+        queue->credits_requested = 1;
+        if (queue->credits > 0) {
+            int granted = (wanted < queue->credits) ? wanted : queue->credits;
+            queue->credits -= granted;
+            queue->granted_credits += granted;
+            lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+            return granted;
+        }
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+
+        if (!wait) {
+            return 0;
+        }
+        //check / reset / check / wait, a batch published in between is not lost
+        if (!reset_done) {
+            monitor_reset(&queue->credit_monitor);
+            reset_done = 1;
+            continue;
+        }
+        reset_done = 0;
+        if (0 != monitor_wait(&queue->credit_monitor)) {
+            return -1;
+        }
+    }
+}
+
+void consumer_producer_set_credit_batch(consumer_producer_t* queue, int credit_batch) {
+    if (NULL == queue || credit_batch < 1) {
+        return;
+    }
+    queue->credit_batch = (credit_batch > queue->capacity) ? queue->capacity : credit_batch;
+}
+
+const char* consumer_producer_set_backlog_compression(consumer_producer_t* queue, int hot_items) {
+    if (NULL == queue || NULL == queue->items) {
+        return "Backlog compression needs the pointer array layout";
+    }
+    if (hot_items < 1 || hot_items > queue->capacity) {
+        return "Invalid hot depth";
+    }
+    if (queue->count > 0) {
+        return "Queue is not empty";
+    }
+
+    //the array only holds the hot items now, a deep queue does not pay for capacity pointers
+    char** hot_array = (char**)allocator_alloc(&queue->allocator, hot_items * sizeof(char*));
+    if (NULL == hot_array) {
+        return "Failed to allocate memory for items";
+    }
+    memset(hot_array, 0, hot_items * sizeof(char*));
+    allocator_free(&queue->allocator, queue->items);
+    queue->items = hot_array;
+    queue->slots = hot_items;
+    queue->head = 0;
+    queue->tail = 0;
+    backlog_init(&queue->backlog, &queue->allocator);
+    queue->compress_backlog = 1;
+    return NULL;
+}
+
+size_t consumer_producer_trim(consumer_producer_t* queue, size_t keep_bytes) {
+    if (NULL == queue || NULL == queue->ring.buffer) {
+        return 0;
+    }
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    size_t released = byte_ring_trim(&queue->ring, keep_bytes);
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+    return released;
+}
+
+void consumer_producer_set_lock_profiles(consumer_producer_t* queue, lock_profile_t* profiles) {
+    if (NULL == queue) {
+        return;
+    }
+    //same order as consumer_producer_lock_name
+    queue->lock_profile = (NULL != profiles) ? &profiles[0] : NULL;
+    queue->not_full_monitor.lock_profile = (NULL != profiles) ? &profiles[1] : NULL;
+    queue->not_empty_monitor.lock_profile = (NULL != profiles) ? &profiles[2] : NULL;
+    queue->finished_monitor.lock_profile = (NULL != profiles) ? &profiles[3] : NULL;
+    queue->credit_monitor.lock_profile = (NULL != profiles) ? &profiles[4] : NULL;
+}
+
+const char* consumer_producer_lock_name(int lock) {
+    static const char* const lock_names[CONSUMER_PRODUCER_PROFILED_LOCKS] = {
+        "queue_mutex", "not_full", "not_empty", "finished", "credit"
+    };
+    if (lock < 0 || lock >= CONSUMER_PRODUCER_PROFILED_LOCKS) {
+        return NULL;
+    }
+    return lock_names[lock];
+}
+
+void consumer_producer_free_item(consumer_producer_t* queue, char* item) {
+    if (NULL == queue) {
+        free(item);
+        return;
+    }
+    allocator_free(&queue->allocator, item);
+}
+
+
 void consumer_producer_signal_finished(consumer_producer_t* queue) {
     if (NULL == queue) {
 
@@ -253,6 +752,9 @@ static void cleanup_partial_init(consumer_producer_t* queue, int stage) {
         return;
     }
 
+    if (stage >= 4) {
+        monitor_destroy(&queue->finished_monitor);
+    }
     if (stage >= 3) {
         monitor_destroy(&queue->not_empty_monitor);
     }
@@ -264,7 +766,139 @@ static void cleanup_partial_init(consumer_producer_t* queue, int stage) {
         queue->mutex_initialized = 0;
     }
     if (NULL != queue->items) {
-        free(queue->items);
+        allocator_free(&queue->allocator, queue->items);
         queue->items = NULL;
     }
+    if (NULL != queue->ring.buffer) {
+        allocator_free(&queue->allocator, queue->ring.buffer);
+        memset(&queue->ring, 0, sizeof(byte_ring_t));
+    }
+}
+
+// credit accounting, all called with queue_mutex held:
+// capacity == count + credits + granted_credits + returned_credits (+ an open ring reservation)
+
+// a put may go in - with a credit granted earlier, or with a free slot nobody was granted
+static int has_free_slot(consumer_producer_t* queue) {
+    return queue->granted_credits > 0 || queue->credits > 0;
+}
+
+// producers that took credits use them first, everyone else takes from the free pool
+static void take_free_slot(consumer_producer_t* queue) {
+    if (queue->granted_credits > 0) {
+        queue->granted_credits--;
+    } else {
+        queue->credits--;
+    }
+}
+
+// the consumer freed a slot - published right away, or in batches once a producer asked for credits
+// returns 1 when slots were published (the caller signals the producers after unlocking)
+static int return_free_slot(consumer_producer_t* queue) {
+    queue->returned_credits++;
+    int batch = queue->credits_requested ? queue->credit_batch : 1;
+    if (queue->returned_credits < batch && queue->count > 0) {
+        return 0;
+    }
+    queue->credits += queue->returned_credits;
+    queue->returned_credits = 0;
+    return 1;
+}
+
+static void signal_free_slots(consumer_producer_t* queue) {
+    monitor_signal(&queue->not_full_monitor);
+    monitor_signal(&queue->credit_monitor);
+}
+
+// either layout was allocated
+static int has_storage(consumer_producer_t* queue) {
+    return NULL != queue->items || NULL != queue->ring.buffer;
+}
+
+// a new item queues behind the backlog, or starts one once the hot items fill the array
+static int goes_to_backlog(consumer_producer_t* queue) {
+    return queue->compress_backlog &&
+           (queue->backlog.num_items > 0 || queue->count >= queue->slots);
+}
+
+// put / try_put past the hot depth, called with queue_mutex held and a free slot
+// *sealed gets a full block the caller compresses once it dropped the lock
+static int append_to_backlog(consumer_producer_t* queue, const char* item, backlog_block_t** sealed) {
+    if (0 != backlog_append(&queue->backlog, item, strlen(item))) {
+        return -1;
+    }
+    take_free_slot(queue);
+    queue->count++;
+    *sealed = backlog_begin_compress(&queue->backlog);
+    return 0;
+}
+
+// the codec runs without the lock, the consumer keeps reading meanwhile
+static void compress_sealed_block(consumer_producer_t* queue, backlog_block_t* sealed) {
+    if (NULL == sealed) {
+        return;
+    }
+    backlog_compress(&queue->backlog, sealed);
+    lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+    backlog_end_compress(&queue->backlog, sealed);
+    lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+}
+
+// get / try_get once the array ran empty - the caller owns a copy, called with queue_mutex held
+// a compressed head is decompressed with the lock dropped, *item stays NULL while another consumer
+// does that. The items of a corrupt block are added to *dropped, the caller logs them once unlocked
+static const char* take_backlog_item_copy(consumer_producer_t* queue, char** item, int* dropped) {
+    backlog_block_t* block;
+    while (NULL != (block = backlog_begin_decompress(&queue->backlog))) {
+        lock_profile_unlock(&queue->queue_mutex, queue->lock_profile);
+        backlog_decompress(&queue->backlog, block);
+        lock_profile_lock(&queue->queue_mutex, queue->lock_profile);
+
+        //a corrupt block is lost, its slots go back so nobody waits for items that never come
+        int block_dropped = backlog_end_decompress(&queue->backlog, block);
+        int slots_published = 0;
+        if (block_dropped > 0) {
+            *dropped += block_dropped;
+            queue->count -= block_dropped;
+            for (int i = 0; i < block_dropped; i++) {
+                slots_published |= return_free_slot(queue);
+            }
+        }
+        if (slots_published) {
+            signal_free_slots(queue);
+        }
+        //consumers that found the head busy look again
+        monitor_signal(&queue->not_empty_monitor);
+    }
+
+    const char* backlog_item = backlog_peek(&queue->backlog);
+    if (NULL == backlog_item) {
+        return NULL;
+    }
+    *item = allocator_strdup(&queue->allocator, backlog_item);
+    if (NULL == *item) {
+        return "Failed to copy backlog item";
+    }
+    backlog_release(&queue->backlog);
+    queue->count--;
+    return NULL;
+}
+
+// the queue has no plugin context, the drop goes straight to the async logger
+static void log_dropped_backlog_items(int dropped) {
+    if (dropped > 0) {
+        char message[ASYNC_LOG_MESSAGE_LENGTH];
+        snprintf(message, sizeof(message), "backlog block did not decompress, %d items dropped", dropped);
+        async_log_write(ASYNC_LOG_ERROR, "consumer_producer", message, __builtin_return_address(0));
+    }
+}
+
+// get / try_get on a byte ring - the caller owns a copy, called with queue_mutex held and count > 0
+static char* take_ring_item_copy(consumer_producer_t* queue) {
+    char* item = allocator_strdup(&queue->allocator, byte_ring_peek(&queue->ring, NULL));
+    if (NULL != item) {
+        byte_ring_release(&queue->ring);
+        queue->count--;
+    }
+    return item;
 }
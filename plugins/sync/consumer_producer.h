@@ -4,10 +4,26 @@
 
 #include <pthread.h>
 #include "monitor.h"
+#include "allocator.h"
+#include "byte_ring.h"
+#include "lock_profile.h"
+#include "backlog.h"
+
+// credit flow control - the consumer publishes freed slots every capacity / DIVISOR
+// items (at most MAX, at least 1) or when the queue runs empty
+#define CONSUMER_PRODUCER_CREDIT_BATCH_DIVISOR 4
+#define CONSUMER_PRODUCER_MAX_CREDIT_BATCH 16
+
+// locks of a queue that can be profiled - queue_mutex and the mutexes of its four monitors
+#define CONSUMER_PRODUCER_PROFILED_LOCKS 5
 
 /** 
  * Consumer-Producer queue structure for thread-safe producer-consumer pattern 
  * Now using monitors for simpler implementation 
+ * Two storage layouts: an array of pointers to separately allocated strings (default), 
+ * or a byte ring where the strings are stored inline (consumer_producer_init_byte_ring) 
+ * The pointer array layout can keep the items past a hot depth in a compressed backlog 
+ * instead (consumer_producer_set_backlog_compression) 
  */ 
 typedef struct 
 { 
@@ -21,6 +37,18 @@ typedef struct
     monitor_t not_empty_monitor;    /* Monitor for "not empty" state */ 
     monitor_t finished_monitor;     /* Monitor for finished signal */ 
     int mutex_initialized; /* Flag to check if mutex is initialized */
+    pipeline_allocator_t allocator; /* Allocator for the ring and the item copies (zeroed = malloc) */
+    byte_ring_t ring;       /* Inline records (byte ring layout), ring.buffer NULL - pointer array layout */
+    int credits;            /* Free slots not granted to any producer */
+    int granted_credits;    /* Slots granted by consumer_producer_take_credits, not used by a put yet */
+    int returned_credits;   /* Slots freed by the consumer, not published yet */
+    int credit_batch;       /* Freed slots published at once (credit flow control) */
+    int credits_requested;  /* A producer took credits, freed slots are published in batches */
+    monitor_t credit_monitor;       /* Monitor for "credits published" */
+    lock_profile_t* lock_profile;   /* Contention profile of queue_mutex, NULL - not profiled */
+    int slots;              /* Entries of the items array - capacity, or the hot depth with a compressed backlog */
+    int compress_backlog;   /* Items past the hot depth go into the backlog */
+    backlog_t backlog;      /* Compressed backlog, count includes its items */
 } consumer_producer_t; 
  
 /** 
@@ -30,6 +58,123 @@ typedef struct
  * @return NULL on success, error message on failure 
  */ 
 const char* consumer_producer_init(consumer_producer_t* queue, int capacity); 
+
+/** 
+ * Initialize a consumer-producer queue whose memory comes from the given allocator 
+ * Items returned by get must then be released with consumer_producer_free_item 
+ * @param queue Pointer to queue structure 
+ * @param capacity Maximum number of items 
+ * @param allocator Allocator to use (copied, NULL means malloc) 
+ * @return NULL on success, error message on failure 
+ */ 
+const char* consumer_producer_init_with_allocator(consumer_producer_t* queue, int capacity, 
+                                                  const pipeline_allocator_t* allocator); 
+
+/** 
+ * Initialize a consumer-producer queue that stores the strings inline in a byte ring 
+ * A put costs a copy into the ring and no allocation, the consumer can read and 
+ * transform the oldest item in place (consumer_producer_peek / consumer_producer_release). 
+ * get / try_get still work and return a copy. Single consumer. 
+ * @param queue Pointer to queue structure 
+ * @param capacity Maximum number of items 
+ * @param ring_bytes Size of the byte ring, an item takes its length + 9 bytes rounded up to 8 
+ * @param allocator Allocator for the ring and the copies (copied, NULL means malloc) 
+ * @return NULL on success, error message on failure 
+ */ 
+const char* consumer_producer_init_byte_ring(consumer_producer_t* queue, int capacity, size_t ring_bytes, 
+                                             const pipeline_allocator_t* allocator); 
+
+/** 
+ * Reserve room for an item of the given length in a byte ring queue (producer) 
+ * Blocks while the queue is full. The item is written straight into the returned 
+ * slot and becomes visible with consumer_producer_commit. 
+ * @param queue Pointer to a byte ring queue 
+ * @param length String length, the slot has length + 1 bytes for the '\0' 
+ * @return Slot to write into, NULL if the item can never fit or on error 
+ */ 
+char* consumer_producer_reserve(consumer_producer_t* queue, size_t length); 
+
+/** 
+ * Publish the item written into the slot from consumer_producer_reserve 
+ * @param queue Pointer to a byte ring queue 
+ */ 
+void consumer_producer_commit(consumer_producer_t* queue); 
+
+/** 
+ * Oldest item of a byte ring queue, read in place (consumer). Blocks if queue is empty. 
+ * The item stays in the ring until consumer_producer_release, the consumer may rewrite 
+ * it in place as long as the length does not grow 
+ * @param queue Pointer to a byte ring queue 
+ * @return The item inside the ring, NULL on error 
+ */ 
+char* consumer_producer_peek(consumer_producer_t* queue); 
+
+/** 
+ * Remove the item returned by consumer_producer_peek and wake up a waiting producer 
+ * @param queue Pointer to a byte ring queue 
+ */ 
+void consumer_producer_release(consumer_producer_t* queue); 
+
+/** 
+ * Take credits for up to wanted items (producer side of the credit flow control) 
+ * Every credit is a slot kept for this producer, so its next puts never block on a 
+ * full queue (in the byte ring layout the bytes may still run out). Freed slots come 
+ * back in batches of credit_batch, or all at once when the queue runs empty. 
+ * @param queue Pointer to queue structure 
+ * @param wanted Maximum number of credits 
+ * @param wait 1 - block until at least one credit is available, 0 - return right away 
+ * @return Number of credits granted (0 only without wait), -1 on error 
+ */ 
+int consumer_producer_take_credits(consumer_producer_t* queue, int wanted, int wait); 
+
+/** 
+ * Override how many freed slots are published to the producer at once (credit flow control) 
+ * @param queue Pointer to queue structure, before any credit was taken 
+ * @param credit_batch Slots per batch, capped at the capacity 
+ */ 
+void consumer_producer_set_credit_batch(consumer_producer_t* queue, int credit_batch); 
+
+/** 
+ * Keep only the first hot_items items of the queue as separate strings, the rest of a deep 
+ * backlog goes back to back into blocks that are compressed once full (backlog.h) and 
+ * decompressed when the consumer reaches them. Costs CPU on both ends for a fraction of 
+ * the memory, so it pays off for queues that hold a large backlog. Pointer array layout only. 
+ * @param queue Pointer to an empty queue, before any thread uses it 
+ * @param hot_items Items kept as separate strings, at most the capacity 
+ * @return NULL on success, error message on failure 
+ */ 
+const char* consumer_producer_set_backlog_compression(consumer_producer_t* queue, int hot_items); 
+
+/** 
+ * Profile the contention of the queue locks (consumer_producer_lock_name gives the order) 
+ * @param queue Pointer to queue structure, before any thread uses it 
+ * @param profiles CONSUMER_PRODUCER_PROFILED_LOCKS zeroed profiles owned by the caller, NULL - stop profiling 
+ */ 
+void consumer_producer_set_lock_profiles(consumer_producer_t* queue, lock_profile_t* profiles); 
+
+/** 
+ * Return the idle memory of the queue to the OS - the pages of an empty byte ring past 
+ * keep_bytes. The pointer array layout keeps no items of its own once they are taken, 
+ * their copies go back to the allocator. 
+ * @param queue Pointer to queue structure 
+ * @param keep_bytes Ring bytes kept resident so a new burst does not fault them in again 
+ * @return Bytes released, 0 if the queue holds items or there was nothing to release 
+ */ 
+size_t consumer_producer_trim(consumer_producer_t* queue, size_t keep_bytes); 
+
+/** 
+ * Name of a profiled lock 
+ * @param lock Index into the profiles of consumer_producer_set_lock_profiles 
+ * @return "queue_mutex", "not_full" ..., NULL past the last lock 
+ */ 
+const char* consumer_producer_lock_name(int lock); 
+
+/** 
+ * Release an item returned by consumer_producer_get / consumer_producer_try_get 
+ * @param queue Queue the item came from 
+ * @param item Item to release 
+ */ 
+void consumer_producer_free_item(consumer_producer_t* queue, char* item); 
  
 /** 
  * Destroy a consumer-producer queue and free its resources 
@@ -53,6 +198,22 @@ const char* consumer_producer_put(consumer_producer_t* queue, const char* item);
  * @return String item or NULL if queue is empty 
  */ 
 char* consumer_producer_get(consumer_producer_t* queue); 
+
+/** 
+ * Non blocking version of consumer_producer_put, used by the stage executor 
+ * so a worker thread never parks on a full queue. 
+ * @param queue Pointer to queue structure 
+ * @param item String to add (queue copies it) 
+ * @return 0 on success, 1 if the queue is full, -1 on error 
+ */ 
+int consumer_producer_try_put(consumer_producer_t* queue, const char* item); 
+
+/** 
+ * Non blocking version of consumer_producer_get 
+ * @param queue Pointer to queue structure 
+ * @return String item (caller owns it) or NULL if the queue is empty 
+ */ 
+char* consumer_producer_try_get(consumer_producer_t* queue); 
  
 /** 
 * Signal that processing is finished 
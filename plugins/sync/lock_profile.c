@@ -0,0 +1,77 @@
+#define _GNU_SOURCE
+#include "lock_profile.h"
+#include <errno.h>
+#include <time.h>
+
+static unsigned long long monotonic_time_ns(void);
+static int histogram_bucket(unsigned long long time_ns);
+
+int lock_profile_lock(pthread_mutex_t* mutex, lock_profile_t* profile)
+{
+    if (NULL == profile) {
+        return pthread_mutex_lock(mutex);
+    }
+
+    int result = pthread_mutex_trylock(mutex);
+    if (EBUSY == result) {
+        unsigned long long wait_start_ns = monotonic_time_ns();
+        result = pthread_mutex_lock(mutex);
+        if (0 != result) {
+            return result;
+        }
+        profile->held_since_ns = monotonic_time_ns();
+        unsigned long long wait_ns = profile->held_since_ns - wait_start_ns;
+        profile->contended++;
+        profile->wait_sum_ns += wait_ns;
+        profile->wait_buckets[histogram_bucket(wait_ns)]++;
+    } else if (0 == result) {
+        profile->held_since_ns = monotonic_time_ns();
+    } else {
+        return result;
+    }
+    profile->acquisitions++;
+    return 0;
+}
+
+int lock_profile_unlock(pthread_mutex_t* mutex, lock_profile_t* profile)
+{
+    if (NULL != profile) {
+        unsigned long long hold_ns = monotonic_time_ns() - profile->held_since_ns;
+        profile->hold_sum_ns += hold_ns;
+        profile->hold_buckets[histogram_bucket(hold_ns)]++;
+    }
+    return pthread_mutex_unlock(mutex);
+}
+
+int lock_profile_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex, lock_profile_t* profile)
+{
+    if (NULL == profile) {
+        return pthread_cond_wait(condition, mutex);
+    }
+
+    //the wait releases the mutex, so it closes one critical section and opens the next
+    unsigned long long hold_ns = monotonic_time_ns() - profile->held_since_ns;
+    profile->hold_sum_ns += hold_ns;
+    profile->hold_buckets[histogram_bucket(hold_ns)]++;
+    int result = pthread_cond_wait(condition, mutex);
+    profile->held_since_ns = monotonic_time_ns();
+    return result;
+}
+
+static unsigned long long monotonic_time_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + (unsigned long long)now.tv_nsec;
+}
+
+static int histogram_bucket(unsigned long long time_ns)
+{
+    int bucket = 0;
+    unsigned long long bound = LOCK_PROFILE_FIRST_BOUND_NS;
+    while (bucket < LOCK_PROFILE_BUCKETS - 1 && time_ns > bound) {
+        bound <<= 2;
+        bucket++;
+    }
+    return bucket;
+}
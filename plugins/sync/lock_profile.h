@@ -0,0 +1,67 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <pthread.h>
+
+/**
+ * Lock contention profile of one mutex - how often it was taken, how often a thread
+ * found it held by another one, and how long threads waited for it and held it.
+ * A lock with a NULL profile costs one pointer check on top of pthread_mutex_lock.
+ * With a profile the lock is tried first, only a failed try is timed as a wait.
+ * The counters are only written by the thread holding the mutex, so they need no
+ * atomics, read them once the threads using the lock are done.
+ * Plain data, the host (main.c) reads it through plugin_get_lock_profile.
+ */
+
+// wait/hold histogram - bucket i counts times up to 32ns * 4^i,
+// the last bucket is everything above (+Inf), so the range is 32ns .. ~134ms
+#define LOCK_PROFILE_BUCKETS 12
+#define LOCK_PROFILE_FIRST_BOUND_NS 32ULL
+
+typedef struct
+{
+    unsigned long long acquisitions;        /* Times the mutex was taken (not counting the returns from a condition wait) */
+    unsigned long long contended;           /* Acquisitions that found the mutex held and had to wait */
+    unsigned long long wait_sum_ns;         /* Time spent waiting for the mutex */
+    unsigned long long hold_sum_ns;         /* Time the mutex was held, condition waits excluded */
+    unsigned long long wait_buckets[LOCK_PROFILE_BUCKETS]; /* Wait histogram of the contended acquisitions */
+    unsigned long long hold_buckets[LOCK_PROFILE_BUCKETS]; /* Hold histogram, one entry per critical section */
+    unsigned long long held_since_ns;       /* Monotonic time the current holder took the mutex */
+} lock_profile_t;
+
+/**
+ * Lock a mutex and record the acquisition
+ * @param mutex Mutex to lock
+ * @param profile Profile of the mutex, NULL - plain pthread_mutex_lock
+ * @return pthread_mutex_lock result
+ */
+int lock_profile_lock(pthread_mutex_t* mutex, lock_profile_t* profile);
+
+/**
+ * Record the hold time and unlock a mutex taken with lock_profile_lock
+ * @param mutex Mutex to unlock
+ * @param profile Profile given to lock_profile_lock
+ * @return pthread_mutex_unlock result
+ */
+int lock_profile_unlock(pthread_mutex_t* mutex, lock_profile_t* profile);
+
+/**
+ * pthread_cond_wait on a profiled mutex - the time parked on the condition is not
+ * hold time, the critical section ends before the wait and starts again after it
+ * @param condition Condition to wait on
+ * @param mutex Mutex held by the caller
+ * @param profile Profile of the mutex, NULL - plain pthread_cond_wait
+ * @return pthread_cond_wait result
+ */
+int lock_profile_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex, lock_profile_t* profile);
+
+// upper bound of a histogram bucket in ns, 0 for the last (+Inf) bucket
+static inline unsigned long long lock_profile_bucket_bound_ns(int bucket)
+{
+    if (bucket >= LOCK_PROFILE_BUCKETS - 1) {
+        return 0;
+    }
+    return LOCK_PROFILE_FIRST_BOUND_NS << (2 * bucket);
+}
+
+#endif /* LOCK_PROFILE_H */
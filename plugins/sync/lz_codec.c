@@ -0,0 +1,182 @@
+#include "lz_codec.h"
+#include <stdint.h>
+#include <string.h>
+
+// match finder - last position of every hashed 4 byte sequence
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+
+static uint32_t read32(const char* p);
+static uint32_t hash_sequence(uint32_t sequence);
+static int write_length(char* dst, size_t dst_capacity, size_t* op, size_t length);
+static int emit_sequence(char* dst, size_t dst_capacity, size_t* op, const char* literals, size_t num_literals,
+                         size_t offset, size_t match_length);
+
+
+size_t lz_compress(const char* src, size_t src_size, char* dst, size_t dst_capacity)
+{
+    //positions + 1, 0 - nothing seen with this hash yet
+    uint32_t table[LZ_HASH_SIZE];
+    memset(table, 0, sizeof(table));
+
+    size_t op = 0;
+    size_t anchor = 0;
+    size_t ip = 0;
+    while (src_size >= LZ_MIN_MATCH + LZ_LAST_LITERALS && ip + LZ_MIN_MATCH + LZ_LAST_LITERALS <= src_size) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t hash = hash_sequence(sequence);
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)ip + 1;
+        if (0 == candidate || ip - (candidate - 1) > LZ_MAX_OFFSET || read32(src + candidate - 1) != sequence) {
+            ip++;
+            continue;
+        }
+        candidate--;
+
+        //extend the match, the last literals stay out of it
+        size_t match_length = LZ_MIN_MATCH;
+        while (ip + match_length < src_size - LZ_LAST_LITERALS && src[candidate + match_length] == src[ip + match_length]) {
+            match_length++;
+        }
+        if (0 != emit_sequence(dst, dst_capacity, &op, src + anchor, ip - anchor, ip - candidate, match_length)) {
+            return 0;
+        }
+        ip += match_length;
+        anchor = ip;
+    }
+
+    if (0 != emit_sequence(dst, dst_capacity, &op, src + anchor, src_size - anchor, 0, 0)) {
+        return 0;
+    }
+    return op;
+}
+
+size_t lz_decompress(const char* src, size_t src_size, char* dst, size_t dst_capacity)
+{
+    const unsigned char* in = (const unsigned char*)src;
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < src_size) {
+        unsigned token = in[ip++];
+
+        size_t num_literals = token >> 4;
+        if (15 == num_literals) {
+            unsigned extra;
+            do {
+                if (ip >= src_size) {
+                    return 0;
+                }
+                extra = in[ip++];
+                num_literals += extra;
+            } while (255 == extra);
+        }
+        if (num_literals > src_size - ip || num_literals > dst_capacity - op) {
+            return 0;
+        }
+        memcpy(dst + op, src + ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+
+        //the last sequence has no match
+        if (ip == src_size) {
+            break;
+        }
+
+        if (src_size - ip < 2) {
+            return 0;
+        }
+        size_t offset = (size_t)in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+        size_t match_length = (token & 15) + LZ_MIN_MATCH;
+        if (15 + LZ_MIN_MATCH == match_length) {
+            unsigned extra;
+            do {
+                if (ip >= src_size) {
+                    return 0;
+                }
+                extra = in[ip++];
+                match_length += extra;
+            } while (255 == extra);
+        }
+        if (0 == offset || offset > op || match_length > dst_capacity - op) {
+            return 0;
+        }
+
+        //an overlapping match repeats the bytes it just wrote, so it is copied forwards byte by byte
+        const char* match = dst + op - offset;
+        if (offset >= match_length) {
+            memcpy(dst + op, match, match_length);
+        } else {
+            for (size_t i = 0; i < match_length; i++) {
+                dst[op + i] = match[i];
+            }
+        }
+        op += match_length;
+    }
+    return op;
+}
+
+static uint32_t read32(const char* p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Knuth multiplicative hash, the top bits are the best mixed
+static uint32_t hash_sequence(uint32_t sequence)
+{
+    return (sequence * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// the part of a length above the 15 in the token, as 255 bytes and a remainder
+static int write_length(char* dst, size_t dst_capacity, size_t* op, size_t length)
+{
+    while (length >= 255) {
+        if (*op >= dst_capacity) {
+            return -1;
+        }
+        dst[(*op)++] = (char)255;
+        length -= 255;
+    }
+    if (*op >= dst_capacity) {
+        return -1;
+    }
+    dst[(*op)++] = (char)length;
+    return 0;
+}
+
+// match_length 0 - the last sequence, literals only
+static int emit_sequence(char* dst, size_t dst_capacity, size_t* op, const char* literals, size_t num_literals,
+                         size_t offset, size_t match_length)
+{
+    if (*op >= dst_capacity) {
+        return -1;
+    }
+    size_t token_position = (*op)++;
+    unsigned literal_code = (num_literals >= 15) ? 15 : (unsigned)num_literals;
+    if (num_literals >= 15 && 0 != write_length(dst, dst_capacity, op, num_literals - 15)) {
+        return -1;
+    }
+    if (num_literals > dst_capacity - *op) {
+        return -1;
+    }
+    memcpy(dst + *op, literals, num_literals);
+    *op += num_literals;
+
+    unsigned match_code = 0;
+    if (match_length > 0) {
+        if (dst_capacity - *op < 2) {
+            return -1;
+        }
+        dst[(*op)++] = (char)(offset & 0xff);
+        dst[(*op)++] = (char)(offset >> 8);
+        size_t length_code = match_length - LZ_MIN_MATCH;
+        match_code = (length_code >= 15) ? 15 : (unsigned)length_code;
+        if (length_code >= 15 && 0 != write_length(dst, dst_capacity, op, length_code - 15)) {
+            return -1;
+        }
+    }
+    dst[token_position] = (char)(literal_code << 4 | match_code);
+    return 0;
+}
@@ -0,0 +1,47 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <stddef.h>
+
+/**
+ * Small LZ77 block codec for the compressed queue backlog - fast rather than tight,
+ * log lines repeat a lot (timestamps, keys, paths) so even a greedy match finder
+ * over a 64KB window gets most of it.
+ *
+ * A block is a run of sequences, LZ4 style: a token byte (literal count in the high
+ * nibble, match length - 4 in the low one, 15 - more length bytes follow, each 255
+ * means another one), the literals, a 2 byte little endian match offset and the
+ * extra match length bytes. The last sequence has literals only, the block ends there.
+ */
+
+// shortest match, and the literals a block always ends with
+#define LZ_MIN_MATCH 4
+#define LZ_LAST_LITERALS 5
+
+// longest match offset
+#define LZ_MAX_OFFSET 65535
+
+// worst case compressed size of n bytes (nothing matched)
+#define LZ_COMPRESS_BOUND(n) ((n) + (n) / 255 + 16)
+
+/**
+ * Compress a block
+ * @param src Bytes to compress
+ * @param src_size Number of bytes
+ * @param dst Output buffer
+ * @param dst_capacity Output buffer size, LZ_COMPRESS_BOUND(src_size) always fits
+ * @return Compressed size, 0 if it did not fit into dst
+ */
+size_t lz_compress(const char* src, size_t src_size, char* dst, size_t dst_capacity);
+
+/**
+ * Decompress a block written by lz_compress
+ * @param src Compressed block
+ * @param src_size Compressed size
+ * @param dst Output buffer
+ * @param dst_capacity Output buffer size, the original size is enough
+ * @return Decompressed size, 0 if the block is corrupt or does not fit into dst
+ */
+size_t lz_decompress(const char* src, size_t src_size, char* dst, size_t dst_capacity);
+
+#endif /* LZ_CODEC_H */
@@ -12,6 +12,7 @@ int monitor_init(monitor_t* monitor) {
 
     monitor->signaled = 0;
     monitor->waiting_count = 0;
+    monitor->lock_profile = NULL;
 
     is_init_success = pthread_mutex_init(&monitor->mutex, NULL);
     if (is_init_success != 0) {
@@ -47,15 +48,15 @@ void monitor_destroy(monitor_t* monitor) {
     }
 
     //signal all the waiting threads before destroying
-    pthread_mutex_lock(&monitor->mutex);
+    lock_profile_lock(&monitor->mutex, monitor->lock_profile);
     monitor->signaled = 1;
     pthread_cond_broadcast(&monitor->condition);
     
     // Wait for all waiting threads to exit properly
     while (monitor->waiting_count > 0) {
-        pthread_cond_wait(&monitor->destroy_cv, &monitor->mutex);
+        lock_profile_cond_wait(&monitor->destroy_cv, &monitor->mutex, monitor->lock_profile);
     }
-    pthread_mutex_unlock(&monitor->mutex);
+    lock_profile_unlock(&monitor->mutex, monitor->lock_profile);
 
     int is_destroyed = pthread_mutex_destroy(&monitor->mutex);
     if(is_destroyed != 0) {
@@ -87,7 +88,7 @@ void monitor_signal(monitor_t* monitor)
         return;
     }
     // Lock the mutex before signaling
-    is_locked = pthread_mutex_lock(&monitor->mutex);
+    is_locked = lock_profile_lock(&monitor->mutex, monitor->lock_profile);
 
     if (is_locked != 0) 
     {
@@ -100,7 +101,7 @@ void monitor_signal(monitor_t* monitor)
 
     pthread_cond_broadcast(&monitor->condition); //wake all waiting threads
 
-    is_unlocked = pthread_mutex_unlock(&monitor->mutex);
+    is_unlocked = lock_profile_unlock(&monitor->mutex, monitor->lock_profile);
     if (is_unlocked != 0) {
         //fprintf(stderr, "[monitor_signal] Error: pthread_mutex_unlock failed with error %d\n", is_unlocked);
     }
@@ -114,7 +115,7 @@ void monitor_reset(monitor_t* monitor)
         return;
     }
 
-    is_locked = pthread_mutex_lock(&monitor->mutex);
+    is_locked = lock_profile_lock(&monitor->mutex, monitor->lock_profile);
     if (is_locked != 0) {
         //fprintf(stderr, "[monitor_reset] Error: pthread_mutex_lock failed with error %d\n", is_locked);
         return;
@@ -122,7 +123,7 @@ void monitor_reset(monitor_t* monitor)
 
     monitor->signaled = 0;
 
-    is_unlocked = pthread_mutex_unlock(&monitor->mutex);
+    is_unlocked = lock_profile_unlock(&monitor->mutex, monitor->lock_profile);
     if (is_unlocked != 0) {
         //fprintf(stderr, "[monitor_reset] Error: pthread_mutex_unlock failed with error %d\n", is_unlocked);
     }
@@ -137,7 +138,7 @@ int monitor_wait(monitor_t* monitor)
         return -1;
     }
 
-    int lock_result  = pthread_mutex_lock(&monitor->mutex);
+    int lock_result  = lock_profile_lock(&monitor->mutex, monitor->lock_profile);
     if (lock_result  != 0) {
         //fprintf(stderr, "[monitor_wait] Error: pthread_mutex_lock failed\n");
         return -1;
@@ -146,7 +147,7 @@ int monitor_wait(monitor_t* monitor)
     if (monitor->signaled) 
     {
         //if already signaled - return immediately
-        if (0 != pthread_mutex_unlock(&monitor->mutex)) 
+        if (0 != lock_profile_unlock(&monitor->mutex, monitor->lock_profile)) 
         {
            // fprintf(stderr, "[monitor_wait] Error: pthread_mutex_unlock failed\n");
             return -1;
@@ -158,7 +159,7 @@ int monitor_wait(monitor_t* monitor)
     while (0 == monitor->signaled)
     {
         //wait for the condition variable, we releases the mutex while waiting
-        int wait_result = pthread_cond_wait(&monitor->condition, &monitor->mutex);
+        int wait_result = lock_profile_cond_wait(&monitor->condition, &monitor->mutex, monitor->lock_profile);
         if (wait_result != 0) 
         {
             monitor->waiting_count--;  // Decrement on error
@@ -172,7 +173,7 @@ int monitor_wait(monitor_t* monitor)
         pthread_cond_signal(&monitor->destroy_cv);
     }
 
-    if (0 != pthread_mutex_unlock(&monitor->mutex)) {
+    if (0 != lock_profile_unlock(&monitor->mutex, monitor->lock_profile)) {
         // fprintf(stderr, "[monitor_wait] Error: pthread_mutex_unlock failed\n");
         return -1;
     }
@@ -1,6 +1,7 @@
 #ifndef MONITOR_H
 #define MONITOR_H
 #include <pthread.h>
+#include "lock_profile.h"
 
 /** Monitor structure that can remember its state in order to solve
  *  solves the race condition where signals sent before waiting are lost
@@ -11,6 +12,7 @@ typedef struct {
     pthread_cond_t destroy_cv;  /* Condition variable for safe destruction */
     int signaled;              /* Flag to remember if monitor was signaled */
     int waiting_count;         /* Counter for threads currently waiting */
+    lock_profile_t* lock_profile; /* Contention profile of the mutex, NULL - not profiled */
 } monitor_t;
 
 /** Initializes the monitor structure.
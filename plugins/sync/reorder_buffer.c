@@ -0,0 +1,136 @@
+#include "reorder_buffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+const char* reorder_buffer_init(reorder_buffer_t* buffer, int window)
+{
+    if (NULL == buffer) {
+        return "Reorder buffer pointer is NULL";
+    }
+    if (window <= 0) {
+        return "Invalid reorder window";
+    }
+
+    memset(buffer, 0, sizeof(reorder_buffer_t));
+    buffer->outputs = (char**)calloc(window, sizeof(char*));
+    buffer->done = (unsigned char*)calloc(window, sizeof(unsigned char));
+    if (NULL == buffer->outputs || NULL == buffer->done) {
+        free(buffer->outputs);
+        free(buffer->done);
+        return "Failed to allocate reorder window";
+    }
+    buffer->window = window;
+
+    pthread_mutex_init(&buffer->mutex, NULL);
+    pthread_cond_init(&buffer->space_cond, NULL);
+    pthread_cond_init(&buffer->drained_cond, NULL);
+    return NULL;
+}
+
+void reorder_buffer_destroy(reorder_buffer_t* buffer)
+{
+    if (NULL == buffer || NULL == buffer->outputs) {
+        return;
+    }
+
+    pthread_cond_destroy(&buffer->drained_cond);
+    pthread_cond_destroy(&buffer->space_cond);
+    pthread_mutex_destroy(&buffer->mutex);
+    free(buffer->outputs);
+    free(buffer->done);
+    memset(buffer, 0, sizeof(reorder_buffer_t));
+}
+
+int reorder_buffer_reserve(reorder_buffer_t* buffer, unsigned long long* seq)
+{
+    pthread_mutex_lock(&buffer->mutex);
+    while (!buffer->closed && buffer->next_seq - buffer->emit_seq >= (unsigned long long)buffer->window) {
+        pthread_cond_wait(&buffer->space_cond, &buffer->mutex);
+    }
+    if (buffer->closed) {
+        pthread_mutex_unlock(&buffer->mutex);
+        return -1;
+    }
+    *seq = buffer->next_seq++;
+    pthread_mutex_unlock(&buffer->mutex);
+    return 0;
+}
+
+int reorder_buffer_complete(reorder_buffer_t* buffer, unsigned long long seq, char* output)
+{
+    int slot = (int)(seq % (unsigned long long)buffer->window);
+
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->outputs[slot] = output;
+    buffer->done[slot] = 1;
+
+    //only the oldest sequence can start an emission, a result further ahead just waits its turn
+    int become_emitter = !buffer->emitting && seq == buffer->emit_seq;
+    if (become_emitter) {
+        buffer->emitting = 1;
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+    return become_emitter;
+}
+
+int reorder_buffer_pop(reorder_buffer_t* buffer, char** output)
+{
+    pthread_mutex_lock(&buffer->mutex);
+    int slot = (int)(buffer->emit_seq % (unsigned long long)buffer->window);
+    if (buffer->emit_seq == buffer->next_seq || !buffer->done[slot]) {
+        //the role is dropped under the lock, so the worker completing this slot takes it over
+        buffer->emitting = 0;
+        //drained only now - the emitter is done forwarding the last result it popped
+        if (buffer->emit_seq == buffer->next_seq) {
+            pthread_cond_broadcast(&buffer->drained_cond);
+        }
+        pthread_mutex_unlock(&buffer->mutex);
+        return 0;
+    }
+
+    *output = buffer->outputs[slot];
+    buffer->outputs[slot] = NULL;
+    buffer->done[slot] = 0;
+    buffer->emit_seq++;
+
+    pthread_cond_signal(&buffer->space_cond);
+    pthread_mutex_unlock(&buffer->mutex);
+    return 1;
+}
+
+void reorder_buffer_retire(reorder_buffer_t* buffer)
+{
+    //the slots are not used, emit_seq only counts the sequences that left
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->emit_seq++;
+    pthread_cond_signal(&buffer->space_cond);
+    if (buffer->emit_seq == buffer->next_seq) {
+        pthread_cond_broadcast(&buffer->drained_cond);
+    }
+    pthread_mutex_unlock(&buffer->mutex);
+}
+
+int reorder_buffer_wait_drained(reorder_buffer_t* buffer)
+{
+    pthread_mutex_lock(&buffer->mutex);
+    while (!buffer->closed && (buffer->emit_seq != buffer->next_seq || buffer->emitting)) {
+        pthread_cond_wait(&buffer->drained_cond, &buffer->mutex);
+    }
+    int result = buffer->closed ? -1 : 0;
+    pthread_mutex_unlock(&buffer->mutex);
+    return result;
+}
+
+void reorder_buffer_close(reorder_buffer_t* buffer)
+{
+    if (NULL == buffer || NULL == buffer->outputs) {
+        return;
+    }
+
+    pthread_mutex_lock(&buffer->mutex);
+    buffer->closed = 1;
+    pthread_cond_broadcast(&buffer->space_cond);
+    pthread_cond_broadcast(&buffer->drained_cond);
+    pthread_mutex_unlock(&buffer->mutex);
+}
@@ -0,0 +1,97 @@
+#ifndef REORDER_BUFFER_H
+#define REORDER_BUFFER_H
+
+#include <pthread.h>
+
+/**
+ * Sequencing window for stages that process items on several threads.
+ * The dispatcher takes a sequence number per item (reorder_buffer_reserve), the
+ * workers hand in their results in any order (reorder_buffer_complete) and the
+ * results leave in sequence order (reorder_buffer_pop).
+ *
+ * There is no emitter thread - the worker whose result completes the oldest
+ * outstanding sequence becomes the emitter and pops everything that is ready,
+ * the others just store their result and go back to work. At most window items
+ * are in flight, reserve blocks until the oldest ones left.
+ *
+ * With relaxed ordering the buffer only counts the items in flight - each worker
+ * forwards its own result and retires its sequence (reorder_buffer_retire).
+ */
+
+typedef struct
+{
+    char** outputs;                 /* Result of each sequence, slot seq % window */
+    unsigned char* done;            /* The result of the slot was handed in */
+    int window;                     /* Maximum number of sequences in flight */
+    unsigned long long next_seq;    /* Next sequence number reserve hands out */
+    unsigned long long emit_seq;    /* Oldest sequence not popped yet */
+    int emitting;                   /* A worker holds the emitter role */
+    int closed;                     /* reorder_buffer_close was called, waits return */
+    pthread_mutex_t mutex;          /* Protects all of the above */
+    pthread_cond_t space_cond;      /* A slot was popped (or the buffer was closed) */
+    pthread_cond_t drained_cond;    /* Everything reserved so far was popped and forwarded */
+} reorder_buffer_t;
+
+/**
+ * Initialize a reorder buffer
+ * @param buffer Buffer to initialize
+ * @param window Maximum number of sequences in flight
+ * @return NULL on success, error message on failure
+ */
+const char* reorder_buffer_init(reorder_buffer_t* buffer, int window);
+
+/**
+ * Release the buffer, results still stored are not freed (the owner drains first)
+ * @param buffer Buffer to destroy
+ */
+void reorder_buffer_destroy(reorder_buffer_t* buffer);
+
+/**
+ * Take the next sequence number, blocks while window sequences are in flight
+ * @param buffer Buffer
+ * @param seq Set to the sequence number
+ * @return 0 on success, -1 once the buffer is closed
+ */
+int reorder_buffer_reserve(reorder_buffer_t* buffer, unsigned long long* seq);
+
+/**
+ * Hand in the result of a sequence
+ * @param buffer Buffer
+ * @param seq Sequence number from reorder_buffer_reserve
+ * @param output Result, NULL if the item produced nothing (it still takes its turn)
+ * @return 1 if the caller became the emitter and must call reorder_buffer_pop until it returns 0,
+ *         0 otherwise
+ */
+int reorder_buffer_complete(reorder_buffer_t* buffer, unsigned long long seq, char* output);
+
+/**
+ * Emitter only - take the oldest result if it was handed in
+ * @param buffer Buffer
+ * @param output Set to the result (may be NULL if the item produced nothing)
+ * @return 1 with a result, 0 when the oldest sequence is not done yet - the caller
+ *         is no longer the emitter
+ */
+int reorder_buffer_pop(reorder_buffer_t* buffer, char** output);
+
+/**
+ * Relaxed ordering - the worker forwarded its result itself, out of order, and only
+ * gives its window slot back. Not mixed with complete / pop on the same buffer
+ * @param buffer Buffer
+ */
+void reorder_buffer_retire(reorder_buffer_t* buffer);
+
+/**
+ * Block until every reserved sequence was popped and the emitter gave up its role
+ * (so the last result was forwarded too)
+ * @param buffer Buffer
+ * @return 0 on success, -1 once the buffer is closed
+ */
+int reorder_buffer_wait_drained(reorder_buffer_t* buffer);
+
+/**
+ * Wake every waiter, reserve and wait_drained fail from now on (shutdown)
+ * @param buffer Buffer
+ */
+void reorder_buffer_close(reorder_buffer_t* buffer);
+
+#endif /* REORDER_BUFFER_H */
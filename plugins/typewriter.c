@@ -1,5 +1,5 @@
 //This typewriter plugin simulates typing by outputting one character at a time 
-// with a delay of 100ms (configurable via TYPEWRITER_CHAR_DELAY_USLEEP).
+// with a delay of 100ms (TYPEWRITER_CHAR_DELAY_USLEEP, or the "delay_us" init parameter).
 
 #define _GNU_SOURCE
 #include "plugin_common.h"
@@ -10,48 +10,68 @@
 
 #define TYPEWRITER_CHAR_DELAY_USLEEP 100000
 
-static const char* typewriter_transform(const char* input_to_type) 
+// delay per character, set by plugin_init
+static useconds_t g_char_delay_usleep = TYPEWRITER_CHAR_DELAY_USLEEP;
+
+// types the string without changing it, used directly as the in-place variant
+static int typewriter_transform_inplace(char* buffer, int length)
 {
-    if (NULL == input_to_type) {
-        return NULL;
+    if (NULL == buffer) {
+        return -1;
     }
-    int input_len = strlen(input_to_type);
-
 
     const char* prefix = "[typewriter] ";
     int prefix_len = strlen(prefix);
-    
+
     // Type prefix character by character with delay
     for(int i=0; i < prefix_len; i++) {
         fprintf(stdout, "%c", prefix[i]);
         fflush(stdout);
-        usleep(TYPEWRITER_CHAR_DELAY_USLEEP);
+        usleep(g_char_delay_usleep);
     }
 
     // Type input character by character with delay
-    for(int i=0; i < input_len; i++) {
-        fprintf(stdout, "%c", input_to_type[i]);
+    for(int i=0; i < length; i++) {
+        fprintf(stdout, "%c", buffer[i]);
         fflush(stdout);
-        usleep(TYPEWRITER_CHAR_DELAY_USLEEP);
+        usleep(g_char_delay_usleep);
     }
 
     //add new line after we finish typing the input
     fprintf(stdout, "\n");
     fflush(stdout);
+    return 0;
+}
+
+static const char* typewriter_transform(const char* input_to_type) 
+{
+    if (NULL == input_to_type) {
+        return NULL;
+    }
 
     //move the input to the next plugin in the chain if exists
     size_t len = strlen(input_to_type);
-    char* copy_of_input = (char*)malloc(len + 1);
+    char* copy_of_input = (char*)plugin_alloc(len + 1);
     if (NULL == copy_of_input) { return NULL; }
+    strcpy(copy_of_input, input_to_type);
 
-    if (copy_of_input) {
-        strcpy(copy_of_input, input_to_type);
-    }
-
+    typewriter_transform_inplace(copy_of_input, (int)len);
     return copy_of_input;
 }
 
+PLUGIN_EXPORT
+int plugin_transform_inplace(char* buffer, int length)
+{
+    return typewriter_transform_inplace(buffer, length);
+}
+
 const char* plugin_init(int queue_size) 
 {
-    return common_plugin_init(typewriter_transform, "typewriter", queue_size);
-}
\ No newline at end of file
+    long delay_us = TYPEWRITER_CHAR_DELAY_USLEEP;
+    const char* error = plugin_param_long("delay_us", 0, 1000000, &delay_us);
+    if (NULL != error) {
+        return error;
+    }
+    g_char_delay_usleep = (useconds_t)delay_us;
+    return common_plugin_init_inplace(typewriter_transform, typewriter_transform_inplace, "typewriter", queue_size);
+}
@@ -1,9 +1,23 @@
 #include "plugin_common.h"
 #include <string.h>
 #include <stdlib.h>
-#include <ctype.h>
 
 // This uppercaser plugin transforms input strings to uppercase
+static int uppercase_transform_inplace(char* buffer, int length)
+{
+    if (NULL == buffer) {
+        return -1;
+    }
+
+    //same result as toupper in the "C" locale the analyzer runs in, but branch free
+    //so the compiler can vectorize it (wider with the x86-64-v3/v4 builds)
+    for(int i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)buffer[i];
+        buffer[i] = (char)((c >= 'a' && c <= 'z') ? (c - ('a' - 'A')) : c);
+    }
+    return 0;
+}
+
 static const char* uppercase_transform(const char* input_to_upper)
 {
     if(NULL == input_to_upper) {
@@ -11,20 +25,24 @@ static const char* uppercase_transform(const char* input_to_upper)
     }
 
     int input_len = strlen(input_to_upper);
-    char* after_uppercase = (char*)malloc(input_len + 1);
+    char* after_uppercase = (char*)plugin_alloc(input_len + 1);
     if (NULL == after_uppercase) {
         return NULL; // TODO: should we log an error here instead of returning NULL?
     }
-    for(int i = 0; i < input_len; i++) {
-        after_uppercase[i] = toupper((unsigned char)input_to_upper[i]);
-    }
-    after_uppercase[input_len] = '\0';//indicate end of string
+    memcpy(after_uppercase, input_to_upper, input_len + 1);
+    uppercase_transform_inplace(after_uppercase, input_len);
 
     return after_uppercase;
 
 }
 
+PLUGIN_EXPORT
+int plugin_transform_inplace(char* buffer, int length)
+{
+    return uppercase_transform_inplace(buffer, length);
+}
+
 const char* plugin_init(int queue_size) 
 {
-    return common_plugin_init(uppercase_transform, "uppercaser", queue_size);
-}
\ No newline at end of file
+    return common_plugin_init_inplace(uppercase_transform, uppercase_transform_inplace, "uppercaser", queue_size);
+}
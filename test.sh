@@ -264,6 +264,423 @@ fi
 
 
 
+# Test 23: fused stage gives the same output as separate stages
+run_test "Fused stage uppercaser+rotator+flipper"
+separate=$(echo -e "hello world\nabc\n<END>" | timeout 5s "$ANALYZER" 10 uppercaser rotator flipper logger 2>/dev/null | grep "\[logger\]" || true)
+fused=$(echo -e "hello world\nabc\n<END>" | timeout 5s "$ANALYZER" 10 uppercaser+rotator+flipper+logger 2>/dev/null | grep "\[logger\]" || true)
+if [[ -n "$fused" && "$fused" == "$separate" ]]; then
+    test_pass
+else
+    test_fail "expected '$separate', got '$fused'"
+fi
+
+
+# Test 24: plugins without in-place transform cannot be fused
+run_test "Fusing expander into a stage - should reject"
+if echo -e "abc\n<END>" | timeout 5s "$ANALYZER" 10 uppercaser+expander logger >/dev/null 2>&1; then
+    test_fail "should reject fusing expander"
+else
+    test_pass
+fi
+
+
+
+# Test 25: executor mode gives the same output as thread per stage
+run_test "Executor mode (--workers 2) keeps output and order"
+lines="one\ntwo\nthree\nfour\nfive\n<END>"
+threaded=$(echo -e "$lines" | timeout 5s "$ANALYZER" 2 uppercaser rotator+flipper expander logger 2>/dev/null | grep "\[logger\]" || true)
+pooled=$(echo -e "$lines" | timeout 5s "$ANALYZER" --workers 2 2 uppercaser rotator+flipper expander logger 2>/dev/null | grep "\[logger\]" || true)
+if [[ -n "$pooled" && "$pooled" == "$threaded" ]]; then
+    test_pass
+else
+    test_fail "expected '$threaded', got '$pooled'"
+fi
+
+
+# Test 26: bad option value
+run_test "Invalid --workers value - should reject"
+if timeout 3s "$ANALYZER" --workers 0 10 logger >/dev/null 2>&1; then
+    test_fail "should reject --workers 0"
+else
+    test_pass
+fi
+
+
+
+# Test 27: per-ISA plugin variants give the same output as the baseline build
+run_test "ISA variants (--isa baseline vs auto)"
+baseline=$(echo -e "Hello World 123\n<END>" | timeout 5s "$ANALYZER" --isa baseline 10 uppercaser flipper logger 2>/dev/null | grep "\[logger\]" || true)
+best=$(echo -e "Hello World 123\n<END>" | timeout 5s "$ANALYZER" --isa auto 10 uppercaser flipper logger 2>/dev/null | grep "\[logger\]" || true)
+if [[ "$baseline" == "[logger] 321 DLROW OLLEH" && "$best" == "$baseline" ]]; then
+    test_pass
+else
+    test_fail "baseline '$baseline', auto '$best'"
+fi
+
+
+# Test 28: unknown ISA level
+run_test "Unknown --isa level - should reject"
+if timeout 3s "$ANALYZER" --isa pentium 10 logger >/dev/null 2>&1; then
+    test_fail "should reject unknown isa level"
+else
+    test_pass
+fi
+
+
+
+# Test 29: lean mode keeps a separate state for every instance of the same plugin
+run_test "Lean mode - repeated plugins: rotator x3 -> logger"
+result=$(echo -e "abcdef\n<END>" | timeout 5s "$ANALYZER" --lean 10 rotator rotator rotator logger 2>/dev/null | grep "\[logger\]" || true)
+if [[ "$result" == "[logger] defabc" ]]; then
+    test_pass
+else
+    test_fail "expected '[logger] defabc', got '$result'"
+fi
+
+
+# Test 30: lean mode goes beyond the linker namespace limit of the default mode
+run_test "Lean mode - 100 stage chain with small stacks"
+chain=$(for i in $(seq 99); do printf "rotator "; done)
+result=$(echo -e "abcd\n<END>" | timeout 20s "$ANALYZER" --lean --stack-size 32 10 $chain logger 2>/dev/null | grep "\[logger\]" || true)
+if [[ "$result" == "[logger] bcda" ]]; then
+    test_pass
+else
+    test_fail "expected '[logger] bcda', got '$result'"
+fi
+
+
+
+# Test 31: --stats reports every stage (named after the plugin and instance) on stderr
+run_test "Stage stats - items per stage, stdout unchanged"
+stats_output=$( { echo -e "one\ntwo\n<END>" | timeout 5s "$ANALYZER" --stats 10 uppercaser rotator+flipper logger 2>&1 1>/dev/null; } || true)
+result=$(echo -e "one\ntwo\n<END>" | timeout 5s "$ANALYZER" --stats 10 uppercaser rotator+flipper logger 2>/dev/null | grep "\[logger\]" | head -1 || true)
+if echo "$stats_output" | grep -qE "^uppercaser#1 +2 " && echo "$stats_output" | grep -qE "^rotator#2\+flipper +2 " &&
+   echo "$stats_output" | grep -qE "^logger#4 +2 " && [[ "$result" == "[logger] NOE" ]]; then
+    test_pass
+else
+    test_fail "unexpected stats '$stats_output' / output '$result'"
+fi
+
+
+
+# Test 32: --metrics writes the stage counters in Prometheus text format
+run_test "Metrics export - Prometheus file with the final counters"
+metrics_file=$(mktemp)
+result=$(echo -e "one\ntwo\nthree\n<END>" | timeout 5s "$ANALYZER" --metrics "$metrics_file" --metrics-interval 50 10 uppercaser rotator+flipper logger 2>/dev/null | grep -c "\[logger\]" || true)
+if [[ "$result" == "3" ]] && grep -q '^analyzer_stage_items_processed_total{stage="uppercaser#1"} 3$' "$metrics_file" &&
+   grep -q '^analyzer_stage_latency_seconds_count{stage="rotator#2+flipper"} 3$' "$metrics_file" &&
+   grep -q '^# TYPE analyzer_stage_queue_depth gauge$' "$metrics_file" && [[ ! -e "$metrics_file.tmp" ]]; then
+    test_pass
+else
+    test_fail "unexpected metrics: $(head -c 300 "$metrics_file")"
+fi
+rm -f "$metrics_file"
+
+
+
+# Test 33: the watchdog reports a stage that holds input without progress (typewriter is slow on purpose)
+run_test "Stall watchdog - slow stage reported, fast pipeline quiet"
+watchdog_output=$( { echo -e "abcdefghij\n<END>" | timeout 10s "$ANALYZER" --watchdog-ms 200 2 uppercaser typewriter logger 2>&1 1>/dev/null; } || true)
+quiet_output=$( { echo -e "hello\n<END>" | timeout 5s "$ANALYZER" --watchdog-ms 200 10 uppercaser logger 2>&1 1>/dev/null; } || true)
+if echo "$watchdog_output" | grep -q "^\[WATCHDOG\] stage typewriter#2 made no progress" &&
+   echo "$watchdog_output" | grep -qE "^\[WATCHDOG\] typewriter#2 .*STALLED <- likely cause" && [[ -z "$quiet_output" ]]; then
+    test_pass
+else
+    test_fail "watchdog output '$watchdog_output', quiet run '$quiet_output'"
+fi
+
+
+
+# Test 34: a recorded trace replays to the same output, at the recorded pace or at max speed
+run_test "Trace record/replay - same output, original timing and max speed"
+trace_file=$(mktemp)
+recorded=$( { echo "first"; sleep 0.4; echo -e "second\n<END>"; } | timeout 5s "$ANALYZER" --record "$trace_file" 10 uppercaser rotator logger 2>/dev/null | grep "\[logger\]" || true)
+replay_start=$(date +%s%N)
+replayed=$(timeout 5s "$ANALYZER" --replay "$trace_file" 10 uppercaser rotator logger 2>/dev/null < /dev/null | grep "\[logger\]" || true)
+replay_ms=$(( ($(date +%s%N) - replay_start) / 1000000 ))
+fast_start=$(date +%s%N)
+replayed_fast=$(timeout 5s "$ANALYZER" --replay "$trace_file" --replay-speed max 10 uppercaser rotator logger 2>/dev/null < /dev/null | grep "\[logger\]" || true)
+fast_ms=$(( ($(date +%s%N) - fast_start) / 1000000 ))
+if [[ "$recorded" == $'[logger] TFIRS\n[logger] DSECON' ]] && [[ "$replayed" == "$recorded" ]] && [[ "$replayed_fast" == "$recorded" ]] &&
+   [[ $replay_ms -ge 350 ]] && [[ $fast_ms -lt 350 ]]; then
+    test_pass
+else
+    test_fail "recorded '$recorded', replayed '$replayed' in ${replay_ms}ms, max speed '$replayed_fast' in ${fast_ms}ms"
+fi
+
+# Test 35: a trace without <END> still ends the replay, a file that is not a trace is rejected
+run_test "Trace replay - <END> added, bad trace rejected"
+printf 'no end here\n' | timeout 2s "$ANALYZER" --record "$trace_file" 10 logger > /dev/null 2>&1 || true
+result=$(timeout 5s "$ANALYZER" --replay "$trace_file" --replay-speed max 10 logger 2>/dev/null | grep -c "Pipeline shutdown complete" || true)
+echo "plain text" > "$trace_file"
+bad_exit=0
+timeout 5s "$ANALYZER" --replay "$trace_file" 10 logger > /dev/null 2>&1 || bad_exit=$?
+if [[ "$result" == "1" ]] && [[ $bad_exit -eq 1 ]]; then
+    test_pass
+else
+    test_fail "replay without <END> '$result', bad trace exit $bad_exit"
+fi
+rm -f "$trace_file"
+
+
+
+# Test 36: byte ring queues - same output as the pointer queues, also through a ring that only holds a few lines
+run_test "Byte ring queues (--ring-bytes) keep output and order"
+input_lines=$(for i in $(seq 1 300); do printf 'line %d %*s\n' $i $((i % 50)) x; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" 4 uppercaser rotator+flipper expander logger 2>/dev/null || true)
+result=$(echo "$input_lines" | timeout 10s "$ANALYZER" --ring-bytes 4096 4 uppercaser rotator+flipper expander logger 2>/dev/null || true)
+result_executor=$(echo "$input_lines" | timeout 10s "$ANALYZER" --ring-bytes 4096 --workers 2 4 uppercaser rotator+flipper expander logger 2>/dev/null || true)
+bad_exit=0
+echo "<END>" | timeout 5s "$ANALYZER" --ring-bytes 100 4 logger > /dev/null 2>&1 || bad_exit=$?
+if [[ -n "$expected" ]] && [[ "$result" == "$expected" ]] && [[ "$result_executor" == "$expected" ]] && [[ $bad_exit -eq 1 ]]; then
+    test_pass
+else
+    test_fail "byte ring output differs ($(echo "$result" | wc -l) / $(echo "$result_executor" | wc -l) vs $(echo "$expected" | wc -l) lines), small ring exit $bad_exit"
+fi
+
+
+
+# Test 37: credit flow control - same output as --no-credits, threads and executor, also through tiny queues
+run_test "Credit flow control keeps output and order"
+input_lines=$(for i in $(seq 1 500); do printf 'credit line %d\n' $i; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" --no-credits 8 uppercaser rotator expander logger 2>/dev/null || true)
+result=$(echo "$input_lines" | timeout 10s "$ANALYZER" 8 uppercaser rotator expander logger 2>/dev/null || true)
+result_small=$(echo "$input_lines" | timeout 10s "$ANALYZER" 1 uppercaser rotator expander logger 2>/dev/null || true)
+result_executor=$(echo "$input_lines" | timeout 10s "$ANALYZER" --workers 3 2 uppercaser rotator expander logger 2>/dev/null || true)
+if [[ -n "$expected" ]] && [[ "$result" == "$expected" ]] && [[ "$result_small" == "$expected" ]] && [[ "$result_executor" == "$expected" ]]; then
+    test_pass
+else
+    test_fail "credit output differs ($(echo "$result" | wc -l) / $(echo "$result_small" | wc -l) / $(echo "$result_executor" | wc -l) vs $(echo "$expected" | wc -l) lines)"
+fi
+
+
+
+# Test 38: key partitioned stage - same lines, order and totals with 1 or 4 shards, threads and executor
+run_test "Partitioned counter keeps order and totals (--partitions)"
+input_lines=$(for i in $(seq 1 400); do printf 'key%d line %d\n' $((i % 7)) $i; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" 4 counter logger 2>/dev/null || true)
+result=$(echo "$input_lines" | timeout 10s "$ANALYZER" --partitions 4 2 counter logger 2>/dev/null || true)
+result_executor=$(echo "$input_lines" | timeout 10s "$ANALYZER" --partitions 4 --workers 2 2 counter logger 2>/dev/null || true)
+totals=$(echo "$expected" | grep -E "^\[logger\] [0-9]+ key[0-9]$" | head -2 | tr '\n' '|')
+if [[ "$totals" == "[logger] 58 key1|[logger] 57 key0|" ]] && [[ "$result" == "$expected" ]] && [[ "$result_executor" == "$expected" ]]; then
+    test_pass
+else
+    test_fail "totals '$totals', partitioned output differs ($(echo "$result" | wc -l) / $(echo "$result_executor" | wc -l) vs $(echo "$expected" | wc -l) lines)"
+fi
+
+
+
+# Test 39: relaxed order - the same lines, per key still in order, totals still last
+run_test "Relaxed order keeps every line and per key order (--relaxed-order)"
+result=$(echo "$input_lines" | timeout 10s "$ANALYZER" --partitions 4 --relaxed-order 2 counter logger 2>/dev/null || true)
+key3_expected=$(echo "$expected" | grep "^\[logger\] key3 ")
+key3_result=$(echo "$result" | grep "^\[logger\] key3 ")
+totals_expected=$(echo "$expected" | grep -E "^\[logger\] [0-9]+ key[0-9]$")
+totals_result=$(echo "$result" | grep -v "Pipeline shutdown complete" | tail -7)
+if [[ "$(echo "$result" | sort)" == "$(echo "$expected" | sort)" ]] && [[ "$key3_result" == "$key3_expected" ]] && [[ "$totals_result" == "$totals_expected" ]]; then
+    test_pass
+else
+    test_fail "relaxed output differs from the ordered one beyond the interleaving of keys"
+fi
+
+
+
+
+# Test 40: output file - the lines of the last stage, the same bytes with one or several writers
+run_test "Output file is identical with 1 and 4 writers (--output)"
+output_dir=$(mktemp -d)
+input_lines=$(for i in $(seq 1 3000); do printf 'output line %d\n' $i; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" 10 uppercaser logger 2>/dev/null | grep "^\[logger\] " | sed 's/^\[logger\] //' || true)
+echo "$input_lines" | timeout 10s "$ANALYZER" --output "$output_dir/serial.txt" --output-writers 1 10 uppercaser >/dev/null 2>&1 || true
+echo "$input_lines" | timeout 10s "$ANALYZER" --output "$output_dir/parallel.txt" --output-writers 4 10 uppercaser >/dev/null 2>&1 || true
+echo "$input_lines" | timeout 10s "$ANALYZER" --workers 2 --output "$output_dir/executor.txt" 10 uppercaser >/dev/null 2>&1 || true
+if [[ -n "$expected" ]] && [[ "$(cat "$output_dir/serial.txt" 2>/dev/null)" == "$expected" ]] && \
+   cmp -s "$output_dir/serial.txt" "$output_dir/parallel.txt" && cmp -s "$output_dir/serial.txt" "$output_dir/executor.txt"; then
+    test_pass
+else
+    test_fail "output files differ ($(cat "$output_dir"/*.txt 2>/dev/null | wc -l) lines in total, expected 3 x $(echo "$expected" | wc -l))"
+fi
+rm -rf "$output_dir"
+
+
+
+
+# Test 41: plan file - same output as the command line it describes, --explain shows the resolved plan
+run_test "Plan file runs the described chain and --explain prints it (--plan)"
+plan_dir=$(mktemp -d)
+cat > "$plan_dir/chain.plan" <<'PLAN'
+# the same chain as: --partitions 2 4 uppercaser+rotator counter logger
+queue 4
+stage uppercaser+rotator queue=8    # fused stage with its own queue size
+stage counter partitions=2 batch=2
+stage logger overflow=block
+PLAN
+printf 'stage uppercaser queue=4\nstage bogus_setting=1\n' > "$plan_dir/bad.plan"
+input_lines=$(for i in $(seq 1 300); do printf 'key%d plan line %d\n' $((i % 5)) $i; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" --partitions 2 4 uppercaser+rotator counter logger 2>/dev/null || true)
+result=$(echo "$input_lines" | timeout 10s "$ANALYZER" --plan "$plan_dir/chain.plan" 2>/dev/null || true)
+explain=$(timeout 10s "$ANALYZER" --plan "$plan_dir/chain.plan" --explain 2>/dev/null || true)
+bad_plan=$(timeout 10s "$ANALYZER" --plan "$plan_dir/bad.plan" 2>&1 || true)
+if [[ -n "$expected" ]] && [[ "$result" == "$expected" ]] && \
+   echo "$explain" | grep -q "rotator#2 runs in place" && echo "$explain" | grep -q "queue         8 slots" && \
+   echo "$explain" | grep -q "credits returned in batches of 2" && echo "$bad_plan" | grep -q "bad.plan:2:"; then
+    test_pass
+else
+    test_fail "plan output differs ($(echo "$result" | wc -l) vs $(echo "$expected" | wc -l) lines) or explain/error text missing"
+fi
+rm -rf "$plan_dir"
+
+
+
+# Test 42: init parameters - rotator shift, typewriter delay, generic keys, unknown keys and workers
+# of a plugin that is not key partitioned fail the init
+run_test "Stage init parameters reach the plugin (plugin_init_ex)"
+result=$(printf 'abcdef\n<END>\n' | timeout 10s "$ANALYZER" 10 rotator:shift=2,batch=2 logger 2>/dev/null || true)
+start_ms=$(date +%s%3N)
+typed=$(printf 'hello world\n<END>\n' | timeout 10s "$ANALYZER" 10 typewriter:delay_us=0 2>/dev/null || true)
+typed_ms=$(( $(date +%s%3N) - start_ms ))
+unknown=$(printf 'abc\n<END>\n' | timeout 10s "$ANALYZER" 10 rotator:shfit=2 logger 2>&1 || true)
+fused=$(printf 'abc\n<END>\n' | timeout 10s "$ANALYZER" 10 uppercaser+rotator:shift=2 logger 2>&1 || true)
+workers=$(printf 'abc\n<END>\n' | timeout 10s "$ANALYZER" 10 uppercaser:workers=4 logger 2>&1 || true)
+if [[ "$result" == *"[logger] efabcd"* ]] && [[ "$typed" == *"[typewriter] hello world"* ]] && [[ $typed_ms -lt 1000 ]] && \
+   echo "$unknown" | grep -q "Unknown parameter shfit" && echo "$fused" | grep -q "parameters of a fused plugin" && \
+   echo "$workers" | grep -q "Parameter workers needs a key partitioned plugin"; then
+    test_pass
+else
+    test_fail "parameters not applied or not rejected (rotated: $result, typed in ${typed_ms}ms)"
+fi
+
+
+
+# Test 43: calibration - the cost model fuses the cheap stateless stages, the output does not change
+run_test "Calibration chooses a plan and keeps the output (--calibrate)"
+input_lines=$(for i in $(seq 1 200); do printf 'key%d calibrated line %d\n' $((i % 4)) $i; done; echo "<END>")
+expected=$(echo "$input_lines" | timeout 10s "$ANALYZER" 8 uppercaser rotator flipper counter logger 2>/dev/null || true)
+result=$(echo "$input_lines" | timeout 20s "$ANALYZER" --calibrate 8 uppercaser rotator flipper counter logger 2>/dev/null || true)
+report=$(timeout 20s "$ANALYZER" --calibrate --explain 8 uppercaser rotator flipper counter logger 2>&1 || true)
+if [[ -n "$expected" ]] && [[ "$result" == "$expected" ]] && echo "$report" | grep -q "queue handoff" && \
+   echo "$report" | grep -q "Chosen plan: .* predicted [0-9]* lines/s" && echo "$report" | grep -q "counter#4 .*key partitioned" && \
+   echo "$report" | grep -q "runs in place"; then
+    test_pass
+else
+    test_fail "calibrated output differs or the report is missing ($(echo "$report" | grep "Chosen plan"))"
+fi
+
+
+
+# Test 44: allocation profile - one allocation per line with a pointer queue, none with a byte ring
+run_test "Allocation profile counts the allocations per item of every stage (--alloc-profile)"
+input_lines=$(for i in $(seq 1 500); do echo "profiled line $i"; done; echo "<END>")
+array_report=$(echo "$input_lines" | timeout 10s "$ANALYZER" --alloc-profile 8 uppercaser logger 2>&1 >/dev/null || true)
+ring_report=$(echo "$input_lines" | timeout 10s "$ANALYZER" --alloc-profile --ring-bytes 8192 8 uppercaser logger 2>&1 >/dev/null || true)
+if echo "$array_report" | grep -Eq "^uppercaser#1 +500 +1\.00 .* 1\.00 " && \
+   echo "$ring_report" | grep -Eq "^uppercaser#1 +500 +0\.00 " && echo "$array_report" | grep -q "peak_bytes"; then
+    test_pass
+else
+    test_fail "unexpected allocation profile: $(echo "$array_report" | grep uppercaser) / $(echo "$ring_report" | grep uppercaser)"
+fi
+
+
+
+# Test 45: lock profile - every lock of every stage is reported, the output does not change
+run_test "Lock profile reports acquisitions and wait/hold times of the queue locks (--lock-profile)"
+input_lines=$(for i in $(seq 1 200); do echo "locked line $i"; done; echo "<END>")
+lock_output=$(echo "$input_lines" | timeout 10s "$ANALYZER" --lock-profile 8 uppercaser logger 2>/tmp/lock_profile_report.txt || true)
+plain_output=$(echo "$input_lines" | timeout 10s "$ANALYZER" 8 uppercaser logger 2>/dev/null || true)
+lock_report=$(cat /tmp/lock_profile_report.txt)
+if [[ "$lock_output" == "$plain_output" ]] && \
+   [[ $(echo "$lock_report" | grep -Ec "^(uppercaser#1|logger#2) +(queue_mutex|not_full|not_empty|finished|credit) ") -eq 10 ]] && \
+   echo "$lock_report" | grep -Eq "^logger#2 +finished +2 " && echo "$lock_report" | grep -q "^locks: .* ms waiting"; then
+    test_pass
+else
+    test_fail "unexpected lock profile: $lock_report"
+fi
+rm -f /tmp/lock_profile_report.txt
+
+
+
+# Test 46: idle memory trim - the ring pages a backlog touched go back to the OS between bursts, the lines are intact
+run_test "Idle stages return their queue memory to the OS after a burst (--trim-idle-ms)"
+trim_report=$( (for i in $(seq 1 200); do echo "burst one line number $i"; done; sleep 0.8
+                for i in $(seq 1 200); do echo "burst two line number $i"; done; sleep 0.8; echo "<END>") | \
+    timeout 20s "$ANALYZER" --stats --trim-idle-ms 100 --trim-warm-bytes 0 --ring-bytes 262144 256 uppercaser typewriter:delay_us=0 \
+    2>&1 >/tmp/trim_output.txt || true)
+typed_lines=$(grep -c "^\[typewriter\] BURST \(ONE\|TWO\) LINE NUMBER [0-9]*$" /tmp/trim_output.txt || true)
+if [[ "$typed_lines" -eq 400 ]] && echo "$trim_report" | grep -Eq "^memory trim: [1-9][0-9]* trims, [1-9][0-9]* bytes returned"; then
+    test_pass
+else
+    test_fail "expected 400 lines and a trim, got $typed_lines lines: $(echo "$trim_report" | grep "memory trim")"
+fi
+rm -f /tmp/trim_output.txt
+
+
+
+# Test 47: compressed backlog - the logger output is held back by an unread pipe, so its queue backs up;
+# the items past the hot depth are compressed in blocks and the output is the same as without
+run_test "A deep queue backlog is compressed in blocks and comes out unchanged (--compress-backlog)"
+for i in $(seq 1 5000); do echo "2024-05-01 level=info request $i served path=/api/items/$((i % 97))"; done > /tmp/backlog_input.txt
+echo "<END>" >> /tmp/backlog_input.txt
+"$ANALYZER" 10000 uppercaser logger < /tmp/backlog_input.txt 2>/dev/null | (sleep 1; cat) > /tmp/backlog_plain.txt
+"$ANALYZER" --stats --compress-backlog 8 10000 uppercaser logger < /tmp/backlog_input.txt 2>/tmp/backlog_report.txt | \
+    (sleep 1; cat) > /tmp/backlog_compressed.txt
+if [[ $(wc -l < /tmp/backlog_compressed.txt) -eq 5001 ]] && cmp -s /tmp/backlog_plain.txt /tmp/backlog_compressed.txt && \
+   grep -Eq "^  backlog: [1-9][0-9]* blocks compressed" /tmp/backlog_report.txt; then
+    test_pass
+else
+    test_fail "output differs or no block was compressed: $(grep "backlog:" /tmp/backlog_report.txt)"
+fi
+rm -f /tmp/backlog_input.txt /tmp/backlog_plain.txt /tmp/backlog_compressed.txt /tmp/backlog_report.txt
+
+
+
+# Test 48: input journal - a run killed while a slow stage still holds most of the lines,
+# the next run replays them from the journal before its own input and deletes the segments at the end
+run_test "Journaled lines of a killed run are recovered by the next one (--journal)"
+rm -rf /tmp/journal_test
+(seq 1 200 | sed 's/^/journaled line /'; sleep 5) | \
+    "$ANALYZER" --journal /tmp/journal_test 10 typewriter:delay_us=2000 > /dev/null 2>&1 &
+journal_pid=$!
+sleep 1
+kill -9 $journal_pid
+wait $journal_pid 2>/dev/null || true # killed on purpose, set -e must not stop here
+echo "<END>" | "$ANALYZER" --journal /tmp/journal_test 10 uppercaser logger > /tmp/journal_output.txt 2>/tmp/journal_report.txt
+if [[ $(grep -c "^\[logger\] JOURNALED LINE" /tmp/journal_output.txt) -eq 200 ]] && \
+   grep -q "Journal: recovered 200 lines" /tmp/journal_report.txt && [[ -z $(ls /tmp/journal_test) ]]; then
+    test_pass
+else
+    test_fail "lines not recovered or segments left: $(cat /tmp/journal_report.txt) $(ls /tmp/journal_test)"
+fi
+rm -rf /tmp/journal_test /tmp/journal_output.txt /tmp/journal_report.txt
+
+
+
+# Test 49: drain - four kinds of log lines become four templates, and every line can be rebuilt
+# from the latest template of its id with the parameters in place of the <*>
+run_test "Template mining forwards template ids and parameters the lines can be rebuilt from (drain)"
+for i in $(seq 1 2000); do
+    case $((i % 4)) in
+        0) echo "2024-05-01T10:00:$((i % 60)) INFO request $i served in $((i % 97)) ms path=/api/items/$((i % 13))" ;;
+        1) echo "2024-05-01T10:01:$((i % 60)) WARN disk /dev/sd$((i % 3)) usage at $((i % 100))% on host-$((i % 5))" ;;
+        2) echo "2024-05-01T10:02:$((i % 60)) INFO user u$((i % 50)) logged in from 10.0.$((i % 7)).$((i % 200))" ;;
+        3) echo "2024-05-01T10:03:$((i % 60)) ERROR connection to db-$((i % 3)) lost, retrying in $((i % 5)) s" ;;
+    esac
+done > /tmp/drain_input.txt
+(cat /tmp/drain_input.txt; echo "<END>") | "$ANALYZER" 100 drain logger 2>/dev/null | grep "^\[logger\]" | \
+    sed 's/^\[logger\] //' > /tmp/drain_output.txt
+awk -F'\t' '{ if (NF == 3) { templates[$1] = $2; parameters = $3 } else { parameters = $2 }
+              split(parameters, words, " "); rest = templates[$1]; line = ""; n = 0
+              while ((i = index(rest, "<*>")) > 0) { line = line substr(rest, 1, i - 1) words[++n]; rest = substr(rest, i + 3) }
+              print line rest }' /tmp/drain_output.txt > /tmp/drain_rebuilt.txt
+if [[ $(cut -f1 /tmp/drain_output.txt | sort -u | wc -l) -eq 4 ]] && cmp -s /tmp/drain_input.txt /tmp/drain_rebuilt.txt && \
+   [[ $(wc -c < /tmp/drain_output.txt) -lt $(wc -c < /tmp/drain_input.txt) ]]; then
+    test_pass
+else
+    test_fail "templates: $(cut -f1 /tmp/drain_output.txt | sort -u | tr '\n' ' ')"
+fi
+rm -f /tmp/drain_input.txt /tmp/drain_output.txt /tmp/drain_rebuilt.txt
+
+
+
 # summerize tests results 
 echo ""
 echo "===================================="
@@ -0,0 +1,288 @@
+/**
+ * Async Log Test Suite
+ *
+ * Tests the asynchronous logging backend used by log_info/log_error:
+ * record format, per call site rate limiting, many writer threads
+ * and the final flush
+ */
+
+#include "../plugins/sync/async_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Test configuration */
+#define NUM_WRITER_THREADS 4
+#define RECORDS_PER_THREAD 8
+#define STORM_SIZE 100
+
+/* Colors for output */
+#define RED "\033[0;31m"
+#define GREEN "\033[0;32m"
+#define BLUE "\033[0;34m"
+#define CYAN "\033[0;36m"
+#define NC "\033[0m"
+
+/* Test result tracking */
+typedef enum {
+    TEST_PASS,
+    TEST_FAIL
+} test_result_t;
+
+/* Streams the backend writes to, read back after each flush */
+static FILE* g_info_capture = NULL;
+static FILE* g_error_capture = NULL;
+
+/* Utility Functions */
+void print_test_header(const char* test_name) {
+    printf("\n%s========================================%s\n", CYAN, NC);
+    printf("%sTEST: %s%s\n", BLUE, test_name, NC);
+    printf("%s========================================%s\n", CYAN, NC);
+}
+
+void print_test_result(const char* test_name, test_result_t result) {
+    const char* status = (result == TEST_PASS) ? "PASS" : "FAIL";
+    const char* color = (result == TEST_PASS) ? GREEN : RED;
+    printf("%s[%s]%s %s\n", color, status, NC, test_name);
+}
+
+/* Read what was captured since the last call and reset the stream */
+static char* read_capture(FILE* capture) {
+    long size = ftell(capture);
+    char* text = (char*)calloc(size + 1, 1);
+    rewind(capture);
+    if (size > 0 && fread(text, 1, size, capture) != (size_t)size) {
+        text[0] = '\0';
+    }
+    rewind(capture);
+    if (0 != ftruncate(fileno(capture), 0)) {
+        printf("  ! failed to truncate the capture file\n");
+    }
+    return text;
+}
+
+static int count_lines_with(const char* text, const char* needle) {
+    int count = 0;
+    for (const char* found = strstr(text, needle); NULL != found; found = strstr(found + 1, needle)) {
+        count++;
+    }
+    return count;
+}
+
+/* Test Functions */
+test_result_t test_record_format() {
+    print_test_header("Record Format");
+
+    async_log_write(ASYNC_LOG_INFO, "uppercaser", "hello info", (void*)0x1000);
+    async_log_write(ASYNC_LOG_ERROR, "rotator", "hello error", (void*)0x2000);
+    async_log_flush();
+
+    char* info = read_capture(g_info_capture);
+    char* error = read_capture(g_error_capture);
+    int ok = (0 == strcmp(info, "[INFO][uppercaser] - hello info\n")) &&
+             (0 == strcmp(error, "[ERROR][rotator] - hello error\n"));
+    if (!ok) {
+        printf("  ✗ unexpected output: info '%s' error '%s'\n", info, error);
+    } else {
+        printf("  ✓ INFO goes to the info stream, ERROR to the error stream, same format as before\n");
+    }
+    free(info);
+    free(error);
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_long_message_cut() {
+    print_test_header("Long Message Cut");
+
+    char long_message[ASYNC_LOG_MESSAGE_LENGTH * 2];
+    memset(long_message, 'x', sizeof(long_message) - 1);
+    long_message[sizeof(long_message) - 1] = '\0';
+    async_log_write(ASYNC_LOG_INFO, "logger", long_message, (void*)0x3000);
+    async_log_flush();
+
+    char* info = read_capture(g_info_capture);
+    int expected_length = (int)strlen("[INFO][logger] - ") + ASYNC_LOG_MESSAGE_LENGTH - 1 + 1;
+    int ok = ((int)strlen(info) == expected_length);
+    if (!ok) {
+        printf("  ✗ expected %d bytes, got %d\n", expected_length, (int)strlen(info));
+    } else {
+        printf("  ✓ message cut to %d bytes\n", ASYNC_LOG_MESSAGE_LENGTH - 1);
+    }
+    free(info);
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_rate_limit_per_call_site() {
+    print_test_header("Rate Limit Per Call Site");
+
+    //a storm from one call site, and a single record from another one
+    for (int i = 0; i < STORM_SIZE; i++) {
+        async_log_write(ASYNC_LOG_ERROR, "flipper", "storm", (void*)0x4000);
+    }
+    async_log_write(ASYNC_LOG_ERROR, "flipper", "other site", (void*)0x5000);
+
+    //after a refill the next record of the storm site carries the suppressed count
+    usleep(1000000 / ASYNC_LOG_RATE_PER_SEC + 50000);
+    async_log_write(ASYNC_LOG_ERROR, "flipper", "storm", (void*)0x4000);
+    async_log_flush();
+
+    char* error = read_capture(g_error_capture);
+    int storm_lines = count_lines_with(error, "[ERROR][flipper] - storm");
+    int other_lines = count_lines_with(error, "[ERROR][flipper] - other site");
+    char expected_suffix[64];
+    snprintf(expected_suffix, sizeof(expected_suffix), "(%d similar messages suppressed)", STORM_SIZE - ASYNC_LOG_RATE_BURST);
+
+    int ok = 1;
+    if (storm_lines != ASYNC_LOG_RATE_BURST + 1) {
+        printf("  ✗ expected %d storm records, got %d\n", ASYNC_LOG_RATE_BURST + 1, storm_lines);
+        ok = 0;
+    } else {
+        printf("  ✓ storm limited to the burst (%d) plus one after the refill\n", ASYNC_LOG_RATE_BURST);
+    }
+    if (1 != other_lines) {
+        printf("  ✗ the other call site lost its record\n");
+        ok = 0;
+    } else {
+        printf("  ✓ other call site not affected\n");
+    }
+    if (NULL == strstr(error, expected_suffix)) {
+        printf("  ✗ missing '%s'\n", expected_suffix);
+        ok = 0;
+    } else {
+        printf("  ✓ suppressed count reported: %s\n", expected_suffix);
+    }
+    free(error);
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+void* writer_thread(void* arg) {
+    int thread_id = *(int*)arg;
+    char message[32];
+    for (int i = 0; i < RECORDS_PER_THREAD; i++) {
+        snprintf(message, sizeof(message), "thread %d record %d", thread_id, i);
+        //a different call site per thread, so the rate limit stays out of the way
+        async_log_write(ASYNC_LOG_INFO, "writer", message, (void*)(long)(0x10000 + thread_id * 0x100));
+    }
+    return NULL;
+}
+
+test_result_t test_concurrent_writers() {
+    print_test_header("Concurrent Writers");
+
+    pthread_t threads[NUM_WRITER_THREADS];
+    int thread_ids[NUM_WRITER_THREADS];
+    for (int i = 0; i < NUM_WRITER_THREADS; i++) {
+        thread_ids[i] = i;
+        pthread_create(&threads[i], NULL, writer_thread, &thread_ids[i]);
+    }
+    for (int i = 0; i < NUM_WRITER_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    async_log_flush();
+
+    char* info = read_capture(g_info_capture);
+    int ok = 1;
+    for (int thread_id = 0; thread_id < NUM_WRITER_THREADS && ok; thread_id++) {
+        //records of one thread keep their order
+        const char* position = info;
+        for (int i = 0; i < RECORDS_PER_THREAD; i++) {
+            char expected[64];
+            snprintf(expected, sizeof(expected), "[INFO][writer] - thread %d record %d\n", thread_id, i);
+            position = strstr(position, expected);
+            if (NULL == position) {
+                printf("  ✗ missing or out of order: %s", expected);
+                ok = 0;
+                break;
+            }
+        }
+    }
+    if (ok) {
+        printf("  ✓ %d records from %d threads, in order per thread\n", NUM_WRITER_THREADS * RECORDS_PER_THREAD, NUM_WRITER_THREADS);
+    }
+    free(info);
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_background_flusher() {
+    print_test_header("Background Flusher");
+
+    async_log_write(ASYNC_LOG_INFO, "typewriter", "printed without a flush", (void*)0x6000);
+
+    //the flusher polls every few ms while busy
+    int printed = 0;
+    for (int i = 0; i < 100 && !printed; i++) {
+        usleep(10000);
+        fflush(g_info_capture);
+        printed = (ftell(g_info_capture) > 0);
+    }
+    async_log_flush();
+
+    char* info = read_capture(g_info_capture);
+    int ok = printed && (0 == strcmp(info, "[INFO][typewriter] - printed without a flush\n"));
+    if (!ok) {
+        printf("  ✗ record not printed by the background thread ('%s')\n", info);
+    } else {
+        printf("  ✓ record printed by the background thread\n");
+    }
+    free(info);
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+int main(void) {
+    int tests_passed = 0;
+    int tests_failed = 0;
+    test_result_t result;
+
+    printf("%s===========================================\n", CYAN);
+    printf("        ASYNC LOG TEST SUITE\n");
+    printf("===========================================%s\n", NC);
+    printf("Testing the asynchronous rate limited log backend\n");
+    printf("\n");
+
+    g_info_capture = tmpfile();
+    g_error_capture = tmpfile();
+    if (NULL == g_info_capture || NULL == g_error_capture) {
+        printf("%sFailed to create capture files%s\n", RED, NC);
+        return 1;
+    }
+    async_log_set_output(g_info_capture, g_error_capture);
+
+    // Run tests
+    result = test_record_format();
+    print_test_result("Record Format", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_long_message_cut();
+    print_test_result("Long Message Cut", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_rate_limit_per_call_site();
+    print_test_result("Rate Limit Per Call Site", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_concurrent_writers();
+    print_test_result("Concurrent Writers", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_background_flusher();
+    print_test_result("Background Flusher", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    // Print summary
+    printf("\n%s===========================================%s\n", CYAN, NC);
+    printf("                SUMMARY\n");
+    printf("%s===========================================%s\n", CYAN, NC);
+    printf("%sTests Passed:  %d%s\n", GREEN, tests_passed, NC);
+    printf("%sTests Failed:  %d%s\n", RED, tests_failed, NC);
+    printf("Total Tests:   %d\n", tests_passed + tests_failed);
+
+    if (tests_failed > 0) {
+        printf("\n%sResult: FAILURE - Some tests failed!%s\n", RED, NC);
+        return 1;
+    } else {
+        printf("\n%sResult: SUCCESS - All tests passed!%s\n", GREEN, NC);
+        return 0;
+    }
+}
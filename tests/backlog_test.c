@@ -0,0 +1,365 @@
+/**
+ * Compressed Backlog Test Suite
+ *
+ * Tests the block codec (round trips, incompressible and corrupt blocks),
+ * the backlog block list and a deep queue whose backlog is compressed:
+ * a producer far ahead of a slow consumer, the items must come out in order,
+ * and a backlog block that does not decompress any more is dropped
+ */
+
+#include "../plugins/sync/lz_codec.h"
+#include "../plugins/sync/backlog.h"
+#include "../plugins/sync/consumer_producer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Test configuration */
+#define CODEC_BLOCK_BYTES 65536
+#define QUEUE_CAPACITY 50000
+#define HOT_ITEMS 16
+#define NUM_ITEMS 200000
+
+/* Colors for output */
+#define RED "\033[0;31m"
+#define GREEN "\033[0;32m"
+#define BLUE "\033[0;34m"
+#define CYAN "\033[0;36m"
+#define NC "\033[0m"
+
+/* Test result tracking */
+typedef enum {
+    TEST_PASS,
+    TEST_FAIL
+} test_result_t;
+
+/* Utility Functions */
+void print_test_header(const char* test_name) {
+    printf("\n%s========================================%s\n", CYAN, NC);
+    printf("%sTEST: %s%s\n", BLUE, test_name, NC);
+    printf("%s========================================%s\n", CYAN, NC);
+}
+
+void print_test_result(const char* test_name, test_result_t result) {
+    const char* status = (result == TEST_PASS) ? "PASS" : "FAIL";
+    const char* color = (result == TEST_PASS) ? GREEN : RED;
+    printf("%s[%s]%s %s\n", color, status, NC, test_name);
+}
+
+/* item i - a log like line, the numbers and the padding vary */
+static void make_item(int i, char* item, size_t item_size) {
+    int length = snprintf(item, item_size, "2024-05-01T10:%02d:%02d level=info req=%d path=/api/v1/items/%d ",
+                          (i / 60) % 60, i % 60, i * 7, i % 1000);
+    int padding = (i * 13) % 50;
+    for (int p = 0; p < padding && length < (int)item_size - 1; p++) {
+        item[length++] = (char)('a' + (i + p) % 26);
+    }
+    item[length] = '\0';
+}
+
+static int round_trip(const char* src, size_t size, size_t* compressed_size) {
+    static char compressed[LZ_COMPRESS_BOUND(CODEC_BLOCK_BYTES)];
+    static char plain[CODEC_BLOCK_BYTES];
+    *compressed_size = lz_compress(src, size, compressed, sizeof(compressed));
+    return *compressed_size > 0 && size == lz_decompress(compressed, *compressed_size, plain, sizeof(plain)) &&
+           0 == memcmp(src, plain, size);
+}
+
+test_result_t test_codec_round_trip() {
+    print_test_header("Codec Round Trip");
+
+    static char block[CODEC_BLOCK_BYTES];
+    size_t used = 0;
+    char item[128];
+    for (int i = 0; used + sizeof(item) < sizeof(block); i++) {
+        make_item(i, item, sizeof(item));
+        size_t length = strlen(item) + 1;
+        memcpy(block + used, item, length);
+        used += length;
+    }
+
+    size_t text_size = 0;
+    int ok = round_trip(block, used, &text_size) && text_size < used / 3;
+
+    //random bytes do not shrink but must stay within the bound
+    srand(1);
+    for (size_t i = 0; i < sizeof(block); i++) {
+        block[i] = (char)rand();
+    }
+    size_t random_size = 0;
+    ok = ok && round_trip(block, sizeof(block), &random_size) && random_size <= LZ_COMPRESS_BOUND(sizeof(block));
+
+    //long runs (overlapping matches), tiny blocks and every length around the token limits
+    memset(block, 'x', sizeof(block));
+    size_t run_size = 0;
+    ok = ok && round_trip(block, sizeof(block), &run_size) && run_size < 512;
+    for (size_t size = 1; size < 600 && ok; size++) {
+        size_t small_size = 0;
+        ok = round_trip(block + sizeof(block) - size, size, &small_size);
+    }
+
+    if (ok) {
+        printf("  ✓ log lines: %zu -> %zu bytes\n", used, text_size);
+        printf("  ✓ random bytes: %zu -> %zu bytes, within the bound\n", sizeof(block), random_size);
+        printf("  ✓ long runs and 1..600 byte blocks round trip\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_codec_corrupt_block() {
+    print_test_header("Codec Corrupt Block");
+
+    const char* text = "abcdabcdabcdabcdabcdabcd - abcdabcdabcdabcd";
+    char compressed[LZ_COMPRESS_BOUND(64)];
+    char plain[64];
+    size_t size = lz_compress(text, strlen(text), compressed, sizeof(compressed));
+
+    //a truncated block, an output buffer too small, and an offset before the start
+    int ok = size > 0;
+    ok = ok && 0 == lz_decompress(compressed, size - 1, plain, sizeof(plain));
+    ok = ok && 0 == lz_decompress(compressed, size, plain, strlen(text) - 1);
+    char bad_offset[] = { 0x10, 'a', 0x05, 0x00, 0x50, 'a', 'b', 'c', 'd', 'e' };
+    ok = ok && 0 == lz_decompress(bad_offset, sizeof(bad_offset), plain, sizeof(plain));
+    //no room for the compressed output
+    ok = ok && 0 == lz_compress(text, strlen(text), compressed, 4);
+
+    if (ok) {
+        printf("  ✓ truncated blocks, small buffers and bad offsets are rejected\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+/* what the queue does around its lock, in one go */
+static int append_and_compress(backlog_t* backlog, const char* item) {
+    if (0 != backlog_append(backlog, item, strlen(item))) {
+        return -1;
+    }
+    backlog_block_t* sealed = backlog_begin_compress(backlog);
+    if (NULL != sealed) {
+        backlog_compress(backlog, sealed);
+        backlog_end_compress(backlog, sealed);
+    }
+    return 0;
+}
+
+static const char* decompress_and_peek(backlog_t* backlog) {
+    backlog_block_t* head = backlog_begin_decompress(backlog);
+    if (NULL != head) {
+        backlog_decompress(backlog, head);
+        backlog_end_decompress(backlog, head);
+    }
+    return backlog_peek(backlog);
+}
+
+test_result_t test_backlog_blocks() {
+    print_test_header("Backlog Blocks");
+
+    backlog_t backlog;
+    backlog_init(&backlog, NULL);
+
+    //enough items for several blocks, one longer than a block, read while it is still written
+    int ok = 1;
+    char item[128];
+    char* long_item = (char*)malloc(BACKLOG_BLOCK_BYTES + 100);
+    memset(long_item, 'L', BACKLOG_BLOCK_BYTES + 99);
+    long_item[BACKLOG_BLOCK_BYTES + 99] = '\0';
+    int num_items = 20000;
+    for (int i = 0; i < num_items && ok; i++) {
+        make_item(i, item, sizeof(item));
+        ok = (0 == append_and_compress(&backlog, (i == 5000) ? long_item : item));
+    }
+    size_t full_bytes = backlog.resident_bytes;
+    ok = ok && backlog.blocks_compressed > 10 && backlog.compressed_bytes < backlog.plain_bytes / 3;
+
+    for (int i = 0; i < num_items && ok; i++) {
+        make_item(i, item, sizeof(item));
+        const char* expected = (i == 5000) ? long_item : item;
+        const char* oldest = decompress_and_peek(&backlog);
+        if (NULL == oldest || 0 != strcmp(oldest, expected)) {
+            printf("  ✗ item %d: expected '%.40s' got '%.40s'\n", i, expected, oldest ? oldest : "(null)");
+            ok = 0;
+        }
+        backlog_release(&backlog);
+        //new items keep coming while the old ones are read
+        if (i % 2 == 0 && ok) {
+            ok = (0 == append_and_compress(&backlog, "tail"));
+        }
+    }
+    for (int i = 0; i < num_items / 2 && ok; i++) {
+        const char* oldest = decompress_and_peek(&backlog);
+        ok = NULL != oldest && 0 == strcmp(oldest, "tail");
+        backlog_release(&backlog);
+    }
+    ok = ok && 0 == backlog.num_items && NULL == backlog_peek(&backlog) && 0 == backlog.resident_bytes;
+    backlog_destroy(&backlog);
+    free(long_item);
+
+    if (ok) {
+        printf("  ✓ %d items in %llu compressed blocks, %llu -> %llu bytes, %zu resident\n", num_items,
+               backlog.blocks_compressed, backlog.plain_bytes, backlog.compressed_bytes, full_bytes);
+        printf("  ✓ read back in order while new items are appended, nothing left after the last\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+void* backlog_producer_thread(void* arg) {
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    char item[128];
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        make_item(i, item, sizeof(item));
+        if (NULL != consumer_producer_put(queue, item)) {
+            return (void*)1;
+        }
+    }
+    return NULL;
+}
+
+test_result_t test_deep_queue() {
+    print_test_header("Deep Queue With A Compressed Backlog");
+
+    consumer_producer_t queue;
+    if (NULL != consumer_producer_init(&queue, QUEUE_CAPACITY) ||
+        NULL != consumer_producer_set_backlog_compression(&queue, HOT_ITEMS)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, backlog_producer_thread, &queue);
+
+    //a slow start lets the backlog grow to the queue capacity, then the consumer keeps up
+    usleep(200000);
+    int max_backlog = queue.backlog.num_items;
+    int ok = 1;
+    char expected[128];
+    for (int i = 0; i < NUM_ITEMS && ok; i++) {
+        make_item(i, expected, sizeof(expected));
+        char* item = (i % 2) ? consumer_producer_get(&queue) : consumer_producer_try_get(&queue);
+        while (NULL == item && i % 2 == 0) {
+            item = consumer_producer_try_get(&queue);
+        }
+        if (NULL == item || 0 != strcmp(item, expected)) {
+            printf("  ✗ item %d: expected '%s' got '%s'\n", i, expected, item ? item : "(null)");
+            ok = 0;
+        }
+        consumer_producer_free_item(&queue, item);
+    }
+
+    void* producer_result = NULL;
+    pthread_join(producer, &producer_result);
+    ok = ok && NULL == producer_result && 0 == queue.count && 0 == queue.backlog.num_items;
+    ok = ok && 0 == consumer_producer_try_put(&queue, "after") && 0 == strcmp("after", queue.items[queue.head]);
+    unsigned long long blocks = queue.backlog.blocks_compressed;
+    consumer_producer_destroy(&queue);
+
+    //the ring layout keeps its items inline, there is nothing to compress
+    consumer_producer_t ring_queue;
+    ok = ok && NULL == consumer_producer_init_byte_ring(&ring_queue, 16, 4096, NULL) &&
+         NULL != consumer_producer_set_backlog_compression(&ring_queue, 4);
+    consumer_producer_destroy(&ring_queue);
+
+    if (ok) {
+        printf("  ✓ %d items in order through %d hot slots, backlog up to %d items in %llu compressed blocks\n",
+               NUM_ITEMS, HOT_ITEMS, max_backlog, blocks);
+        printf("  ✓ the queue goes back to the hot array once the backlog is drained\n");
+        printf("  ✓ a byte ring queue refuses backlog compression\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_corrupt_backlog_block() {
+    print_test_header("Corrupt Backlog Block");
+
+    consumer_producer_t queue;
+    if (NULL != consumer_producer_init(&queue, QUEUE_CAPACITY) ||
+        NULL != consumer_producer_set_backlog_compression(&queue, HOT_ITEMS)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    //the hot items, then enough for a few blocks - the second block is compressed by now
+    char item[128];
+    int num_items = 5000;
+    int ok = 1;
+    for (int i = 0; i < num_items && ok; i++) {
+        make_item(i, item, sizeof(item));
+        ok = (0 == consumer_producer_try_put(&queue, item));
+    }
+    backlog_block_t* victim = (NULL != queue.backlog.head) ? queue.backlog.head->next : NULL;
+    ok = ok && NULL != victim && 0 != victim->compressed_size;
+    int victim_items = ok ? victim->num_items : 0;
+    if (ok) {
+        memset(victim->data, 0xff, victim->compressed_size);
+    }
+
+    //the consumer skips the lost items instead of waiting for them, the later ones come in order
+    int received = 0;
+    char* last = NULL;
+    char* got;
+    while (ok && NULL != (got = consumer_producer_try_get(&queue))) {
+        consumer_producer_free_item(&queue, last);
+        last = got;
+        received++;
+    }
+    make_item(num_items - 1, item, sizeof(item));
+    ok = ok && received == num_items - victim_items && NULL != last && 0 == strcmp(last, item);
+    ok = ok && 0 == queue.count && 1 == queue.backlog.blocks_dropped;
+    consumer_producer_free_item(&queue, last);
+    consumer_producer_destroy(&queue);
+
+    if (ok) {
+        printf("  ✓ %d items of the corrupt block dropped, the other %d delivered\n", victim_items, received);
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+int main(void) {
+    int tests_passed = 0;
+    int tests_failed = 0;
+    test_result_t result;
+
+    printf("%s===========================================\n", CYAN);
+    printf("     COMPRESSED BACKLOG TEST SUITE\n");
+    printf("===========================================%s\n", NC);
+    printf("Testing the block codec and the compressed queue backlog\n");
+    printf("\n");
+
+    // Run tests
+    result = test_codec_round_trip();
+    print_test_result("Codec Round Trip", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_codec_corrupt_block();
+    print_test_result("Codec Corrupt Block", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_backlog_blocks();
+    print_test_result("Backlog Blocks", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_deep_queue();
+    print_test_result("Deep Queue With A Compressed Backlog", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_corrupt_backlog_block();
+    print_test_result("Corrupt Backlog Block", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    // Print summary
+    printf("\n%s===========================================%s\n", CYAN, NC);
+    printf("                SUMMARY\n");
+    printf("%s===========================================%s\n", CYAN, NC);
+    printf("%sTests Passed:  %d%s\n", GREEN, tests_passed, NC);
+    printf("%sTests Failed:  %d%s\n", RED, tests_failed, NC);
+    printf("Total Tests:   %d\n", tests_passed + tests_failed);
+
+    if (tests_failed > 0) {
+        printf("\n%sResult: FAILURE - Some tests failed!%s\n", RED, NC);
+        return 1;
+    } else {
+        printf("\n%sResult: SUCCESS - All tests passed!%s\n", GREEN, NC);
+        return 0;
+    }
+}
@@ -0,0 +1,397 @@
+/**
+ * Byte Ring Test Suite
+ *
+ * Tests the inline record layout of the queue: record sizes, wrap around,
+ * reservation / commit, in-place reads, the byte ring queue API, a
+ * producer / consumer run with variable length items, a producer waiting
+ * for another one's reservation and the idle trim
+ */
+
+#include "../plugins/sync/byte_ring.h"
+#include "../plugins/sync/consumer_producer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Test configuration */
+#define RING_BYTES 256
+#define QUEUE_CAPACITY 64
+#define NUM_ITEMS 5000
+
+/* Colors for output */
+#define RED "\033[0;31m"
+#define GREEN "\033[0;32m"
+#define BLUE "\033[0;34m"
+#define CYAN "\033[0;36m"
+#define NC "\033[0m"
+
+/* Test result tracking */
+typedef enum {
+    TEST_PASS,
+    TEST_FAIL
+} test_result_t;
+
+/* Utility Functions */
+void print_test_header(const char* test_name) {
+    printf("\n%s========================================%s\n", CYAN, NC);
+    printf("%sTEST: %s%s\n", BLUE, test_name, NC);
+    printf("%s========================================%s\n", CYAN, NC);
+}
+
+void print_test_result(const char* test_name, test_result_t result) {
+    const char* status = (result == TEST_PASS) ? "PASS" : "FAIL";
+    const char* color = (result == TEST_PASS) ? GREEN : RED;
+    printf("%s[%s]%s %s\n", color, status, NC, test_name);
+}
+
+/* item i of the stress run - the length varies so records wrap at different offsets */
+static void make_item(int i, char* item, size_t item_size) {
+    int length = snprintf(item, item_size, "item-%d-", i);
+    int padding = (i * 7) % 40;
+    for (int p = 0; p < padding && length < (int)item_size - 1; p++) {
+        item[length++] = (char)('a' + (i + p) % 26);
+    }
+    item[length] = '\0';
+}
+
+static int push(byte_ring_t* ring, const char* item) {
+    char* slot = byte_ring_reserve(ring, strlen(item));
+    if (NULL == slot) {
+        return -1;
+    }
+    memcpy(slot, item, strlen(item) + 1);
+    byte_ring_commit(ring);
+    return 0;
+}
+
+/* Test Functions */
+test_result_t test_record_size() {
+    print_test_header("Record Size");
+
+    int ok = (8 + 8 == byte_ring_record_size(0)) && (16 == byte_ring_record_size(7)) &&
+             (24 == byte_ring_record_size(8)) && (0 == byte_ring_record_size(100) % BYTE_RING_ALIGNMENT);
+    if (!ok) {
+        printf("  ✗ unexpected record sizes %zu %zu %zu\n", byte_ring_record_size(0), byte_ring_record_size(7), byte_ring_record_size(8));
+    } else {
+        printf("  ✓ header + string + '\\0', rounded up to %d\n", BYTE_RING_ALIGNMENT);
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_wrap_around() {
+    print_test_header("Wrap Around");
+
+    static char buffer[64];
+    byte_ring_t ring;
+    byte_ring_init(&ring, buffer, sizeof(buffer));
+
+    //24 + 24 bytes, then drop the first one - the third record does not fit at the end (16 left)
+    int ok = (0 == push(&ring, "first-record-xx")) && (0 == push(&ring, "second-record-x"));
+    char* oldest = byte_ring_peek(&ring, NULL);
+    ok = ok && NULL != oldest && 0 == strcmp(oldest, "first-record-xx");
+    byte_ring_release(&ring);
+
+    ok = ok && (0 == push(&ring, "third-record-xx"));
+    ok = ok && (ring.tail == 24); //went back to offset 0
+    ok = ok && (-1 == push(&ring, "fourth")); //no room until the second one goes
+
+    size_t length = 0;
+    oldest = byte_ring_peek(&ring, &length);
+    ok = ok && NULL != oldest && 0 == strcmp(oldest, "second-record-x") && 15 == length;
+    byte_ring_release(&ring);
+    oldest = byte_ring_peek(&ring, NULL);
+    ok = ok && NULL != oldest && 0 == strcmp(oldest, "third-record-xx");
+    byte_ring_release(&ring);
+    ok = ok && (0 == ring.used) && (NULL == byte_ring_peek(&ring, NULL));
+
+    if (!ok) {
+        printf("  ✗ wrong records or offsets (head %zu tail %zu used %zu)\n", ring.head, ring.tail, ring.used);
+    } else {
+        printf("  ✓ record placed at offset 0 when the end of the buffer is too small\n");
+        printf("  ✓ records come back in order across the wrap, ring empty afterwards\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_reservation() {
+    print_test_header("Reservation And Commit");
+
+    static char buffer[128];
+    byte_ring_t ring;
+    byte_ring_init(&ring, buffer, sizeof(buffer));
+
+    char* slot = byte_ring_reserve(&ring, 5);
+    int ok = (NULL != slot);
+    ok = ok && (NULL == byte_ring_peek(&ring, NULL));          //not visible before the commit
+    ok = ok && (NULL == byte_ring_reserve(&ring, 3));          //one reservation at a time
+    ok = ok && (NULL == byte_ring_reserve(&ring, 200));
+    if (ok) {
+        memcpy(slot, "hello", 6);
+        byte_ring_commit(&ring);
+        char* item = byte_ring_peek(&ring, NULL);
+        ok = (NULL != item && 0 == strcmp(item, "hello"));
+    }
+
+    if (!ok) {
+        printf("  ✗ reservation semantics broken\n");
+    } else {
+        printf("  ✓ reserved record hidden until commit, a second reservation is refused\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_queue_in_place() {
+    print_test_header("Queue In Place Read");
+
+    consumer_producer_t queue;
+    if (NULL != consumer_producer_init_byte_ring(&queue, 4, RING_BYTES, NULL)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    int ok = (NULL == consumer_producer_put(&queue, "abc")) && (NULL == consumer_producer_put(&queue, "defg"));
+
+    //the consumer rewrites the item inside the ring, no copy
+    char* item = consumer_producer_peek(&queue);
+    ok = ok && NULL != item && 0 == strcmp(item, "abc") && item >= queue.ring.buffer && item < queue.ring.buffer + RING_BYTES;
+    if (NULL != item) {
+        item[0] = 'A';
+    }
+    ok = ok && 0 == strcmp(consumer_producer_peek(&queue), "Abc");
+    consumer_producer_release(&queue);
+
+    //get still hands out a copy the caller owns
+    char* copy = consumer_producer_get(&queue);
+    ok = ok && NULL != copy && 0 == strcmp(copy, "defg") && 0 == queue.count;
+    consumer_producer_free_item(&queue, copy);
+
+    //capacity still limits the count, and an item larger than the ring is refused
+    for (int i = 0; i < 4; i++) {
+        ok = ok && (0 == consumer_producer_try_put(&queue, "x"));
+    }
+    ok = ok && (1 == consumer_producer_try_put(&queue, "x"));
+    char too_long[RING_BYTES + 1];
+    memset(too_long, 'z', RING_BYTES);
+    too_long[RING_BYTES] = '\0';
+    ok = ok && (-1 == consumer_producer_try_put(&queue, too_long)) && (NULL != consumer_producer_put(&queue, too_long));
+
+    consumer_producer_destroy(&queue);
+    if (!ok) {
+        printf("  ✗ byte ring queue API broken\n");
+    } else {
+        printf("  ✓ peek returns the item inside the ring, release frees it\n");
+        printf("  ✓ get copies, capacity limits the count, oversized items refused\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+void* ring_producer_thread(void* arg) {
+    consumer_producer_t* queue = (consumer_producer_t*)arg;
+    char item[64];
+    for (int i = 0; i < NUM_ITEMS; i++) {
+        make_item(i, item, sizeof(item));
+        if (NULL != consumer_producer_put(queue, item)) {
+            return (void*)1;
+        }
+    }
+    return NULL;
+}
+
+test_result_t test_producer_consumer() {
+    print_test_header("Producer Consumer Through A Small Ring");
+
+    consumer_producer_t queue;
+    if (NULL != consumer_producer_init_byte_ring(&queue, QUEUE_CAPACITY, RING_BYTES, NULL)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_producer_thread, &queue);
+
+    //the ring holds only a few items, so the producer keeps blocking and wrapping
+    int ok = 1;
+    char expected[64];
+    for (int i = 0; i < NUM_ITEMS && ok; i++) {
+        make_item(i, expected, sizeof(expected));
+        char* item = consumer_producer_peek(&queue);
+        if (NULL == item || 0 != strcmp(item, expected)) {
+            printf("  ✗ item %d: expected '%s' got '%s'\n", i, expected, item ? item : "(null)");
+            ok = 0;
+        }
+        consumer_producer_release(&queue);
+    }
+
+    void* producer_result = NULL;
+    pthread_join(producer, &producer_result);
+    ok = ok && NULL == producer_result && 0 == queue.count && 0 == queue.ring.used;
+    consumer_producer_destroy(&queue);
+
+    if (ok) {
+        printf("  ✓ %d variable length items through a %d byte ring, in order\n", NUM_ITEMS, RING_BYTES);
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+typedef struct {
+    consumer_producer_t* queue;
+    volatile int done;
+} blocked_put_t;
+
+void* blocked_put_thread(void* arg) {
+    blocked_put_t* put = (blocked_put_t*)arg;
+    const char* error = consumer_producer_put(put->queue, "second");
+    put->done = 1;
+    return (NULL != error) ? (void*)1 : NULL;
+}
+
+test_result_t test_put_waits_for_reservation() {
+    print_test_header("Put Waiting For An Open Reservation");
+
+    consumer_producer_t queue;
+    if (NULL != consumer_producer_init_byte_ring(&queue, 4, RING_BYTES, NULL)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    //the queue has free slots, only the open reservation keeps the second producer out
+    char* slot = consumer_producer_reserve(&queue, 5);
+    blocked_put_t put = { &queue, 0 };
+    pthread_t producer;
+    pthread_create(&producer, NULL, blocked_put_thread, &put);
+    usleep(50000);
+    int ok = (NULL != slot) && !put.done;
+
+    memcpy(slot, "first", 6);
+    consumer_producer_commit(&queue);
+
+    //the commit alone must wake it, nothing is consumed meanwhile
+    for (int waited_ms = 0; waited_ms < 2000 && !put.done; waited_ms += 10) {
+        usleep(10000);
+    }
+    int woken = put.done;
+    ok = ok && woken;
+
+    //a producer that was never woken gets its room from the consumer, so the test still ends
+    char* first = consumer_producer_get(&queue);
+    ok = ok && NULL != first && 0 == strcmp(first, "first");
+    consumer_producer_free_item(&queue, first);
+    void* producer_result = NULL;
+    pthread_join(producer, &producer_result);
+    char* second = consumer_producer_get(&queue);
+    ok = ok && NULL == producer_result && NULL != second && 0 == strcmp(second, "second");
+    consumer_producer_free_item(&queue, second);
+    consumer_producer_destroy(&queue);
+
+    if (!ok) {
+        printf("  ✗ %s\n", woken ? "items out of order" : "the commit did not wake the waiting producer");
+    } else {
+        printf("  ✓ a put blocked on an open reservation wakes on its commit\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_trim() {
+    print_test_header("Trim Of An Idle Ring");
+
+    //a page aligned buffer of 8 pages, a backlog touches all of them
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t ring_bytes = 8 * page_size;
+    char* buffer = NULL;
+    if (0 != posix_memalign((void**)&buffer, page_size, ring_bytes)) {
+        printf("  ✗ failed to allocate the ring\n");
+        return TEST_FAIL;
+    }
+    byte_ring_t ring;
+    byte_ring_init(&ring, buffer, ring_bytes);
+
+    char item[64];
+    int pushed = 0;
+    make_item(1, item, sizeof(item));
+    while (0 == push(&ring, item)) {
+        pushed++;
+    }
+    int ok = (0 == byte_ring_trim(&ring, 0)); //holds records, nothing goes
+    for (int i = 0; i < pushed; i++) {
+        byte_ring_release(&ring);
+    }
+
+    //one page kept warm, the other seven go, a second trim finds nothing resident
+    size_t released = byte_ring_trim(&ring, page_size);
+    ok = ok && (7 * page_size == released) && (0 == byte_ring_trim(&ring, page_size));
+
+    //the released pages come back zeroed and the ring keeps working
+    ok = ok && (0 == push(&ring, "after-trim"));
+    char* oldest = byte_ring_peek(&ring, NULL);
+    ok = ok && NULL != oldest && 0 == strcmp(oldest, "after-trim");
+    byte_ring_release(&ring);
+    free(buffer);
+
+    if (!ok) {
+        printf("  ✗ released %zu bytes of %zu, expected %zu\n", released, ring_bytes, 7 * page_size);
+    } else {
+        printf("  ✓ a ring holding records is not trimmed\n");
+        printf("  ✓ an empty ring releases every page past the warm bytes once\n");
+        printf("  ✓ the ring keeps working after the trim\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+int main(void) {
+    int tests_passed = 0;
+    int tests_failed = 0;
+    test_result_t result;
+
+    printf("%s===========================================\n", CYAN);
+    printf("        BYTE RING TEST SUITE\n");
+    printf("===========================================%s\n", NC);
+    printf("Testing the inline record queue layout\n");
+    printf("\n");
+
+    // Run tests
+    result = test_record_size();
+    print_test_result("Record Size", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_wrap_around();
+    print_test_result("Wrap Around", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_reservation();
+    print_test_result("Reservation And Commit", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_queue_in_place();
+    print_test_result("Queue In Place Read", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_producer_consumer();
+    print_test_result("Producer Consumer Through A Small Ring", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_put_waits_for_reservation();
+    print_test_result("Put Waiting For An Open Reservation", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_trim();
+    print_test_result("Trim Of An Idle Ring", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    // Print summary
+    printf("\n%s===========================================%s\n", CYAN, NC);
+    printf("                SUMMARY\n");
+    printf("%s===========================================%s\n", CYAN, NC);
+    printf("%sTests Passed:  %d%s\n", GREEN, tests_passed, NC);
+    printf("%sTests Failed:  %d%s\n", RED, tests_failed, NC);
+    printf("Total Tests:   %d\n", tests_passed + tests_failed);
+
+    if (tests_failed > 0) {
+        printf("\n%sResult: FAILURE - Some tests failed!%s\n", RED, NC);
+        return 1;
+    } else {
+        printf("\n%sResult: SUCCESS - All tests passed!%s\n", GREEN, NC);
+        return 0;
+    }
+}
@@ -557,6 +557,190 @@ test_result_t test_error_conditions() {
     return TEST_PASS;
 }
 
+test_result_t test_non_blocking_operations() {
+    consumer_producer_t queue;
+    char buffer[64];
+    char* item;
+    int i;
+    
+    print_test_header("Non Blocking Put/Get");
+    
+    memset(&queue, 0, sizeof(consumer_producer_t));
+    if (NULL != consumer_producer_init(&queue, QUEUE_SIZE)) {
+        return TEST_FAIL;
+    }
+    
+    // Empty queue must not block
+    item = consumer_producer_try_get(&queue);
+    if (NULL != item) {
+        printf("  ✗ try_get on empty queue returned an item\n");
+        free(item);
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ try_get on empty queue returned NULL\n");
+    
+    // Fill the queue, the next put must report full instead of blocking
+    for (i = 0; i < QUEUE_SIZE; i++) {
+        snprintf(buffer, sizeof(buffer), "Try-Item-%d", i);
+        if (0 != consumer_producer_try_put(&queue, buffer)) {
+            printf("  ✗ try_put %d failed on a non full queue\n", i);
+            consumer_producer_destroy(&queue);
+            return TEST_FAIL;
+        }
+    }
+    if (1 != consumer_producer_try_put(&queue, "overflow")) {
+        printf("  ✗ try_put on full queue did not report full\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ try_put reports full queue\n");
+    
+    // Items come back in order
+    for (i = 0; i < QUEUE_SIZE; i++) {
+        snprintf(buffer, sizeof(buffer), "Try-Item-%d", i);
+        item = consumer_producer_try_get(&queue);
+        if (NULL == item || 0 != strcmp(item, buffer)) {
+            printf("  ✗ try_get %d returned '%s'\n", i, item ? item : "NULL");
+            free(item);
+            consumer_producer_destroy(&queue);
+            return TEST_FAIL;
+        }
+        free(item);
+    }
+    printf("  ✓ try_get preserves FIFO order\n");
+    
+    if (-1 != consumer_producer_try_put(NULL, "test") || -1 != consumer_producer_try_put(&queue, NULL)) {
+        printf("  ✗ try_put with NULL arguments did not return error\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ try_put NULL arguments handled\n");
+    
+    consumer_producer_destroy(&queue);
+    return TEST_PASS;
+}
+
+/* Counting allocator - checks that every block the queue takes is given back */
+typedef struct {
+    int allocations;
+    int deallocations;
+    size_t bytes_in_use;
+} counting_allocator_t;
+
+static void* counting_allocate(void* context, size_t size) {
+    counting_allocator_t* counter = (counting_allocator_t*)context;
+    counter->allocations++;
+    counter->bytes_in_use += size;
+    return malloc(size);
+}
+
+static void counting_deallocate(void* context, void* ptr, size_t size) {
+    counting_allocator_t* counter = (counting_allocator_t*)context;
+    counter->deallocations++;
+    counter->bytes_in_use -= size;
+    free(ptr);
+}
+
+test_result_t test_custom_allocator() {
+    consumer_producer_t queue;
+    counting_allocator_t counter = {0, 0, 0};
+    pipeline_allocator_t allocator = { counting_allocate, counting_deallocate, &counter };
+    char* item;
+    
+    print_test_header("Custom Allocator");
+    
+    memset(&queue, 0, sizeof(consumer_producer_t));
+    if (NULL != consumer_producer_init_with_allocator(&queue, QUEUE_SIZE, &allocator)) {
+        return TEST_FAIL;
+    }
+    
+    consumer_producer_put(&queue, "first");
+    consumer_producer_put(&queue, "second");
+    consumer_producer_try_put(&queue, "third");
+    if (counter.allocations != 4) { // ring + 3 items
+        printf("  ✗ Expected 4 allocations, got %d\n", counter.allocations);
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ Ring and items allocated through the allocator\n");
+    
+    item = consumer_producer_get(&queue);
+    if (NULL == item || 0 != strcmp(item, "first")) {
+        printf("  ✗ Got wrong item\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    consumer_producer_free_item(&queue, item);
+    
+    // the remaining items are released by destroy
+    consumer_producer_destroy(&queue);
+    if (counter.allocations != counter.deallocations || counter.bytes_in_use != 0) {
+        printf("  ✗ Leak: %d allocations, %d deallocations, %zu bytes in use\n",
+               counter.allocations, counter.deallocations, counter.bytes_in_use);
+        return TEST_FAIL;
+    }
+    printf("  ✓ All memory returned to the allocator\n");
+    
+    return TEST_PASS;
+}
+
+test_result_t test_credit_flow_control() {
+    consumer_producer_t queue;
+    char* item;
+    int i;
+    
+    print_test_header("Credit Flow Control");
+    
+    // capacity 16 - freed slots are handed back in batches of 4
+    if (NULL != consumer_producer_init(&queue, 16)) {
+        return TEST_FAIL;
+    }
+    
+    if (16 != consumer_producer_take_credits(&queue, 20, 0) || 0 != consumer_producer_take_credits(&queue, 1, 0)) {
+        printf("  ✗ Expected all 16 credits once, then none\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ Credits granted up to the capacity\n");
+    
+    for (i = 0; i < 16; i++) {
+        consumer_producer_put(&queue, "credit");
+    }
+    
+    // three freed slots stay with the consumer, the fourth publishes the batch
+    for (i = 0; i < 4; i++) {
+        item = consumer_producer_get(&queue);
+        consumer_producer_free_item(&queue, item);
+        if (i < 3 && 0 != consumer_producer_take_credits(&queue, 4, 0)) {
+            printf("  ✗ Credit returned before the batch was complete\n");
+            consumer_producer_destroy(&queue);
+            return TEST_FAIL;
+        }
+    }
+    if (4 != consumer_producer_take_credits(&queue, 8, 0)) {
+        printf("  ✗ Expected a batch of 4 credits\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ Freed slots returned in batches\n");
+    
+    // draining the queue flushes the partial batch
+    for (i = 0; i < 12; i++) {
+        item = consumer_producer_get(&queue);
+        consumer_producer_free_item(&queue, item);
+    }
+    if (12 != consumer_producer_take_credits(&queue, 16, 0) || 0 != queue.count) {
+        printf("  ✗ Empty queue should return every remaining credit\n");
+        consumer_producer_destroy(&queue);
+        return TEST_FAIL;
+    }
+    printf("  ✓ Partial batch flushed once the queue is empty\n");
+    
+    consumer_producer_destroy(&queue);
+    return TEST_PASS;
+}
+
 /* Main Test Runner */
 int main(void) {
     int tests_passed = 0;
@@ -598,6 +782,18 @@ int main(void) {
     print_test_result("Error Conditions", result);
     if (result == TEST_PASS) tests_passed++; else tests_failed++;
     
+    result = test_non_blocking_operations();
+    print_test_result("Non Blocking Put/Get", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+    
+    result = test_custom_allocator();
+    print_test_result("Custom Allocator", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+    
+    result = test_credit_flow_control();
+    print_test_result("Credit Flow Control", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+    
     // Print summary
     printf("\n%s===========================================%s\n", CYAN, NC);
     printf("                SUMMARY\n");
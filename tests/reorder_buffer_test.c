@@ -0,0 +1,298 @@
+/**
+ * Reorder Buffer Test Suite
+ *
+ * Tests the sequencing window of the key partitioned stages: results handed in
+ * out of order leave in order, the emitter role moves to the worker holding the
+ * oldest result, the window bounds the items in flight, relaxed ordering only
+ * gives slots back and several workers completing concurrently still produce
+ * one ordered stream
+ */
+
+#include "../plugins/sync/reorder_buffer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <string.h>
+
+/* Test configuration */
+#define WINDOW 8
+#define NUM_WORKERS 4
+#define NUM_ITEMS 20000
+
+/* Colors for output */
+#define RED "\033[0;31m"
+#define GREEN "\033[0;32m"
+#define BLUE "\033[0;34m"
+#define CYAN "\033[0;36m"
+#define NC "\033[0m"
+
+/* Test result tracking */
+typedef enum {
+    TEST_PASS,
+    TEST_FAIL
+} test_result_t;
+
+/* Utility Functions */
+void print_test_header(const char* test_name) {
+    printf("\n%s========================================%s\n", CYAN, NC);
+    printf("%sTEST: %s%s\n", BLUE, test_name, NC);
+    printf("%s========================================%s\n", CYAN, NC);
+}
+
+void print_test_result(const char* test_name, test_result_t result) {
+    const char* status = (result == TEST_PASS) ? "PASS" : "FAIL";
+    const char* color = (result == TEST_PASS) ? GREEN : RED;
+    printf("%s[%s]%s %s\n", color, status, NC, test_name);
+}
+
+static char* make_output(unsigned long long seq) {
+    char* output = (char*)malloc(24);
+    snprintf(output, 24, "%llu", seq);
+    return output;
+}
+
+/* Test Functions */
+test_result_t test_out_of_order_completion() {
+    print_test_header("Out Of Order Completion");
+
+    reorder_buffer_t buffer;
+    if (NULL != reorder_buffer_init(&buffer, WINDOW)) {
+        printf("  ✗ init failed\n");
+        return TEST_FAIL;
+    }
+
+    unsigned long long seqs[3];
+    for (int i = 0; i < 3; i++) {
+        reorder_buffer_reserve(&buffer, &seqs[i]);
+    }
+
+    //2 and 1 finish first - nobody may emit until 0 is in
+    int ok = (0 == reorder_buffer_complete(&buffer, seqs[2], make_output(seqs[2])));
+    ok = ok && (0 == reorder_buffer_complete(&buffer, seqs[1], NULL));
+    ok = ok && (1 == reorder_buffer_complete(&buffer, seqs[0], make_output(seqs[0])));
+
+    //the emitter gets 0, the empty turn of 1, then 2, then gives the role up
+    char* output = NULL;
+    ok = ok && 1 == reorder_buffer_pop(&buffer, &output) && NULL != output && 0 == strcmp(output, "0");
+    free(output);
+    ok = ok && 1 == reorder_buffer_pop(&buffer, &output) && NULL == output;
+    ok = ok && 1 == reorder_buffer_pop(&buffer, &output) && NULL != output && 0 == strcmp(output, "2");
+    free(output);
+    ok = ok && 0 == reorder_buffer_pop(&buffer, &output) && 0 == buffer.emitting;
+
+    //the next oldest result starts a new emission
+    unsigned long long seq;
+    reorder_buffer_reserve(&buffer, &seq);
+    ok = ok && (3 == seq) && (1 == reorder_buffer_complete(&buffer, seq, NULL));
+    ok = ok && 1 == reorder_buffer_pop(&buffer, &output) && 0 == reorder_buffer_pop(&buffer, &output);
+    ok = ok && 0 == reorder_buffer_wait_drained(&buffer);
+
+    reorder_buffer_destroy(&buffer);
+    if (!ok) {
+        printf("  ✗ results not returned in sequence order\n");
+    } else {
+        printf("  ✓ results handed in as 2, 1, 0 come out as 0, 1, 2\n");
+        printf("  ✓ only the worker completing the oldest sequence emits\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+void* reserve_thread(void* arg) {
+    reorder_buffer_t* buffer = (reorder_buffer_t*)arg;
+    unsigned long long seq = 0;
+    reorder_buffer_reserve(buffer, &seq);
+    return (void*)(size_t)seq;
+}
+
+test_result_t test_window_limit() {
+    print_test_header("Window Limit");
+
+    reorder_buffer_t buffer;
+    reorder_buffer_init(&buffer, 2);
+    unsigned long long seq;
+    reorder_buffer_reserve(&buffer, &seq);
+    reorder_buffer_reserve(&buffer, &seq);
+
+    //the window is full, a third reserve waits for the oldest to be popped
+    pthread_t waiter;
+    pthread_create(&waiter, NULL, reserve_thread, &buffer);
+    usleep(50000);
+    pthread_mutex_lock(&buffer.mutex);
+    int blocked = (2 == buffer.next_seq);
+    pthread_mutex_unlock(&buffer.mutex);
+
+    char* output = NULL;
+    int ok = blocked && (1 == reorder_buffer_complete(&buffer, 0, NULL)) && (1 == reorder_buffer_pop(&buffer, &output));
+    void* third_seq = NULL;
+    pthread_join(waiter, &third_seq);
+    ok = ok && (2 == (size_t)third_seq);
+    reorder_buffer_pop(&buffer, &output);
+
+    //close wakes a reserve that would wait forever
+    reorder_buffer_close(&buffer);
+    ok = ok && (-1 == reorder_buffer_reserve(&buffer, &seq)) && (-1 == reorder_buffer_wait_drained(&buffer));
+    reorder_buffer_destroy(&buffer);
+
+    if (!ok) {
+        printf("  ✗ window not enforced (blocked %d)\n", blocked);
+    } else {
+        printf("  ✓ reserve blocks while the window is full, a pop lets it through\n");
+        printf("  ✓ close fails the waits\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+test_result_t test_relaxed_retire() {
+    print_test_header("Relaxed Retire");
+
+    reorder_buffer_t buffer;
+    reorder_buffer_init(&buffer, 2);
+    unsigned long long seq;
+    reorder_buffer_reserve(&buffer, &seq);
+    reorder_buffer_reserve(&buffer, &seq);
+
+    //the window is full until a worker retires, in whichever order they finish
+    pthread_t waiter;
+    pthread_create(&waiter, NULL, reserve_thread, &buffer);
+    usleep(50000);
+    pthread_mutex_lock(&buffer.mutex);
+    int blocked = (2 == buffer.next_seq);
+    pthread_mutex_unlock(&buffer.mutex);
+
+    reorder_buffer_retire(&buffer);
+    void* third_seq = NULL;
+    pthread_join(waiter, &third_seq);
+    int ok = blocked && (2 == (size_t)third_seq);
+
+    reorder_buffer_retire(&buffer);
+    reorder_buffer_retire(&buffer);
+    ok = ok && (0 == reorder_buffer_wait_drained(&buffer)) && (0 == buffer.emitting);
+    reorder_buffer_destroy(&buffer);
+
+    if (!ok) {
+        printf("  ✗ retire did not free the window (blocked %d)\n", blocked);
+    } else {
+        printf("  ✓ retire gives a slot back without an emitter\n");
+        printf("  ✓ the buffer drains once every sequence retired\n");
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+/* stress - the workers claim sequences, finish them after a random delay and emit */
+typedef struct {
+    reorder_buffer_t buffer;
+    pthread_mutex_t claim_mutex;
+    unsigned long long emitted[NUM_ITEMS];
+    int num_emitted;
+    int out_of_order;
+} stress_context_t;
+
+static void emit_ready(stress_context_t* context) {
+    char* output = NULL;
+    while (reorder_buffer_pop(&context->buffer, &output)) {
+        unsigned long long value = strtoull(output, NULL, 10);
+        //only one emitter at a time, so no lock around the log
+        if (context->num_emitted != (int)value) {
+            context->out_of_order++;
+        }
+        context->emitted[context->num_emitted++] = value;
+        free(output);
+    }
+}
+
+void* stress_worker(void* arg) {
+    stress_context_t* context = (stress_context_t*)arg;
+    unsigned int seed = (unsigned int)(size_t)pthread_self();
+    while (1) {
+        unsigned long long seq;
+        pthread_mutex_lock(&context->claim_mutex);
+        if (context->buffer.next_seq >= NUM_ITEMS || 0 != reorder_buffer_reserve(&context->buffer, &seq)) {
+            pthread_mutex_unlock(&context->claim_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&context->claim_mutex);
+
+        if (0 == rand_r(&seed) % 64) {
+            usleep(rand_r(&seed) % 200);
+        }
+        if (reorder_buffer_complete(&context->buffer, seq, make_output(seq))) {
+            emit_ready(context);
+        }
+    }
+    return NULL;
+}
+
+test_result_t test_concurrent_workers() {
+    print_test_header("Concurrent Workers");
+
+    static stress_context_t context;
+    memset(&context, 0, sizeof(context));
+    reorder_buffer_init(&context.buffer, WINDOW);
+    pthread_mutex_init(&context.claim_mutex, NULL);
+
+    pthread_t workers[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_create(&workers[i], NULL, stress_worker, &context);
+    }
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    int ok = (0 == reorder_buffer_wait_drained(&context.buffer)) && (NUM_ITEMS == context.num_emitted) &&
+             (0 == context.out_of_order);
+    reorder_buffer_destroy(&context.buffer);
+    pthread_mutex_destroy(&context.claim_mutex);
+
+    if (!ok) {
+        printf("  ✗ %d results emitted, %d out of order\n", context.num_emitted, context.out_of_order);
+    } else {
+        printf("  ✓ %d results from %d workers through a window of %d, in order\n", NUM_ITEMS, NUM_WORKERS, WINDOW);
+    }
+    return ok ? TEST_PASS : TEST_FAIL;
+}
+
+int main(void) {
+    int tests_passed = 0;
+    int tests_failed = 0;
+    test_result_t result;
+
+    printf("%s===========================================\n", CYAN);
+    printf("        REORDER BUFFER TEST SUITE\n");
+    printf("===========================================%s\n", NC);
+    printf("Testing the sequencing window of partitioned stages\n");
+    printf("\n");
+
+    // Run tests
+    result = test_out_of_order_completion();
+    print_test_result("Out Of Order Completion", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_window_limit();
+    print_test_result("Window Limit", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_relaxed_retire();
+    print_test_result("Relaxed Retire", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    result = test_concurrent_workers();
+    print_test_result("Concurrent Workers", result);
+    if (result == TEST_PASS) tests_passed++; else tests_failed++;
+
+    // Print summary
+    printf("\n%s===========================================%s\n", CYAN, NC);
+    printf("                SUMMARY\n");
+    printf("%s===========================================%s\n", CYAN, NC);
+    printf("%sTests Passed:  %d%s\n", GREEN, tests_passed, NC);
+    printf("%sTests Failed:  %d%s\n", RED, tests_failed, NC);
+    printf("Total Tests:   %d\n", tests_passed + tests_failed);
+
+    if (tests_failed > 0) {
+        printf("\n%sResult: FAILURE - Some tests failed!%s\n", RED, NC);
+        return 1;
+    } else {
+        printf("\n%sResult: SUCCESS - All tests passed!%s\n", GREEN, NC);
+        return 0;
+    }
+}